@@ -59,6 +59,7 @@ void loop() {
     lastMillis = millis();
     //publishTelemetry(mqttClient, "/sensors", getDefaultSensor());
     publishTelemetry(getDefaultSensor());
+    //publishDefaultSensorJson();
   }
 }
 #endif
\ No newline at end of file
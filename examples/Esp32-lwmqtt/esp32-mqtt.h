@@ -46,6 +46,14 @@ String getDefaultSensor(){
   return "Wifi: " + String(WiFi.RSSI()) + "db";
 }
 
+// The same reading as JSON, built on the stack.
+bool publishDefaultSensorJson(){
+  char buffer[64];
+  JsonWriter json(buffer, sizeof(buffer));
+  json.beginObject().add("rssi", WiFi.RSSI()).endObject();
+  return mqtt->publishTelemetry(json);
+}
+
 String getJwt(){
   iat = time(nullptr);
   Serial.println("Refreshing JWT");
@@ -222,9 +222,21 @@ void setup() {
 }
 
 
+// Feeds a file to publishTelemetryStream() a chunk at a time.
+class FileReader : public PublishReader {
+  public:
+    FileReader(File &file) : file(file) {}
+    int read(char *data, size_t length) {
+      return file.read((uint8_t *)data, length);
+    }
+  private:
+    File &file;
+};
+
 /**
  * This function uses SPIFFS as swap space for temporarily storing the
- * temporary base64-encoded image.
+ * temporary base64-encoded image, and streams it from there so it never
+ * has to fit in RAM.
  */
 void publishTelemetryFromFile() {
   File file = SPIFFS.open("/b64image.txt", FILE_READ);
@@ -234,17 +246,11 @@ void publishTelemetryFromFile() {
   } else {
     Serial.println("Publishing data using temp file");
   }
-  char* data = (char*)heap_caps_malloc(file.size(), MALLOC_CAP_8BIT);
-
-  int i=0;
-  while(file.available()){
-    data[i++] = file.read();
-  }
-  Serial.println(String(i) + " bytes read");
+  FileReader reader(file);
 
   delay(10);
   mqtt->loop();
-  mqtt->publishTelemetry(data, file.size());
+  mqtt->publishTelemetryStream("", file.size(), &reader);
   mqtt->loop();
   delay(10);
   file.close();
@@ -297,17 +303,17 @@ void transmitImage() {
   digitalWrite(CAMERA_LED_GPIO, LOW);
 }
 
-// The MQTT callback function for commands and configuration updates
+// The MQTT callback function for configuration updates
 // Place your message handler code here.
 void messageReceived(String &topic, String &payload) {
   Serial.println("incoming: " + topic + " - " + payload);
-  // Uncomment to transmit image when receiving commands
-  // Note: If your device is named command, this will send images on all
-  //       messages such as configuration change which is sent on connect.
-  if (topic.lastIndexOf("/command") > 0) {
-    Serial.println("Transmit image on receieve command");
-    transmitImage();
-  }
+}
+
+// Commands, routed by CloudIoTCoreMqtt, transmit an image.
+void commandReceived(CloudIoTCoreMqtt *mqtt, const char *subfolder,
+                     const char *data, size_t length) {
+  Serial.println("Transmit image on receieve command");
+  transmitImage();
 }
 ///////////////////////////////
 
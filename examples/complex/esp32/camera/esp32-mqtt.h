@@ -31,6 +31,10 @@ MQTTClient *mqttClient;
 unsigned long iat = 0;
 String jwt;
 
+// Handler for commands, in camera.ino
+void commandReceived(CloudIoTCoreMqtt *mqtt, const char *subfolder,
+                     const char *data, size_t length);
+
 ///////////////////////////////
 // Helpers specific to this board
 ///////////////////////////////
@@ -108,5 +112,6 @@ void setupCloudIoT() {
   mqtt = new CloudIoTCoreMqtt(mqttClient, netClient, device);
   mqtt->setUseLts(true);
   mqtt->setLogConnect(false); // To avoid pushing invalid messages
+  mqtt->onCommand(NULL, commandReceived); // commands on any subfolder
   mqtt->startMQTT();
 }
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+# Copyright 2020 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Builds signed firmware images for CloudIoTCoreOta.
+
+Full image:
+  ota_image.py --key ec_private.pem new.bin -o image.ota
+Delta image against the firmware the device runs now:
+  ota_image.py --key ec_private.pem --old old.bin new.bin -o image.ota
+Public key to pass to CloudIoTCoreOta, as a C initializer:
+  ota_image.py --key ec_private.pem --print-public-key
+
+The image format is described in src/CloudIoTCoreOta.h. Signing uses the
+openssl command line tool.
+"""
+
+import argparse
+import struct
+import subprocess
+import sys
+
+# Shortest run of old firmware worth a copy record.
+MIN_MATCH = 8
+
+
+def varint(value):
+  out = bytearray()
+  while True:
+    b = value & 0x7f
+    value >>= 7
+    if value:
+      out.append(b | 0x80)
+    else:
+      out.append(b)
+      return bytes(out)
+
+
+def zigzag(value):
+  return (value << 1) ^ (value >> 63)
+
+
+def match_length(old, old_pos, new, new_pos):
+  n = 0
+  end = min(len(old) - old_pos, len(new) - new_pos)
+  while n < end and old[old_pos + n] == new[new_pos + n]:
+    n += 1
+  return n
+
+
+def find_matches(old, new):
+  """Greedy list of (new_pos, old_pos, length) exact matches."""
+  index = {}
+  for i in range(len(old) - MIN_MATCH, -1, -1):
+    index[old[i:i + MIN_MATCH]] = i
+
+  matches = []
+  j = 0
+  last_new_end = 0
+  last_old_end = 0
+  while j + MIN_MATCH <= len(new):
+    key = new[j:j + MIN_MATCH]
+    # Prefer carrying on where the last match left off, as after a changed
+    # constant (same length) or inserted bytes, over a hash table hit.
+    candidates = (last_old_end + (j - last_new_end), last_old_end,
+                  index.get(key))
+    best_len = 0
+    best_pos = None
+    for pos in candidates:
+      if pos is None or pos + MIN_MATCH > len(old):
+        continue
+      if old[pos:pos + MIN_MATCH] == key:
+        n = match_length(old, pos, new, j)
+        if n > best_len:
+          best_len = n
+          best_pos = pos
+        break
+    if best_pos is None:
+      j += 1
+      continue
+    matches.append((j, best_pos, best_len))
+    j += best_len
+    last_new_end = j
+    last_old_end = best_pos + best_len
+  return matches
+
+
+def make_patch(old, new):
+  out = bytearray()
+  matches = find_matches(old, new)
+  new_pos = 0
+  old_pos = 0
+  copy = 0
+  # Each record is the copy of a match plus the bytes up to the next one.
+  for match_new, match_old, length in matches + [(len(new), None, 0)]:
+    extra = new[new_pos + copy:match_new]
+    seek = 0 if match_old is None else match_old - (old_pos + copy)
+    out += varint(copy) + varint(len(extra)) + varint(zigzag(seek)) + extra
+    old_pos = old_pos + copy + seek
+    new_pos = match_new
+    copy = length
+  return bytes(out)
+
+
+def sign(key, data):
+  der = subprocess.run(['openssl', 'dgst', '-sha256', '-sign', key, '-binary'],
+                       input=data, stdout=subprocess.PIPE, check=True).stdout
+  # ECDSA-Sig-Value ::= SEQUENCE { r INTEGER, s INTEGER }
+  pos = 2 if der[1] < 0x80 else 2 + (der[1] & 0x7f)
+  sig = b''
+  for _ in range(2):
+    length = der[pos + 1]
+    value = der[pos + 2:pos + 2 + length]
+    sig += value.lstrip(b'\0').rjust(32, b'\0')
+    pos += 2 + length
+  return sig
+
+
+def public_key(key):
+  der = subprocess.run(['openssl', 'ec', '-in', key, '-pubout', '-outform',
+                        'DER'], stdout=subprocess.PIPE,
+                       stderr=subprocess.DEVNULL, check=True).stdout
+  # uncompressed point 04 || x || y at the end of SubjectPublicKeyInfo
+  return der[-64:]
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument('--key', required=True, help='EC private key, PEM')
+  parser.add_argument('--old', help='firmware to build a delta against')
+  parser.add_argument('--print-public-key', action='store_true')
+  parser.add_argument('new', nargs='?', help='new firmware')
+  parser.add_argument('-o', '--output', help='image file to write')
+  args = parser.parse_args()
+
+  if args.print_public_key:
+    key = public_key(args.key)
+    print(', '.join('0x%02x' % b for b in key))
+    return 0
+  if not args.new or not args.output:
+    parser.error('new firmware and --output are needed')
+
+  with open(args.new, 'rb') as f:
+    new = f.read()
+  if args.old:
+    with open(args.old, 'rb') as f:
+      body = make_patch(f.read(), new)
+    magic = b'OTD1'
+  else:
+    body = new
+    magic = b'OTA1'
+
+  with open(args.output, 'wb') as f:
+    f.write(magic + struct.pack('>I', len(new)) + body + sign(args.key, new))
+  print('%s: %d bytes for %d bytes of firmware' %
+        (args.output, 8 + len(body) + 64, len(new)))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
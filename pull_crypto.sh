@@ -54,9 +54,17 @@ do
 done
 
 # Add a do not edit comment.
-for f in src/crypto/sha256.cpp src/crypto/sha256.h src/crypto/secp256r1.cpp src/crypto/ecc.cpp src/crypto/ecc.h src/crypto/ecdsa.cpp src/crypto/ecdsa.h src/crypto/nn.cpp src/crypto/nn.h
+for f in src/crypto/sha256.cpp src/crypto/sha256.h src/crypto/secp256r1.cpp
 do
   sed -i '1i// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.' $f
 done
 
+# The rest carry local changes, kept in crypto.patch.
+for f in src/crypto/ecc.cpp src/crypto/ecc.h src/crypto/ecdsa.cpp src/crypto/ecdsa.h src/crypto/nn.cpp src/crypto/nn.h
+do
+  sed -i '1i// Edit the patch, not this file. See CONTRIBUTING.md for instructions.' $f
+  sed -i '1i// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.' $f
+done
+patch -p1 < crypto.patch || exit 1
+
 rm -rf tmp
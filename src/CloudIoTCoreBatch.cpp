@@ -0,0 +1,237 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreBatch.h"
+
+// Record header in the ring:
+//   flags                      1 byte, QoS in the low bits, BATCH_SENT
+//   subtopic length            1 byte
+//   sample length              2 bytes, little endian
+//   millis() when queued       4 bytes, little endian
+// followed by the subtopic and the sample.
+#define BATCH_SENT 0x80
+#define BATCH_QOS_MASK 0x03
+
+static size_t putVarint(unsigned char *out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+TelemetryBatch::TelemetryBatch(size_t maxBytes, uint16_t maxSamples,
+                               unsigned long maxLatencyMillis) {
+  this->maxBytes = maxBytes;
+  this->maxSamples = maxSamples;
+  this->maxLatency = maxLatencyMillis;
+}
+
+unsigned char TelemetryBatch::at(size_t pos) {
+  return ring[pos % BATCH_BUFFER_SIZE];
+}
+
+void TelemetryBatch::copyIn(size_t pos, const void *data, size_t length) {
+  pos %= BATCH_BUFFER_SIZE;
+  size_t first = BATCH_BUFFER_SIZE - pos;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(ring + pos, data, first);
+  memcpy(ring, (const unsigned char *)data + first, length - first);
+}
+
+void TelemetryBatch::copyOut(size_t pos, void *data, size_t length) {
+  pos %= BATCH_BUFFER_SIZE;
+  size_t first = BATCH_BUFFER_SIZE - pos;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(data, ring + pos, first);
+  memcpy((unsigned char *)data + first, ring, length - first);
+}
+
+size_t TelemetryBatch::recordLength(size_t pos) {
+  return BATCH_RECORD_HEADER_LENGTH + at(pos + 1) + at(pos + 2) +
+         (at(pos + 3) << 8);
+}
+
+bool TelemetryBatch::matches(size_t pos, const char *subtopic, size_t length) {
+  if (at(pos + 1) != length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (at(pos + BATCH_RECORD_HEADER_LENGTH + i) != (unsigned char)subtopic[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TelemetryBatch::dropOldest() {
+  size_t length = recordLength(head);
+  if (!(at(head) & BATCH_SENT)) {
+    samples--;
+    bytes -= length;
+    dropped++;
+  }
+  head = (head + length) % BATCH_BUFFER_SIZE;
+  used -= length;
+}
+
+// Frees sent records at the front of the ring.
+void TelemetryBatch::compact() {
+  while (used > 0 && (at(head) & BATCH_SENT)) {
+    size_t length = recordLength(head);
+    head = (head + length) % BATCH_BUFFER_SIZE;
+    used -= length;
+  }
+}
+
+bool TelemetryBatch::add(const char *subtopic, const char *data, size_t length,
+                         int qos, unsigned long now) {
+  size_t subtopic_length = strlen(subtopic);
+  size_t record_length = BATCH_RECORD_HEADER_LENGTH + subtopic_length + length;
+  if (subtopic_length > 255 || length > 0xffff ||
+      record_length > BATCH_BUFFER_SIZE) {
+    dropped++;
+    return false;
+  }
+  while (used + record_length > BATCH_BUFFER_SIZE) {
+    dropOldest();
+  }
+  compact();
+  pending = 0;
+
+  unsigned char header[BATCH_RECORD_HEADER_LENGTH];
+  header[0] = qos & BATCH_QOS_MASK;
+  header[1] = subtopic_length;
+  header[2] = length;
+  header[3] = length >> 8;
+  header[4] = now;
+  header[5] = now >> 8;
+  header[6] = now >> 16;
+  header[7] = now >> 24;
+  size_t tail = head + used;
+  copyIn(tail, header, BATCH_RECORD_HEADER_LENGTH);
+  copyIn(tail + BATCH_RECORD_HEADER_LENGTH, subtopic, subtopic_length);
+  copyIn(tail + BATCH_RECORD_HEADER_LENGTH + subtopic_length, data, length);
+  used += record_length;
+  bytes += record_length;
+  samples++;
+  return true;
+}
+
+bool TelemetryBatch::isDue(unsigned long now) {
+  if (samples == 0) {
+    return false;
+  }
+  if (samples >= maxSamples || bytes >= maxBytes) {
+    return true;
+  }
+  // After compact() the head record is the oldest queued one.
+  unsigned char stamp[4];
+  copyOut(head + 4, stamp, 4);
+  unsigned long oldest = stamp[0] | ((unsigned long)stamp[1] << 8) |
+                         ((unsigned long)stamp[2] << 16) |
+                         ((unsigned long)stamp[3] << 24);
+  return now - oldest >= maxLatency;
+}
+
+const char *TelemetryBatch::next(unsigned long now, const char **subtopic,
+                                 size_t *length, int *qos) {
+  pending = 0;
+  if (samples == 0) {
+    return NULL;
+  }
+  size_t subtopic_length = at(head + 1);
+  copyOut(head + BATCH_RECORD_HEADER_LENGTH, this->subtopic, subtopic_length);
+  this->subtopic[subtopic_length] = '\0';
+
+  // Count first so the frame header can go in front of the samples.
+  uint16_t count = 0;
+  for (size_t pos = head, end = head + used; pos < end; pos += recordLength(pos)) {
+    if (!(at(pos) & BATCH_SENT) && matches(pos, this->subtopic, subtopic_length)) {
+      count++;
+    }
+  }
+
+  // The head record is the first sample of the frame.
+  unsigned char stamp[4];
+  copyOut(head + 4, stamp, 4);
+  uint32_t previous = stamp[0] | ((uint32_t)stamp[1] << 8) |
+                      ((uint32_t)stamp[2] << 16) | ((uint32_t)stamp[3] << 24);
+  int max_qos = 0;
+  size_t out = 0;
+  payload[out++] = BATCH_VERSION;
+  out += putVarint(payload + out, count);
+  out += putVarint(payload + out, now - previous);
+  for (size_t pos = head, end = head + used; pos < end; pos += recordLength(pos)) {
+    unsigned char flags = at(pos);
+    if ((flags & BATCH_SENT) || !matches(pos, this->subtopic, subtopic_length)) {
+      continue;
+    }
+    copyOut(pos + 4, stamp, 4);
+    uint32_t queued = stamp[0] | ((uint32_t)stamp[1] << 8) |
+                      ((uint32_t)stamp[2] << 16) | ((uint32_t)stamp[3] << 24);
+    out += putVarint(payload + out, queued - previous);
+    previous = queued;
+    size_t sample_length = at(pos + 2) | (at(pos + 3) << 8);
+    out += putVarint(payload + out, sample_length);
+    copyOut(pos + BATCH_RECORD_HEADER_LENGTH + subtopic_length, payload + out,
+            sample_length);
+    out += sample_length;
+    if ((flags & BATCH_QOS_MASK) > max_qos) {
+      max_qos = flags & BATCH_QOS_MASK;
+    }
+    pending++;
+  }
+
+  *subtopic = this->subtopic;
+  *length = out;
+  *qos = max_qos;
+  return (const char *)payload;
+}
+
+void TelemetryBatch::remove() {
+  if (pending == 0) {
+    return;
+  }
+  size_t subtopic_length = strlen(subtopic);
+  for (size_t pos = head, end = head + used; pos < end && pending > 0;
+       pos += recordLength(pos)) {
+    if (!(at(pos) & BATCH_SENT) && matches(pos, subtopic, subtopic_length)) {
+      ring[pos % BATCH_BUFFER_SIZE] |= BATCH_SENT;
+      bytes -= recordLength(pos);
+      samples--;
+      pending--;
+    }
+  }
+  compact();
+}
+
+uint16_t TelemetryBatch::depth() {
+  return samples;
+}
+
+size_t TelemetryBatch::queuedBytes() {
+  return bytes;
+}
+
+uint32_t TelemetryBatch::droppedCount() {
+  return dropped;
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_BATCH_H__
+#define __CLOUDIOTCORE_BATCH_H__
+
+#include <Arduino.h>
+
+// Telemetry batching: samples are queued in a ring buffer and published
+// together, one message per subfolder, once the queue holds maxBytes or
+// maxSamples or its oldest sample is maxLatencyMillis old. Each message
+// is a frame of samples:
+//
+//   version                    1 byte, 1
+//   count                      varint, number of samples
+//   age                        varint, ms the first sample was queued
+//                              before publishing
+//   per sample:
+//     delta                    varint, ms after the previous sample, 0 for
+//                              the first
+//     length                   varint
+//     sample
+//
+// Varints are little endian base 128, as in protocol buffers. When the
+// queue is full the oldest samples are dropped to make room.
+
+// Bytes for queued samples, their subtopics and BATCH_RECORD_HEADER_LENGTH
+// bytes of bookkeeping each.
+#ifdef CONF_BATCH_BUFFER_SIZE
+#define BATCH_BUFFER_SIZE CONF_BATCH_BUFFER_SIZE
+#else
+#define BATCH_BUFFER_SIZE 1024
+#endif
+
+#define BATCH_VERSION 1
+#define BATCH_RECORD_HEADER_LENGTH 8
+// Frame header plus per sample framing never exceeds the record overhead,
+// so the samples of any one subfolder always fit in one frame.
+#define BATCH_PAYLOAD_SIZE (BATCH_BUFFER_SIZE + 11)
+
+class TelemetryBatch {
+  private:
+    size_t maxBytes;
+    uint16_t maxSamples;
+    unsigned long maxLatency;
+
+    unsigned char ring[BATCH_BUFFER_SIZE];
+    size_t head = 0;     // oldest record
+    size_t used = 0;     // bytes of records, including sent ones
+    size_t bytes = 0;    // bytes of queued records
+    uint16_t samples = 0;
+    uint32_t dropped = 0;
+
+    // the frame from the last next(), and how many samples it holds
+    char subtopic[256];
+    unsigned char payload[BATCH_PAYLOAD_SIZE];
+    uint16_t pending = 0;
+
+    unsigned char at(size_t pos);
+    void copyIn(size_t pos, const void *data, size_t length);
+    void copyOut(size_t pos, void *data, size_t length);
+    size_t recordLength(size_t pos);
+    bool matches(size_t pos, const char *subtopic, size_t length);
+    void dropOldest();
+    void compact();
+
+  public:
+    TelemetryBatch(size_t maxBytes = BATCH_BUFFER_SIZE / 2,
+                   uint16_t maxSamples = 32,
+                   unsigned long maxLatencyMillis = 1000);
+
+    // Queues a sample taken at now (millis()). Returns false, and counts a
+    // drop, if it can never fit; older samples are dropped to make room.
+    bool add(const char *subtopic, const char *data, size_t length, int qos,
+             unsigned long now);
+    // True if a flush threshold is reached.
+    bool isDue(unsigned long now);
+
+    // Frames the queued samples of the oldest sample's subfolder, with the
+    // highest QoS among them. NULL if the queue is empty.
+    const char *next(unsigned long now, const char **subtopic, size_t *length,
+                     int *qos);
+    // Removes the samples framed by the last next(), once published.
+    void remove();
+
+    // Samples queued, their bytes in the buffer, and samples dropped since
+    // construction.
+    uint16_t depth();
+    size_t queuedBytes();
+    uint32_t droppedCount();
+};
+
+#endif // __CLOUDIOTCORE_BATCH_H__
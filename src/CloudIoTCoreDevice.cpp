@@ -40,6 +40,10 @@ CloudIoTCoreDevice::CloudIoTCoreDevice(const char *project_id,
   setPrivateKey(private_key);
 }
 
+CloudIoTCoreDevice::~CloudIoTCoreDevice() {
+  free(topics);
+}
+
 unsigned long CloudIoTCoreDevice::getExpMillis() {
   return exp_millis;
 }
@@ -50,14 +54,22 @@ int CloudIoTCoreDevice::getJwtExpSecs() {
 
 String CloudIoTCoreDevice::createJWT(long long int current_time) {
   exp_millis = millis() + (jwt_exp_secs * 1000);
-  jwt = CreateJwt(project_id, current_time, priv_key, this->jwt_exp_secs);
+  if (signer != NULL) {
+    jwt = CreateJwt(project_id, current_time, *signer, this->jwt_exp_secs);
+  } else {
+    jwt = CreateJwt(project_id, current_time, priv_key, this->jwt_exp_secs);
+  }
   return jwt;
 }
 
 String CloudIoTCoreDevice::createJWT(long long int current_time, int exp_in_secs) {
   jwt_exp_secs = exp_in_secs;
   exp_millis = millis() + (jwt_exp_secs * 1000);
-  jwt = CreateJwt(project_id, current_time, priv_key, exp_in_secs);
+  if (signer != NULL) {
+    jwt = CreateJwt(project_id, current_time, *signer, exp_in_secs);
+  } else {
+    jwt = CreateJwt(project_id, current_time, priv_key, exp_in_secs);
+  }
   return jwt;
 }
 
@@ -70,17 +82,69 @@ String CloudIoTCoreDevice::getBasePath() {
          "/registries/" + registry_id + "/devices/" + device_id;
 }
 
+void CloudIoTCoreDevice::renderTopics() {
+  if (project_id == NULL || location == NULL || registry_id == NULL ||
+      device_id == NULL) {
+    return;
+  }
+  const char *parts[NUM_TOPICS][9] = {
+    {"projects/", project_id, "/locations/", location, "/registries/",
+     registry_id, "/devices/", device_id, NULL},
+    {"/devices/", device_id, "/events", NULL},
+    {"/devices/", device_id, "/state", NULL},
+    {"/devices/", device_id, "/config", NULL},
+    {"/devices/", device_id, "/commands/#", NULL},
+  };
+
+  size_t size = 0;
+  for (int t = 0; t < NUM_TOPICS; t++) {
+    topic_length[t] = 0;
+    for (int i = 0; parts[t][i] != NULL; i++) {
+      topic_length[t] += strlen(parts[t][i]);
+    }
+    topic_start[t] = size;
+    size += topic_length[t] + 1;
+  }
+
+  free(topics);
+  topics = (char *)malloc(size);
+  if (topics == NULL) {
+    return;
+  }
+  for (int t = 0; t < NUM_TOPICS; t++) {
+    char *out = topics + topic_start[t];
+    for (int i = 0; parts[t][i] != NULL; i++) {
+      size_t n = strlen(parts[t][i]);
+      memcpy(out, parts[t][i], n);
+      out += n;
+    }
+    *out = '\0';
+  }
+}
+
+const char *CloudIoTCoreDevice::getTopicView(int topic, size_t *length) {
+  if (topics == NULL) {
+    if (length != NULL) {
+      *length = 0;
+    }
+    return "";
+  }
+  if (length != NULL) {
+    *length = topic_length[topic];
+  }
+  return topics + topic_start[topic];
+}
+
 String CloudIoTCoreDevice::getClientId(){
-  return String("projects/") + project_id + "/locations/" + location +
-         "/registries/" + registry_id + "/devices/" + device_id;
+  return String(getClientIdView());
 }
 
 String CloudIoTCoreDevice::getConfigTopic(){
-  return String("/devices/") + device_id + "/config";
+  return String(getConfigTopicView());
 }
 
 String CloudIoTCoreDevice::getCommandsTopic(){
-  return String("/devices/") + device_id + "/commands/#";
+  return String(getCommandsTopicView());
 }
 
 String CloudIoTCoreDevice::getDeviceId(){
@@ -88,11 +152,31 @@ String CloudIoTCoreDevice::getDeviceId(){
 }
 
 String CloudIoTCoreDevice::getEventsTopic(){
-  return String("/devices/") + device_id + "/events";
+  return String(getEventsTopicView());
 }
 
 String CloudIoTCoreDevice::getStateTopic(){
-  return String("/devices/") + device_id + "/state";
+  return String(getStateTopicView());
+}
+
+const char *CloudIoTCoreDevice::getClientIdView(size_t *length) {
+  return getTopicView(CLIENT_ID, length);
+}
+
+const char *CloudIoTCoreDevice::getCommandsTopicView(size_t *length) {
+  return getTopicView(COMMANDS_TOPIC, length);
+}
+
+const char *CloudIoTCoreDevice::getConfigTopicView(size_t *length) {
+  return getTopicView(CONFIG_TOPIC, length);
+}
+
+const char *CloudIoTCoreDevice::getEventsTopicView(size_t *length) {
+  return getTopicView(EVENTS_TOPIC, length);
+}
+
+const char *CloudIoTCoreDevice::getStateTopicView(size_t *length) {
+  return getTopicView(STATE_TOPIC, length);
 }
 
 String CloudIoTCoreDevice::getConfigPath(int version) {
@@ -117,21 +201,25 @@ void CloudIoTCoreDevice::setJwtExpSecs(int exp_in_secs) {
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setProjectId(const char *project_id) {
   this->project_id = project_id;
+  renderTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setLocation(const char *location) {
   this->location = location;
+  renderTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setRegistryId(const char *registry_id) {
   this->registry_id = registry_id;
+  renderTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setDeviceId(const char *device_id) {
   this->device_id = device_id;
+  renderTopics();
   return *this;
 }
 
@@ -161,3 +249,17 @@ CloudIoTCoreDevice &CloudIoTCoreDevice::setPrivateKey(const unsigned char *priva
   }
   return *this;
 }
+
+CloudIoTCoreDevice &CloudIoTCoreDevice::setSigner(JwtSigner *signer) {
+  this->signer = signer;
+  return *this;
+}
+
+bool CloudIoTCoreDevice::sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+                              unsigned char signature[JWT_SIGNATURE_LENGTH]) {
+  if (signer != NULL) {
+    return signer->sign(digest, signature);
+  }
+  EccLightSigner builtin(priv_key);
+  return builtin.sign(digest, signature);
+}
@@ -21,12 +21,25 @@
 
 class CloudIoTCoreDevice {
  private:
-  const char *project_id;
-  const char *location;
-  const char *registry_id;
-  const char *device_id;
+  const char *project_id = NULL;
+  const char *location = NULL;
+  const char *registry_id = NULL;
+  const char *device_id = NULL;
+
+  // Client id and MQTT topics, rendered once into one allocation whenever
+  // the ids change so that publishing does not build Strings.
+  enum { CLIENT_ID, EVENTS_TOPIC, STATE_TOPIC, CONFIG_TOPIC, COMMANDS_TOPIC,
+         NUM_TOPICS };
+  char *topics = NULL;
+  size_t topic_start[NUM_TOPICS];
+  size_t topic_length[NUM_TOPICS];
+  void renderTopics();
+  const char *getTopicView(int topic, size_t *length);
+  CloudIoTCoreDevice(const CloudIoTCoreDevice &);
+  CloudIoTCoreDevice &operator=(const CloudIoTCoreDevice &);
 
   NN_DIGIT priv_key[9];
+  JwtSigner *signer = NULL;
   String jwt;
   int jwt_exp_secs;
   unsigned long exp_millis = 0;
@@ -40,6 +53,7 @@ class CloudIoTCoreDevice {
   CloudIoTCoreDevice(const char *project_id, const char *location,
                      const char *registry_id, const char *device_id,
                      const char *private_key);
+  ~CloudIoTCoreDevice();
 
   CloudIoTCoreDevice &setProjectId(const char *project_id);
   CloudIoTCoreDevice &setLocation(const char *location);
@@ -47,6 +61,12 @@ class CloudIoTCoreDevice {
   CloudIoTCoreDevice &setDeviceId(const char *device_id);
   CloudIoTCoreDevice &setPrivateKey(const char *private_key);
   CloudIoTCoreDevice &setPrivateKey(const unsigned char *private_key);
+  // Signs JWTs with signer instead of the built-in engine and private key.
+  // Pass NULL to go back to the built-in engine.
+  CloudIoTCoreDevice &setSigner(JwtSigner *signer);
+  // Signs digest with the same signer and key as createJWT().
+  bool sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+            unsigned char signature[JWT_SIGNATURE_LENGTH]);
   void setJwtExpSecs(int exp_in_secs);
   int getJwtExpSecs();
   unsigned long getExpMillis();
@@ -67,5 +87,14 @@ class CloudIoTCoreDevice {
   String getDeviceId();
   String getEventsTopic();
   String getStateTopic();
+
+  /* The same without allocating, valid until an id changes. length, if not
+   * NULL, receives the string length. They return "" if the topics could
+   * not be allocated, and publishing then fails. */
+  const char *getClientIdView(size_t *length = NULL);
+  const char *getCommandsTopicView(size_t *length = NULL);
+  const char *getConfigTopicView(size_t *length = NULL);
+  const char *getEventsTopicView(size_t *length = NULL);
+  const char *getStateTopicView(size_t *length = NULL);
 };
 #endif  // CloudIoTCoreDevice_h
@@ -0,0 +1,180 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreEnvelope.h"
+#include "crypto/prng.h"
+#include "crypto/sha256.h"
+
+// Room left in front of each message for its envelope header and proof.
+#define ENVELOPE_PREFIX_LENGTH \
+  (ENVELOPE_HEADER_LENGTH + ENVELOPE_MAX_DEPTH * ENVELOPE_HASH_LENGTH)
+
+static void hashNode(unsigned char *out, const unsigned char *left,
+                     const unsigned char *right) {
+  unsigned char prefix = 0x01;
+  Sha256 sha;
+  sha.update(&prefix, 1);
+  sha.update(left, ENVELOPE_HASH_LENGTH);
+  sha.update(right, ENVELOPE_HASH_LENGTH);
+  sha.final(out);
+}
+
+static void putUint32(unsigned char *out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+TelemetryEnvelope::TelemetryEnvelope(CloudIoTCoreDevice *device) {
+  this->device = device;
+  // Batches from different boots should not share sequence numbers.
+  prng((unsigned char *)&sequence, sizeof(sequence));
+}
+
+bool TelemetryEnvelope::isFull(const char *subtopic, size_t length) {
+  return messages == ENVELOPE_MAX_MESSAGES ||
+         used + strlen(subtopic) + 1 + ENVELOPE_PREFIX_LENGTH + length >
+             ENVELOPE_BUFFER_SIZE;
+}
+
+bool TelemetryEnvelope::add(const char *subtopic, const char *data,
+                            size_t length, int qos) {
+  if (sealed || isFull(subtopic, length)) {
+    return false;
+  }
+  size_t subtopic_length = strlen(subtopic) + 1;
+  subtopic_start[messages] = used;
+  memcpy(buffer + used, subtopic, subtopic_length);
+  used += subtopic_length + ENVELOPE_PREFIX_LENGTH;
+  message_start[messages] = used;
+  message_length[messages] = length;
+  message_qos[messages] = qos;
+  memcpy(buffer + used, data, length);
+  used += length;
+  messages++;
+  return true;
+}
+
+uint8_t TelemetryEnvelope::count() {
+  return messages;
+}
+
+bool TelemetryEnvelope::seal() {
+  if (sealed || messages == 0) {
+    return sealed;
+  }
+
+  // leaves
+  for (uint8_t i = 0; i < messages; i++) {
+    const char *subtopic = (const char *)buffer + subtopic_start[i];
+    unsigned char prefix = 0x00;
+    Sha256 sha;
+    sha.update(&prefix, 1);
+    sha.update((const unsigned char *)subtopic, strlen(subtopic) + 1);
+    sha.update(buffer + message_start[i], message_length[i]);
+    sha.final(tree[i]);
+  }
+
+  // inner levels, each stored after the one below it
+  uint8_t level = 0;
+  uint8_t width = messages;
+  while (width > 1) {
+    uint8_t next = level + width;
+    for (uint8_t j = 0; 2 * j < width; j++) {
+      if (2 * j + 1 < width) {
+        hashNode(tree[next + j], tree[level + 2 * j], tree[level + 2 * j + 1]);
+      } else {
+        memcpy(tree[next + j], tree[level + 2 * j], ENVELOPE_HASH_LENGTH);
+      }
+    }
+    level = next;
+    width = (width + 1) / 2;
+  }
+  const unsigned char *root = tree[level];
+
+  // envelopes, written in the room left in front of each message
+  for (uint8_t i = 0; i < messages; i++) {
+    unsigned char proof[ENVELOPE_MAX_DEPTH][ENVELOPE_HASH_LENGTH];
+    uint8_t proof_length = 0;
+    uint8_t index = i;
+    level = 0;
+    width = messages;
+    while (width > 1) {
+      if ((index ^ 1) < width) {
+        memcpy(proof[proof_length++], tree[level + (index ^ 1)],
+               ENVELOPE_HASH_LENGTH);
+      }
+      level += width;
+      index >>= 1;
+      width = (width + 1) / 2;
+    }
+
+    unsigned char *envelope = buffer + message_start[i] -
+        ENVELOPE_HEADER_LENGTH - proof_length * ENVELOPE_HASH_LENGTH;
+    envelope_start[i] = envelope - buffer;
+    envelope[0] = ENVELOPE_VERSION;
+    putUint32(envelope + 1, sequence);
+    envelope[5] = i;
+    envelope[6] = messages;
+    envelope[7] = proof_length;
+    memcpy(envelope + ENVELOPE_HEADER_LENGTH, proof,
+           proof_length * ENVELOPE_HASH_LENGTH);
+  }
+
+  // the one signature of the batch
+  unsigned char digest[JWT_DIGEST_LENGTH];
+  signature_message[0] = ENVELOPE_VERSION;
+  putUint32(signature_message + 1, sequence);
+  signature_message[5] = messages;
+  memcpy(signature_message + 6, root, ENVELOPE_HASH_LENGTH);
+  Sha256 sha;
+  sha.update(signature_message, 6 + ENVELOPE_HASH_LENGTH);
+  sha.final(digest);
+  if (!device->sign(digest,
+                    signature_message + 6 + ENVELOPE_HASH_LENGTH)) {
+    return false;
+  }
+
+  sealed = true;
+  return true;
+}
+
+const char *TelemetryEnvelope::getSubtopic(uint8_t i) {
+  return (const char *)buffer + subtopic_start[i];
+}
+
+const char *TelemetryEnvelope::getEnvelope(uint8_t i, size_t *length) {
+  *length = message_start[i] + message_length[i] - envelope_start[i];
+  return (const char *)buffer + envelope_start[i];
+}
+
+int TelemetryEnvelope::getQos(uint8_t i) {
+  return message_qos[i];
+}
+
+const char *TelemetryEnvelope::getSignatureMessage(size_t *length) {
+  *length = ENVELOPE_SIGNATURE_MESSAGE_LENGTH;
+  return (const char *)signature_message;
+}
+
+void TelemetryEnvelope::clear() {
+  messages = 0;
+  used = 0;
+  if (sealed) {
+    sequence++;
+  }
+  sealed = false;
+}
@@ -0,0 +1,114 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_ENVELOPE_H__
+#define __CLOUDIOTCORE_ENVELOPE_H__
+
+#include <Arduino.h>
+#include "CloudIoTCoreDevice.h"
+
+// Signed telemetry envelopes: messages are collected into a batch, a Merkle
+// tree is built over their SHA-256 hashes and only the root is signed. Each
+// message is published wrapped in an envelope carrying its inclusion proof:
+//
+//   version                    1 byte, 1
+//   batch sequence             4 bytes, big endian
+//   index                      1 byte, position of the message in the batch
+//   count                      1 byte, number of messages in the batch
+//   proof length               1 byte, number of hashes that follow
+//   proof                      32 bytes each, leaf to root
+//   message
+//
+// Leaves are SHA-256(0x00 || subtopic || 0x00 || message), inner nodes
+// SHA-256(0x01 || left || right); a node without a right sibling moves up a
+// level unchanged, and its proof has no hash for that level. Once per batch
+// a signature message goes to the events topic subfolder
+// ENVELOPE_SUBFOLDER:
+//
+//   version                    1 byte, 1
+//   batch sequence             4 bytes, big endian
+//   count                      1 byte
+//   root                       32 bytes
+//   ECDSA P-256 signature      64 bytes, r || s, of SHA-256 of the above
+//
+// The signature is made with the device key (see CloudIoTCoreDevice::sign),
+// so the registry's public key verifies it.
+
+#ifndef ENVELOPE_SUBFOLDER
+#define ENVELOPE_SUBFOLDER "/envelope-signatures"
+#endif
+
+// A batch holds up to 2^ENVELOPE_MAX_DEPTH messages.
+#ifdef CONF_ENVELOPE_MAX_DEPTH
+#define ENVELOPE_MAX_DEPTH CONF_ENVELOPE_MAX_DEPTH
+#else
+#define ENVELOPE_MAX_DEPTH 3
+#endif
+#define ENVELOPE_MAX_MESSAGES (1 << ENVELOPE_MAX_DEPTH)
+
+// Bytes for the messages of one batch, their subtopics and envelope headers.
+#ifdef CONF_ENVELOPE_BUFFER_SIZE
+#define ENVELOPE_BUFFER_SIZE CONF_ENVELOPE_BUFFER_SIZE
+#else
+#define ENVELOPE_BUFFER_SIZE 2048
+#endif
+
+#define ENVELOPE_VERSION 1
+#define ENVELOPE_HEADER_LENGTH 8
+#define ENVELOPE_HASH_LENGTH 32
+#define ENVELOPE_SIGNATURE_MESSAGE_LENGTH (6 + ENVELOPE_HASH_LENGTH + JWT_SIGNATURE_LENGTH)
+
+class TelemetryEnvelope {
+  private:
+    CloudIoTCoreDevice *device;
+    uint32_t sequence;
+    uint8_t messages = 0;
+    bool sealed = false;
+    size_t used = 0;
+    unsigned char buffer[ENVELOPE_BUFFER_SIZE];
+    // per message: start of the subtopic, of the envelope, of the message,
+    // its length and QoS
+    uint16_t subtopic_start[ENVELOPE_MAX_MESSAGES];
+    uint16_t envelope_start[ENVELOPE_MAX_MESSAGES];
+    uint16_t message_start[ENVELOPE_MAX_MESSAGES];
+    uint16_t message_length[ENVELOPE_MAX_MESSAGES];
+    uint8_t message_qos[ENVELOPE_MAX_MESSAGES];
+    unsigned char tree[2 * ENVELOPE_MAX_MESSAGES - 1][ENVELOPE_HASH_LENGTH];
+    unsigned char signature_message[ENVELOPE_SIGNATURE_MESSAGE_LENGTH];
+
+  public:
+    TelemetryEnvelope(CloudIoTCoreDevice *device);
+
+    // Adds a message to the batch. Returns false if the batch is sealed or
+    // the message does not fit; check isFull() first to avoid the latter.
+    bool add(const char *subtopic, const char *data, size_t length, int qos);
+    // True if a message of length bytes would not fit in the batch.
+    bool isFull(const char *subtopic, size_t length);
+    uint8_t count();
+
+    // Builds the tree, fills in every envelope and signs the root.
+    bool seal();
+    // After seal(): envelope i, ready to publish to the events topic plus
+    // getSubtopic(i).
+    const char *getSubtopic(uint8_t i);
+    const char *getEnvelope(uint8_t i, size_t *length);
+    int getQos(uint8_t i);
+    const char *getSignatureMessage(size_t *length);
+
+    // Starts the next batch.
+    void clear();
+};
+
+#endif // __CLOUDIOTCORE_ENVELOPE_H__
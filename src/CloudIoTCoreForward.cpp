@@ -0,0 +1,374 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreForward.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <stdio.h>
+#endif
+
+// CRC-32 (IEEE 802.3), reflected, a nibble at a time.
+static const uint32_t crc_table[16] = {
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+  0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+  0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+static void putUint32(unsigned char *out, uint32_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+static uint32_t getUint32(const unsigned char *in) {
+  return in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) |
+         ((uint32_t)in[3] << 24);
+}
+
+#if defined(ESP8266) || defined(ESP32)
+FsForwardStorage::FsForwardStorage(fs::FS &fs, const char *dir) : fs(fs) {
+  this->dir = dir;
+}
+
+String FsForwardStorage::path(uint32_t segment) {
+  return String(dir) + "/" + String((unsigned long)segment) + ".log";
+}
+
+bool FsForwardStorage::append(uint32_t segment, const unsigned char *data,
+                              size_t len) {
+  File file = fs.open(path(segment), "a");
+  if (!file) {
+    return false;
+  }
+  bool result = file.write(data, len) == len;
+  file.close();
+  return result;
+}
+
+bool FsForwardStorage::read(uint32_t segment, unsigned long offset,
+                            unsigned char *data, size_t len) {
+  File file = fs.open(path(segment), "r");
+  if (!file) {
+    return false;
+  }
+  bool result = file.seek(offset) && file.read(data, len) == len;
+  file.close();
+  return result;
+}
+
+unsigned long FsForwardStorage::size(uint32_t segment) {
+  String name = path(segment);
+  if (!fs.exists(name)) {
+    return 0;
+  }
+  File file = fs.open(name, "r");
+  unsigned long result = file ? file.size() : 0;
+  file.close();
+  return result;
+}
+
+void FsForwardStorage::remove(uint32_t segment) {
+  fs.remove(path(segment));
+}
+
+bool FsForwardStorage::saveState(const unsigned char *data, size_t len) {
+  File file = fs.open(String(dir) + "/state", "w");
+  if (!file) {
+    return false;
+  }
+  bool result = file.write(data, len) == len;
+  file.close();
+  return result;
+}
+
+bool FsForwardStorage::loadState(unsigned char *data, size_t len) {
+  String name = String(dir) + "/state";
+  if (!fs.exists(name)) {
+    return false;
+  }
+  File file = fs.open(name, "r");
+  bool result = file && file.read(data, len) == len;
+  file.close();
+  return result;
+}
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+FileForwardStorage::FileForwardStorage(const char *dir) {
+  this->dir = dir;
+}
+
+String FileForwardStorage::path(uint32_t segment) {
+  return String(dir) + "/" + String((unsigned long)segment) + ".log";
+}
+
+bool FileForwardStorage::append(uint32_t segment, const unsigned char *data,
+                                size_t len) {
+  FILE *file = fopen(path(segment).c_str(), "ab");
+  if (file == NULL) {
+    return false;
+  }
+  bool result = fwrite(data, 1, len, file) == len;
+  return fclose(file) == 0 && result;
+}
+
+bool FileForwardStorage::read(uint32_t segment, unsigned long offset,
+                              unsigned char *data, size_t len) {
+  FILE *file = fopen(path(segment).c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  bool result = fseek(file, offset, SEEK_SET) == 0 &&
+                fread(data, 1, len, file) == len;
+  fclose(file);
+  return result;
+}
+
+unsigned long FileForwardStorage::size(uint32_t segment) {
+  FILE *file = fopen(path(segment).c_str(), "rb");
+  if (file == NULL) {
+    return 0;
+  }
+  long result = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : 0;
+  fclose(file);
+  return result > 0 ? result : 0;
+}
+
+void FileForwardStorage::remove(uint32_t segment) {
+  ::remove(path(segment).c_str());
+}
+
+bool FileForwardStorage::saveState(const unsigned char *data, size_t len) {
+  FILE *file = fopen((String(dir) + "/state").c_str(), "wb");
+  if (file == NULL) {
+    return false;
+  }
+  bool result = fwrite(data, 1, len, file) == len;
+  return fclose(file) == 0 && result;
+}
+
+bool FileForwardStorage::loadState(unsigned char *data, size_t len) {
+  FILE *file = fopen((String(dir) + "/state").c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  bool result = fread(data, 1, len, file) == len;
+  fclose(file);
+  return result;
+}
+#endif
+
+ForwardLog::ForwardLog(ForwardStorage *storage, unsigned int replayPerSecond) {
+  this->storage = storage;
+  this->replayInterval = replayPerSecond > 0 ? 1000 / replayPerSecond : 0;
+}
+
+bool ForwardLog::saveState() {
+  unsigned char state[FORWARD_STATE_LENGTH];
+  putUint32(state, read_segment);
+  putUint32(state + 4, read_offset);
+  putUint32(state + 8, write_segment);
+  putUint32(state + 12, crc32(0, state, 12));
+  unsaved = 0;
+  return storage->saveState(state, FORWARD_STATE_LENGTH);
+}
+
+// Reads and checks the record at offset into record; length is what it
+// takes up in the segment.
+bool ForwardLog::readRecord(uint32_t segment, unsigned long offset,
+                            unsigned long *length) {
+  unsigned char header[FORWARD_RECORD_HEADER_LENGTH];
+  unsigned char trailer[FORWARD_RECORD_TRAILER_LENGTH];
+  if (!storage->read(segment, offset, header, FORWARD_RECORD_HEADER_LENGTH) ||
+      header[0] != FORWARD_SYNC) {
+    return false;
+  }
+  size_t body = header[1] | (header[2] << 8);
+  if (body < 3 || body > FORWARD_RECORD_SIZE ||
+      !storage->read(segment, offset + FORWARD_RECORD_HEADER_LENGTH, record, body) ||
+      !storage->read(segment, offset + FORWARD_RECORD_HEADER_LENGTH + body,
+                     trailer, FORWARD_RECORD_TRAILER_LENGTH)) {
+    return false;
+  }
+  uint32_t crc = crc32(crc32(0, header + 1, 2), record, body);
+  size_t subtopic_length = record[1];
+  if (crc != getUint32(trailer) || subtopic_length == 0 ||
+      2 + subtopic_length > body || record[1 + subtopic_length] != '\0') {
+    return false;
+  }
+  *length = FORWARD_RECORD_HEADER_LENGTH + body + FORWARD_RECORD_TRAILER_LENGTH;
+  return true;
+}
+
+bool ForwardLog::begin() {
+  unsigned char state[FORWARD_STATE_LENGTH];
+  if (storage->loadState(state, FORWARD_STATE_LENGTH) &&
+      crc32(0, state, 12) == getUint32(state + 12)) {
+    read_segment = getUint32(state);
+    read_offset = getUint32(state + 4);
+    write_segment = getUint32(state + 8);
+  }
+  if (write_segment < read_segment) {
+    read_segment = write_segment;
+    read_offset = 0;
+  }
+  record_length = 0;
+
+  // Appends go after the last good record, so the segment being written
+  // must end in one. If power loss damaged it, start the next.
+  write_size = storage->size(write_segment);
+  unsigned long offset = 0;
+  unsigned long length;
+  while (offset < write_size && readRecord(write_segment, offset, &length)) {
+    offset += length;
+  }
+  record_length = 0;
+  if (offset < write_size) {
+    write_segment++;
+    write_size = 0;
+  }
+  return saveState();
+}
+
+void ForwardLog::dropSegment() {
+  unsigned long offset = read_offset;
+  unsigned long length;
+  while (readRecord(read_segment, offset, &length)) {
+    offset += length;
+    dropped++;
+  }
+  record_length = 0;
+  storage->remove(read_segment);
+  read_segment++;
+  read_offset = 0;
+}
+
+bool ForwardLog::append(const char *subtopic, const char *data, size_t length,
+                        int qos) {
+  size_t subtopic_length = strlen(subtopic) + 1;
+  size_t body = 2 + subtopic_length + length;
+  if (subtopic_length > 255 || body > FORWARD_RECORD_SIZE) {
+    dropped++;
+    return false;
+  }
+  size_t total = FORWARD_RECORD_HEADER_LENGTH + body + FORWARD_RECORD_TRAILER_LENGTH;
+  if (write_size > 0 && write_size + total > FORWARD_SEGMENT_SIZE) {
+    write_segment++;
+    write_size = 0;
+    if (write_segment - read_segment >= FORWARD_MAX_SEGMENTS) {
+      dropSegment();
+    }
+    saveState();
+  }
+
+  // The record buffer is reused, so a record from next() has to be read
+  // again.
+  record_length = 0;
+  unsigned char *out = record;
+  out[0] = FORWARD_SYNC;
+  out[1] = body;
+  out[2] = body >> 8;
+  out[3] = qos;
+  out[4] = subtopic_length;
+  memcpy(out + 5, subtopic, subtopic_length);
+  memcpy(out + 5 + subtopic_length, data, length);
+  putUint32(out + FORWARD_RECORD_HEADER_LENGTH + body, crc32(0, out + 1, 2 + body));
+  if (!storage->append(write_segment, out, total)) {
+    return false;
+  }
+  write_size += total;
+  return true;
+}
+
+bool ForwardLog::pending() {
+  return read_segment != write_segment || read_offset < write_size;
+}
+
+const char *ForwardLog::next(unsigned long now, const char **subtopic,
+                             size_t *length, int *qos) {
+  if (!pending() || (long)(now - replayAt) < 0) {
+    return NULL;
+  }
+  while (record_length == 0) {
+    unsigned long size = read_segment == write_segment
+                             ? write_size
+                             : storage->size(read_segment);
+    if (read_offset >= size) {
+      if (read_segment == write_segment) {
+        return NULL;
+      }
+      storage->remove(read_segment);
+      read_segment++;
+      read_offset = 0;
+      saveState();
+    } else if (!readRecord(read_segment, read_offset, &record_length)) {
+      // The rest of the segment is lost.
+      record_length = 0;
+      dropped++;
+      if (read_segment == write_segment) {
+        write_segment++;
+        write_size = 0;
+      }
+      storage->remove(read_segment);
+      read_segment++;
+      read_offset = 0;
+      saveState();
+    }
+  }
+  replayAt = now + replayInterval;
+
+  size_t body = record_length - FORWARD_RECORD_HEADER_LENGTH -
+                FORWARD_RECORD_TRAILER_LENGTH;
+  size_t subtopic_length = record[1];
+  *subtopic = (const char *)record + 2;
+  *length = body - 2 - subtopic_length;
+  *qos = record[0];
+  return (const char *)record + 2 + subtopic_length;
+}
+
+void ForwardLog::remove() {
+  if (record_length == 0) {
+    return;
+  }
+  read_offset += record_length;
+  record_length = 0;
+  if (read_segment == write_segment && read_offset >= write_size) {
+    // All replayed: free the segment now rather than appending to it.
+    storage->remove(write_segment);
+    write_segment++;
+    write_size = 0;
+    read_segment = write_segment;
+    read_offset = 0;
+    saveState();
+  } else if (++unsaved >= FORWARD_CURSOR_INTERVAL) {
+    saveState();
+  }
+}
+
+uint32_t ForwardLog::droppedCount() {
+  return dropped;
+}
@@ -0,0 +1,173 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_FORWARD_H__
+#define __CLOUDIOTCORE_FORWARD_H__
+
+#include <Arduino.h>
+
+#if defined(ESP8266) || defined(ESP32)
+#include <FS.h>
+#endif
+
+// Store and forward: telemetry published while offline is appended to a log
+// in flash and replayed after reconnecting. The log is a run of numbered
+// segment files, each only ever appended to and then deleted whole once
+// replayed, so flash sees sequential writes and no rewrites. A record is
+//
+//   sync                       1 byte, 0xa5
+//   body length                2 bytes, little endian
+//   QoS                        1 byte
+//   subtopic length            1 byte, including the NUL
+//   subtopic                   NUL terminated
+//   message
+//   CRC-32                     4 bytes, little endian, of everything from
+//                              the body length to the end of the message
+//
+// A record that fails its CRC ends its segment; that is what power loss in
+// the middle of an append leaves behind. The read cursor and the segment
+// being written are kept in a small state file, saved when a segment is
+// started or finished and every FORWARD_CURSOR_INTERVAL replayed records:
+// after a reset up to that many records may be published twice.
+
+// Segments are started once the current one would grow past this size;
+// a multiple of the flash erase block size wastes the least.
+#ifdef CONF_FORWARD_SEGMENT_SIZE
+#define FORWARD_SEGMENT_SIZE CONF_FORWARD_SEGMENT_SIZE
+#else
+#define FORWARD_SEGMENT_SIZE 4096
+#endif
+
+// With this many segments the oldest is dropped to start a new one.
+#ifdef CONF_FORWARD_MAX_SEGMENTS
+#define FORWARD_MAX_SEGMENTS CONF_FORWARD_MAX_SEGMENTS
+#else
+#define FORWARD_MAX_SEGMENTS 16
+#endif
+
+// Largest record body; longer messages are not logged.
+#ifdef CONF_FORWARD_RECORD_SIZE
+#define FORWARD_RECORD_SIZE CONF_FORWARD_RECORD_SIZE
+#else
+#define FORWARD_RECORD_SIZE 512
+#endif
+
+#ifndef FORWARD_CURSOR_INTERVAL
+#define FORWARD_CURSOR_INTERVAL 16
+#endif
+
+#define FORWARD_SYNC 0xa5
+#define FORWARD_RECORD_HEADER_LENGTH 3
+#define FORWARD_RECORD_TRAILER_LENGTH 4
+#define FORWARD_STATE_LENGTH 16
+
+// Where the segments and state live.
+class ForwardStorage {
+  public:
+    virtual ~ForwardStorage() {}
+    virtual bool append(uint32_t segment, const unsigned char *data, size_t len) = 0;
+    virtual bool read(uint32_t segment, unsigned long offset, unsigned char *data, size_t len) = 0;
+    // 0 if the segment does not exist.
+    virtual unsigned long size(uint32_t segment) = 0;
+    virtual void remove(uint32_t segment) = 0;
+    virtual bool saveState(const unsigned char *data, size_t len) = 0;
+    virtual bool loadState(unsigned char *data, size_t len) = 0;
+};
+
+#if defined(ESP8266) || defined(ESP32)
+// Files in dir on LittleFS, SPIFFS or any other fs::FS, which must be
+// mounted first.
+class FsForwardStorage : public ForwardStorage {
+  public:
+    FsForwardStorage(fs::FS &fs, const char *dir);
+    bool append(uint32_t segment, const unsigned char *data, size_t len);
+    bool read(uint32_t segment, unsigned long offset, unsigned char *data, size_t len);
+    unsigned long size(uint32_t segment);
+    void remove(uint32_t segment);
+    bool saveState(const unsigned char *data, size_t len);
+    bool loadState(unsigned char *data, size_t len);
+  private:
+    fs::FS &fs;
+    const char *dir;
+    String path(uint32_t segment);
+};
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+// Plain files in an existing directory.
+class FileForwardStorage : public ForwardStorage {
+  public:
+    FileForwardStorage(const char *dir);
+    bool append(uint32_t segment, const unsigned char *data, size_t len);
+    bool read(uint32_t segment, unsigned long offset, unsigned char *data, size_t len);
+    unsigned long size(uint32_t segment);
+    void remove(uint32_t segment);
+    bool saveState(const unsigned char *data, size_t len);
+    bool loadState(unsigned char *data, size_t len);
+  private:
+    const char *dir;
+    String path(uint32_t segment);
+};
+#endif
+
+class ForwardLog {
+  private:
+    ForwardStorage *storage;
+    unsigned long replayInterval;
+    unsigned long replayAt = 0;
+
+    uint32_t read_segment = 0;
+    unsigned long read_offset = 0;
+    uint32_t write_segment = 0;
+    unsigned long write_size = 0;
+    uint16_t unsaved = 0;
+    uint32_t dropped = 0;
+
+    // the body of the record from the last next(), or a whole record being
+    // appended
+    unsigned char record[FORWARD_RECORD_HEADER_LENGTH + FORWARD_RECORD_SIZE +
+                         FORWARD_RECORD_TRAILER_LENGTH];
+    unsigned long record_length = 0;
+
+    bool saveState();
+    bool readRecord(uint32_t segment, unsigned long offset, unsigned long *length);
+    void dropSegment();
+
+  public:
+    // replayPerSecond limits next() so replay leaves room for live
+    // telemetry.
+    ForwardLog(ForwardStorage *storage, unsigned int replayPerSecond = 10);
+
+    // Loads the cursor and checks the last segment; call once at startup,
+    // before anything else.
+    bool begin();
+
+    // Appends a message. Returns false if it is too long or the storage
+    // failed.
+    bool append(const char *subtopic, const char *data, size_t length, int qos);
+    // True if records are waiting to be replayed.
+    bool pending();
+    // The oldest record, if it is time to replay one (now is millis()) and
+    // there is one. Stays the same until remove().
+    const char *next(unsigned long now, const char **subtopic, size_t *length,
+                     int *qos);
+    // Moves past the record from next(), once it is published.
+    void remove();
+
+    // Records lost to dropped segments or damaged by power loss.
+    uint32_t droppedCount();
+};
+
+#endif // __CLOUDIOTCORE_FORWARD_H__
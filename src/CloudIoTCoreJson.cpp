@@ -0,0 +1,1267 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreJson.h"
+
+// Setter types
+#define BIND_INT 0
+#define BIND_NUMBER 1
+#define BIND_BOOL 2
+#define BIND_STRING 3
+
+// Parser states
+#define S_VALUE 0          // a value is next
+#define S_VALUE_OR_END 1   // after [
+#define S_KEY_OR_END 2     // after {
+#define S_KEY 3            // after , in an object
+#define S_COLON 4
+#define S_AFTER 5          // after a value in a container
+#define S_STRING 6
+#define S_ESCAPE 7
+#define S_UNICODE 8
+#define S_NUMBER 9
+#define S_LITERAL 10
+#define S_DONE 11
+
+// Number states; the first four may end a number.
+#define N_ZERO 0           // a leading 0
+#define N_INT 1
+#define N_FRAC 2
+#define N_EXP 3
+#define N_SIGN 4           // after -
+#define N_DOT 5
+#define N_E 6
+#define N_EXP_SIGN 7
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+JsonParser::JsonParser() {
+  begin();
+}
+
+bool JsonParser::bind(const char *path, uint8_t type, void (*setter)()) {
+  if (bindingCount == JSON_BINDINGS || path[0] != '$') {
+    return false;
+  }
+  bindings[bindingCount].path = path;
+  bindings[bindingCount].length = strlen(path);
+  bindings[bindingCount].wildcard = strstr(path, "[*]") != NULL;
+  bindings[bindingCount].type = type;
+  bindings[bindingCount].setter = setter;
+  bindingCount++;
+  return true;
+}
+
+bool JsonParser::bind(const char *path, JsonIntSetter setter) {
+  return bind(path, BIND_INT, (void (*)())setter);
+}
+
+bool JsonParser::bind(const char *path, JsonNumberSetter setter) {
+  return bind(path, BIND_NUMBER, (void (*)())setter);
+}
+
+bool JsonParser::bind(const char *path, JsonBoolSetter setter) {
+  return bind(path, BIND_BOOL, (void (*)())setter);
+}
+
+bool JsonParser::bind(const char *path, JsonStringSetter setter) {
+  return bind(path, BIND_STRING, (void (*)())setter);
+}
+
+void JsonParser::begin() {
+  state = S_VALUE;
+  depth = 0;
+  path[0] = '$';
+  pathLength = 1;
+  inKey = false;
+  match = -1;
+  highSurrogate = 0;
+  err = JSON_OK;
+  offset = 0;
+}
+
+// Whether the path of the current value fits pattern, where [*] stands for
+// any index; with prefix, whether values under it may.
+bool JsonParser::matches(const char *pattern, bool prefix) {
+  uint16_t i = 0;
+  while (*pattern != '\0') {
+    if (prefix && i == pathLength) {
+      return true;
+    }
+    if (pattern[0] == '[' && pattern[1] == '*' && pattern[2] == ']') {
+      if (i >= pathLength || path[i] != '[') {
+        return false;
+      }
+      while (i < pathLength && path[i] != ']') {
+        i++;
+      }
+      if (i == pathLength) {
+        return false;
+      }
+      i++;
+      pattern += 3;
+    } else {
+      if (i >= pathLength || path[i] != *pattern) {
+        return false;
+      }
+      i++;
+      pattern++;
+    }
+  }
+  return i == pathLength;
+}
+
+// The path is kept at its full length even when the buffer is not, so it
+// can be cut back; values on an overlong path match nothing.
+void JsonParser::appendPath(char c) {
+  if (pathLength < JSON_PATH_SIZE) {
+    path[pathLength] = c;
+  }
+  pathLength++;
+}
+
+void JsonParser::appendValue(char c) {
+  if (valueLength < JSON_VALUE_SIZE - 1) {
+    value[valueLength++] = c;
+  } else {
+    valueOverflow = true;
+  }
+}
+
+// UTF-8 of a \u escape, into the key or the bound value.
+void JsonParser::appendCodePoint(uint32_t cp) {
+  char out[4];
+  int n;
+  if (cp < 0x80) {
+    out[0] = cp;
+    n = 1;
+  } else if (cp < 0x800) {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+    n = 2;
+  } else if (cp < 0x10000) {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+    n = 3;
+  } else {
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    n = 4;
+  }
+  for (int i = 0; i < n; i++) {
+    if (inKey) {
+      appendPath(out[i]);
+    } else if (match >= 0) {
+      appendValue(out[i]);
+    }
+  }
+}
+
+// A value starts: extends the path for array elements and looks up its
+// binding.
+void JsonParser::beginValue() {
+  if (depth > 0 && arrays[depth - 1]) {
+    char digits[6];
+    int n = 0;
+    uint16_t index = indexes[depth - 1];
+    do {
+      digits[n++] = '0' + index % 10;
+      index /= 10;
+    } while (index > 0);
+    appendPath('[');
+    while (n > 0) {
+      appendPath(digits[--n]);
+    }
+    appendPath(']');
+  }
+  match = -1;
+  valueLength = 0;
+  valueOverflow = false;
+  if (pathLength > JSON_PATH_SIZE) {
+    return;
+  }
+  uint32_t mask = depth > 0 ? candidates[depth - 1] : 0xffffffff;
+  for (uint8_t i = 0; i < bindingCount && (mask >> i) != 0; i++) {
+    Binding &binding = bindings[i];
+    // Most paths differ from the value's in the last key or in length.
+    if ((mask >> i & 1) &&
+        path[pathLength - 1] == binding.path[binding.length - 1] &&
+        (binding.wildcard || binding.length == pathLength) &&
+        matches(binding.path, false)) {
+      match = i;
+      break;
+    }
+  }
+}
+
+// A value is complete: back to its container, or done.
+void JsonParser::endValue() {
+  match = -1;
+  if (depth == 0) {
+    state = S_DONE;
+    return;
+  }
+  pathLength = pathLengths[depth - 1];
+  state = S_AFTER;
+}
+
+bool JsonParser::pushContainer(bool array) {
+  if (depth == JSON_MAX_DEPTH) {
+    return fail(JSON_TOO_DEEP);
+  }
+  arrays[depth] = array;
+  indexes[depth] = 0;
+  pathLengths[depth] = pathLength;
+  // Only bindings that lead here need trying for the values inside.
+  uint32_t mask = depth > 0 ? candidates[depth - 1] : 0xffffffff;
+  candidates[depth] = 0;
+  if (pathLength <= JSON_PATH_SIZE) {
+    for (uint8_t i = 0; i < bindingCount && (mask >> i) != 0; i++) {
+      if ((mask >> i & 1) && matches(bindings[i].path, true)) {
+        candidates[depth] |= (uint32_t)1 << i;
+      }
+    }
+  }
+  depth++;
+  match = -1;
+  state = array ? S_VALUE_OR_END : S_KEY_OR_END;
+  return true;
+}
+
+void JsonParser::popContainer() {
+  depth--;
+  pathLength = pathLengths[depth];
+  endValue();
+}
+
+bool JsonParser::fail(JsonError error) {
+  err = error;
+  return false;
+}
+
+// The setter of the bound value, as its type.
+#define SETTER(type) ((type)bindings[match].setter)
+
+bool JsonParser::parse(char c) {
+  switch (state) {
+    case S_VALUE_OR_END:
+      if (isSpace(c)) {
+        return true;
+      }
+      if (c == ']') {
+        popContainer();
+        return true;
+      }
+      state = S_VALUE;
+      // fall through
+    case S_VALUE:
+      if (isSpace(c)) {
+        return true;
+      }
+      beginValue();
+      if (c == '{' || c == '[') {
+        return pushContainer(c == '[');
+      }
+      if (c == '"') {
+        inKey = false;
+        state = S_STRING;
+        return true;
+      }
+      if (c == '-' || isDigit(c)) {
+        numberState = c == '-' ? N_SIGN : c == '0' ? N_ZERO : N_INT;
+        if (match >= 0) {
+          appendValue(c);
+        }
+        state = S_NUMBER;
+        return true;
+      }
+      literal = c == 't' ? "true" : c == 'f' ? "false" : c == 'n' ? "null" : NULL;
+      if (literal == NULL) {
+        return fail(JSON_SYNTAX);
+      }
+      literalPos = 1;
+      state = S_LITERAL;
+      return true;
+
+    case S_KEY_OR_END:
+      if (c == '}') {
+        popContainer();
+        return true;
+      }
+      // fall through
+    case S_KEY:
+      if (isSpace(c)) {
+        return true;
+      }
+      if (c != '"') {
+        return fail(JSON_SYNTAX);
+      }
+      pathLength = pathLengths[depth - 1];
+      appendPath('.');
+      inKey = true;
+      state = S_STRING;
+      return true;
+
+    case S_COLON:
+      if (isSpace(c)) {
+        return true;
+      }
+      if (c != ':') {
+        return fail(JSON_SYNTAX);
+      }
+      state = S_VALUE;
+      return true;
+
+    case S_AFTER:
+      if (isSpace(c)) {
+        return true;
+      }
+      if (c == ',') {
+        if (arrays[depth - 1]) {
+          indexes[depth - 1]++;
+          state = S_VALUE;
+        } else {
+          state = S_KEY;
+        }
+        return true;
+      }
+      if (c == (arrays[depth - 1] ? ']' : '}')) {
+        popContainer();
+        return true;
+      }
+      return fail(JSON_SYNTAX);
+
+    case S_STRING:
+      if (c != '\\' && highSurrogate != 0) {
+        appendCodePoint(0xfffd);
+        highSurrogate = 0;
+      }
+      if (c == '"') {
+        if (inKey) {
+          inKey = false;
+          state = S_COLON;
+          return true;
+        }
+        if (match >= 0) {
+          if (bindings[match].type != BIND_STRING || valueOverflow) {
+            skipped++;
+          } else {
+            value[valueLength] = '\0';
+            SETTER(JsonStringSetter)(value, valueLength);
+          }
+        }
+        endValue();
+        return true;
+      }
+      if (c == '\\') {
+        state = S_ESCAPE;
+        return true;
+      }
+      if ((unsigned char)c < 0x20) {
+        return fail(JSON_SYNTAX);
+      }
+      if (inKey) {
+        appendPath(c);
+      } else if (match >= 0) {
+        appendValue(c);
+      }
+      return true;
+
+    case S_ESCAPE: {
+      if (c == 'u') {
+        unicode = 0;
+        unicodePos = 0;
+        state = S_UNICODE;
+        return true;
+      }
+      if (highSurrogate != 0) {
+        appendCodePoint(0xfffd);
+        highSurrogate = 0;
+      }
+      const char *escapes = "\"\"\\\\//b\bf\fn\nr\rt\t";
+      while (*escapes != '\0' && *escapes != c) {
+        escapes += 2;
+      }
+      if (*escapes == '\0') {
+        return fail(JSON_SYNTAX);
+      }
+      appendCodePoint((unsigned char)escapes[1]);
+      state = S_STRING;
+      return true;
+    }
+
+    case S_UNICODE:
+      if (isDigit(c)) {
+        unicode = (unicode << 4) | (c - '0');
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        unicode = (unicode << 4) | ((c | 0x20) - 'a' + 10);
+      } else {
+        return fail(JSON_SYNTAX);
+      }
+      if (++unicodePos < 4) {
+        return true;
+      }
+      state = S_STRING;
+      if (unicode >= 0xd800 && unicode <= 0xdbff) {
+        if (highSurrogate != 0) {
+          appendCodePoint(0xfffd);
+        }
+        highSurrogate = unicode;
+      } else if (unicode >= 0xdc00 && unicode <= 0xdfff && highSurrogate != 0) {
+        appendCodePoint(0x10000 + ((uint32_t)(highSurrogate - 0xd800) << 10) +
+                        (unicode - 0xdc00));
+        highSurrogate = 0;
+      } else {
+        if (highSurrogate != 0) {
+          appendCodePoint(0xfffd);
+          highSurrogate = 0;
+        }
+        appendCodePoint(unicode >= 0xdc00 && unicode <= 0xdfff ? 0xfffd : unicode);
+      }
+      return true;
+
+    case S_NUMBER: {
+      uint8_t next = 0xff;
+      switch (numberState) {
+        case N_SIGN:
+          next = c == '0' ? N_ZERO : isDigit(c) ? N_INT : 0xff;
+          break;
+        case N_ZERO:
+        case N_INT:
+          next = c == '.' ? N_DOT : (c | 0x20) == 'e' ? N_E :
+                 isDigit(c) && numberState == N_INT ? N_INT : 0xff;
+          break;
+        case N_DOT:
+        case N_FRAC:
+          next = isDigit(c) ? N_FRAC :
+                 (c | 0x20) == 'e' && numberState == N_FRAC ? N_E : 0xff;
+          break;
+        case N_E:
+          next = c == '+' || c == '-' ? N_EXP_SIGN : isDigit(c) ? N_EXP : 0xff;
+          break;
+        case N_EXP_SIGN:
+        case N_EXP:
+          next = isDigit(c) ? N_EXP : 0xff;
+          break;
+      }
+      if (next != 0xff) {
+        numberState = next;
+        if (match >= 0) {
+          appendValue(c);
+        }
+        return true;
+      }
+      // The number ended on c, which belongs to what follows.
+      if (numberState > N_EXP) {
+        return fail(JSON_SYNTAX);
+      }
+      if (match >= 0) {
+        value[valueLength] = '\0';
+        uint8_t type = bindings[match].type;
+        if (valueOverflow || (type == BIND_INT && numberState > N_INT) ||
+            type == BIND_BOOL || type == BIND_STRING) {
+          skipped++;
+        } else if (type == BIND_INT) {
+          SETTER(JsonIntSetter)(strtol(value, NULL, 10));
+        } else {
+          SETTER(JsonNumberSetter)(strtod(value, NULL));
+        }
+      }
+      endValue();
+      return parse(c);
+    }
+
+    case S_LITERAL:
+      if (c != literal[literalPos]) {
+        return fail(JSON_SYNTAX);
+      }
+      if (literal[++literalPos] != '\0') {
+        return true;
+      }
+      if (match >= 0 && literal[0] != 'n') {
+        if (bindings[match].type == BIND_BOOL) {
+          SETTER(JsonBoolSetter)(literal[0] == 't');
+        } else {
+          skipped++;
+        }
+      }
+      endValue();
+      return true;
+
+    case S_DONE:
+      if (isSpace(c)) {
+        return true;
+      }
+      return fail(JSON_SYNTAX);
+  }
+  return fail(JSON_SYNTAX);
+}
+
+bool JsonParser::feed(const char *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (state == S_STRING && match < 0 && !inKey && highSurrogate == 0) {
+      // Nothing to keep: run to the next character that means something.
+      size_t start = i;
+      while (i < length && data[i] != '"' && data[i] != '\\' &&
+             (unsigned char)data[i] >= 0x20) {
+        i++;
+      }
+      offset += i - start;
+      if (i == length) {
+        break;
+      }
+    }
+    if (err != JSON_OK || !parse(data[i])) {
+      return false;
+    }
+    offset++;
+  }
+  return err == JSON_OK;
+}
+
+bool JsonParser::end() {
+  if (err == JSON_OK && state == S_NUMBER && depth == 0) {
+    // A number on its own ends with the document.
+    parse(' ');
+  }
+  if (err == JSON_OK && state != S_DONE) {
+    err = JSON_INCOMPLETE;
+  }
+  return err == JSON_OK;
+}
+
+JsonError JsonParser::error() {
+  return err;
+}
+
+size_t JsonParser::errorOffset() {
+  return offset;
+}
+
+uint32_t JsonParser::skippedCount() {
+  return skipped;
+}
+
+///////////////////////////////
+// Writer
+///////////////////////////////
+static const char digitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t powersOf10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL
+};
+
+// Writes the digits of value ending before end, two at a time, and returns
+// where they start.
+static char *formatUnsigned(unsigned long long value, char *end) {
+  // 32 bit division is much cheaper where it is all there is.
+  while (value > 0xffffffffULL) {
+    unsigned long long q = value / 100;
+    const char *pair = digitPairs + 2 * (unsigned)(value - q * 100);
+    *--end = pair[1];
+    *--end = pair[0];
+    value = q;
+  }
+  uint32_t v = value;
+  while (v >= 100) {
+    uint32_t q = v / 100;
+    const char *pair = digitPairs + 2 * (v - q * 100);
+    *--end = pair[1];
+    *--end = pair[0];
+    v = q;
+  }
+  if (v >= 10) {
+    *--end = digitPairs[2 * v + 1];
+    *--end = digitPairs[2 * v];
+  } else {
+    *--end = '0' + v;
+  }
+  return end;
+}
+
+// Float formatting after Grisu3 (Loitsch, "Printing floating-point
+// numbers quickly and accurately with integers", PLDI 2010): the digits are
+// generated from the bounds of the interval of numbers that round to the
+// value, scaled by a cached power of ten so all of it is 64 bit integer
+// arithmetic. For the fraction of a percent of values where the rounding
+// of that scaling leaves the result in doubt, the digits are worked out
+// exactly with big integers instead, so the result is always the shortest
+// that reads back as the same value.
+struct DiyFp {
+  uint64_t f;
+  int e;
+};
+
+static DiyFp multiply(DiyFp x, DiyFp y) {
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+  uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+  mid += 1U << 31; // round
+  DiyFp r = {ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64};
+  return r;
+}
+
+static DiyFp normalize(DiyFp x) {
+#if defined(__GNUC__)
+  int shift = __builtin_clzll(x.f);
+  x.f <<= shift;
+  x.e -= shift;
+#else
+  while ((x.f >> 32) == 0) {
+    x.f <<= 32;
+    x.e -= 32;
+  }
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+#endif
+  return x;
+}
+
+// 10^k for k = -300, -292, ..., 324 as normalized DiyFps.
+struct CachedPower {
+  uint64_t f;
+  int16_t e;
+  int16_t k;
+};
+
+static const CachedPower cachedPowers[] = {
+  {0xab70fe17c79ac6caULL, -1060, -300}, {0xff77b1fcbebcdc4fULL, -1034, -292},
+  {0xbe5691ef416bd60cULL, -1007, -284}, {0x8dd01fad907ffc3cULL, -980, -276},
+  {0xd3515c2831559a83ULL, -954, -268}, {0x9d71ac8fada6c9b5ULL, -927, -260},
+  {0xea9c227723ee8bcbULL, -901, -252}, {0xaecc49914078536dULL, -874, -244},
+  {0x823c12795db6ce57ULL, -847, -236}, {0xc21094364dfb5637ULL, -821, -228},
+  {0x9096ea6f3848984fULL, -794, -220}, {0xd77485cb25823ac7ULL, -768, -212},
+  {0xa086cfcd97bf97f4ULL, -741, -204}, {0xef340a98172aace5ULL, -715, -196},
+  {0xb23867fb2a35b28eULL, -688, -188}, {0x84c8d4dfd2c63f3bULL, -661, -180},
+  {0xc5dd44271ad3cdbaULL, -635, -172}, {0x936b9fcebb25c996ULL, -608, -164},
+  {0xdbac6c247d62a584ULL, -582, -156}, {0xa3ab66580d5fdaf6ULL, -555, -148},
+  {0xf3e2f893dec3f126ULL, -529, -140}, {0xb5b5ada8aaff80b8ULL, -502, -132},
+  {0x87625f056c7c4a8bULL, -475, -124}, {0xc9bcff6034c13053ULL, -449, -116},
+  {0x964e858c91ba2655ULL, -422, -108}, {0xdff9772470297ebdULL, -396, -100},
+  {0xa6dfbd9fb8e5b88fULL, -369, -92}, {0xf8a95fcf88747d94ULL, -343, -84},
+  {0xb94470938fa89bcfULL, -316, -76}, {0x8a08f0f8bf0f156bULL, -289, -68},
+  {0xcdb02555653131b6ULL, -263, -60}, {0x993fe2c6d07b7facULL, -236, -52},
+  {0xe45c10c42a2b3b06ULL, -210, -44}, {0xaa242499697392d3ULL, -183, -36},
+  {0xfd87b5f28300ca0eULL, -157, -28}, {0xbce5086492111aebULL, -130, -20},
+  {0x8cbccc096f5088ccULL, -103, -12}, {0xd1b71758e219652cULL, -77, -4},
+  {0x9c40000000000000ULL, -50, 4}, {0xe8d4a51000000000ULL, -24, 12},
+  {0xad78ebc5ac620000ULL, 3, 20}, {0x813f3978f8940984ULL, 30, 28},
+  {0xc097ce7bc90715b3ULL, 56, 36}, {0x8f7e32ce7bea5c70ULL, 83, 44},
+  {0xd5d238a4abe98068ULL, 109, 52}, {0x9f4f2726179a2245ULL, 136, 60},
+  {0xed63a231d4c4fb27ULL, 162, 68}, {0xb0de65388cc8ada8ULL, 189, 76},
+  {0x83c7088e1aab65dbULL, 216, 84}, {0xc45d1df942711d9aULL, 242, 92},
+  {0x924d692ca61be758ULL, 269, 100}, {0xda01ee641a708deaULL, 295, 108},
+  {0xa26da3999aef774aULL, 322, 116}, {0xf209787bb47d6b85ULL, 348, 124},
+  {0xb454e4a179dd1877ULL, 375, 132}, {0x865b86925b9bc5c2ULL, 402, 140},
+  {0xc83553c5c8965d3dULL, 428, 148}, {0x952ab45cfa97a0b3ULL, 455, 156},
+  {0xde469fbd99a05fe3ULL, 481, 164}, {0xa59bc234db398c25ULL, 508, 172},
+  {0xf6c69a72a3989f5cULL, 534, 180}, {0xb7dcbf5354e9beceULL, 561, 188},
+  {0x88fcf317f22241e2ULL, 588, 196}, {0xcc20ce9bd35c78a5ULL, 614, 204},
+  {0x98165af37b2153dfULL, 641, 212}, {0xe2a0b5dc971f303aULL, 667, 220},
+  {0xa8d9d1535ce3b396ULL, 694, 228}, {0xfb9b7cd9a4a7443cULL, 720, 236},
+  {0xbb764c4ca7a44410ULL, 747, 244}, {0x8bab8eefb6409c1aULL, 774, 252},
+  {0xd01fef10a657842cULL, 800, 260}, {0x9b10a4e5e9913129ULL, 827, 268},
+  {0xe7109bfba19c0c9dULL, 853, 276}, {0xac2820d9623bf429ULL, 880, 284},
+  {0x80444b5e7aa7cf85ULL, 907, 292}, {0xbf21e44003acdd2dULL, 933, 300},
+  {0x8e679c2f5e44ff8fULL, 960, 308}, {0xd433179d9c8cb841ULL, 986, 316},
+  {0x9e19db92b4e31ba9ULL, 1013, 324},
+};
+
+// Keeps the scaled bounds between 2^-60 and 2^-32 of their integer part, so
+// it fits 32 bits.
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+static const CachedPower &cachedPowerFor(int e) {
+  // k = ceil((alpha - e - 1) * log10(2))
+  int x = GRISU_ALPHA - e - 1;
+  int k = (x * 78913) / (1 << 18) + (x > 0);
+  return cachedPowers[(300 + k + 7) / 8];
+}
+
+// Takes the last digit down while that stays in the interval and gets
+// closer to the value. False if the error of the scaled values, less than
+// unit, leaves it unclear whether the digits are in the interval or the
+// closest.
+static bool roundWeed(char *digits, int length, uint64_t distance,
+                      uint64_t unsafe, uint64_t rest, uint64_t tenKappa,
+                      uint64_t unit) {
+  uint64_t small = distance - unit;
+  uint64_t big = distance + unit;
+  while (rest < small && unsafe - rest >= tenKappa &&
+         (rest + tenKappa < small ||
+          small - rest >= rest + tenKappa - small)) {
+    digits[length - 1]--;
+    rest += tenKappa;
+  }
+  if (rest < big && unsafe - rest >= tenKappa &&
+      (rest + tenKappa < big || big - rest > rest + tenKappa - big)) {
+    return false;
+  }
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+// Writes the fewest digits such that value = digits * 10^*exponent, or
+// returns false when it can not be sure of them.
+static bool grisu3(uint64_t f, int e, bool lowerCloser, char *digits,
+                   int *length, int *exponent) {
+  DiyFp v = {f, e};
+  DiyFp plus = {(f << 1) + 1, e - 1};
+  plus = normalize(plus);
+  DiyFp minus = lowerCloser ? DiyFp{(f << 2) - 1, e - 2} : DiyFp{(f << 1) - 1, e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  const CachedPower &cached = cachedPowerFor(plus.e);
+  DiyFp c = {cached.f, cached.e};
+  DiyFp w = multiply(normalize(v), c);
+  DiyFp high = multiply(plus, c);
+  DiyFp low = multiply(minus, c);
+  // Each product is off by less than one unit, so the digits are generated
+  // from the widest interval it could be and checked against the narrowest.
+  uint64_t unit = 1;
+  uint64_t tooHigh = high.f + unit;
+  uint64_t unsafe = tooHigh - (low.f - unit);
+  uint64_t distance = tooHigh - w.f;
+  *exponent = -cached.k;
+
+  // tooHigh is split at its binary point, one = 2^-e.
+  int shift = -high.e;
+  uint64_t one = 1ULL << shift;
+  uint32_t p1 = tooHigh >> shift;
+  uint64_t p2 = tooHigh & (one - 1);
+  int kappa = 10;
+  while (kappa > 1 && p1 < powersOf10[kappa - 1]) {
+    kappa--;
+  }
+  *length = 0;
+  while (kappa > 0) {
+    uint32_t divisor = powersOf10[kappa - 1];
+    uint32_t d = p1 / divisor;
+    p1 -= d * divisor;
+    digits[(*length)++] = '0' + d;
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << shift) + p2;
+    if (rest < unsafe) {
+      *exponent += kappa;
+      return roundWeed(digits, *length, distance, unsafe, rest,
+                       (uint64_t)divisor << shift, unit);
+    }
+  }
+  for (;;) {
+    p2 *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    digits[(*length)++] = '0' + (uint32_t)(p2 >> shift);
+    p2 &= one - 1;
+    kappa--;
+    if (p2 < unsafe) {
+      *exponent += kappa;
+      return roundWeed(digits, *length, distance * unit, unsafe, p2, one, unit);
+    }
+  }
+}
+
+// Unsigned integers big enough for the exact digits of any double, or of
+// any float where double is float. exactDigits() keeps four on the stack.
+#if __SIZEOF_DOUBLE__ == 4
+#define BIGNUM_WORDS 8
+#else
+#define BIGNUM_WORDS 36
+#endif
+
+struct Bignum {
+  uint32_t words[BIGNUM_WORDS];   // least significant first
+  int used;
+};
+
+static void bigSet(Bignum *a, uint64_t value) {
+  a->words[0] = (uint32_t)value;
+  a->words[1] = (uint32_t)(value >> 32);
+  a->used = a->words[1] != 0 ? 2 : a->words[0] != 0 ? 1 : 0;
+}
+
+static void bigShiftLeft(Bignum *a, int bits) {
+  if (a->used == 0) {
+    return;
+  }
+  int words = bits / 32;
+  bits %= 32;
+  a->words[a->used] = 0;
+  for (int i = a->used; i >= 0; i--) {
+    uint32_t lower = i > 0 && bits > 0 ? a->words[i - 1] >> (32 - bits) : 0;
+    a->words[i + words] = a->words[i] << bits | lower;
+  }
+  for (int i = 0; i < words; i++) {
+    a->words[i] = 0;
+  }
+  a->used += words + (a->words[a->used + words] != 0);
+}
+
+static void bigMultiply(Bignum *a, uint32_t factor) {
+  uint64_t carry = 0;
+  for (int i = 0; i < a->used; i++) {
+    carry += (uint64_t)a->words[i] * factor;
+    a->words[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  if (carry != 0) {
+    a->words[a->used++] = (uint32_t)carry;
+  }
+}
+
+static void bigMultiplyPow10(Bignum *a, int k) {
+  for (; k >= 9; k -= 9) {
+    bigMultiply(a, 1000000000);
+  }
+  bigMultiply(a, (uint32_t)powersOf10[k]);
+}
+
+static void bigAdd(Bignum *sum, const Bignum *a, const Bignum *b) {
+  int used = a->used > b->used ? a->used : b->used;
+  uint64_t carry = 0;
+  for (int i = 0; i < used; i++) {
+    carry += (uint64_t)(i < a->used ? a->words[i] : 0) +
+             (i < b->used ? b->words[i] : 0);
+    sum->words[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  sum->used = used;
+  if (carry != 0) {
+    sum->words[sum->used++] = (uint32_t)carry;
+  }
+}
+
+// a -= b, for a >= b.
+static void bigSubtract(Bignum *a, const Bignum *b) {
+  int64_t borrow = 0;
+  for (int i = 0; i < a->used; i++) {
+    borrow += (int64_t)a->words[i] - (i < b->used ? b->words[i] : 0);
+    a->words[i] = (uint32_t)borrow;
+    borrow = borrow < 0 ? -1 : 0;
+  }
+  while (a->used > 0 && a->words[a->used - 1] == 0) {
+    a->used--;
+  }
+}
+
+static int bigCompare(const Bignum *a, const Bignum *b) {
+  if (a->used != b->used) {
+    return a->used < b->used ? -1 : 1;
+  }
+  for (int i = a->used - 1; i >= 0; i--) {
+    if (a->words[i] != b->words[i]) {
+      return a->words[i] < b->words[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+// The fewest digits, the closest of them to the value, that still round to
+// it (Steele and White's free-format algorithm as refined by Burger and
+// Dybvig, "Printing floating-point numbers quickly and accurately", PLDI
+// 1996). value = r / s * 10^k, and the numbers within mMinus / s below or
+// mPlus / s above it round to it, at the ends too when f is even as
+// round-half-even reads them.
+static int exactDigits(uint64_t f, int e, bool lowerCloser, char *digits,
+                       int *exponent) {
+  Bignum r, s, mMinus, t;
+  bigSet(&r, f << 2);
+  bigSet(&s, 4);
+  bigSet(&mMinus, lowerCloser ? 1 : 2);
+  if (e >= 0) {
+    bigShiftLeft(&r, e);
+    bigShiftLeft(&mMinus, e);
+  } else {
+    bigShiftLeft(&s, -e);
+  }
+  bool even = (f & 1) == 0;
+  // k starts at or just below the power of ten above the value and goes up
+  // until the top of the interval, r + mPlus, is under s.
+  int highBit = normalize(DiyFp{f, e}).e + 63;
+  int k = (highBit * 78913 + (highBit > 0 ? (1 << 18) - 1 : 0)) / (1 << 18) - 1;
+  if (k >= 0) {
+    bigMultiplyPow10(&s, k);
+  } else {
+    bigMultiplyPow10(&r, -k);
+    bigMultiplyPow10(&mMinus, -k);
+  }
+  // mPlus is mMinus, or twice it when the lower neighbour is closer.
+  for (;;) {
+    bigAdd(&t, &r, &mMinus);
+    if (lowerCloser) {
+      bigAdd(&t, &t, &mMinus);
+    }
+    int c = bigCompare(&t, &s);
+    if (even ? c < 0 : c <= 0) {
+      break;
+    }
+    bigMultiply(&s, 10);
+    k++;
+  }
+
+  int length = 0;
+  for (;;) {
+    bigMultiply(&r, 10);
+    bigMultiply(&mMinus, 10);
+    int d = 0;
+    while (bigCompare(&r, &s) >= 0) {
+      bigSubtract(&r, &s);
+      d++;
+    }
+    int c = bigCompare(&r, &mMinus);
+    bool low = even ? c <= 0 : c < 0;
+    bigAdd(&t, &r, &mMinus);
+    if (lowerCloser) {
+      bigAdd(&t, &t, &mMinus);
+    }
+    c = bigCompare(&t, &s);
+    bool high = even ? c >= 0 : c > 0;
+    if (!low && !high) {
+      digits[length++] = '0' + d;
+      continue;
+    }
+    if (low && high) {
+      bigAdd(&t, &r, &r);
+      high = bigCompare(&t, &s) > 0;
+    }
+    digits[length++] = '0' + d + high;
+    break;
+  }
+  *exponent = k - length;
+  return length;
+}
+
+// Writes the fewest digits such that value = digits * 10^*exponent.
+static int shortestDigits(uint64_t f, int e, bool lowerCloser, char *digits,
+                          int *exponent) {
+  int length;
+  if (grisu3(f, e, lowerCloser, digits, &length, exponent)) {
+    return length;
+  }
+  return exactDigits(f, e, lowerCloser, digits, exponent);
+}
+
+JsonWriter::JsonWriter(char *buffer, size_t size) {
+  this->buffer = buffer;
+  this->size = size;
+  clear();
+}
+
+void JsonWriter::clear() {
+  used = 0;
+  overflow = size == 0;
+  comma = false;
+  if (size > 0) {
+    buffer[0] = '\0';
+  }
+}
+
+void JsonWriter::put(char c) {
+  put(&c, 1);
+}
+
+// Keeps room for the NUL.
+void JsonWriter::put(const char *data, size_t length) {
+  if (overflow) {
+    return;
+  }
+  if (length >= size - used) {
+    length = size - used - 1;
+    overflow = true;
+  }
+  memcpy(buffer + used, data, length);
+  used += length;
+  buffer[used] = '\0';
+}
+
+void JsonWriter::separate() {
+  if (comma) {
+    put(',');
+  }
+  comma = true;
+}
+
+void JsonWriter::putString(const char *data, size_t length) {
+  put('"');
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = data[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    put(data + start, i - start);
+    start = i + 1;
+    char escape[6] = {'\\', (char)c, 0, 0, 0, 0};
+    size_t n = 2;
+    switch (c) {
+      case '"': case '\\': break;
+      case '\b': escape[1] = 'b'; break;
+      case '\f': escape[1] = 'f'; break;
+      case '\n': escape[1] = 'n'; break;
+      case '\r': escape[1] = 'r'; break;
+      case '\t': escape[1] = 't'; break;
+      default:
+        escape[1] = 'u';
+        escape[2] = '0';
+        escape[3] = '0';
+        escape[4] = "0123456789abcdef"[c >> 4];
+        escape[5] = "0123456789abcdef"[c & 0xf];
+        n = 6;
+    }
+    put(escape, n);
+  }
+  put(data + start, length - start);
+  put('"');
+}
+
+void JsonWriter::putUnsigned(unsigned long long value) {
+  char digits[20];
+  char *start = formatUnsigned(value, digits + sizeof(digits));
+  put(start, digits + sizeof(digits) - start);
+}
+
+// The way JavaScript prints numbers: plain from 1e-6 up to 1e21, with an
+// exponent outside that.
+void JsonWriter::putDecimal(uint64_t f, int e, bool lowerCloser) {
+  char digits[18];
+  int exponent;
+  int length = shortestDigits(f, e, lowerCloser, digits, &exponent);
+  int point = length + exponent; // digits before the decimal point
+  char out[32];
+  int n = 0;
+  if (length <= point && point <= 21) {
+    memcpy(out, digits, length);
+    n = length;
+    while (n < point) {
+      out[n++] = '0';
+    }
+  } else if (0 < point && point <= 21) {
+    memcpy(out, digits, point);
+    out[point] = '.';
+    memcpy(out + point + 1, digits + point, length - point);
+    n = length + 1;
+  } else if (-6 < point && point <= 0) {
+    out[n++] = '0';
+    out[n++] = '.';
+    while (n < 2 - point) {
+      out[n++] = '0';
+    }
+    memcpy(out + n, digits, length);
+    n += length;
+  } else {
+    out[n++] = digits[0];
+    if (length > 1) {
+      out[n++] = '.';
+      memcpy(out + n, digits + 1, length - 1);
+      n += length - 1;
+    }
+    out[n++] = 'e';
+    int exp10 = point - 1;
+    if (exp10 < 0) {
+      out[n++] = '-';
+      exp10 = -exp10;
+    }
+    char *end = out + sizeof(out);
+    char *start = formatUnsigned(exp10, end);
+    memmove(out + n, start, end - start);
+    n += end - start;
+  }
+  put(out, n);
+}
+
+JsonWriter &JsonWriter::beginObject() {
+  separate();
+  put('{');
+  comma = false;
+  return *this;
+}
+
+JsonWriter &JsonWriter::endObject() {
+  put('}');
+  comma = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::beginArray() {
+  separate();
+  put('[');
+  comma = false;
+  return *this;
+}
+
+JsonWriter &JsonWriter::endArray() {
+  put(']');
+  comma = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name) {
+  separate();
+  putString(name, strlen(name));
+  put(':');
+  comma = false;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *data) {
+  return value(data, strlen(data));
+}
+
+JsonWriter &JsonWriter::value(const char *data, size_t length) {
+  separate();
+  putString(data, length);
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const String &data) {
+  return value(data.c_str(), data.length());
+}
+
+JsonWriter &JsonWriter::value(bool data) {
+  separate();
+  if (data) {
+    put("true", 4);
+  } else {
+    put("false", 5);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(int data) {
+  return value((long long)data);
+}
+
+JsonWriter &JsonWriter::value(unsigned int data) {
+  return value((unsigned long long)data);
+}
+
+JsonWriter &JsonWriter::value(long data) {
+  return value((long long)data);
+}
+
+JsonWriter &JsonWriter::value(unsigned long data) {
+  return value((unsigned long long)data);
+}
+
+JsonWriter &JsonWriter::value(long long data) {
+  separate();
+  if (data < 0) {
+    put('-');
+    putUnsigned(0 - (unsigned long long)data);
+  } else {
+    putUnsigned(data);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long long data) {
+  separate();
+  putUnsigned(data);
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(float data) {
+  uint32_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  uint32_t biased = (bits >> 23) & 0xff;
+  uint32_t fraction = bits & 0x7fffff;
+  if (biased == 0xff) {
+    return nullValue();
+  }
+  separate();
+  if (bits >> 31) {
+    put('-');
+  }
+  if (biased == 0 && fraction == 0) {
+    put('0');
+  } else if (biased == 0) {
+    putDecimal(fraction, -149, false);
+  } else {
+    putDecimal(fraction | 0x800000, biased - 150, fraction == 0 && biased > 1);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(double data) {
+#if __SIZEOF_DOUBLE__ == 4
+  return value((float)data);
+#else
+  uint64_t bits;
+  memcpy(&bits, &data, sizeof(bits));
+  uint32_t biased = (bits >> 52) & 0x7ff;
+  uint64_t fraction = bits & 0xfffffffffffffULL;
+  if (biased == 0x7ff) {
+    return nullValue();
+  }
+  separate();
+  if (bits >> 63) {
+    put('-');
+  }
+  if (biased == 0 && fraction == 0) {
+    put('0');
+  } else if (biased == 0) {
+    putDecimal(fraction, -1074, false);
+  } else {
+    putDecimal(fraction | 0x10000000000000ULL, biased - 1075,
+               fraction == 0 && biased > 1);
+  }
+  return *this;
+#endif
+}
+
+JsonWriter &JsonWriter::nullValue() {
+  separate();
+  put("null", 4);
+  return *this;
+}
+
+const char *JsonWriter::c_str() const {
+  return size > 0 ? buffer : "";
+}
+
+size_t JsonWriter::length() const {
+  return used;
+}
+
+bool JsonWriter::ok() const {
+  return !overflow;
+}
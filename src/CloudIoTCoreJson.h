@@ -0,0 +1,224 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_JSON_H__
+#define __CLOUDIOTCORE_JSON_H__
+
+#include <Arduino.h>
+
+// Streaming JSON parser for config and command payloads. It takes the
+// document in pieces of any size, as a ReceiveHandler or a TopicHandler gets
+// them, keeps only a fixed amount of state and never allocates. Values whose
+// path is bound are handed to typed setters as soon as they are complete:
+//
+//   $.sampling.period_ms     member of an object
+//   $.leds[2].on             array element
+//   $.leds[*].on             any array element
+//
+// Setters run as values complete, so a document that turns out to be
+// malformed further on may have applied some of them; end() tells.
+
+// Deepest nesting of objects and arrays.
+#ifdef CONF_JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH CONF_JSON_MAX_DEPTH
+#else
+#define JSON_MAX_DEPTH 16
+#endif
+
+// Longest path of the value being parsed, as written above; values deeper
+// than this can not be bound.
+#ifdef CONF_JSON_PATH_SIZE
+#define JSON_PATH_SIZE CONF_JSON_PATH_SIZE
+#else
+#define JSON_PATH_SIZE 96
+#endif
+
+// Longest bound string or number; longer ones are skipped.
+#ifdef CONF_JSON_VALUE_SIZE
+#define JSON_VALUE_SIZE CONF_JSON_VALUE_SIZE
+#else
+#define JSON_VALUE_SIZE 64
+#endif
+
+// Most bindings per parser, up to 32.
+#ifdef CONF_JSON_BINDINGS
+#define JSON_BINDINGS CONF_JSON_BINDINGS
+#else
+#define JSON_BINDINGS 16
+#endif
+
+#if JSON_BINDINGS > 32
+#error JSON_BINDINGS is at most 32
+#endif
+
+typedef void (*JsonIntSetter)(long value);
+typedef void (*JsonNumberSetter)(double value);
+typedef void (*JsonBoolSetter)(bool value);
+// value is NUL terminated, only valid during the call.
+typedef void (*JsonStringSetter)(const char *value, size_t length);
+
+enum JsonError {
+  JSON_OK,
+  JSON_INCOMPLETE,       // end() before the document was complete
+  JSON_SYNTAX,
+  JSON_TOO_DEEP          // nested deeper than JSON_MAX_DEPTH
+};
+
+class JsonParser {
+  private:
+    struct Binding {
+      const char *path;
+      uint16_t length;
+      bool wildcard;                      // has [*]
+      uint8_t type;
+      void (*setter)();
+    };
+    Binding bindings[JSON_BINDINGS];
+    uint8_t bindingCount = 0;
+
+    // parser state
+    uint8_t state;
+    uint8_t depth;
+    bool arrays[JSON_MAX_DEPTH];          // container kind at each depth
+    uint16_t indexes[JSON_MAX_DEPTH];     // element index in arrays
+    uint16_t pathLengths[JSON_MAX_DEPTH]; // path length of each container
+    uint32_t candidates[JSON_MAX_DEPTH];  // bindings that may be inside it
+    char path[JSON_PATH_SIZE];
+    uint16_t pathLength;
+    bool inKey;
+
+    // the current scalar
+    int8_t match;                         // bound binding, or -1
+    char value[JSON_VALUE_SIZE];
+    uint8_t valueLength;
+    bool valueOverflow;
+    uint8_t literalPos;
+    const char *literal;
+    uint8_t numberState;
+    uint16_t unicode;
+    uint8_t unicodePos;
+    uint16_t highSurrogate;
+
+    JsonError err;
+    size_t offset;
+    uint32_t skipped = 0;
+
+    bool bind(const char *path, uint8_t type, void (*setter)());
+    bool matches(const char *pattern, bool prefix);
+    void beginValue();
+    void endValue();
+    void appendPath(char c);
+    void appendValue(char c);
+    void appendCodePoint(uint32_t cp);
+    bool pushContainer(bool array);
+    void popContainer();
+    bool parse(char c);
+    bool fail(JsonError error);
+
+  public:
+    JsonParser();
+
+    // Binds a path, which must outlive the parser, to a setter; the first
+    // binding that fits a value gets it. Numbers with a fraction or exponent
+    // do not reach int setters. Returns false when the table is full or the
+    // path does not start with $.
+    bool bind(const char *path, JsonIntSetter setter);
+    bool bind(const char *path, JsonNumberSetter setter);
+    bool bind(const char *path, JsonBoolSetter setter);
+    bool bind(const char *path, JsonStringSetter setter);
+
+    // Starts a document.
+    void begin();
+    // Parses the next piece. Returns false once the document is malformed.
+    bool feed(const char *data, size_t length);
+    // Returns true if exactly one complete document was fed.
+    bool end();
+
+    JsonError error();
+    // Bytes fed before the error.
+    size_t errorOffset();
+    // Bound values skipped for being longer than JSON_VALUE_SIZE or of
+    // another type than their setter.
+    uint32_t skippedCount();
+};
+
+// Writes JSON into a buffer of the caller's, usually on the stack, for
+// publishTelemetry(). Commas and escaping are taken care of; numbers are
+// formatted without printf or String, floats in the fewest digits that read
+// back as the same value:
+//
+//   char buffer[128];
+//   JsonWriter json(buffer, sizeof(buffer));
+//   json.beginObject().add("rssi", WiFi.RSSI()).add("temp", 21.5f).endObject();
+//
+// What does not fit is cut off and ok() turns false.
+class JsonWriter {
+  private:
+    char *buffer;
+    size_t size;
+    size_t used;
+    bool overflow;
+    bool comma;                           // a member or element came before
+
+    void put(char c);
+    void put(const char *data, size_t length);
+    void separate();
+    void putString(const char *data, size_t length);
+    void putUnsigned(unsigned long long value);
+    void putDecimal(uint64_t f, int e, bool lowerCloser);
+
+  public:
+    JsonWriter(char *buffer, size_t size);
+
+    // Starts over in the same buffer.
+    void clear();
+
+    JsonWriter &beginObject();
+    JsonWriter &endObject();
+    JsonWriter &beginArray();
+    JsonWriter &endArray();
+    // The name of the next object member.
+    JsonWriter &key(const char *name);
+
+    JsonWriter &value(const char *data);
+    JsonWriter &value(const char *data, size_t length);
+    JsonWriter &value(const String &data);
+    JsonWriter &value(bool data);
+    JsonWriter &value(int data);
+    JsonWriter &value(unsigned int data);
+    JsonWriter &value(long data);
+    JsonWriter &value(unsigned long data);
+    JsonWriter &value(long long data);
+    JsonWriter &value(unsigned long long data);
+    // NaN and infinities, which JSON has no numbers for, are written null.
+    JsonWriter &value(float data);
+    JsonWriter &value(double data);
+    JsonWriter &nullValue();
+
+    // key(name) and value(data).
+    template <typename T>
+    JsonWriter &add(const char *name, T data) {
+      key(name);
+      return value(data);
+    }
+
+    // NUL terminated.
+    const char *c_str() const;
+    size_t length() const;
+    // False if something did not fit.
+    bool ok() const;
+};
+
+#endif // __CLOUDIOTCORE_JSON_H__
@@ -14,11 +14,46 @@
  *****************************************************************************/
 #include "CloudIoTCoreMqtt.h"
 
-// Forward global callback declarations
-String getJwt();
-void messageReceived(String &topic, String &payload);
+// Events topic plus subtopic up to this length are built on the stack.
+#define TOPIC_BUFFER_SIZE 192
+
+// MQTT PUBLISH fixed header: packet type and flags, then up to four bytes of
+// remaining length.
+#define MQTT_FIXED_HEADER_MAX 5
+#define MQTT_PUBLISH 0x30
+#define MQTT_RETAIN 0x01
+#define MQTT_MAX_REMAINING 268435455
+
+// Gathered publishes stage the headers and small segments in a buffer of
+// this size, so each network write (a TLS record) carries a useful amount.
+#define GATHER_BUFFER_SIZE (TOPIC_BUFFER_SIZE + 64)
+
+// Forward global callback declarations. Where the toolchain allows they are
+// weak, so programs that give every instance a JwtProvider and a
+// MessageHandler need not define them.
+#if defined(__GNUC__) && !defined(__APPLE__)
+#define CLOUD_IOT_CORE_WEAK_GLOBALS
+#define CLOUD_IOT_CORE_WEAK __attribute__((weak))
+#else
+#define CLOUD_IOT_CORE_WEAK
+#endif
+String getJwt() CLOUD_IOT_CORE_WEAK;
+void messageReceived(String &topic, String &payload) CLOUD_IOT_CORE_WEAK;
 // callback for startMQTTAdvanced
-void messageReceivedAdvanced(MQTTClient *client, char topic[], char bytes[], int length);
+void messageReceivedAdvanced(MQTTClient *client, char topic[], char bytes[], int length) CLOUD_IOT_CORE_WEAK;
+
+// Instances with a message handler, hashed by their MQTTClient. Host
+// programs may run thousands; devices run one.
+#if defined(__linux__) || defined(__APPLE__)
+#define HANDLER_BUCKETS 256
+#else
+#define HANDLER_BUCKETS 1
+#endif
+static CloudIoTCoreMqtt *handledInstances[HANDLER_BUCKETS];
+
+static CloudIoTCoreMqtt **handlerBucket(MQTTClient *client) {
+  return &handledInstances[((uintptr_t)client >> 4) % HANDLER_BUCKETS];
+}
 
 
 ///////////////////////////////
@@ -31,178 +66,829 @@ CloudIoTCoreMqtt::CloudIoTCoreMqtt(
   this->device = _device;
 }
 
-boolean CloudIoTCoreMqtt::loop() {
-  if (millis() > device->getExpMillis() && mqttClient->connected()) {
-    // reconnect
-    Serial.println("Reconnecting before JWT expiration");
-    mqttClient->disconnect();
+CloudIoTCoreMqtt::~CloudIoTCoreMqtt() {
+  if (!handled) {
+    return;
+  }
+  for (CloudIoTCoreMqtt **p = handlerBucket(mqttClient); *p != NULL; p = &(*p)->nextHandled) {
+    if (*p == this) {
+      *p = nextHandled;
+      break;
+    }
   }
-  return this->mqttClient->loop();
 }
 
-void CloudIoTCoreMqtt::mqttConnect(bool skip) {
-  Serial.println("Connecting...");
-  bool keepgoing = true;
-  while (keepgoing) {
-    bool result =
-        this->mqttClient->connect(
-            device->getClientId().c_str(),
-            "unused",
-            getJwt().c_str(),
-            skip);
-
-    if (this->mqttClient->lastError() != LWMQTT_SUCCESS && result){
-      // TODO: refactorme
-      // Inform the client why it could not connect and help debugging.
-      logError();
-      logReturnCode();
-      logConfiguration(false);
-
-      // See https://cloud.google.com/iot/docs/how-tos/exponential-backoff
-      if (this->__backoff__ < this->__minbackoff__) {
-        this->__backoff__ = this->__minbackoff__;
-      }
-      this->__backoff__ = (this->__backoff__ * this->__factor__) + random(this->__jitter__);
-      if (this->__backoff__ > this->__max_backoff__) {
-        this->__backoff__ = this->__max_backoff__;
-      }
+void CloudIoTCoreMqtt::setJwtProvider(JwtProvider *provider) {
+  this->jwtProvider = provider;
+}
 
-      // Clean up the client
-      this->mqttClient->disconnect();
-      skip = false;
-      Serial.println("Delaying " + String(this->__backoff__) + "ms");
-      delay(this->__backoff__);
-      keepgoing = true;
-    } else {
-      Serial.println(mqttClient->connected() ? "connected" : "not connected");
-      if (!mqttClient->connected()) {
-        Serial.println("Settings incorrect or missing a cypher for SSL");
-        mqttClient->disconnect();
-        logConfiguration(false);
-        skip = false;
-        keepgoing = true;
-        Serial.println("Waiting 60 seconds, retry will likely fail");
-        delay(this->__max_backoff__);
-      } else {
-        // We're now connected
-        Serial.println("\nLibrary connected!");
-        keepgoing = false;
-        this->__backoff__ = this->__minbackoff__;
+void CloudIoTCoreMqtt::setMessageHandler(MessageHandler *handler) {
+  this->messageHandler = handler;
+}
+
+String CloudIoTCoreMqtt::createJwt() {
+  if (jwtProvider != NULL) {
+    return jwtProvider->getJwt();
+  }
+#ifdef CLOUD_IOT_CORE_WEAK_GLOBALS
+  if (getJwt == NULL) {
+    Serial.println("No JwtProvider and no getJwt()");
+    return "";
+  }
+#endif
+  return getJwt();
+}
+
+// MQTTClient callbacks carry no context but the client, so the instance is
+// looked up by it.
+void CloudIoTCoreMqtt::dispatch(MQTTClient *client, char topic[], char bytes[], int length) {
+  for (CloudIoTCoreMqtt *mqtt = *handlerBucket(client); mqtt != NULL; mqtt = mqtt->nextHandled) {
+    if (mqtt->mqttClient == client) {
+      if (!mqtt->route(topic, bytes, length)) {
+        mqtt->unrouted(topic, bytes, length);
       }
+      return;
     }
   }
+}
 
-  // Set QoS to 1 (ack) for configuration messages
-  this->mqttClient->subscribe(device->getConfigTopic(), 1);
-  // QoS 0 (no ack) for commands
-  this->mqttClient->subscribe(device->getCommandsTopic(), 0);
+// FNV-1a, to compare subfolders by hash and length before their bytes.
+static uint32_t topicHash(const char *data, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return hash;
+}
 
-  onConnect();
+void CloudIoTCoreMqtt::onConfig(TopicHandler handler) {
+  this->configHandler = handler;
 }
 
-void CloudIoTCoreMqtt::mqttConnectAsync(bool skip) {
-  Serial.println("Connecting...");
-
-  bool result =
-      this->mqttClient->connect(
-          device->getClientId().c_str(),
-          "unused",
-          getJwt().c_str(),
-          skip);
-
-  if (this->mqttClient->lastError() != LWMQTT_SUCCESS && result == true){
-    // TODO: refactorme
-    // Inform the client why it could not connect and help debugging.
-    logError();
-    logReturnCode();
-    logConfiguration(false);
-
-    // See https://cloud.google.com/iot/docs/how-tos/exponential-backoff
-    if (this->__backoff__ < this->__minbackoff__) {
-      this->__backoff__ = this->__minbackoff__;
+bool CloudIoTCoreMqtt::onCommand(const char *subfolder, TopicHandler handler) {
+  size_t length = subfolder != NULL ? strlen(subfolder) : 0;
+  uint32_t hash = subfolder != NULL ? topicHash(subfolder, length) : 0;
+  // Setting a subfolder again replaces its handler.
+  uint8_t i = 0;
+  for (; i < routeCount; i++) {
+    if (subfolder == NULL ? routes[i].subfolder == NULL
+                          : routes[i].subfolder != NULL &&
+                            strcmp(routes[i].subfolder, subfolder) == 0) {
+      break;
     }
-    this->__backoff__ = (this->__backoff__ * this->__factor__) + random(this->__jitter__);
-    if (this->__backoff__ > this->__max_backoff__) {
-      this->__backoff__ = this->__max_backoff__;
+  }
+  if (i == TOPIC_ROUTES) {
+    return false;
+  }
+  if (i == routeCount) {
+    routeCount++;
+  }
+  routes[i].subfolder = subfolder;
+  routes[i].length = length;
+  routes[i].hash = hash;
+  routes[i].handler = handler;
+  return true;
+}
+
+// Matches /devices/<id>/config and /devices/<id>/commands[/<subfolder>]
+// against the device's stored topics.
+bool CloudIoTCoreMqtt::route(const char *topic, const char *data, size_t length) {
+  size_t topicLength = strlen(topic);
+  size_t configLength;
+  const char *config = device->getConfigTopicView(&configLength);
+  if (topicLength == configLength && memcmp(topic, config, configLength) == 0) {
+    if (configHandler == NULL) {
+      return false;
     }
+    configHandler(this, topic + topicLength, data, length);
+    return true;
+  }
+
+  // The commands topic ends in "/#".
+  size_t prefixLength;
+  const char *prefix = device->getCommandsTopicView(&prefixLength);
+  if (routeCount == 0 || prefixLength < 2 || topicLength < prefixLength - 2 ||
+      memcmp(topic, prefix, prefixLength - 2) != 0) {
+    return false;
+  }
+  const char *subfolder = topic + prefixLength - 2;
+  if (*subfolder == '/') {
+    subfolder++;
+  } else if (*subfolder != '\0') {
+    return false;
+  }
+  size_t subfolderLength = topic + topicLength - subfolder;
+  uint32_t hash = topicHash(subfolder, subfolderLength);
+  TopicHandler any = NULL;
+  for (uint8_t i = 0; i < routeCount; i++) {
+    if (routes[i].subfolder == NULL) {
+      any = routes[i].handler;
+    } else if (routes[i].hash == hash && routes[i].length == subfolderLength &&
+               memcmp(routes[i].subfolder, subfolder, subfolderLength) == 0) {
+      routes[i].handler(this, subfolder, data, length);
+      return true;
+    }
+  }
+  if (any == NULL) {
+    return false;
+  }
+  any(this, subfolder, data, length);
+  return true;
+}
 
-    // Clean up the client
-    this->mqttClient->disconnect();
-    skip = false;
-    // Serial.println("Delaying " + String(this->__backoff__) + "ms");
-    // delay(this->__backoff__);
+void CloudIoTCoreMqtt::unrouted(char topic[], char bytes[], int length) {
+  if (messageHandler != NULL) {
+    messageHandler->messageReceived(this, topic, bytes, length);
+  } else if (advancedCallback) {
+#ifdef CLOUD_IOT_CORE_WEAK_GLOBALS
+    if (messageReceivedAdvanced == NULL) {
+      return;
+    }
+#endif
+    messageReceivedAdvanced(mqttClient, topic, bytes, length);
   } else {
-    Serial.println(mqttClient->connected() ? "connected" : "not connected");
-    if (!mqttClient->connected()) {
-      Serial.println("No internet or Settings incorrect or missing a cypher for SSL");
-      mqttClient->disconnect();
-      logConfiguration(false);
-      skip = false;
-      Serial.println("\naborting mqtt connection attempt, lets rety later...\tLibrary not connected!");
-      // delay(this->__max_backoff__);
-    } else {
-      // We're now connected
-      Serial.println("\nLibrary connected!");
-      this->__backoff__ = this->__minbackoff__;
+#ifdef CLOUD_IOT_CORE_WEAK_GLOBALS
+    if (messageReceived == NULL) {
+      return;
+    }
+#endif
+    // as MQTTClient does for onMessage()
+    String topicString = String(topic);
+    String payload = bytes != NULL ? String(bytes) : String();
+    messageReceived(topicString, payload);
+  }
+}
+
+void CloudIoTCoreMqtt::startHandler() {
+  if (!handled) {
+    CloudIoTCoreMqtt **bucket = handlerBucket(mqttClient);
+    nextHandled = *bucket;
+    *bucket = this;
+    handled = true;
+  }
+  this->mqttClient->onMessageAdvanced(dispatch);
+}
+
+boolean CloudIoTCoreMqtt::loop() {
+  if (state == CONNECTION_ONLINE && !mqttClient->connected()) {
+    Serial.println("Connection lost");
+    // Straight back to signing: the backoff is still at its minimum after a
+    // successful connection, and lwmqtt already waited out its timeouts.
+    setState(CONNECTION_SIGNING);
+  }
+  if (millis() > device->getExpMillis() && mqttClient->connected()) {
+    // reconnect
+    Serial.println("Reconnecting before JWT expiration");
+    mqttClient->disconnect();
+    if (state == CONNECTION_ONLINE) {
+      setState(CONNECTION_SIGNING);
+    }
+  }
+  if (state != CONNECTION_IDLE && state != CONNECTION_ONLINE) {
+    advance();
+  }
+  if (batch != NULL && batch->isDue(millis()) && mqttClient->connected()) {
+    flushBatch();
+  }
+  if (forward != NULL && forward->pending() && mqttClient->connected()) {
+    const char *subtopic;
+    size_t length;
+    int qos;
+    const char *data = forward->next(millis(), &subtopic, &length, &qos);
+    if (data != NULL && publishEvent(subtopic, data, length, qos)) {
+      forward->remove();
     }
   }
+  if (envelope != NULL && envelopeWindow > 0 && envelope->count() > 0 &&
+      millis() - envelopeStart >= envelopeWindow && mqttClient->connected()) {
+    flushEnvelope();
+  }
+  boolean result = this->mqttClient->loop();
+  if (window != NULL && mqttClient->connected()) {
+    window->poll(millis());
+  }
+  return result;
+}
 
+// Blocks until online, but runs the same state machine as
+// mqttConnectAsync() and yields while waiting out the backoff. Returns early
+// if a connection callback calls mqttDisconnect().
+void CloudIoTCoreMqtt::mqttConnect(bool skip) {
+  mqttConnectAsync(skip);
+  while (state != CONNECTION_ONLINE) {
+    if (state == CONNECTION_IDLE) {
+      return;
+    }
+    advance();
+    if (state == CONNECTION_BACKOFF) {
+      delay(1);
+    }
+    yield();
+  }
+}
 
-  // Set QoS to 1 (ack) for configuration messages
-  this->mqttClient->subscribe(device->getConfigTopic(), 1);
-  // QoS 0 (no ack) for commands
-  this->mqttClient->subscribe(device->getCommandsTopic(), 0);
+// Starts connecting; loop() does the rest, one step per call. A connection
+// already under way, or waiting out its backoff, is left alone.
+void CloudIoTCoreMqtt::mqttConnectAsync(bool skip) {
+  if (state == CONNECTION_IDLE) {
+    this->connectSkip = skip;
+    setState(CONNECTION_SIGNING);
+  }
+}
+
+void CloudIoTCoreMqtt::mqttDisconnect() {
+  if (mqttClient->connected()) {
+    mqttClient->disconnect();
+  }
+  setState(CONNECTION_IDLE);
+}
+
+ConnectionState CloudIoTCoreMqtt::getConnectionState() {
+  return state;
+}
 
-  onConnect();
+void CloudIoTCoreMqtt::setConnectionCallback(ConnectionCallback callback) {
+  this->connectionCallback = callback;
+}
+
+void CloudIoTCoreMqtt::setState(ConnectionState next) {
+  if (next == state) {
+    return;
+  }
+  state = next;
+  if (connectionCallback != NULL) {
+    connectionCallback(this, next);
+  }
+}
+
+// See https://cloud.google.com/iot/docs/how-tos/exponential-backoff
+void CloudIoTCoreMqtt::backoff(unsigned long delayMillis) {
+  // Clean up the client
+  this->mqttClient->disconnect();
+  this->connectSkip = false;
+  this->jwt = "";
+  Serial.println("Retrying in " + String(delayMillis) + "ms");
+  this->retryAt = millis() + delayMillis;
+  setState(CONNECTION_BACKOFF);
+}
+
+// One step of Idle -> Signing -> Connecting -> Subscribing -> Online, with
+// Backoff after any failure. Each step does at most one blocking operation.
+void CloudIoTCoreMqtt::advance() {
+  switch (state) {
+    case CONNECTION_SIGNING:
+      Serial.println("Connecting...");
+      this->jwt = createJwt();
+      setState(CONNECTION_CONNECTING);
+      break;
+
+    case CONNECTION_CONNECTING: {
+      bool result =
+          this->mqttClient->connect(
+              device->getClientIdView(),
+              "unused",
+              jwt.c_str(),
+              connectSkip);
+      this->jwt = "";
+
+      if (this->mqttClient->lastError() != LWMQTT_SUCCESS) {
+        // Inform the client why it could not connect and help debugging.
+        logError();
+        logReturnCode();
+        logConfiguration(false);
+
+        if (this->__backoff__ < this->__minbackoff__) {
+          this->__backoff__ = this->__minbackoff__;
+        }
+        this->__backoff__ = (this->__backoff__ * this->__factor__) + random(this->__jitter__);
+        if (this->__backoff__ > this->__max_backoff__) {
+          this->__backoff__ = this->__max_backoff__;
+        }
+        backoff(this->__backoff__);
+      } else if (!result || !mqttClient->connected()) {
+        Serial.println("No internet or Settings incorrect or missing a cypher for SSL");
+        logConfiguration(false);
+        backoff(this->__max_backoff__);
+      } else {
+        setState(CONNECTION_SUBSCRIBING);
+      }
+      break;
+    }
+
+    case CONNECTION_SUBSCRIBING:
+      // Set QoS to 1 (ack) for configuration messages
+      // QoS 0 (no ack) for commands
+      if (this->mqttClient->subscribe(device->getConfigTopicView(), 1) &&
+          this->mqttClient->subscribe(device->getCommandsTopicView(), 0)) {
+        Serial.println("\nLibrary connected!");
+        this->__backoff__ = this->__minbackoff__;
+        if (window != NULL) {
+          window->resend(millis());
+        }
+        setState(CONNECTION_ONLINE);
+        onConnect();
+      } else {
+        logError();
+        backoff(this->__backoff__);
+      }
+      break;
+
+    case CONNECTION_BACKOFF:
+      if ((long)(millis() - retryAt) >= 0) {
+        setState(CONNECTION_SIGNING);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// The network client as MQTTClient sees it, through the publish window and
+// the receive stream when set.
+Client *CloudIoTCoreMqtt::wrapClient() {
+  Client *client = netClient;
+  if (window != NULL) {
+    client = window->wrap(client);
+  }
+  if (receiveStream != NULL) {
+    client = receiveStream->wrap(client);
+  }
+  return client;
 }
 
 void CloudIoTCoreMqtt::startMQTT() {
+  Client *client = wrapClient();
   this->mqttClient->begin(useLts ? CLOUD_IOT_CORE_MQTT_HOST_LTS : CLOUD_IOT_CORE_MQTT_HOST,
-    CLOUD_IOT_CORE_MQTT_PORT, *netClient);
-  this->mqttClient->onMessage(messageReceived);
+    CLOUD_IOT_CORE_MQTT_PORT, *client);
+  advancedCallback = false;
+  if (messageHandler != NULL || configHandler != NULL || routeCount > 0) {
+    startHandler();
+  } else {
+    this->mqttClient->onMessage(messageReceived);
+  }
 }
 
 void CloudIoTCoreMqtt::startMQTTAdvanced() {
+  Client *client = wrapClient();
   this->mqttClient->begin(useLts ? CLOUD_IOT_CORE_MQTT_HOST_LTS : CLOUD_IOT_CORE_MQTT_HOST,
-    CLOUD_IOT_CORE_MQTT_PORT, *netClient);
-  this->mqttClient->onMessageAdvanced(messageReceivedAdvanced);
+    CLOUD_IOT_CORE_MQTT_PORT, *client);
+  advancedCallback = true;
+  if (messageHandler != NULL || configHandler != NULL || routeCount > 0) {
+    startHandler();
+  } else {
+    this->mqttClient->onMessageAdvanced(messageReceivedAdvanced);
+  }
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const String &data) {
-  return this->mqttClient->publish(device->getEventsTopic(), data);
+  return publishEvent("", data.c_str(), data.length(), 0);
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const String &data, int qos) {
-  return this->mqttClient->publish(device->getEventsTopic(), data, false, qos);
+  return publishEvent("", data.c_str(), data.length(), qos);
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const char* data, int length) {
-  return this->mqttClient->publish(device->getEventsTopic().c_str(), data, length);
+  return publishEvent("", data, length, 0);
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const String &subtopic, const String &data) {
-  return this->mqttClient->publish(device->getEventsTopic() + subtopic, data);
+  return publishEvent(subtopic.c_str(), data.c_str(), data.length(), 0);
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const String &subtopic, const String &data, int qos) {
-  return this->mqttClient->publish(device->getEventsTopic() + subtopic, data, false, qos);
+  return publishEvent(subtopic.c_str(), data.c_str(), data.length(), qos);
 }
 
 bool CloudIoTCoreMqtt::publishTelemetry(const String &subtopic, const char* data, int length) {
-  return this->mqttClient->publish(String(device->getEventsTopic() + subtopic).c_str(), data, length);
+  return publishEvent(subtopic.c_str(), data, length, 0);
+}
+
+bool CloudIoTCoreMqtt::publishTelemetry(const JsonWriter &json, int qos) {
+  if (!json.ok()) {
+    return false;
+  }
+  return publishEvent("", json.c_str(), json.length(), qos);
+}
+
+bool CloudIoTCoreMqtt::publishTelemetry(const String &subtopic, const JsonWriter &json, int qos) {
+  if (!json.ok()) {
+    return false;
+  }
+  return publishEvent(subtopic.c_str(), json.c_str(), json.length(), qos);
+}
+
+bool CloudIoTCoreMqtt::publishTelemetry(const PublishSegment *segments, size_t count, int qos) {
+  return publishSegments("", segments, count, qos);
+}
+
+bool CloudIoTCoreMqtt::publishTelemetry(const String &subtopic, const PublishSegment *segments,
+                                        size_t count, int qos) {
+  return publishSegments(subtopic.c_str(), segments, count, qos);
+}
+
+// Segments are written straight into the PUBLISH packet when the message
+// goes out as is. Otherwise they are gathered into one buffer for
+// publishEvent().
+bool CloudIoTCoreMqtt::publishSegments(const char *subtopic, const PublishSegment *segments,
+                                       size_t count, int qos) {
+  // Only QoS 0 is encoded here, and Cloud IoT Core has no QoS 2.
+  if (qos < 0 || qos > 1) {
+    return false;
+  }
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++) {
+    length += segments[i].length;
+  }
+  size_t baseLength;
+  const char *base = device->getEventsTopicView(&baseLength);
+  size_t subtopicLength = strlen(subtopic);
+  size_t topicLength = baseLength + subtopicLength;
+  if (baseLength == 0 || 2 + topicLength + 2 + length > MQTT_MAX_REMAINING) {
+    return false;
+  }
+  if (session != NULL || envelope != NULL || batch != NULL ||
+      !mqttClient->connected() || (qos == 1 && window == NULL) ||
+      topicLength >= TOPIC_BUFFER_SIZE) {
+    char *data = (char *)malloc(length > 0 ? length : 1);
+    if (data == NULL) {
+      return false;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+      memcpy(data + pos, segments[i].data, segments[i].length);
+      pos += segments[i].length;
+    }
+    bool result = publishEvent(subtopic, data, length, qos);
+    free(data);
+    return result;
+  }
+
+  unsigned char out[GATHER_BUFFER_SIZE];
+  if (qos == 1) {
+    memcpy(out, base, baseLength);
+    memcpy(out + baseLength, subtopic, subtopicLength);
+    return window->publish((const char *)out, topicLength, segments, count, false,
+                           millis()) != 0;
+  }
+
+  // Fixed header with the remaining length computed up front, then the
+  // topic, then the segments, small ones staged behind the headers.
+  size_t remaining = 2 + topicLength + length;
+  size_t pos = 0;
+  out[pos++] = MQTT_PUBLISH;
+  do {
+    unsigned char b = remaining & 0x7f;
+    remaining >>= 7;
+    out[pos++] = remaining > 0 ? b | 0x80 : b;
+  } while (remaining > 0);
+  out[pos++] = topicLength >> 8;
+  out[pos++] = topicLength & 0xff;
+  memcpy(out + pos, base, baseLength);
+  memcpy(out + pos + baseLength, subtopic, subtopicLength);
+  pos += topicLength;
+  for (size_t i = 0; i < count; i++) {
+    const unsigned char *data = (const unsigned char *)segments[i].data;
+    size_t segmentLength = segments[i].length;
+    if (pos + segmentLength > GATHER_BUFFER_SIZE) {
+      if (netClient->write(out, pos) != pos) {
+        return false;
+      }
+      pos = 0;
+    }
+    if (segmentLength >= GATHER_BUFFER_SIZE) {
+      if (netClient->write(data, segmentLength) != segmentLength) {
+        return false;
+      }
+    } else {
+      memcpy(out + pos, data, segmentLength);
+      pos += segmentLength;
+    }
+  }
+  return pos == 0 || netClient->write(out, pos) == pos;
+}
+
+bool CloudIoTCoreMqtt::publishTelemetryStream(const String &subtopic, size_t length,
+                                              PublishReader *reader) {
+  size_t baseLength;
+  const char *base = device->getEventsTopicView(&baseLength);
+  size_t topicLength = baseLength + subtopic.length();
+  if (baseLength == 0 || 2 + topicLength + length > MQTT_MAX_REMAINING) {
+    return false;
+  }
+  bool direct = session == NULL && envelope == NULL && batch == NULL &&
+                mqttClient->connected();
+  if (!direct && !mqttClient->connected() && forward == NULL && batch == NULL) {
+    return false;
+  }
+  size_t size = length;
+  if (direct) {
+    size = STREAM_CHUNK_SIZE;
+    if (size < MQTT_FIXED_HEADER_MAX + 2 + topicLength) {
+      size = MQTT_FIXED_HEADER_MAX + 2 + topicLength;
+    }
+  }
+  unsigned char *buffer = (unsigned char *)malloc(size > 0 ? size : 1);
+  if (buffer == NULL) {
+    return false;
+  }
+
+  if (!direct) {
+    size_t pos = 0;
+    while (pos < length) {
+      int n = reader->read((char *)buffer + pos, length - pos);
+      if (n <= 0 || (size_t)n > length - pos) {
+        free(buffer);
+        return false;
+      }
+      pos += n;
+    }
+    bool result = publishEvent(subtopic.c_str(), (const char *)buffer, length, 0);
+    free(buffer);
+    return result;
+  }
+
+  size_t remaining = 2 + topicLength + length;
+  size_t pos = 0;
+  buffer[pos++] = MQTT_PUBLISH;
+  do {
+    unsigned char b = remaining & 0x7f;
+    remaining >>= 7;
+    buffer[pos++] = remaining > 0 ? b | 0x80 : b;
+  } while (remaining > 0);
+  buffer[pos++] = topicLength >> 8;
+  buffer[pos++] = topicLength & 0xff;
+  memcpy(buffer + pos, base, baseLength);
+  memcpy(buffer + pos + baseLength, subtopic.c_str(), subtopic.length());
+  pos += topicLength;
+
+  // Fill the buffer from the reader and send it, until the whole payload
+  // is out.
+  size_t left = length;
+  bool started = false;
+  bool result = true;
+  while (result && (pos > 0 || left > 0)) {
+    while (left > 0 && pos < size) {
+      size_t want = size - pos < left ? size - pos : left;
+      int n = reader->read((char *)buffer + pos, want);
+      if (n <= 0 || (size_t)n > want) {
+        result = false;
+        break;
+      }
+      pos += n;
+      left -= n;
+    }
+    if (result) {
+      started = true;
+      result = netClient->write(buffer, pos) == pos;
+    }
+    pos = 0;
+  }
+  free(buffer);
+  if (!result && started) {
+    // The broker is waiting for the rest of the packet.
+    netClient->stop();
+  }
+  return result;
+}
+
+// All telemetry goes through here: logged if offline with a forward log,
+// queued if there is a batch, then encrypted if there is a session, then
+// collected if there is an envelope, otherwise published as is.
+bool CloudIoTCoreMqtt::publishEvent(const char *subtopic, const char* data, int length, int qos) {
+  if (forward != NULL && !mqttClient->connected()) {
+    return forward->append(subtopic, data, length, qos);
+  }
+  if (batch != NULL) {
+    bool result = batch->add(subtopic, data, length, qos, millis());
+    if (batch->isDue(millis()) && mqttClient->connected()) {
+      flushBatch();
+    }
+    return result;
+  }
+  return publishUnbatched(subtopic, data, length, qos);
+}
+
+bool CloudIoTCoreMqtt::publishUnbatched(const char *subtopic, const char* data, int length, int qos) {
+  if (session != NULL) {
+    size_t sessionLength;
+    if (session->needsRotation()) {
+      session->rotate();
+      const char *announcement = session->getAnnouncement(&sessionLength);
+      if (!publishToEvents(SESSION_SUBFOLDER, announcement, sessionLength, 1)) {
+        // Try again with the next message, the backend can not decrypt
+        // without the announcement.
+        session->expire();
+        return false;
+      }
+    }
+    data = session->encrypt(data, length, &sessionLength);
+    if (data == NULL) {
+      return false;
+    }
+    length = sessionLength;
+  }
+  if (envelope != NULL) {
+    return publishEnvelope(subtopic, data, length, qos);
+  }
+  return publishToEvents(subtopic, data, length, qos);
+}
+
+// Publishes to the events topic plus subtopic without allocating, unless the
+// topic is longer than TOPIC_BUFFER_SIZE. Fails if the device could not
+// allocate its topics.
+bool CloudIoTCoreMqtt::publishToEvents(const char *subtopic, const char* data, int length, int qos) {
+  size_t baseLength;
+  const char *base = device->getEventsTopicView(&baseLength);
+  if (baseLength == 0) {
+    return false;
+  }
+  if (subtopic[0] == '\0') {
+    return publishTopic(base, baseLength, data, length, false, qos);
+  }
+  size_t subtopicLength = strlen(subtopic);
+  if (baseLength + subtopicLength >= TOPIC_BUFFER_SIZE) {
+    String topic = String(base) + subtopic;
+    return publishTopic(topic.c_str(), topic.length(), data, length, false, qos);
+  }
+  char topic[TOPIC_BUFFER_SIZE];
+  memcpy(topic, base, baseLength);
+  memcpy(topic + baseLength, subtopic, subtopicLength + 1);
+  return publishTopic(topic, baseLength + subtopicLength, data, length, false, qos);
+}
+
+// QoS 1 goes through the publish window when there is one.
+bool CloudIoTCoreMqtt::publishTopic(const char *topic, size_t topicLength, const char* data,
+                                    int length, bool retained, int qos) {
+  if (qos == 1 && window != NULL && length >= 0 && mqttClient->connected()) {
+    return window->publish(topic, topicLength, data, length, retained, millis()) != 0;
+  }
+  return this->mqttClient->publish(topic, data, length, retained, qos);
+}
+
+// Queues a message for the current envelope batch, flushing first if it
+// would not fit.
+bool CloudIoTCoreMqtt::publishEnvelope(const char *subtopic, const char* data, int length, int qos) {
+  bool result = true;
+  if (envelope->isFull(subtopic, length) && envelope->count() > 0) {
+    result = flushEnvelope();
+  }
+  if (envelope->count() == 0) {
+    envelopeStart = millis();
+  }
+  if (!envelope->add(subtopic, data, length, qos)) {
+    return false;
+  }
+  if (envelope->count() == ENVELOPE_MAX_MESSAGES) {
+    result = flushEnvelope() && result;
+  }
+  return result;
+}
+
+bool CloudIoTCoreMqtt::flushEnvelope() {
+  if (envelope == NULL || envelope->count() == 0) {
+    return true;
+  }
+  if (!envelope->seal()) {
+    return false;
+  }
+  bool result = true;
+  size_t length;
+  for (uint8_t i = 0; i < envelope->count(); i++) {
+    const char *data = envelope->getEnvelope(i, &length);
+    result = publishToEvents(envelope->getSubtopic(i), data, length,
+                             envelope->getQos(i)) && result;
+  }
+  const char *signature = envelope->getSignatureMessage(&length);
+  result = publishToEvents(ENVELOPE_SUBFOLDER, signature, length, 1) && result;
+  envelope->clear();
+  return result;
+}
+
+// Publishes one frame per subfolder. Samples stay queued if their frame
+// could not be published.
+bool CloudIoTCoreMqtt::flushBatch() {
+  if (batch == NULL) {
+    return true;
+  }
+  while (batch->depth() > 0) {
+    const char *subtopic;
+    size_t length;
+    int qos;
+    const char *frame = batch->next(millis(), &subtopic, &length, &qos);
+    if (!publishUnbatched(subtopic, frame, length, qos)) {
+      return false;
+    }
+    batch->remove();
+  }
+  return true;
+}
+
+void CloudIoTCoreMqtt::setForwardLog(ForwardLog *log) {
+  this->forward = log;
+}
+
+void CloudIoTCoreMqtt::setPublishWindow(PublishWindow *window) {
+  this->window = window;
+}
+
+void CloudIoTCoreMqtt::setReceiveStream(ReceiveStream *stream) {
+  this->receiveStream = stream;
+}
+
+void CloudIoTCoreMqtt::setBatch(TelemetryBatch *batch) {
+  this->batch = batch;
+}
+
+void CloudIoTCoreMqtt::setSession(CloudIoTCoreSession *session) {
+  this->session = session;
+}
+
+void CloudIoTCoreMqtt::setEnvelope(TelemetryEnvelope *envelope, unsigned long windowMillis) {
+  this->envelope = envelope;
+  this->envelopeWindow = windowMillis;
 }
 
 // Helper that just sends default sensor
 bool CloudIoTCoreMqtt::publishState(const String &data) {
-  return this->mqttClient->publish(device->getStateTopic(), data);
+  return publishState(data.c_str(), data.length());
 }
 
 bool CloudIoTCoreMqtt::publishState(const char* data) {
-  return this->mqttClient->publish(device->getStateTopic().c_str(), data);
+  return publishState(data, strlen(data));
 }
 
 bool CloudIoTCoreMqtt::publishState(const char* data, int length) {
-  return this->mqttClient->publish(device->getStateTopic().c_str(), data, length);
+  size_t topicLength;
+  const char *topic = device->getStateTopicView(&topicLength);
+  if (topicLength == 0) {
+    return false;
+  }
+  return this->mqttClient->publish(topic, data, length);
+}
+
+PublishChannel *CloudIoTCoreMqtt::openTelemetryChannel(
+    const String &subtopic, int qos, bool retained, size_t capacity) {
+  size_t baseLength;
+  const char *base = device->getEventsTopicView(&baseLength);
+  if (baseLength == 0) {
+    return NULL;
+  }
+  String topic = String(base) + subtopic;
+  PublishChannel *channel = new PublishChannel(this, topic.c_str(), NULL, qos,
+                                               retained, true, capacity);
+  if (channel->packet == NULL) {
+    delete channel;
+    return NULL;
+  }
+  channel->subtopic = channel->topic + baseLength;
+  return channel;
+}
+
+PublishChannel *CloudIoTCoreMqtt::openStateChannel(size_t capacity) {
+  size_t topicLength;
+  const char *topic = device->getStateTopicView(&topicLength);
+  if (topicLength == 0) {
+    return NULL;
+  }
+  PublishChannel *channel = new PublishChannel(this, topic, NULL, 0, false,
+                                               false, capacity);
+  if (channel->packet == NULL) {
+    delete channel;
+    return NULL;
+  }
+  return channel;
+}
+
+bool CloudIoTCoreMqtt::publishChannel(PublishChannel *channel, const char* data, int length) {
+  if (channel->telemetry && (session != NULL || envelope != NULL || batch != NULL ||
+                             (forward != NULL && !mqttClient->connected()))) {
+    return publishEvent(channel->subtopic, data, length, channel->qos);
+  }
+  if (channel->qos != 0 || length < 0 || (size_t)length > channel->capacity ||
+      !this->mqttClient->connected()) {
+    return publishTopic(channel->topic, channel->topicLength, data, length,
+                        channel->retained, channel->qos);
+  }
+
+  // Only the fixed header and the payload change between publishes. The
+  // header is written right aligned against the stored topic.
+  unsigned char header[MQTT_FIXED_HEADER_MAX];
+  size_t remaining = 2 + channel->topicLength + length;
+  size_t headerLength = 1;
+  header[0] = MQTT_PUBLISH | (channel->retained ? MQTT_RETAIN : 0);
+  do {
+    unsigned char b = remaining & 0x7f;
+    remaining >>= 7;
+    header[headerLength++] = remaining > 0 ? b | 0x80 : b;
+  } while (remaining > 0);
+
+  unsigned char *start = channel->packet + MQTT_FIXED_HEADER_MAX - headerLength;
+  memcpy(start, header, headerLength);
+  memcpy(channel->packet + MQTT_FIXED_HEADER_MAX + 2 + channel->topicLength, data, length);
+  size_t total = headerLength + 2 + channel->topicLength + length;
+  return this->netClient->write(start, total) == total;
 }
 
 void CloudIoTCoreMqtt::logError() {
@@ -258,7 +944,7 @@ void CloudIoTCoreMqtt::logConfiguration(bool showJWT) {
       ":" + String(CLOUD_IOT_CORE_MQTT_PORT));
   Serial.println("ClientId: " + device->getClientId());
   if (showJWT) {
-    Serial.println("JWT: " + getJwt());
+    Serial.println("JWT: " + createJwt());
   }
 }
 
@@ -305,3 +991,48 @@ void CloudIoTCoreMqtt::setLogConnect(boolean enabled) {
 void CloudIoTCoreMqtt::setUseLts(boolean enabled) {
   this->useLts = enabled;
 }
+
+///////////////////////////////
+// Publish channels
+///////////////////////////////
+PublishChannel::PublishChannel(CloudIoTCoreMqtt *mqtt, const char *topic,
+                               const char *subtopic, int qos, bool retained,
+                               bool telemetry, size_t capacity) {
+  this->mqtt = mqtt;
+  this->qos = qos;
+  this->retained = retained;
+  this->telemetry = telemetry;
+  this->subtopic = subtopic;
+  this->topicLength = strlen(topic);
+  this->capacity = capacity;
+
+  // The topic is kept twice: encoded in the packet for the QoS 0 path and
+  // NUL terminated for MQTTClient.
+  size_t packetLength = MQTT_FIXED_HEADER_MAX + 2 + topicLength + capacity;
+  this->packet = NULL;
+  this->topic = NULL;
+  if (topicLength > 0xffff) {
+    return;
+  }
+  this->packet = (unsigned char *)malloc(packetLength + topicLength + 1);
+  if (this->packet == NULL) {
+    return;
+  }
+  this->packet[MQTT_FIXED_HEADER_MAX] = topicLength >> 8;
+  this->packet[MQTT_FIXED_HEADER_MAX + 1] = topicLength & 0xff;
+  memcpy(this->packet + MQTT_FIXED_HEADER_MAX + 2, topic, topicLength);
+  this->topic = (char *)this->packet + packetLength;
+  memcpy(this->topic, topic, topicLength + 1);
+}
+
+PublishChannel::~PublishChannel() {
+  free(this->packet);
+}
+
+bool PublishChannel::publish(const char* data, int length) {
+  return mqtt->publishChannel(this, data, length);
+}
+
+bool PublishChannel::publish(const String &data) {
+  return mqtt->publishChannel(this, data.c_str(), data.length());
+}
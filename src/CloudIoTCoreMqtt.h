@@ -16,11 +16,122 @@
 #define __CLOUDIOTCORE_MQTT_H__
 #include <Arduino.h>
 #include "CloudIoTCore.h"
+#include "CloudIoTCoreBatch.h"
 #include "CloudIoTCoreDevice.h"
+#include "CloudIoTCoreEnvelope.h"
+#include "CloudIoTCoreForward.h"
+#include "CloudIoTCoreJson.h"
+#include "CloudIoTCoreReceive.h"
+#include "CloudIoTCoreSession.h"
+#include "CloudIoTCoreWindow.h"
 #include <Client.h>
 #include <MQTTClient.h>
 
+class CloudIoTCoreMqtt;
+
+// Connection progress, advanced one step per CloudIoTCoreMqtt::loop():
+// IDLE -> SIGNING -> CONNECTING -> SUBSCRIBING -> ONLINE, and BACKOFF after
+// a failure until the retry time, then SIGNING again. A lost connection
+// goes from ONLINE back to SIGNING.
+enum ConnectionState {
+  CONNECTION_IDLE,        // not started, or mqttDisconnect()
+  CONNECTION_SIGNING,     // next step creates the JWT
+  CONNECTION_CONNECTING,  // next step opens the MQTT connection
+  CONNECTION_SUBSCRIBING, // next step subscribes to config and commands
+  CONNECTION_ONLINE,
+  CONNECTION_BACKOFF      // waiting for the retry time
+};
+
+typedef void (*ConnectionCallback)(CloudIoTCoreMqtt *mqtt, ConnectionState state);
+
+// Routed config or command message. subfolder is what follows commands/ in
+// the topic, "" for config and commands without one. data is length bytes;
+// both point into the MQTT client's buffer and are only valid during the
+// call.
+typedef void (*TopicHandler)(CloudIoTCoreMqtt *mqtt, const char *subfolder,
+                             const char *data, size_t length);
+
+// Most command routes per instance.
+#ifdef CONF_TOPIC_ROUTES
+#define TOPIC_ROUTES CONF_TOPIC_ROUTES
+#else
+#define TOPIC_ROUTES 8
+#endif
+
+struct TopicRoute {
+  const char *subfolder;    // NULL for any subfolder
+  size_t length;
+  uint32_t hash;
+  TopicHandler handler;
+};
+
+// Per-instance replacements for the getJwt(), messageReceived() and
+// messageReceivedAdvanced() functions a sketch defines, so that one program
+// can run many clients. Instances without them use the global functions.
+class JwtProvider {
+  public:
+    virtual ~JwtProvider() {}
+    virtual String getJwt() = 0;
+};
+
+class MessageHandler {
+  public:
+    virtual ~MessageHandler() {}
+    // topic is NUL terminated, bytes is length bytes; both are only valid
+    // during the call.
+    virtual void messageReceived(CloudIoTCoreMqtt *mqtt, char topic[], char bytes[],
+                                 int length) = 0;
+};
+
+// Supplies the payload of CloudIoTCoreMqtt::publishTelemetryStream() a
+// chunk at a time, from a file, a camera frame buffer or a ring buffer.
+class PublishReader {
+  public:
+    virtual ~PublishReader() {}
+    // Fills data with up to length bytes and returns how many, or 0 or
+    // less on failure.
+    virtual int read(char *data, size_t length) = 0;
+};
+
+// Buffer that streamed publishes send the packet through.
+#ifdef CONF_STREAM_CHUNK_SIZE
+#define STREAM_CHUNK_SIZE CONF_STREAM_CHUNK_SIZE
+#else
+#define STREAM_CHUNK_SIZE 2048
+#endif
+
+// A prepared publish target from CloudIoTCoreMqtt::openTelemetryChannel() or
+// openStateChannel(). The MQTT PUBLISH packet is kept encoded up to the
+// payload: QoS 0 publishes only fill in the fixed header and payload, and go
+// to the network client in a single write. QoS 1 publishes, payloads over
+// the capacity, and telemetry that is batched, encrypted or put in envelopes go
+// through the normal path with the stored topic.
+class PublishChannel {
+  friend class CloudIoTCoreMqtt;
+  private:
+    CloudIoTCoreMqtt *mqtt;
+    int qos;
+    bool retained;
+    bool telemetry;
+    const char *subtopic;  // telemetry only, points into topic
+    char *topic;           // NUL terminated
+    unsigned char *packet; // fixed header space, topic, payload space
+    size_t topicLength;
+    size_t capacity;       // payload bytes that fit in packet
+
+    PublishChannel(CloudIoTCoreMqtt *mqtt, const char *topic, const char *subtopic,
+                   int qos, bool retained, bool telemetry, size_t capacity);
+    PublishChannel(const PublishChannel &);
+    PublishChannel &operator=(const PublishChannel &);
+
+  public:
+    ~PublishChannel();
+    bool publish(const char* data, int length);
+    bool publish(const String &data);
+};
+
 class CloudIoTCoreMqtt {
+  friend class PublishChannel;
   private:
     int __backoff__ = 1000; // current backoff, milliseconds
     static const int __factor__ = 2.5f;
@@ -34,12 +145,89 @@ class CloudIoTCoreMqtt {
     Client *netClient;
     CloudIoTCoreDevice *device;
 
+    TelemetryEnvelope *envelope = NULL;
+    unsigned long envelopeWindow = 0; // ms, 0 to only flush full batches
+    unsigned long envelopeStart = 0;  // millis() of the batch's first message
+
+    CloudIoTCoreSession *session = NULL;
+
+    TelemetryBatch *batch = NULL;
+
+    ForwardLog *forward = NULL;
+
+    PublishWindow *window = NULL;
+
+    ReceiveStream *receiveStream = NULL;
+
+    JwtProvider *jwtProvider = NULL;
+    MessageHandler *messageHandler = NULL;
+    // instances with a message handler or routes, for dispatch()
+    CloudIoTCoreMqtt *nextHandled = NULL;
+    bool handled = false;
+    bool advancedCallback = false;
+
+    TopicHandler configHandler = NULL;
+    TopicRoute routes[TOPIC_ROUTES];
+    uint8_t routeCount = 0;
+
+    ConnectionState state = CONNECTION_IDLE;
+    ConnectionCallback connectionCallback = NULL;
+    unsigned long retryAt = 0; // millis() deadline in CONNECTION_BACKOFF
+    bool connectSkip = false;
+    String jwt;
+
+    String createJwt();
+    void startHandler();
+    static void dispatch(MQTTClient *client, char topic[], char bytes[], int length);
+    bool route(const char *topic, const char *data, size_t length);
+    void unrouted(char topic[], char bytes[], int length);
+
+    Client *wrapClient();
+    void advance();
+    void backoff(unsigned long delayMillis);
+    void setState(ConnectionState next);
+
+    bool publishEvent(const char *subtopic, const char* data, int length, int qos);
+    bool publishSegments(const char *subtopic, const PublishSegment *segments, size_t count,
+                         int qos);
+    bool publishUnbatched(const char *subtopic, const char* data, int length, int qos);
+    bool publishToEvents(const char *subtopic, const char* data, int length, int qos);
+    bool publishChannel(PublishChannel *channel, const char* data, int length);
+    bool publishTopic(const char *topic, size_t topicLength, const char* data, int length,
+                      bool retained, int qos);
+    bool publishEnvelope(const char *subtopic, const char* data, int length, int qos);
+
   public:
     CloudIoTCoreMqtt(MQTTClient *mqttClient, Client *netClient, CloudIoTCoreDevice *device);
+    ~CloudIoTCoreMqtt();
+
+    // Used instead of the global getJwt() when set.
+    void setJwtProvider(JwtProvider *provider);
+    // Used instead of the global messageReceived() and
+    // messageReceivedAdvanced() when set before startMQTT().
+    void setMessageHandler(MessageHandler *handler);
+
+    // Routes config and commands/<subfolder> messages to handlers without
+    // copying them. Set routes before startMQTT(); subfolder must outlive
+    // the instance, and NULL matches commands no other route does.
+    // Messages no route matches go to the MessageHandler or the global
+    // functions. onCommand() returns false when the table is full.
+    void onConfig(TopicHandler handler);
+    bool onCommand(const char *subfolder, TopicHandler handler);
 
+    // Keeps the connection up once started: call it often, it never waits
+    // out a backoff. Returns false while not connected.
     boolean loop();
+    // Connects and waits until online, or until a connection callback calls
+    // mqttDisconnect().
     void mqttConnect(bool skip = false);
+    // Starts connecting and returns at once; loop() does the rest.
     void mqttConnectAsync(bool skip = false);
+    // Disconnects and stops reconnecting.
+    void mqttDisconnect();
+    ConnectionState getConnectionState();
+    // Called on every state change.
+    void setConnectionCallback(ConnectionCallback callback);
     void startMQTT();
     void startMQTTAdvanced();
 
@@ -49,10 +237,60 @@ class CloudIoTCoreMqtt {
     bool publishTelemetry(const String &subtopic, const String &data);
     bool publishTelemetry(const String &subtopic, const String &data, int qos);
     bool publishTelemetry(const String &subtopic, const char* data, int length);
+    // Publishes what the writer holds; false if it did not all fit.
+    bool publishTelemetry(const JsonWriter &json, int qos = 0);
+    bool publishTelemetry(const String &subtopic, const JsonWriter &json, int qos = 0);
+    // The payload is the segments one after another, written into the
+    // MQTT packet without joining them first. qos must be 0 or 1.
+    bool publishTelemetry(const PublishSegment *segments, size_t count, int qos = 0);
+    bool publishTelemetry(const String &subtopic, const PublishSegment *segments,
+                          size_t count, int qos = 0);
+    // Publishes length bytes from the reader at QoS 0 through a
+    // STREAM_CHUNK_SIZE buffer, whatever the MQTTClient buffer size. If the
+    // reader fails partway the connection is closed, as the packet can not
+    // be finished, and loop() reconnects. Telemetry that is batched,
+    // encrypted, put in envelopes or logged offline is read whole first.
+    bool publishTelemetryStream(const String &subtopic, size_t length, PublishReader *reader);
     bool publishState(const String &data);
     bool publishState(const char* data);
     bool publishState(const char* data, int length);
 
+    // Prepared channels for repeated publishes to the same topic; delete
+    // them when done. capacity is the largest payload for the fast path.
+    // Returns NULL if out of memory.
+    PublishChannel *openTelemetryChannel(const String &subtopic, int qos = 0,
+                                         bool retained = false, size_t capacity = 256);
+    PublishChannel *openStateChannel(size_t capacity = 256);
+
+    // Telemetry is encrypted end to end for a backend key, see
+    // CloudIoTCoreSession.h. Pass NULL to publish in the clear.
+    void setSession(CloudIoTCoreSession *session);
+    // Telemetry is collected into batches and published in signed envelopes,
+    // see CloudIoTCoreEnvelope.h. A batch goes out when full, or from loop()
+    // windowMillis after its first message. Pass NULL to publish directly.
+    void setEnvelope(TelemetryEnvelope *envelope, unsigned long windowMillis = 0);
+    // Seals and publishes the current batch now.
+    bool flushEnvelope();
+    // Telemetry is queued and published in frames of samples, see
+    // CloudIoTCoreBatch.h. loop() publishes when the batch is due. Batches
+    // are encrypted and put in envelopes like single messages. Pass NULL to
+    // publish directly.
+    void setBatch(TelemetryBatch *batch);
+    // Publishes everything queued in the batch now.
+    bool flushBatch();
+    // Telemetry published while offline is appended to the log, see
+    // CloudIoTCoreForward.h, and replayed from loop() once online, at the
+    // log's rate. Call the log's begin() first. Pass NULL to drop it.
+    void setForwardLog(ForwardLog *log);
+    // QoS 1 telemetry is pipelined through the window, see
+    // CloudIoTCoreWindow.h, and publishTelemetry() returns false while the
+    // window is full. Set it before startMQTT().
+    void setPublishWindow(PublishWindow *window);
+    // Incoming messages are handed over in pieces as they arrive, see
+    // CloudIoTCoreReceive.h, so they need not fit in the MQTTClient buffer.
+    // Set it before startMQTT().
+    void setReceiveStream(ReceiveStream *stream);
+
     void logConfiguration(bool showJWT);
     void logError();
     void logReturnCode();
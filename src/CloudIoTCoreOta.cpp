@@ -0,0 +1,374 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreOta.h"
+
+#ifndef CONF_ECDSA_SIGN_ONLY
+
+#if defined(ESP8266)
+#include <Updater.h>
+#elif defined(ESP32)
+#include <Update.h>
+#include "esp_ota_ops.h"
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <stdio.h>
+#endif
+
+#if defined(ESP8266) || defined(ESP32)
+bool RunningFirmwareSource::read(unsigned long offset, unsigned char *data,
+                                 size_t len) {
+#if defined(ESP32)
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  return running != NULL &&
+         esp_partition_read(running, offset, data, len) == ESP_OK;
+#else
+  // The sketch starts at the beginning of flash.
+  return ESP.flashRead(offset, (uint32_t *)data, len);
+#endif
+}
+
+bool UpdateOtaWriter::begin(size_t size) {
+  return Update.begin(size);
+}
+
+bool UpdateOtaWriter::write(const unsigned char *data, size_t len) {
+  return Update.write((uint8_t *)data, len) == len;
+}
+
+bool UpdateOtaWriter::end() {
+  return Update.end();
+}
+
+void UpdateOtaWriter::abort() {
+#if defined(ESP32)
+  Update.abort();
+#else
+  // The image is one byte short, so end() discards it instead of scheduling
+  // it for boot.
+  Update.end();
+#endif
+}
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+FileOtaWriter::FileOtaWriter(const char *path) {
+  this->path = path;
+}
+
+FileOtaWriter::~FileOtaWriter() {
+  if (file != NULL) {
+    fclose((FILE *)file);
+  }
+}
+
+bool FileOtaWriter::begin(size_t) {
+  if (file != NULL) {
+    fclose((FILE *)file);
+  }
+  file = fopen(path, "wb");
+  return file != NULL;
+}
+
+bool FileOtaWriter::write(const unsigned char *data, size_t len) {
+  return fwrite(data, 1, len, (FILE *)file) == len;
+}
+
+bool FileOtaWriter::end() {
+  int ret = fclose((FILE *)file);
+  file = NULL;
+  return ret == 0;
+}
+
+void FileOtaWriter::abort() {
+  if (file != NULL) {
+    fclose((FILE *)file);
+    file = NULL;
+  }
+  remove(path);
+}
+
+FileOtaSource::FileOtaSource(const char *path) {
+  file = fopen(path, "rb");
+}
+
+FileOtaSource::~FileOtaSource() {
+  if (file != NULL) {
+    fclose((FILE *)file);
+  }
+}
+
+bool FileOtaSource::read(unsigned long offset, unsigned char *data,
+                         size_t len) {
+  if (file == NULL || fseek((FILE *)file, offset, SEEK_SET) != 0) {
+    return false;
+  }
+  size_t n = fread(data, 1, len, (FILE *)file);
+  memset(data + n, 0, len - n);
+  return true;
+}
+#endif
+
+// Record parts of a delta patch, in order
+#define RECORD_COPY_LENGTH 0
+#define RECORD_EXTRA_LENGTH 1
+#define RECORD_SEEK 2
+#define RECORD_COPY 3
+#define RECORD_EXTRA 4
+
+CloudIoTCoreOta::CloudIoTCoreOta(OtaWriter *writer,
+                                 const unsigned char *public_key)
+    : CloudIoTCoreOta(writer, public_key, NULL) {}
+
+CloudIoTCoreOta::CloudIoTCoreOta(OtaWriter *writer,
+                                 const unsigned char *public_key,
+                                 OtaSource *source) {
+  this->writer = writer;
+  this->source = source;
+  NN_Decode(this->public_key.x, NUMWORDS, (unsigned char *)public_key,
+            OTA_SIGNATURE_LENGTH / 2);
+  NN_Decode(this->public_key.y, NUMWORDS,
+            (unsigned char *)public_key + OTA_SIGNATURE_LENGTH / 2,
+            OTA_SIGNATURE_LENGTH / 2);
+}
+
+void CloudIoTCoreOta::fail() {
+  if (begun) {
+    writer->abort();
+    begun = false;
+  }
+  status = OTA_FAILED;
+}
+
+void CloudIoTCoreOta::finish() {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+
+  sha.final(digest);
+  NN_Decode(r, NUMWORDS, signature, OTA_SIGNATURE_LENGTH / 2);
+  NN_Decode(s, NUMWORDS, signature + OTA_SIGNATURE_LENGTH / 2,
+            OTA_SIGNATURE_LENGTH / 2);
+
+  ecc_init();
+  ecdsa_init(&public_key);
+  if (ecdsa_verify(digest, r, s, &public_key) != 1) {
+    fail();
+    return;
+  }
+  // Only now does the writer get the complete image.
+  if (!writer->write(&last_byte, 1) || !writer->end()) {
+    fail();
+    return;
+  }
+  begun = false;
+  status = OTA_VERIFIED;
+}
+
+// Hashes and writes len bytes of new firmware, holding back the last one.
+size_t CloudIoTCoreOta::emit(const unsigned char *data, size_t len) {
+  sha.update(data, len);
+  written += len;
+  if (written == firmware_length) {
+    last_byte = data[len - 1];
+    len--;
+  }
+  if (len > 0 && !writer->write(data, len)) {
+    fail();
+  }
+  return len;
+}
+
+// Returns up to *len bytes of old firmware at old_pos, reading them into the
+// window first if needed; *len is set to the number of bytes available.
+const unsigned char *CloudIoTCoreOta::oldBytes(size_t *len) {
+  if (!window_valid || old_pos < window_start ||
+      old_pos >= window_start + OTA_DELTA_WINDOW) {
+    window_start = old_pos & ~(unsigned long)3;
+    window_valid = source->read(window_start, (unsigned char *)window,
+                                OTA_DELTA_WINDOW);
+    if (!window_valid) {
+      return NULL;
+    }
+  }
+  size_t offset = old_pos - window_start;
+  if (*len > OTA_DELTA_WINDOW - offset) {
+    *len = OTA_DELTA_WINDOW - offset;
+  }
+  return (unsigned char *)window + offset;
+}
+
+// Applies up to len bytes of patch, returns how many were consumed. Copies
+// from the old firmware are made even when len is 0.
+size_t CloudIoTCoreOta::patch(const unsigned char *data, size_t len) {
+  size_t used = 0;
+
+  while (status == OTA_RECEIVING && written < firmware_length) {
+    if (record_state <= RECORD_SEEK) {
+      if (used == len) {
+        break;
+      }
+      unsigned char b = data[used++];
+      if (varint_shift > 28) {
+        fail();
+        break;
+      }
+      varint |= (unsigned long)(b & 0x7f) << varint_shift;
+      varint_shift += 7;
+      if (b & 0x80) {
+        continue;
+      }
+      if (record_state == RECORD_COPY_LENGTH) {
+        copy_left = varint;
+      } else if (record_state == RECORD_EXTRA_LENGTH) {
+        extra_left = varint;
+      } else {
+        seek = (long)(varint >> 1) ^ -(long)(varint & 1);
+      }
+      varint = 0;
+      varint_shift = 0;
+      record_state++;
+      if (record_state == RECORD_COPY &&
+          (copy_left > firmware_length - written ||
+           extra_left > firmware_length - written - copy_left)) {
+        fail();
+      }
+    } else if (record_state == RECORD_COPY && copy_left > 0) {
+      size_t n = copy_left;
+      const unsigned char *old = oldBytes(&n);
+      if (old == NULL) {
+        fail();
+        break;
+      }
+      emit(old, n);
+      old_pos += n;
+      copy_left -= n;
+    } else if (record_state == RECORD_EXTRA && extra_left > 0) {
+      if (used == len) {
+        break;
+      }
+      size_t n = len - used;
+      if (n > extra_left) n = extra_left;
+      emit(data + used, n);
+      used += n;
+      extra_left -= n;
+    } else if (record_state == RECORD_COPY) {
+      record_state = RECORD_EXTRA;
+    } else {
+      if (seek < 0 && (unsigned long)-seek > old_pos) {
+        fail();
+        break;
+      }
+      old_pos += seek;
+      record_state = RECORD_COPY_LENGTH;
+    }
+  }
+  return used;
+}
+
+OtaStatus CloudIoTCoreOta::write(const unsigned char *chunk, size_t len) {
+  if (status == OTA_VERIFIED || status == OTA_FAILED) {
+    return status;
+  }
+  status = OTA_RECEIVING;
+
+  while (len > 0 && status == OTA_RECEIVING) {
+    size_t n;
+    if (received < OTA_HEADER_LENGTH) {
+      header[received] = *chunk;
+      n = 1;
+      if (received + 1 == OTA_HEADER_LENGTH) {
+        firmware_length = ((unsigned long)header[4] << 24) |
+                          ((unsigned long)header[5] << 16) |
+                          ((unsigned long)header[6] << 8) | header[7];
+        delta = memcmp(header, OTA_DELTA_MAGIC, 4) == 0;
+        if ((memcmp(header, OTA_MAGIC, 4) != 0 && !delta) ||
+            (delta && source == NULL) || firmware_length == 0 ||
+            !writer->begin(firmware_length)) {
+          fail();
+        } else {
+          begun = true;
+        }
+      }
+    } else if (written < firmware_length) {
+      if (delta) {
+        n = patch(chunk, len);
+      } else {
+        n = firmware_length - written;
+        n = len < n ? len : n;
+        emit(chunk, n);
+      }
+    } else {
+      n = OTA_SIGNATURE_LENGTH - signature_received;
+      n = len < n ? len : n;
+      memcpy(signature + signature_received, chunk, n);
+      signature_received += n;
+      if (signature_received == OTA_SIGNATURE_LENGTH) {
+        finish();
+      }
+    }
+    received += n;
+    chunk += n;
+    len -= n;
+  }
+  return status;
+}
+
+OtaStatus CloudIoTCoreOta::write(const char *chunk, int len) {
+  return write((const unsigned char *)chunk, (size_t)len);
+}
+
+void CloudIoTCoreOta::reset() {
+  if (begun) {
+    writer->abort();
+    begun = false;
+  }
+  sha = Sha256();
+  status = OTA_IDLE;
+  received = 0;
+  firmware_length = 0;
+  written = 0;
+  signature_received = 0;
+  delta = false;
+  record_state = RECORD_COPY_LENGTH;
+  varint = 0;
+  varint_shift = 0;
+  copy_left = 0;
+  extra_left = 0;
+  seek = 0;
+  old_pos = 0;
+  window_valid = false;
+}
+
+OtaStatus CloudIoTCoreOta::getStatus() {
+  return status;
+}
+
+unsigned long CloudIoTCoreOta::getReceived() {
+  return received;
+}
+
+unsigned long CloudIoTCoreOta::getFirmwareLength() {
+  if (received < OTA_HEADER_LENGTH) {
+    return 0;
+  }
+  return firmware_length;
+}
+
+unsigned long CloudIoTCoreOta::getWritten() {
+  return written;
+}
+
+#endif /* CONF_ECDSA_SIGN_ONLY */
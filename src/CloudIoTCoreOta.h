@@ -0,0 +1,197 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_OTA_H__
+#define __CLOUDIOTCORE_OTA_H__
+
+#include <Arduino.h>
+#include "crypto/ecdsa.h"
+#include "crypto/sha256.h"
+
+#ifndef CONF_ECDSA_SIGN_ONLY
+
+// Signed firmware images are sent as a series of command messages, e.g. on
+// the "ota" subfolder of the commands topic. Concatenated, the messages
+// contain:
+//
+//   "OTA1"                     4 byte magic
+//   firmware length            4 bytes, big endian
+//   firmware                   firmware length bytes
+//   ECDSA P-256 signature      64 bytes, r || s, of SHA-256(firmware)
+//
+// Messages may be split anywhere, the receiver does not need the whole image
+// in RAM.
+//
+// Delta images start with "OTD1" instead, and firmware length and signature
+// are those of the new firmware. In place of the firmware comes a patch
+// against the running firmware. The patch is a series of records:
+//
+//   copy length                LEB128 varint
+//   extra length               LEB128 varint
+//   seek                       LEB128 varint, zigzag encoded
+//   extra bytes                extra length bytes
+//
+// Each record outputs copy length bytes of the old firmware, starting at the
+// current old position, followed by the extra bytes. The old position then
+// moves on by copy length plus seek. The patch ends once it has produced
+// firmware length bytes. ota_image.py in the repository root builds both
+// kinds of image.
+#define OTA_MAGIC "OTA1"
+#define OTA_DELTA_MAGIC "OTD1"
+#define OTA_HEADER_LENGTH 8
+#define OTA_SIGNATURE_LENGTH 64
+
+// Bytes of the old firmware cached while applying a delta, a multiple of 4.
+#ifndef OTA_DELTA_WINDOW
+#define OTA_DELTA_WINDOW 256
+#endif
+
+// Destination of the firmware bytes. end() is only called once the
+// signature has been checked; until then the last firmware byte is held back
+// so a writer never sees a complete image that did not verify.
+class OtaWriter {
+  public:
+    virtual ~OtaWriter() {}
+    virtual bool begin(size_t size) = 0;
+    virtual bool write(const unsigned char *data, size_t len) = 0;
+    // The image verified: make it the one to boot.
+    virtual bool end() = 0;
+    // The image failed verification or the transfer was abandoned.
+    virtual void abort() = 0;
+};
+
+// Old firmware that delta images are applied to. read() is called with
+// offset and len multiples of 4; bytes past the end of the old firmware may
+// be anything.
+class OtaSource {
+  public:
+    virtual ~OtaSource() {}
+    virtual bool read(unsigned long offset, unsigned char *data, size_t len) = 0;
+};
+
+#if defined(ESP8266) || defined(ESP32)
+// Reads the firmware that is currently running.
+class RunningFirmwareSource : public OtaSource {
+  public:
+    bool read(unsigned long offset, unsigned char *data, size_t len);
+};
+
+// Writes to the OTA update partition through the core's Update object.
+class UpdateOtaWriter : public OtaWriter {
+  public:
+    bool begin(size_t size);
+    bool write(const unsigned char *data, size_t len);
+    bool end();
+    void abort();
+};
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+// Writes the image to a file on hosts; the file is removed on abort().
+class FileOtaWriter : public OtaWriter {
+  public:
+    FileOtaWriter(const char *path);
+    ~FileOtaWriter();
+    bool begin(size_t size);
+    bool write(const unsigned char *data, size_t len);
+    bool end();
+    void abort();
+  private:
+    const char *path;
+    void *file = NULL;
+};
+
+// Reads old firmware from a file on hosts.
+class FileOtaSource : public OtaSource {
+  public:
+    FileOtaSource(const char *path);
+    ~FileOtaSource();
+    bool read(unsigned long offset, unsigned char *data, size_t len);
+  private:
+    void *file;
+};
+#endif
+
+enum OtaStatus {
+  OTA_IDLE,       // nothing received yet
+  OTA_RECEIVING,  // image in progress
+  OTA_VERIFIED,   // signature valid, image committed
+  OTA_FAILED      // bad header, write error or invalid signature
+};
+
+class CloudIoTCoreOta {
+  private:
+    OtaWriter *writer;
+    OtaSource *source;
+    point_t public_key;
+    Sha256 sha;
+    OtaStatus status = OTA_IDLE;
+    bool begun = false; // writer->begin() succeeded, end() not yet called
+    unsigned long received = 0;
+    unsigned long firmware_length = 0;
+    unsigned long written = 0;
+    unsigned char header[OTA_HEADER_LENGTH];
+    unsigned char signature[OTA_SIGNATURE_LENGTH];
+    unsigned char signature_received = 0;
+    unsigned char last_byte;
+
+    // delta patch state
+    bool delta = false;
+    unsigned char record_state = 0;
+    unsigned long varint = 0;
+    unsigned char varint_shift = 0;
+    unsigned long copy_left = 0;
+    unsigned long extra_left = 0;
+    long seek = 0;
+    unsigned long old_pos = 0;
+    unsigned long window_start = 0;
+    bool window_valid = false;
+    uint32_t window[OTA_DELTA_WINDOW / 4];
+
+    void fail();
+    void finish();
+    size_t emit(const unsigned char *data, size_t len);
+    size_t patch(const unsigned char *data, size_t len);
+    const unsigned char *oldBytes(size_t *len);
+
+  public:
+    // public_key is the 64 byte uncompressed P-256 key, x || y big endian,
+    // whose private key signs the firmware. Delta images need a source for
+    // the old firmware and fail without one.
+    CloudIoTCoreOta(OtaWriter *writer, const unsigned char *public_key);
+    CloudIoTCoreOta(OtaWriter *writer, const unsigned char *public_key,
+                    OtaSource *source);
+
+    // Feeds the next part of the image, e.g. the payload passed to
+    // messageReceivedAdvanced(). The signature is checked as soon as its last
+    // byte arrives. Returns the status after this chunk.
+    OtaStatus write(const unsigned char *chunk, size_t len);
+    OtaStatus write(const char *chunk, int len);
+
+    // Abandons the current image, if any, and waits for a new one.
+    void reset();
+
+    OtaStatus getStatus();
+    // Bytes received so far, including header and signature.
+    unsigned long getReceived();
+    // Length of the new firmware, 0 until the header has arrived.
+    unsigned long getFirmwareLength();
+    // Firmware bytes produced so far.
+    unsigned long getWritten();
+};
+
+#endif /* CONF_ECDSA_SIGN_ONLY */
+
+#endif // __CLOUDIOTCORE_OTA_H__
@@ -0,0 +1,348 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreReceive.h"
+
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_QOS_MASK 0x06
+#define MQTT_QOS1 0x02
+
+// Parser states for incoming packets
+#define PARSE_TYPE 0
+#define PARSE_LENGTH 1
+#define PARSE_PASS 2          // a packet for MQTTClient
+#define PARSE_TOPIC_LENGTH 3  // the rest are a streamed PUBLISH
+#define PARSE_TOPIC 4
+#define PARSE_ID 5
+#define PARSE_PAYLOAD 6
+#define PARSE_SKIP 7
+
+///////////////////////////////
+// Pass-through client
+///////////////////////////////
+ReceiveStreamClient::ReceiveStreamClient(ReceiveStream *stream) {
+  this->stream = stream;
+}
+
+int ReceiveStreamClient::connect(IPAddress ip, uint16_t port) {
+  stream->reset();
+  return net->connect(ip, port);
+}
+
+int ReceiveStreamClient::connect(const char *host, uint16_t port) {
+  stream->reset();
+  return net->connect(host, port);
+}
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+int ReceiveStreamClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  stream->reset();
+  return net->connect(ip, port, timeout);
+}
+
+int ReceiveStreamClient::connect(const char *host, uint16_t port, int32_t timeout) {
+  stream->reset();
+  return net->connect(host, port, timeout);
+}
+#endif
+
+size_t ReceiveStreamClient::write(uint8_t b) {
+  return net->write(b);
+}
+
+size_t ReceiveStreamClient::write(const uint8_t *buf, size_t size) {
+  return net->write(buf, size);
+}
+
+int ReceiveStreamClient::available() {
+  stream->pump();
+  return stream->pass_end - stream->pass_start;
+}
+
+int ReceiveStreamClient::read() {
+  if (stream->pass_start == stream->pass_end) {
+    stream->pump();
+    if (stream->pass_start == stream->pass_end) {
+      return -1;
+    }
+  }
+  return stream->pass[stream->pass_start++];
+}
+
+int ReceiveStreamClient::read(uint8_t *buf, size_t size) {
+  if (stream->pass_start == stream->pass_end) {
+    stream->pump();
+    if (stream->pass_start == stream->pass_end) {
+      return -1;
+    }
+  }
+  size_t n = stream->pass_end - stream->pass_start;
+  if (n > size) {
+    n = size;
+  }
+  memcpy(buf, stream->pass + stream->pass_start, n);
+  stream->pass_start += n;
+  return n;
+}
+
+int ReceiveStreamClient::peek() {
+  if (stream->pass_start == stream->pass_end) {
+    stream->pump();
+    if (stream->pass_start == stream->pass_end) {
+      return -1;
+    }
+  }
+  return stream->pass[stream->pass_start];
+}
+
+void ReceiveStreamClient::flush() {
+  net->flush();
+}
+
+void ReceiveStreamClient::stop() {
+  stream->reset();
+  net->stop();
+}
+
+#if defined(ESP8266)
+bool ReceiveStreamClient::flush(unsigned int maxWaitMs) {
+  return net->flush(maxWaitMs);
+}
+
+bool ReceiveStreamClient::stop(unsigned int maxWaitMs) {
+  stream->reset();
+  return net->stop(maxWaitMs);
+}
+#endif
+
+uint8_t ReceiveStreamClient::connected() {
+  return net->connected();
+}
+
+ReceiveStreamClient::operator bool() {
+  return (bool)*net;
+}
+
+///////////////////////////////
+// Stream
+///////////////////////////////
+ReceiveStream::ReceiveStream(ReceiveHandler *handler, size_t streamAbove)
+    : client(this) {
+  this->handler = handler;
+  this->streamAbove = streamAbove;
+}
+
+Client *ReceiveStream::wrap(Client *net) {
+  client.net = net;
+  return &client;
+}
+
+void ReceiveStream::reset() {
+  if (streaming) {
+    streaming = false;
+    handler->end(false);
+  }
+  state = PARSE_TYPE;
+  pass_start = 0;
+  pass_end = 0;
+}
+
+// Reads what the network client has, as far as there is room for what may
+// have to be held for MQTTClient.
+void ReceiveStream::pump() {
+  if (client.net == NULL) {
+    return;
+  }
+  if (pass_start > 0) {
+    memmove(pass, pass + pass_start, pass_end - pass_start);
+    pass_end -= pass_start;
+    pass_start = 0;
+  }
+  while (client.net->available() > 0) {
+    size_t limit = RECEIVE_CHUNK_SIZE;
+    if (state == PARSE_TYPE || state == PARSE_LENGTH || state == PARSE_PASS) {
+      // A fixed header read earlier is held until its length is complete.
+      size_t held = state == PARSE_LENGTH ? header_length : 0;
+      size_t room = RECEIVE_PASS_SIZE - pass_end;
+      room = room > held ? room - held : 0;
+      if (limit > room) {
+        limit = room;
+      }
+    } else if (limit > remaining) {
+      // Only this packet: the next may be for MQTTClient.
+      limit = remaining;
+    }
+    if (limit == 0) {
+      break;
+    }
+    int n = client.net->read(in, limit);
+    if (n <= 0) {
+      break;
+    }
+    parse(in, n);
+  }
+}
+
+void ReceiveStream::topicDone() {
+  topic[topic_length] = '\0';
+  id = 0;
+  id_pos = 0;
+  if (header[0] & MQTT_QOS_MASK) {
+    state = PARSE_ID;
+  } else {
+    beginPayload();
+  }
+}
+
+void ReceiveStream::beginPayload() {
+  streaming = true;
+  state = PARSE_PAYLOAD;
+  handler->begin(topic, remaining);
+  if (remaining == 0) {
+    endPayload();
+  }
+}
+
+// Hands over the end of the message, then acknowledges it.
+void ReceiveStream::endPayload() {
+  streaming = false;
+  state = PARSE_TYPE;
+  handler->end(true);
+  if ((header[0] & MQTT_QOS_MASK) == MQTT_QOS1) {
+    unsigned char ack[4] = {MQTT_PUBACK, 2, (unsigned char)(id >> 8),
+                            (unsigned char)(id & 0xff)};
+    client.net->write(ack, sizeof(ack));
+  }
+}
+
+void ReceiveStream::parse(const unsigned char *data, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    size_t n;
+    switch (state) {
+      case PARSE_TYPE:
+        header[0] = data[i++];
+        header_length = 1;
+        remaining = 0;
+        shift = 0;
+        state = PARSE_LENGTH;
+        break;
+
+      case PARSE_LENGTH:
+        header[header_length++] = data[i];
+        remaining |= (unsigned long)(data[i] & 0x7f) << shift;
+        shift += 7;
+        if (data[i++] & 0x80) {
+          if (header_length == sizeof(header)) {
+            // Not MQTT; nothing after this can be trusted.
+            reset();
+            client.net->stop();
+            return;
+          }
+          break;
+        }
+        if ((header[0] & 0xf0) != MQTT_PUBLISH || remaining <= streamAbove) {
+          memcpy(pass + pass_end, header, header_length);
+          pass_end += header_length;
+          state = remaining > 0 ? PARSE_PASS : PARSE_TYPE;
+        } else if (remaining < 2) {
+          dropped++;
+          state = remaining > 0 ? PARSE_SKIP : PARSE_TYPE;
+        } else {
+          topic_length = 0;
+          topic_pos = 0;
+          state = PARSE_TOPIC_LENGTH;
+        }
+        break;
+
+      case PARSE_PASS:
+        n = len - i < remaining ? len - i : remaining;
+        memcpy(pass + pass_end, data + i, n);
+        pass_end += n;
+        i += n;
+        remaining -= n;
+        if (remaining == 0) {
+          state = PARSE_TYPE;
+        }
+        break;
+
+      case PARSE_TOPIC_LENGTH:
+        topic_length = (topic_length << 8) | data[i++];
+        remaining--;
+        if (++topic_pos < 2) {
+          break;
+        }
+        topic_pos = 0;
+        if (topic_length >= RECEIVE_TOPIC_SIZE ||
+            (unsigned long)topic_length + (header[0] & MQTT_QOS_MASK ? 2 : 0) >
+                remaining) {
+          dropped++;
+          state = remaining > 0 ? PARSE_SKIP : PARSE_TYPE;
+        } else {
+          state = PARSE_TOPIC;
+          if (topic_length == 0) {
+            topicDone();
+          }
+        }
+        break;
+
+      case PARSE_TOPIC:
+        n = topic_length - topic_pos;
+        if (n > len - i) {
+          n = len - i;
+        }
+        memcpy(topic + topic_pos, data + i, n);
+        topic_pos += n;
+        i += n;
+        remaining -= n;
+        if (topic_pos == topic_length) {
+          topicDone();
+        }
+        break;
+
+      case PARSE_ID:
+        id = (id << 8) | data[i++];
+        remaining--;
+        if (++id_pos == 2) {
+          beginPayload();
+        }
+        break;
+
+      case PARSE_PAYLOAD:
+        n = len - i < remaining ? len - i : remaining;
+        handler->chunk((const char *)data + i, n);
+        i += n;
+        remaining -= n;
+        if (remaining == 0) {
+          endPayload();
+        }
+        break;
+
+      case PARSE_SKIP:
+        n = len - i < remaining ? len - i : remaining;
+        i += n;
+        remaining -= n;
+        if (remaining == 0) {
+          state = PARSE_TYPE;
+        }
+        break;
+    }
+  }
+}
+
+uint32_t ReceiveStream::droppedCount() {
+  return dropped;
+}
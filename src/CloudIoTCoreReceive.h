@@ -0,0 +1,144 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_RECEIVE_H__
+#define __CLOUDIOTCORE_RECEIVE_H__
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Streaming receive: MQTTClient reads every incoming packet whole into its
+// buffer and drops the connection when one does not fit, so a device that
+// may get a 64 KB config needs a 64 KB buffer. A ReceiveStream sits between
+// MQTTClient and the network client, like a PublishWindow, and takes PUBLISH
+// packets out of the stream before MQTTClient sees them. Their payload goes
+// to a ReceiveHandler in pieces as it arrives, at most RECEIVE_CHUNK_SIZE
+// bytes each, and QoS 1 messages are acknowledged once the whole payload
+// has been handed over. Everything else passes through.
+
+// Largest piece of payload handed over at once; also the most read from the
+// network client at a time.
+#ifdef CONF_RECEIVE_CHUNK_SIZE
+#define RECEIVE_CHUNK_SIZE CONF_RECEIVE_CHUNK_SIZE
+#else
+#define RECEIVE_CHUNK_SIZE 256
+#endif
+
+// Longest topic; messages to longer topics are dropped.
+#ifdef CONF_RECEIVE_TOPIC_SIZE
+#define RECEIVE_TOPIC_SIZE CONF_RECEIVE_TOPIC_SIZE
+#else
+#define RECEIVE_TOPIC_SIZE 192
+#endif
+
+// Bytes of other packets held for MQTTClient to read.
+#define RECEIVE_PASS_SIZE 64
+
+class ReceiveStream;
+
+// Gets each streamed message as begin(), any number of chunk()s and end().
+class ReceiveHandler {
+  public:
+    virtual ~ReceiveHandler() {}
+    // topic is NUL terminated; length is the whole payload.
+    virtual void begin(const char *topic, size_t length) = 0;
+    // The next length bytes of payload, only valid during the call.
+    virtual void chunk(const char *data, size_t length) = 0;
+    // complete is false when the connection closed partway.
+    virtual void end(bool complete) = 0;
+};
+
+// Forwards to the network client, keeping streamed messages from the reader.
+class ReceiveStreamClient : public Client {
+  friend class ReceiveStream;
+  private:
+    ReceiveStream *stream;
+    Client *net = NULL;
+
+  public:
+    ReceiveStreamClient(ReceiveStream *stream);
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+    int connect(IPAddress ip, uint16_t port, int32_t timeout);
+    int connect(const char *host, uint16_t port, int32_t timeout);
+#endif
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush();
+    void stop();
+#if defined(ESP8266)
+    bool flush(unsigned int maxWaitMs);
+    bool stop(unsigned int maxWaitMs);
+#endif
+    uint8_t connected();
+    operator bool();
+};
+
+class ReceiveStream {
+  friend class ReceiveStreamClient;
+  private:
+    ReceiveStreamClient client;
+    ReceiveHandler *handler;
+    size_t streamAbove;
+
+    // incoming packet parser
+    unsigned char state = 0;
+    unsigned char header[5];
+    unsigned char header_length = 0;
+    unsigned char shift = 0;
+    unsigned long remaining = 0;
+    uint16_t topic_length = 0;
+    uint16_t topic_pos = 0;
+    uint16_t id = 0;
+    unsigned char id_pos = 0;
+    bool streaming = false; // between begin() and end()
+    char topic[RECEIVE_TOPIC_SIZE];
+    uint32_t dropped = 0;
+
+    unsigned char in[RECEIVE_CHUNK_SIZE];
+    // other packets, for MQTTClient
+    unsigned char pass[RECEIVE_PASS_SIZE];
+    uint8_t pass_start = 0;
+    uint8_t pass_end = 0;
+
+    void pump();
+    void parse(const unsigned char *data, size_t len);
+    void topicDone();
+    void beginPayload();
+    void endPayload();
+    void reset();
+
+  public:
+    // PUBLISH packets with more than streamAbove bytes after the fixed
+    // header are streamed; smaller ones still go to MQTTClient and its
+    // callbacks. 0 streams all of them.
+    ReceiveStream(ReceiveHandler *handler, size_t streamAbove = 0);
+
+    // The client to give MQTTClient in place of the network client;
+    // CloudIoTCoreMqtt::startMQTT() does this when it has a stream.
+    Client *wrap(Client *net);
+
+    // Messages dropped for a topic over RECEIVE_TOPIC_SIZE or a malformed
+    // packet.
+    uint32_t droppedCount();
+};
+
+#endif // __CLOUDIOTCORE_RECEIVE_H__
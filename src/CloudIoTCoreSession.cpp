@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreSession.h"
+#include "crypto/hmac_sha256.h"
+#include "crypto/prng.h"
+
+#define SESSION_POINT_LENGTH 64
+
+CloudIoTCoreSession::CloudIoTCoreSession(const unsigned char *backend_key,
+                                         unsigned long rotate_millis) {
+  NN_Decode(this->backend_key.x, NUMWORDS, (unsigned char *)backend_key,
+            SESSION_POINT_LENGTH / 2);
+  NN_Decode(this->backend_key.y, NUMWORDS,
+            (unsigned char *)backend_key + SESSION_POINT_LENGTH / 2,
+            SESSION_POINT_LENGTH / 2);
+  this->rotate_millis = rotate_millis;
+}
+
+CloudIoTCoreSession::~CloudIoTCoreSession() {
+  memset(key, 0, sizeof(key));
+}
+
+bool CloudIoTCoreSession::needsRotation() {
+  // The counter will not run out in practice, but the nonce must not repeat.
+  return !active || millis() - started >= rotate_millis ||
+         counter == (uint64_t)-1;
+}
+
+void CloudIoTCoreSession::rotate() {
+  NN_DIGIT ephemeral[NUMWORDS];
+  point_t public_key, shared;
+  unsigned char secret[SESSION_POINT_LENGTH / 2];
+
+  ecc_gen_private_key(ephemeral);
+  ecc_gen_pub_key(ephemeral, &public_key);
+  ecc_mul(&shared, &backend_key, ephemeral);
+
+  announcement[0] = SESSION_VERSION;
+  prng(announcement + 1, 4);
+  NN_Encode(announcement + 5, SESSION_POINT_LENGTH / 2, public_key.x,
+            KEYDIGITS);
+  NN_Encode(announcement + 5 + SESSION_POINT_LENGTH / 2,
+            SESSION_POINT_LENGTH / 2, public_key.y, KEYDIGITS);
+  NN_Encode(secret, sizeof(secret), shared.x, KEYDIGITS);
+
+  hkdf_sha256(announcement + 5, SESSION_POINT_LENGTH, secret, sizeof(secret),
+              (const unsigned char *)SESSION_HKDF_INFO,
+              sizeof(SESSION_HKDF_INFO) - 1, key, sizeof(key));
+
+  // Only the derived key is kept.
+  memset(ephemeral, 0, sizeof(ephemeral));
+  memset(&shared, 0, sizeof(shared));
+  memset(secret, 0, sizeof(secret));
+
+  counter = 0;
+  started = millis();
+  active = true;
+}
+
+void CloudIoTCoreSession::expire() {
+  active = false;
+}
+
+const char *CloudIoTCoreSession::getAnnouncement(size_t *length) {
+  *length = SESSION_ANNOUNCEMENT_LENGTH;
+  return (const char *)announcement;
+}
+
+const char *CloudIoTCoreSession::encrypt(const char *data, size_t length,
+                                         size_t *out_length) {
+  if (length > SESSION_BUFFER_SIZE - SESSION_OVERHEAD) {
+    return NULL;
+  }
+
+  // header = version || session id || counter, and the nonce is its tail
+  buffer[0] = SESSION_VERSION;
+  memcpy(buffer + 1, announcement + 1, 4);
+  for (int i = 0; i < 8; i++) {
+    buffer[5 + i] = counter >> (56 - 8 * i);
+  }
+  counter++;
+
+  chacha20_poly1305_encrypt(key, buffer + 1, buffer, SESSION_HEADER_LENGTH,
+                            (const unsigned char *)data, length,
+                            buffer + SESSION_HEADER_LENGTH,
+                            buffer + SESSION_HEADER_LENGTH + length);
+  *out_length = length + SESSION_OVERHEAD;
+  return (const char *)buffer;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_SESSION_H__
+#define __CLOUDIOTCORE_SESSION_H__
+
+#include <Arduino.h>
+#include "crypto/chacha20_poly1305.h"
+#include "crypto/ecc.h"
+
+// End to end encrypted telemetry for a backend P-256 key. A session starts
+// with an ephemeral key pair: ECDH with the backend key gives a shared
+// secret, and HKDF-SHA256 turns it into a ChaCha20-Poly1305 key that is
+// used until the next rotation. The device announces each session once, on
+// the events topic subfolder SESSION_SUBFOLDER:
+//
+//   version                    1 byte, 1
+//   session id                 4 bytes
+//   ephemeral public key       64 bytes, x || y big endian
+//
+// The backend derives the same key as
+// HKDF-SHA256(salt = ephemeral public key, ikm = x of the shared point,
+// info = SESSION_HKDF_INFO, 32 bytes). Each encrypted message is:
+//
+//   version                    1 byte, 1
+//   session id                 4 bytes
+//   counter                    8 bytes, big endian
+//   ciphertext
+//   tag                        16 bytes
+//
+// with nonce = session id || counter and the first 13 bytes as associated
+// data.
+
+#ifndef SESSION_SUBFOLDER
+#define SESSION_SUBFOLDER "/session-keys"
+#endif
+
+#define SESSION_HKDF_INFO "cloud-iot-core session v1"
+
+// Largest encrypted message, overhead included.
+#ifdef CONF_SESSION_BUFFER_SIZE
+#define SESSION_BUFFER_SIZE CONF_SESSION_BUFFER_SIZE
+#else
+#define SESSION_BUFFER_SIZE 1024
+#endif
+
+#define SESSION_VERSION 1
+#define SESSION_HEADER_LENGTH 13
+#define SESSION_OVERHEAD (SESSION_HEADER_LENGTH + POLY1305_TAG_LENGTH)
+#define SESSION_ANNOUNCEMENT_LENGTH 69
+
+class CloudIoTCoreSession {
+  private:
+    point_t backend_key;
+    unsigned long rotate_millis;
+    unsigned long started = 0;
+    bool active = false;
+    uint64_t counter = 0;
+    unsigned char key[CHACHA20_KEY_LENGTH];
+    unsigned char announcement[SESSION_ANNOUNCEMENT_LENGTH];
+    unsigned char buffer[SESSION_BUFFER_SIZE];
+
+  public:
+    // backend_key is the backend's 64 byte uncompressed P-256 public key,
+    // x || y big endian. A new session key is made every rotate_millis.
+    CloudIoTCoreSession(const unsigned char *backend_key,
+                        unsigned long rotate_millis);
+    ~CloudIoTCoreSession();
+
+    // True before the first message and once the session is due to rotate.
+    bool needsRotation();
+    // Starts a new session: one ECDH, which costs about as much as signing
+    // a JWT. ecc_init() must have been called.
+    void rotate();
+    // Makes needsRotation() true, e.g. when the announcement was lost.
+    void expire();
+    // The announcement of the current session.
+    const char *getAnnouncement(size_t *length);
+
+    // Encrypts a message into an internal buffer, valid until the next call.
+    // Returns NULL if the message is too long for SESSION_BUFFER_SIZE.
+    const char *encrypt(const char *data, size_t length, size_t *out_length);
+};
+
+#endif // __CLOUDIOTCORE_SESSION_H__
@@ -0,0 +1,290 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "CloudIoTCoreWindow.h"
+
+#define MQTT_PUBLISH_QOS1 0x32
+#define MQTT_DUP 0x08
+#define MQTT_RETAIN 0x01
+#define MQTT_PUBACK 0x40
+
+// Parser states for incoming packets
+#define PARSE_TYPE 0
+#define PARSE_LENGTH 1
+#define PARSE_BODY 2
+
+///////////////////////////////
+// Pass-through client
+///////////////////////////////
+PublishWindowClient::PublishWindowClient(PublishWindow *window) {
+  this->window = window;
+}
+
+// Follows the packet framing of everything read and hands the packet id of
+// each PUBACK to the window.
+void PublishWindowClient::parse(const uint8_t *data, int len) {
+  for (int i = 0; i < len; i++) {
+    unsigned char b = data[i];
+    switch (state) {
+      case PARSE_TYPE:
+        type = b & 0xf0;
+        id = 0;
+        remaining = 0;
+        shift = 0;
+        state = PARSE_LENGTH;
+        break;
+      case PARSE_LENGTH:
+        remaining |= (unsigned long)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+          state = remaining > 0 ? PARSE_BODY : PARSE_TYPE;
+        }
+        break;
+      case PARSE_BODY:
+        if (type == MQTT_PUBACK) {
+          // packet id, most significant byte first
+          id = (id << 8) | b;
+        }
+        if (--remaining == 0) {
+          if (type == MQTT_PUBACK) {
+            window->acked(id);
+          }
+          state = PARSE_TYPE;
+        }
+        break;
+    }
+  }
+}
+
+int PublishWindowClient::connect(IPAddress ip, uint16_t port) {
+  state = PARSE_TYPE;
+  return net->connect(ip, port);
+}
+
+int PublishWindowClient::connect(const char *host, uint16_t port) {
+  state = PARSE_TYPE;
+  return net->connect(host, port);
+}
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+int PublishWindowClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  state = PARSE_TYPE;
+  return net->connect(ip, port, timeout);
+}
+
+int PublishWindowClient::connect(const char *host, uint16_t port, int32_t timeout) {
+  state = PARSE_TYPE;
+  return net->connect(host, port, timeout);
+}
+#endif
+
+size_t PublishWindowClient::write(uint8_t b) {
+  return net->write(b);
+}
+
+size_t PublishWindowClient::write(const uint8_t *buf, size_t size) {
+  return net->write(buf, size);
+}
+
+int PublishWindowClient::available() {
+  return net->available();
+}
+
+int PublishWindowClient::read() {
+  int b = net->read();
+  if (b >= 0) {
+    uint8_t byte = b;
+    parse(&byte, 1);
+  }
+  return b;
+}
+
+int PublishWindowClient::read(uint8_t *buf, size_t size) {
+  int n = net->read(buf, size);
+  if (n > 0) {
+    parse(buf, n);
+  }
+  return n;
+}
+
+int PublishWindowClient::peek() {
+  return net->peek();
+}
+
+void PublishWindowClient::flush() {
+  net->flush();
+}
+
+void PublishWindowClient::stop() {
+  net->stop();
+}
+
+#if defined(ESP8266)
+bool PublishWindowClient::flush(unsigned int maxWaitMs) {
+  return net->flush(maxWaitMs);
+}
+
+bool PublishWindowClient::stop(unsigned int maxWaitMs) {
+  return net->stop(maxWaitMs);
+}
+#endif
+
+uint8_t PublishWindowClient::connected() {
+  return net->connected();
+}
+
+PublishWindowClient::operator bool() {
+  return (bool)*net;
+}
+
+///////////////////////////////
+// In-flight window
+///////////////////////////////
+PublishWindow::PublishWindow(uint8_t size, unsigned long retryMillis)
+    : client(this) {
+  this->size = size > 0 && size <= PUBLISH_WINDOW_SLOTS ? size : PUBLISH_WINDOW_SLOTS;
+  this->retryMillis = retryMillis;
+  memset(slot_id, 0, sizeof(slot_id));
+}
+
+Client *PublishWindow::wrap(Client *net) {
+  client.net = net;
+  return &client;
+}
+
+bool PublishWindow::send(uint8_t slot, bool dup, unsigned long now) {
+  if (dup) {
+    slot_packet[slot][0] |= MQTT_DUP;
+  }
+  slot_sent[slot] = now;
+  return client.net->write(slot_packet[slot], slot_length[slot]) == slot_length[slot];
+}
+
+void PublishWindow::acked(uint16_t id) {
+  for (uint8_t i = 0; i < PUBLISH_WINDOW_SLOTS; i++) {
+    if (slot_id[i] == id && id != 0) {
+      slot_id[i] = 0;
+      in_flight--;
+      if (callback != NULL) {
+        callback(this, id);
+      }
+      return;
+    }
+  }
+}
+
+uint16_t PublishWindow::publish(const char *topic, size_t topicLength,
+                                const char *data, size_t length, bool retained,
+                                unsigned long now) {
+  PublishSegment segment = {data, length};
+  return publish(topic, topicLength, &segment, 1, retained, now);
+}
+
+uint16_t PublishWindow::publish(const char *topic, size_t topicLength,
+                                const PublishSegment *segments, size_t count,
+                                bool retained, unsigned long now) {
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++) {
+    length += segments[i].length;
+  }
+  size_t remaining = 2 + topicLength + 2 + length;
+  if (isFull() || client.net == NULL || topicLength > 0xffff ||
+      remaining + 5 > PUBLISH_WINDOW_PACKET_SIZE) {
+    return 0;
+  }
+  uint8_t slot = 0;
+  while (slot_id[slot] != 0) {
+    slot++;
+  }
+  // Next id not in flight, wrapping within the window's range.
+  do {
+    last_id = next_id;
+    next_id = next_id == 0xffff ? PUBLISH_WINDOW_FIRST_ID : next_id + 1;
+  } while (isPending(last_id));
+
+  unsigned char *out = slot_packet[slot];
+  size_t pos = 0;
+  out[pos++] = MQTT_PUBLISH_QOS1 | (retained ? MQTT_RETAIN : 0);
+  do {
+    unsigned char b = remaining & 0x7f;
+    remaining >>= 7;
+    out[pos++] = remaining > 0 ? b | 0x80 : b;
+  } while (remaining > 0);
+  out[pos++] = topicLength >> 8;
+  out[pos++] = topicLength & 0xff;
+  memcpy(out + pos, topic, topicLength);
+  pos += topicLength;
+  out[pos++] = last_id >> 8;
+  out[pos++] = last_id & 0xff;
+  for (size_t i = 0; i < count; i++) {
+    memcpy(out + pos, segments[i].data, segments[i].length);
+    pos += segments[i].length;
+  }
+
+  slot_length[slot] = pos;
+  if (!send(slot, false, now)) {
+    return 0;
+  }
+  slot_id[slot] = last_id;
+  in_flight++;
+  return last_id;
+}
+
+void PublishWindow::poll(unsigned long now) {
+  for (uint8_t i = 0; i < PUBLISH_WINDOW_SLOTS; i++) {
+    if (slot_id[i] != 0 && now - slot_sent[i] >= retryMillis) {
+      retransmits++;
+      send(i, true, now);
+    }
+  }
+}
+
+void PublishWindow::resend(unsigned long now) {
+  for (uint8_t i = 0; i < PUBLISH_WINDOW_SLOTS; i++) {
+    if (slot_id[i] != 0) {
+      retransmits++;
+      send(i, true, now);
+    }
+  }
+}
+
+bool PublishWindow::isFull() {
+  return in_flight >= size;
+}
+
+uint8_t PublishWindow::inFlight() {
+  return in_flight;
+}
+
+bool PublishWindow::isPending(uint16_t id) {
+  for (uint8_t i = 0; i < PUBLISH_WINDOW_SLOTS; i++) {
+    if (slot_id[i] == id && id != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t PublishWindow::lastId() {
+  return last_id;
+}
+
+uint32_t PublishWindow::retransmitCount() {
+  return retransmits;
+}
+
+void PublishWindow::setAckCallback(PublishAckCallback callback) {
+  this->callback = callback;
+}
@@ -0,0 +1,153 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef __CLOUDIOTCORE_WINDOW_H__
+#define __CLOUDIOTCORE_WINDOW_H__
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Pipelined QoS 1: MQTTClient waits for the PUBACK of every QoS 1 publish,
+// one round trip per message. A PublishWindow instead writes QoS 1 PUBLISH
+// packets itself and keeps up to a window of them in flight. It sits
+// between MQTTClient and the network client, passing everything through and
+// picking out the PUBACKs, which lwmqtt ignores when it is not waiting for
+// one. Unacknowledged messages are sent again, with DUP set, after
+// retryMillis and after every reconnect.
+//
+// Packet ids come from PUBLISH_WINDOW_FIRST_ID up, away from the ids lwmqtt
+// counts up from 1 for its own subscribes and publishes.
+
+// Most messages in flight, and the largest PUBLISH packet (topic, payload
+// and 9 bytes of headers) each can hold.
+#ifdef CONF_PUBLISH_WINDOW_SLOTS
+#define PUBLISH_WINDOW_SLOTS CONF_PUBLISH_WINDOW_SLOTS
+#else
+#define PUBLISH_WINDOW_SLOTS 8
+#endif
+
+#ifdef CONF_PUBLISH_WINDOW_PACKET_SIZE
+#define PUBLISH_WINDOW_PACKET_SIZE CONF_PUBLISH_WINDOW_PACKET_SIZE
+#else
+#define PUBLISH_WINDOW_PACKET_SIZE 320
+#endif
+
+#define PUBLISH_WINDOW_FIRST_ID 0x8000
+
+class PublishWindow;
+
+// A piece of a payload that is published gathered with others, see
+// CloudIoTCoreMqtt::publishTelemetry().
+struct PublishSegment {
+  const char *data;
+  size_t length;
+};
+
+typedef void (*PublishAckCallback)(PublishWindow *window, uint16_t id);
+
+// Forwards to the network client and reports PUBACKs to the window.
+class PublishWindowClient : public Client {
+  friend class PublishWindow;
+  private:
+    PublishWindow *window;
+    Client *net = NULL;
+    // incoming packet parser
+    unsigned char state = 0;
+    unsigned char type = 0;
+    unsigned long remaining = 0;
+    unsigned char shift = 0;
+    uint16_t id = 0;
+
+    void parse(const uint8_t *data, int len);
+
+  public:
+    PublishWindowClient(PublishWindow *window);
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+    int connect(IPAddress ip, uint16_t port, int32_t timeout);
+    int connect(const char *host, uint16_t port, int32_t timeout);
+#endif
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush();
+    void stop();
+#if defined(ESP8266)
+    bool flush(unsigned int maxWaitMs);
+    bool stop(unsigned int maxWaitMs);
+#endif
+    uint8_t connected();
+    operator bool();
+};
+
+class PublishWindow {
+  friend class PublishWindowClient;
+  private:
+    PublishWindowClient client;
+    uint8_t size;
+    unsigned long retryMillis;
+    PublishAckCallback callback = NULL;
+
+    uint16_t next_id = PUBLISH_WINDOW_FIRST_ID;
+    uint16_t last_id = 0;
+    uint8_t in_flight = 0;
+    uint16_t slot_id[PUBLISH_WINDOW_SLOTS];          // 0 if free
+    unsigned long slot_sent[PUBLISH_WINDOW_SLOTS];   // millis() of last send
+    uint16_t slot_length[PUBLISH_WINDOW_SLOTS];
+    unsigned char slot_packet[PUBLISH_WINDOW_SLOTS][PUBLISH_WINDOW_PACKET_SIZE];
+    uint32_t retransmits = 0;
+
+    bool send(uint8_t slot, bool dup, unsigned long now);
+    void acked(uint16_t id);
+
+  public:
+    // size is the number of messages in flight, at most
+    // PUBLISH_WINDOW_SLOTS.
+    PublishWindow(uint8_t size = PUBLISH_WINDOW_SLOTS,
+                  unsigned long retryMillis = 10000);
+
+    // The client to give MQTTClient in place of the network client;
+    // CloudIoTCoreMqtt::startMQTT() does this when it has a window.
+    Client *wrap(Client *net);
+
+    // Sends a QoS 1 message and returns its packet id, or 0 if the window
+    // is full, the packet is too large or the write failed.
+    uint16_t publish(const char *topic, size_t topicLength, const char *data,
+                     size_t length, bool retained, unsigned long now);
+    // The same with the payload in count segments.
+    uint16_t publish(const char *topic, size_t topicLength,
+                     const PublishSegment *segments, size_t count, bool retained,
+                     unsigned long now);
+    // Sends again what has waited retryMillis for its PUBACK.
+    void poll(unsigned long now);
+    // Sends everything in flight again, after a reconnect.
+    void resend(unsigned long now);
+
+    bool isFull();
+    uint8_t inFlight();
+    bool isPending(uint16_t id);
+    // Id of the last message publish() sent.
+    uint16_t lastId();
+    uint32_t retransmitCount();
+    // Called with the id of each acknowledged message.
+    void setAckCallback(PublishAckCallback callback);
+};
+
+#endif // __CLOUDIOTCORE_WINDOW_H__
@@ -0,0 +1,269 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "chacha20_poly1305.h"
+#include <string.h>
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+  a += b; d ^= a; d = ROTL32(d, 16); \
+  c += d; b ^= c; b = ROTL32(b, 12); \
+  a += b; d ^= a; d = ROTL32(d, 8); \
+  c += d; b ^= c; b = ROTL32(b, 7);
+
+static uint32_t load32(const unsigned char *p) {
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static void store32(unsigned char *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+void chacha20_block(const uint32_t state[16],
+                    unsigned char out[CHACHA20_BLOCK_LENGTH]) {
+  uint32_t x[16];
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    x[i] = state[i];
+  }
+  for (i = 0; i < 10; i++) {
+    QUARTERROUND(x[0], x[4], x[8], x[12]);
+    QUARTERROUND(x[1], x[5], x[9], x[13]);
+    QUARTERROUND(x[2], x[6], x[10], x[14]);
+    QUARTERROUND(x[3], x[7], x[11], x[15]);
+    QUARTERROUND(x[0], x[5], x[10], x[15]);
+    QUARTERROUND(x[1], x[6], x[11], x[12]);
+    QUARTERROUND(x[2], x[7], x[8], x[13]);
+    QUARTERROUND(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; i++) {
+    store32(out + 4 * i, x[i] + state[i]);
+  }
+}
+
+static void chacha20_init(uint32_t state[16],
+                          const unsigned char key[CHACHA20_KEY_LENGTH],
+                          const unsigned char nonce[CHACHA20_NONCE_LENGTH]) {
+  state[0] = 0x61707865;
+  state[1] = 0x3320646e;
+  state[2] = 0x79622d32;
+  state[3] = 0x6b206574;
+  for (int i = 0; i < 8; i++) {
+    state[4 + i] = load32(key + 4 * i);
+  }
+  state[12] = 0;
+  for (int i = 0; i < 3; i++) {
+    state[13 + i] = load32(nonce + 4 * i);
+  }
+}
+
+// XORs len bytes of keystream, starting at block 1, into in.
+static void chacha20_xor(uint32_t state[16], const unsigned char *in,
+                         size_t len, unsigned char *out) {
+  unsigned char block[CHACHA20_BLOCK_LENGTH];
+
+  state[12] = 1;
+  while (len > 0) {
+    size_t n = len < CHACHA20_BLOCK_LENGTH ? len : CHACHA20_BLOCK_LENGTH;
+    chacha20_block(state, block);
+    state[12]++;
+    for (size_t i = 0; i < n; i++) {
+      out[i] = in[i] ^ block[i];
+    }
+    in += n;
+    out += n;
+    len -= n;
+  }
+  memset(block, 0, sizeof(block));
+}
+
+// Poly1305 with 26-bit limbs.
+typedef struct poly1305 {
+  uint32_t r[5];
+  uint32_t h[5];
+  uint32_t pad[4];
+} poly1305_t;
+
+static void poly1305_init(poly1305_t *st, const unsigned char key[32]) {
+  st->r[0] = load32(key + 0) & 0x3ffffff;
+  st->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+  st->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+  st->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+  st->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+  memset(st->h, 0, sizeof(st->h));
+  for (int i = 0; i < 4; i++) {
+    st->pad[i] = load32(key + 16 + 4 * i);
+  }
+}
+
+// Absorbs data as 16-byte blocks, zero padding the last one (the AEAD
+// construction pads each part to 16 bytes anyway).
+static void poly1305_padded(poly1305_t *st, const unsigned char *data,
+                            size_t len) {
+  const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3],
+                 r4 = st->r[4];
+  const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3],
+           h4 = st->h[4];
+  unsigned char last[16];
+
+  while (len > 0) {
+    const unsigned char *m = data;
+    if (len < 16) {
+      memset(last, 0, sizeof(last));
+      memcpy(last, data, len);
+      m = last;
+      len = 16;
+    }
+    h0 += load32(m + 0) & 0x3ffffff;
+    h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+    h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+    h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+    h4 += (load32(m + 12) >> 8) | (1 << 24);
+
+    uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 +
+                  (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 +
+                  (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 +
+                  (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 +
+                  (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 +
+                  (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    uint32_t c;
+    c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+    d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+    d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+    d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+    d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    data += 16;
+    len -= 16;
+  }
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+  st->h[3] = h3;
+  st->h[4] = h4;
+}
+
+static void poly1305_finish(poly1305_t *st, unsigned char tag[16]) {
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3],
+           h4 = st->h[4];
+  uint32_t c, g0, g1, g2, g3, g4, mask;
+  uint64_t f;
+
+  // full carry
+  c = h1 >> 26; h1 &= 0x3ffffff;
+  h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+  h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+  h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+  h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+  h1 += c;
+
+  // h - p, taken if it does not borrow
+  g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+  g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+  g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+  g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+  g4 = h4 + c - (1 << 26);
+  mask = (g4 >> 31) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  // h + pad mod 2^128
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+  f = (uint64_t)h0 + st->pad[0]; store32(tag + 0, (uint32_t)f);
+  f = (uint64_t)h1 + st->pad[1] + (f >> 32); store32(tag + 4, (uint32_t)f);
+  f = (uint64_t)h2 + st->pad[2] + (f >> 32); store32(tag + 8, (uint32_t)f);
+  f = (uint64_t)h3 + st->pad[3] + (f >> 32); store32(tag + 12, (uint32_t)f);
+
+  memset(st, 0, sizeof(poly1305_t));
+}
+
+// Tag over aad and ciphertext, with the one-time key from block 0.
+static void aead_tag(uint32_t state[16], const unsigned char *aad,
+                     size_t aad_len, const unsigned char *ciphertext,
+                     size_t len, unsigned char tag[POLY1305_TAG_LENGTH]) {
+  unsigned char block[CHACHA20_BLOCK_LENGTH];
+  unsigned char lengths[16];
+  poly1305_t st;
+
+  state[12] = 0;
+  chacha20_block(state, block);
+  poly1305_init(&st, block);
+  memset(block, 0, sizeof(block));
+
+  poly1305_padded(&st, aad, aad_len);
+  poly1305_padded(&st, ciphertext, len);
+  store32(lengths, (uint32_t)aad_len);
+  store32(lengths + 4, (uint32_t)((uint64_t)aad_len >> 32));
+  store32(lengths + 8, (uint32_t)len);
+  store32(lengths + 12, (uint32_t)((uint64_t)len >> 32));
+  poly1305_padded(&st, lengths, sizeof(lengths));
+  poly1305_finish(&st, tag);
+}
+
+void chacha20_poly1305_encrypt(const unsigned char key[CHACHA20_KEY_LENGTH],
+                               const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                               const unsigned char *aad, size_t aad_len,
+                               const unsigned char *in, size_t len,
+                               unsigned char *out,
+                               unsigned char tag[POLY1305_TAG_LENGTH]) {
+  uint32_t state[16];
+
+  chacha20_init(state, key, nonce);
+  chacha20_xor(state, in, len, out);
+  aead_tag(state, aad, aad_len, out, len, tag);
+  memset(state, 0, sizeof(state));
+}
+
+int chacha20_poly1305_decrypt(const unsigned char key[CHACHA20_KEY_LENGTH],
+                              const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                              const unsigned char *aad, size_t aad_len,
+                              const unsigned char *in, size_t len,
+                              unsigned char *out,
+                              const unsigned char tag[POLY1305_TAG_LENGTH]) {
+  uint32_t state[16];
+  unsigned char expected[POLY1305_TAG_LENGTH];
+  unsigned char diff = 0;
+
+  chacha20_init(state, key, nonce);
+  aead_tag(state, aad, aad_len, in, len, expected);
+  for (int i = 0; i < POLY1305_TAG_LENGTH; i++) {
+    diff |= expected[i] ^ tag[i];
+  }
+  if (diff == 0) {
+    chacha20_xor(state, in, len, out);
+  }
+  memset(state, 0, sizeof(state));
+  return diff == 0;
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _CHACHA20_POLY1305_H_
+#define _CHACHA20_POLY1305_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHACHA20_KEY_LENGTH 32
+#define CHACHA20_NONCE_LENGTH 12
+#define CHACHA20_BLOCK_LENGTH 64
+#define POLY1305_TAG_LENGTH 16
+
+// One ChaCha20 block (RFC 8439) of state: 4 constant words, 8 key words, the
+// block counter and 3 nonce words. The counter is not advanced.
+void chacha20_block(const uint32_t state[16],
+                    unsigned char out[CHACHA20_BLOCK_LENGTH]);
+
+// ChaCha20-Poly1305 AEAD (RFC 8439). out may be the same buffer as in.
+void chacha20_poly1305_encrypt(const unsigned char key[CHACHA20_KEY_LENGTH],
+                               const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                               const unsigned char *aad, size_t aad_len,
+                               const unsigned char *in, size_t len,
+                               unsigned char *out,
+                               unsigned char tag[POLY1305_TAG_LENGTH]);
+
+// Returns 1 and decrypts if tag is valid, otherwise returns 0 and leaves
+// out untouched.
+int chacha20_poly1305_decrypt(const unsigned char key[CHACHA20_KEY_LENGTH],
+                              const unsigned char nonce[CHACHA20_NONCE_LENGTH],
+                              const unsigned char *aad, size_t aad_len,
+                              const unsigned char *in, size_t len,
+                              unsigned char *out,
+                              const unsigned char tag[POLY1305_TAG_LENGTH]);
+
+#endif /* _CHACHA20_POLY1305_H_ */
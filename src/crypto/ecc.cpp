@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 /**
  * \addtogroup ecc
  *
@@ -61,6 +62,18 @@ p_clear(point_t * P0)
   NN_AssignZero(P0->y, NUMWORDS);
 }
 /*---------------------------------------------------------------------------*/
+/**
+ * \brief             P0->x *= s^2, P0->y *= s^3, t is a temporary
+ */
+static void
+p_scale(point_t * P0, NN_DIGIT * s, NN_DIGIT * t)
+{
+  NN_ModSqrOpt(t, s, param.p, param.omega, NUMWORDS);
+  NN_ModMultOpt(P0->x, P0->x, t, param.p, param.omega, NUMWORDS);
+  NN_ModMultOpt(t, t, s, param.p, param.omega, NUMWORDS);
+  NN_ModMultOpt(P0->y, P0->y, t, param.p, param.omega, NUMWORDS);
+}
+/*---------------------------------------------------------------------------*/
 /**
  * \brief             P0 = P1
  */
@@ -125,11 +138,12 @@ Z_is_one(NN_DIGIT *Z)
 static void
 c_add_mix(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2)
 {
-  NN_DIGIT t1[NUMWORDS];
-  NN_DIGIT t2[NUMWORDS];
-  NN_DIGIT t3[NUMWORDS];
-  NN_DIGIT t4[NUMWORDS];
-  NN_DIGIT Z2[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t1, NUMWORDS);
+  NN_TEMP(t2, NUMWORDS);
+  NN_TEMP(t3, NUMWORDS);
+  NN_TEMP(t4, NUMWORDS);
+  NN_TEMP(Z2, NUMWORDS);
 
   /* P2 == infinity */
   if(NN_Zero(P2->x, NUMWORDS)) {
@@ -226,9 +240,10 @@ ecc_get_order(NN_DIGIT * order)
 void
 ecc_add(point_t * P0, point_t * P1, point_t * P2)
 {
-  NN_DIGIT Z0[NUMWORDS];
-  NN_DIGIT Z1[NUMWORDS];
-  NN_DIGIT Z2[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(Z0, NUMWORDS);
+  NN_TEMP(Z1, NUMWORDS);
+  NN_TEMP(Z2, NUMWORDS);
 
   p_clear(P0);
   NN_AssignZero(Z0, NUMWORDS);
@@ -256,10 +271,11 @@ ecc_add(point_t * P0, point_t * P1, point_t * P2)
 void
 ecc_dbl_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1)
 {
-  NN_DIGIT n0[NUMWORDS];
-  NN_DIGIT n1[NUMWORDS];
-  NN_DIGIT n2[NUMWORDS];
-  NN_DIGIT n3[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(n0, NUMWORDS);
+  NN_TEMP(n1, NUMWORDS);
+  NN_TEMP(n2, NUMWORDS);
+  NN_TEMP(n3, NUMWORDS);
 
   if(NN_Zero(Z1, NUMWORDS)) {
     NN_AssignZero(Z0, NUMWORDS);
@@ -342,13 +358,14 @@ ecc_dbl_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1)
 void
 ecc_add_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2, NN_DIGIT * Z2)
 {
-  NN_DIGIT n0[NUMWORDS];
-  NN_DIGIT n1[NUMWORDS];
-  NN_DIGIT n2[NUMWORDS];
-  NN_DIGIT n3[NUMWORDS];
-  NN_DIGIT n4[NUMWORDS];
-  NN_DIGIT n5[NUMWORDS];
-  NN_DIGIT n6[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(n0, NUMWORDS);
+  NN_TEMP(n1, NUMWORDS);
+  NN_TEMP(n2, NUMWORDS);
+  NN_TEMP(n3, NUMWORDS);
+  NN_TEMP(n4, NUMWORDS);
+  NN_TEMP(n5, NUMWORDS);
+  NN_TEMP(n6, NUMWORDS);
 
   if(NN_Zero(Z1, NUMWORDS)) {
     p_copy(P0, P2);
@@ -458,17 +475,61 @@ ecc_add_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t *
 }
 /*---------------------------------------------------------------------------*/
 void
+ecc_batch_to_affine(point_t * points, NN_DIGIT * Z, uint8_t num)
+{
+  uint8_t i;
+  NN_SCRATCH_FRAME();
+  NN_TEMP(R, NUMWORDS);
+  NN_TEMP(t, NUMWORDS);
+
+  /* Scale each point to Z = R, the product of its own and all earlier Zs,
+   * so that only the last R needs inverting: 1/R of points[i] times Z[i] is
+   * 1/R of points[i-1]. The Zs are the one buffer this needs. */
+  NN_AssignDigit(R, 1, NUMWORDS);
+  for(i = 0; i < num; i++) {
+    if(NN_Zero(Z + i*NUMWORDS, NUMWORDS)) {
+      continue;
+    }
+    p_scale(&(points[i]), R, t);
+    NN_ModMultOpt(R, R, Z + i*NUMWORDS, param.p, param.omega, NUMWORDS);
+  }
+
+  NN_ModInv(R, R, param.p, NUMWORDS);
+  for(i = num; i-- > 0; ) {
+    if(NN_Zero(Z + i*NUMWORDS, NUMWORDS)) {
+      p_clear(&(points[i]));
+      continue;
+    }
+    /* x = X / R^2, y = Y / R^3 */
+    p_scale(&(points[i]), R, t);
+    NN_ModMultOpt(R, R, Z + i*NUMWORDS, param.p, param.omega, NUMWORDS);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
 ecc_win_precompute(point_t * baseP, point_t * pointArray)
 {
   uint8_t i;
+  NN_SCRATCH_FRAME();
+  NN_TEMP(Z, (NUM_POINTS - 1) * NUMWORDS);
 
   NN_Assign(pointArray[0].x, baseP->x, NUMWORDS);
   NN_Assign(pointArray[0].y, baseP->y, NUMWORDS);
 
+  /* [i+1]P = [i]P + P in Jacobian coordinates, Z[i-1] is the Z of [i]P.
+   * P itself is affine: Z[0] starts at 1 and the first addition replaces
+   * it, which c_add_mix() allows. */
   for(i = 1; i < NUM_POINTS; i++) {
-    ecc_add(&(pointArray[i]), &(pointArray[i-1]), baseP);
+    if(i == 1) {
+      NN_AssignDigit(Z, 1, NUMWORDS);
+    }
+    c_add_mix(&(pointArray[i]), Z + (i-1)*NUMWORDS, &(pointArray[i-1]),
+              Z + (i > 1 ? i-2 : 0)*NUMWORDS, baseP);
   }
 
+  /* back to affine with one inversion, [0] is already affine */
+  ecc_batch_to_affine(&(pointArray[1]), Z, NUM_POINTS - 1);
+
   for(i = 0; i < NUM_MASKS; i++) {
     mask[i] = BASIC_MASK << (W_BITS*i);
   }
@@ -479,8 +540,9 @@ void
 ecc_mul(point_t * P0, point_t * P1, NN_DIGIT * n)
 {
   int16_t i, tmp;
-  NN_DIGIT Z0[NUMWORDS];
-  NN_DIGIT Z1[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(Z0, NUMWORDS);
+  NN_TEMP(Z1, NUMWORDS);
 
   /* clear point */
   p_clear(P0);
@@ -519,11 +581,12 @@ void
 ecc_m_dbl_projective(point_t * P0, NN_DIGIT *Z0, uint8_t m)
 {
   uint8_t i;
-  NN_DIGIT W[NUMWORDS];
-  NN_DIGIT A[NUMWORDS];
-  NN_DIGIT B[NUMWORDS];
-  NN_DIGIT t1[NUMWORDS];
-  NN_DIGIT y2[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(W, NUMWORDS);
+  NN_TEMP(A, NUMWORDS);
+  NN_TEMP(B, NUMWORDS);
+  NN_TEMP(t1, NUMWORDS);
+  NN_TEMP(y2, NUMWORDS);
 
   if(NN_Zero(Z0, NUMWORDS)){
     return;
@@ -600,8 +663,9 @@ ecc_win_mul(point_t * P0, NN_DIGIT * n, point_t * pointArray)
   int16_t i, tmp;
   int8_t j;
   NN_DIGIT windex;
-  NN_DIGIT Z0[NUMWORDS];
-  NN_DIGIT Z1[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(Z0, NUMWORDS);
+  NN_TEMP(Z1, NUMWORDS);
 #ifndef REPEAT_DOUBLE
   int8_t k;
 #endif
@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 /**
  * \defgroup ecc Elliptic Curve Point Arithmetic
  *
@@ -49,6 +50,21 @@
  */
 #define NUM_POINTS ((1 << W_BITS) - 1)
 
+/**
+ * Worst-case scratch workspace in digits for ecc_init(), ecc_gen_pub_key(),
+ * ecdsa_init(), ecdsa_sign() and ecdsa_verify() when built with
+ * CONF_NN_SCRATCH. ecc_win_precompute() holds the NUM_POINTS - 1 Zs of the
+ * table, ecc_batch_to_affine() two temporaries below it and NN_ModInv()
+ * another 15 * NUMWORDS below that. For small windows the signing path
+ * dominates with 21 * NUMWORDS, hence the floor of 5 points. With W_BITS = 4
+ * this is 279 digits (1116 bytes), which matches NN_ScratchHighWater() on a
+ * host.
+ */
+#ifndef NN_SCRATCH_DIGITS
+#define NN_SCRATCH_DIGITS \
+  (((NUM_POINTS > 5 ? NUM_POINTS : 5) + 16) * NUMWORDS)
+#endif
+
 /**
  * The data structure define the elliptic curve.
  */
@@ -135,6 +151,15 @@ void ecc_dbl_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1);
  */
 void ecc_mul(point_t * P0, point_t * P1, NN_DIGIT * n);
 
+/**
+ * \brief             Convert num Jacobian points (points[i], Z[i]) to affine
+ *                    coordinates in place, sharing one inversion
+ *                    (Montgomery's trick). Z holds num elements of NUMWORDS
+ *                    digits and is left as is. Points with Z[i] = 0
+ *                    (infinity) are set to (0, 0).
+ */
+void ecc_batch_to_affine(point_t * points, NN_DIGIT * Z, uint8_t num);
+
 /**
  * \brief             Precompute the points for sliding window method
  */
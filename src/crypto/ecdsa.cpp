@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 /**
  * \addtogroup ecdsa
  *
@@ -13,19 +14,14 @@
  *
  */
 #include "ecdsa.h"
+#include "hmac_sha256.h"
 #include "prng.h"
 #include <stdlib.h>
 
 #define TRUE 1
 #define FALSE 0
 
-//enable shamir trick
-//#define SHAMIR_TRICK
-
 #ifdef SHAMIR_TRICK
-/* The size of sliding window, S_W_BITS <= 8 */
-#define S_W_BITS 2
-
 /*
  * basic mask used to generate mask array
  * For example: if S_W_BITS is 2, BASIC_MASK must be 0x03;
@@ -37,30 +33,48 @@
 /* number of windows in one digit, NUM_MASKS = NN_DIGIT_BITS/W_BITS */
 #define S_NUM_MASKS (NN_DIGIT_BITS/S_W_BITS)
 
-/* number of points for precomputed points, NN_POINTS = 2^W_BITS - 1 */
-#define S_NUM_POINTS ((1 << (2*S_W_BITS)) - 1)
-
 #define S_MAX ((1 << S_W_BITS) - 1)
 
 #endif /* SHAMIR_TRICK */
 
 
-
+#ifndef CONF_ECDSA_SIGN_ONLY
 #ifdef SHAMIR_TRICK
-static point_t pqBaseArray[S_NUM_POINTS];
 static NN_DIGIT s_mask[S_NUM_MASKS];
 static curve_params_t* param;
-#else /* defined(SLIDING_WIN) */
-/* precomputed array of public key(used in verification) for
- * sliding window method.
- */
-static point_t qBaseArray[NUM_POINTS];
 #endif /* SHAMIR_TRICK */
+/* public key set by ecdsa_init() and its precomputed array (Shamir trick
+ * or sliding window method)
+ */
+static ecdsa_key_t init_key;
+
+/*
+ * least recently used cache of verification keys, see ecdsa_key_cache_get()
+ */
+typedef struct key_cache_entry {
+  ecdsa_key_t key;
+  uint32_t last_used; /* 0 if unused */
+} key_cache_entry_t;
+
+static key_cache_entry_t key_cache[ECDSA_KEY_CACHE_SIZE];
+static uint32_t key_cache_clock;
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
 static NN_DIGIT order[NUMWORDS];
 
+/*
+ * pool of precomputed nonce tuples, see ecdsa_pool_fill()
+ */
+typedef struct nonce_tuple {
+  NN_DIGIT k_inv[NUMWORDS];
+  NN_DIGIT r[NUMWORDS];
+} nonce_tuple_t;
+
+static ECDSA_POOL_ATTR nonce_tuple_t pool[ECDSA_POOL_SIZE];
+static ECDSA_POOL_ATTR uint8_t pool_count;
 
 /*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 #ifdef SHAMIR_TRICK
 static point_t * baseP;
 /**
@@ -125,13 +139,14 @@ shamir_init(point_t * pKey, point_t * pointArray)
  *
  */
 static void
-shamir(point_t * P0, NN_DIGIT * u1, NN_DIGIT * u2)
+shamir(point_t * P0, NN_DIGIT * u1, NN_DIGIT * u2, point_t * pqBaseArray)
 {
   int16_t i, tmp, tmp2;
   int8_t j, k;
   NN_DIGIT windex;
-  NN_DIGIT Z0[NUMWORDS];
-  NN_DIGIT Z1[NUMWORDS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(Z0, NUMWORDS);
+  NN_TEMP(Z1, NUMWORDS);
 
   /* clear point */
   NN_AssignZero(P0->x, NUMWORDS);
@@ -182,65 +197,229 @@ shamir(point_t * P0, NN_DIGIT * u1, NN_DIGIT * u2)
 #endif /* SHAMIR_TRICK */
 /*---------------------------------------------------------------------------*/
 void
-ecdsa_init(point_t * pb_key)
+ecdsa_key_init(ecdsa_key_t *key, point_t *pb_key)
 {
+  NN_Assign(key->pub.x, pb_key->x, NUMWORDS);
+  NN_Assign(key->pub.y, pb_key->y, NUMWORDS);
 #ifdef SHAMIR_TRICK
   param = ecc_get_param();
-  shamir_init(pb_key, pqBaseArray);
+  shamir_init(pb_key, key->table);
 #else /* defined(SLIDING_WIN) */
   /* precompute the array of public key for sliding window method */
-  ecc_win_precompute(pb_key, qBaseArray);
+  ecc_win_precompute(pb_key, key->table);
 #endif /* SHAMIR_TRICK */
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_init(point_t * pb_key)
+{
+  ecdsa_key_init(&init_key, pb_key);
   /* we need to know param->r */
   ecc_get_order(order);
 }
+/*---------------------------------------------------------------------------*/
+ecdsa_key_t *
+ecdsa_key_cache_get(point_t *pb_key)
+{
+  uint8_t i;
+  uint8_t victim = 0;
+
+  key_cache_clock++;
+  if(key_cache_clock == 0) {
+    /* wrapped around, forget the order rather than mix up old and new */
+    for(i = 0; i < ECDSA_KEY_CACHE_SIZE; i++) {
+      if(key_cache[i].last_used) {
+        key_cache[i].last_used = 1;
+      }
+    }
+    key_cache_clock = 2;
+  }
 
+  for(i = 0; i < ECDSA_KEY_CACHE_SIZE; i++) {
+    if(key_cache[i].last_used &&
+       NN_Cmp(key_cache[i].key.pub.x, pb_key->x, NUMWORDS) == 0 &&
+       NN_Cmp(key_cache[i].key.pub.y, pb_key->y, NUMWORDS) == 0) {
+      key_cache[i].last_used = key_cache_clock;
+      return &(key_cache[i].key);
+    }
+    if(key_cache[i].last_used < key_cache[victim].last_used) {
+      victim = i;
+    }
+  }
+
+  ecdsa_key_init(&(key_cache[victim].key), pb_key);
+  key_cache[victim].last_used = key_cache_clock;
+  return &(key_cache[victim].key);
+}
 /*---------------------------------------------------------------------------*/
 void
-ecdsa_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d)
+ecdsa_key_cache_clear(void)
 {
+  memset(key_cache, 0, sizeof(key_cache));
+  key_cache_clock = 0;
+}
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
-  char done = FALSE;
-  NN_DIGIT k[NUMWORDS];
-  NN_DIGIT k_inv[NUMWORDS];
-  NN_DIGIT tmp[NUMWORDS];
-  NN_DIGIT digest[NUMWORDS];
-  point_t P;
-  NN_DIGIT sha256tmp[SHA256_DIGEST_LENGTH/NN_DIGIT_LEN];
-  NN_UINT result_bit_len;
-  NN_UINT order_bit_len;
+/*---------------------------------------------------------------------------*/
+/*
+ * HMAC_DRBG state of the RFC 6979 nonce generator (section 3.2), for
+ * SHA-256 and a 256-bit group order.
+ */
+typedef struct rfc6979 {
+  uint8_t K[HMAC_SHA256_DIGEST_LENGTH];
+  uint8_t V[HMAC_SHA256_DIGEST_LENGTH];
+} rfc6979_t;
 
-  while(!done) {
-    ecc_gen_private_key(k);
+/**
+ * \brief             K = HMAC_K(V || sep || x || h), V = HMAC_K(V)
+ *                    sep is skipped when x is NULL.
+ */
+static void
+rfc6979_update(rfc6979_t *st, uint8_t sep, uint8_t *x, uint8_t *h)
+{
+  HmacSha256 mac_k(st->K, HMAC_SHA256_DIGEST_LENGTH);
+  mac_k.update(st->V, HMAC_SHA256_DIGEST_LENGTH);
+  mac_k.update(&sep, 1);
+  if(x) {
+    mac_k.update(x, NUMBYTES - NN_DIGIT_LEN);
+    mac_k.update(h, SHA256_DIGEST_LENGTH);
+  }
+  mac_k.final(st->K);
 
-    if((NN_Zero(k, NUMWORDS)) == 1) {
-      continue;
-    }
+  HmacSha256 mac_v(st->K, HMAC_SHA256_DIGEST_LENGTH);
+  mac_v.update(st->V, HMAC_SHA256_DIGEST_LENGTH);
+  mac_v.final(st->V);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             Seed the generator with the private key d and the
+ *                    message hash (steps a. to g.)
+ */
+static void
+rfc6979_init(rfc6979_t *st, NN_DIGIT *d, uint8_t sha256sum[SHA256_DIGEST_LENGTH])
+{
+  uint8_t x[NUMBYTES - NN_DIGIT_LEN];
+  uint8_t h[SHA256_DIGEST_LENGTH];
+  NN_DIGIT h1[NUMWORDS];
+
+  /* int2octets(d) and bits2octets(H(m)) = int2octets(H(m) mod n) */
+  NN_Encode(x, NUMBYTES - NN_DIGIT_LEN, d, NUMWORDS - 1);
+  NN_Decode(h1, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, sha256sum, SHA256_DIGEST_LENGTH);
+  h1[NUMWORDS - 1] = 0;
+  if(NN_Cmp(h1, order, NUMWORDS) >= 0) {
+    NN_Sub(h1, h1, order, NUMWORDS);
+  }
+  NN_Encode(h, SHA256_DIGEST_LENGTH, h1, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN);
+
+  memset(st->V, 0x01, HMAC_SHA256_DIGEST_LENGTH);
+  memset(st->K, 0x00, HMAC_SHA256_DIGEST_LENGTH);
+  rfc6979_update(st, 0x00, x, h);
+  rfc6979_update(st, 0x01, x, h);
+
+  memset(x, 0, sizeof(x));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             Next nonce candidate k in [1, n-1] (step h.)
+ */
+static void
+rfc6979_next(rfc6979_t *st, NN_DIGIT *k)
+{
+  while(TRUE) {
+    HmacSha256 mac_v(st->K, HMAC_SHA256_DIGEST_LENGTH);
+    mac_v.update(st->V, HMAC_SHA256_DIGEST_LENGTH);
+    mac_v.final(st->V);
 
-    ecc_win_mul_base(&P, k);
+    NN_Decode(k, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, st->V, SHA256_DIGEST_LENGTH);
+    k[NUMWORDS - 1] = 0;
 
-    NN_Mod(r, P.x, NUMWORDS, order, NUMWORDS);
+    /* the next call, or a rejected candidate, moves the state on */
+    rfc6979_update(st, 0x00, NULL, NULL);
 
-    if((NN_Zero(r, NUMWORDS)) == 1) {
-	    continue;
+    if(!NN_Zero(k, NUMWORDS) && NN_Cmp(k, order, NUMWORDS) < 0) {
+      return;
     }
-    NN_ModInv(k_inv, k, order, NUMWORDS);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             The message independent part of signing, r = (k*G).x
+ *                    mod n and k_inv = 1/k mod n.
+ * \return            FALSE if k can not be used.
+ */
+static char
+nonce_tuple(NN_DIGIT *k, NN_DIGIT *k_inv, NN_DIGIT *r)
+{
+  NN_SCRATCH_FRAME();
+  NN_TEMP_POINT(P);
+
+  if((NN_Zero(k, NUMWORDS)) == 1) {
+    return FALSE;
+  }
 
-    NN_Decode(sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, sha256sum, SHA256_DIGEST_LENGTH);
+  ecc_win_mul_base(P, k);
 
-    result_bit_len = NN_Bits(sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
-    order_bit_len = NN_Bits(order, NUMWORDS);
+  NN_Mod(r, P->x, NUMWORDS, order, NUMWORDS);
 
-    if (result_bit_len > order_bit_len) {
-        NN_Mod(digest, sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, order, NUMWORDS);
+  if((NN_Zero(r, NUMWORDS)) == 1) {
+    return FALSE;
+  }
+  NN_ModInv(k_inv, k, order, NUMWORDS);
+
+  return TRUE;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             ECDSA signing with nonces from drbg, or from the pool
+ *                    and then the PRNG when drbg is NULL.
+ */
+static void
+sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d, rfc6979_t *drbg)
+{
 
-    } else
-    {
-        memset(digest, 0, NUMBYTES);
-        NN_Assign(digest, sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
-        if (result_bit_len == order_bit_len) {
-            NN_ModSmall(digest, order, NUMWORDS);
-        }
+  char done = FALSE;
+  NN_SCRATCH_FRAME();
+  NN_TEMP(k, NUMWORDS);
+  NN_TEMP(k_inv, NUMWORDS);
+  NN_TEMP(tmp, NUMWORDS);
+  NN_TEMP(digest, NUMWORDS);
+  NN_TEMP(sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN);
+  NN_UINT result_bit_len;
+  NN_UINT order_bit_len;
+
+  NN_Decode(sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, sha256sum, SHA256_DIGEST_LENGTH);
+
+  result_bit_len = NN_Bits(sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
+  order_bit_len = NN_Bits(order, NUMWORDS);
+
+  if (result_bit_len > order_bit_len) {
+      NN_Mod(digest, sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, order, NUMWORDS);
+
+  } else
+  {
+      memset(digest, 0, NUMBYTES);
+      NN_Assign(digest, sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
+      if (result_bit_len == order_bit_len) {
+          NN_ModSmall(digest, order, NUMWORDS);
+      }
+  }
+
+  while(!done) {
+    if(!drbg && pool_count > 0) {
+      /* r and k^-1 were precomputed, only s is left */
+      pool_count--;
+      NN_Assign(r, pool[pool_count].r, NUMWORDS);
+      NN_Assign(k_inv, pool[pool_count].k_inv, NUMWORDS);
+      memset(&(pool[pool_count]), 0, sizeof(nonce_tuple_t));
+    } else {
+      if(drbg) {
+        rfc6979_next(drbg, k);
+      } else {
+        ecc_gen_private_key(k);
+      }
+      if(!nonce_tuple(k, k_inv, r)) {
+        continue;
+      }
     }
 
     NN_ModMult(k, d, r, order, NUMWORDS);
@@ -253,18 +432,75 @@ ecdsa_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN
 
 }
 /*---------------------------------------------------------------------------*/
+void
+ecdsa_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d)
+{
+  ecc_get_order(order);
+  sign(sha256sum, r, s, d, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_sign_deterministic(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d)
+{
+  rfc6979_t drbg;
+
+  ecc_get_order(order);
+  rfc6979_init(&drbg, d, sha256sum);
+  sign(sha256sum, r, s, d, &drbg);
+  memset(&drbg, 0, sizeof(drbg));
+}
+/*---------------------------------------------------------------------------*/
 uint8_t
-ecdsa_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, point_t *Q)
+ecdsa_pool_fill(uint8_t count)
+{
+  NN_SCRATCH_FRAME();
+  NN_TEMP(k, NUMWORDS);
+
+  ecc_get_order(order);
+
+  while(count > 0 && pool_count < ECDSA_POOL_SIZE) {
+    ecc_gen_private_key(k);
+    if(nonce_tuple(k, pool[pool_count].k_inv, pool[pool_count].r)) {
+      pool_count++;
+      count--;
+    }
+  }
+  memset(k, 0, NUMBYTES);
+
+  return pool_count;
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_pool_available(void)
+{
+  return pool_count;
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_pool_clear(void)
 {
-  NN_DIGIT sha256tmp[SHA256_DIGEST_LENGTH/NN_DIGIT_LEN];
-  NN_DIGIT w[NUMWORDS];
-  NN_DIGIT u1[NUMWORDS];
-  NN_DIGIT u2[NUMWORDS];
-  NN_DIGIT digest[NUMWORDS];
+  memset(pool, 0, sizeof(pool));
+  pool_count = 0;
+}
+/*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
+/**
+ * \brief             ECDSA verification with the precomputed table of key.
+ */
+static uint8_t
+verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, ecdsa_key_t *key)
+{
+  NN_SCRATCH_FRAME();
+  NN_TEMP(sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN);
+  NN_TEMP(w, NUMWORDS);
+  NN_TEMP(u1, NUMWORDS);
+  NN_TEMP(u2, NUMWORDS);
+  NN_TEMP(digest, NUMWORDS);
 #ifndef SHAMIR_TRICK
-  point_t u1P, u2Q;
+  NN_TEMP_POINT(u1P);
+  NN_TEMP_POINT(u2Q);
 #endif
-  point_t final;
+  NN_TEMP_POINT(final);
   NN_UINT result_bit_len;
   NN_UINT order_bit_len;
 
@@ -306,20 +542,20 @@ ecdsa_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s,
 
   /* u1P+u2Q */
 #ifdef SHAMIR_TRICK
-  shamir(&final, u1, u2);
+  shamir(final, u1, u2, key->table);
 #else
-  ecc_win_mul_base(&u1P, u1);
-  ecc_win_mul(&u2Q, u2, qBaseArray);
-  ecc_add(&final, &u1P, &u2Q);
+  ecc_win_mul_base(u1P, u1);
+  ecc_win_mul(u2Q, u2, key->table);
+  ecc_add(final, u1P, u2Q);
 #endif
 
-  result_bit_len = NN_Bits(final.x, NUMWORDS);
+  result_bit_len = NN_Bits(final->x, NUMWORDS);
   order_bit_len = NN_Bits(order, NUMWORDS);
 
   if (result_bit_len > order_bit_len) {
-      NN_Mod(w, final.x, NUMWORDS, order, NUMWORDS);
+      NN_Mod(w, final->x, NUMWORDS, order, NUMWORDS);
   } else {
-      NN_Assign(w, final.x, NUMWORDS);
+      NN_Assign(w, final->x, NUMWORDS);
       if (result_bit_len == order_bit_len) {
           NN_ModSmall(w, order, NUMWORDS);
       }
@@ -331,6 +567,58 @@ ecdsa_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s,
     return 2;
   }
 }
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, point_t *Q)
+{
+  (void)Q; /* the key set up by ecdsa_init() */
+  return verify(sha256sum, r, s, &init_key);
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_key_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, ecdsa_key_t *key)
+{
+  ecc_get_order(order);
+  return verify(sha256sum, r, s, key);
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+ecdsa_verify_batch(ecdsa_verify_item_t *items, uint16_t count)
+{
+  uint16_t i, j;
+  uint16_t valid = 0;
+  ecdsa_key_t *key;
+
+  ecc_get_order(order);
+
+  for(i = 0; i < count; i++) {
+    items[i].result = 0;
+  }
+
+  for(i = 0; i < count; i++) {
+    if(items[i].result) {
+      continue;
+    }
+    key = ecdsa_key_cache_get(items[i].pb_key);
+
+    /* all remaining signatures by this key, while its table is at hand */
+    for(j = i; j < count; j++) {
+      if(items[j].result ||
+         (j != i &&
+          (NN_Cmp(items[j].pb_key->x, key->pub.x, NUMWORDS) != 0 ||
+           NN_Cmp(items[j].pb_key->y, key->pub.y, NUMWORDS) != 0))) {
+        continue;
+      }
+      items[j].result = verify(items[j].sha256sum, items[j].r, items[j].s, key);
+      if(items[j].result == 1) {
+        valid++;
+      }
+    }
+  }
+
+  return valid;
+}
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
 /**
  * @}
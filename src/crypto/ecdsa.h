@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 #define SHA256_DIGEST_LENGTH 32
 /**
  * \defgroup ecdsa Elliptic Curve Digital Signature Algorithm
@@ -20,6 +21,79 @@
 #include "nn.h"
 #include "ecc.h"
 
+/**
+ * Number of precomputed nonce tuples kept by ecdsa_pool_fill().
+ */
+#ifdef CONF_ECDSA_POOL_SIZE
+#define ECDSA_POOL_SIZE CONF_ECDSA_POOL_SIZE
+#else
+#define ECDSA_POOL_SIZE 2
+#endif
+
+/**
+ * Storage attribute of the nonce pool, e.g. RTC_DATA_ATTR on ESP32 to keep
+ * it across deep sleep.
+ */
+#ifndef ECDSA_POOL_ATTR
+#define ECDSA_POOL_ATTR
+#endif
+
+/**
+ * Define CONF_ECDSA_SIGN_ONLY for devices that only sign: it removes
+ * ecdsa_init(), ecdsa_verify(), the key cache and their precomputed public
+ * key tables (2312 bytes of RAM with W_BITS = 4 and the default cache),
+ * along with NN routines that only verification or other code uses, and
+ * CloudIoTCoreOta. Signing does not need ecdsa_init().
+ */
+#ifndef CONF_ECDSA_SIGN_ONLY
+//enable shamir trick
+//#define SHAMIR_TRICK
+
+#ifdef SHAMIR_TRICK
+/* The size of sliding window, S_W_BITS <= 8 */
+#define S_W_BITS 2
+
+/* number of points for precomputed points, NN_POINTS = 2^W_BITS - 1 */
+#define S_NUM_POINTS ((1 << (2*S_W_BITS)) - 1)
+
+#define ECDSA_KEY_POINTS S_NUM_POINTS
+#else
+#define ECDSA_KEY_POINTS NUM_POINTS
+#endif /* SHAMIR_TRICK */
+
+/**
+ * Number of verification keys kept by ecdsa_key_cache_get(). Each entry is
+ * static RAM for (ECDSA_KEY_POINTS + 1) points and a counter, 1156 bytes
+ * with W_BITS = 4, so only raise it for devices that check signatures by
+ * several keys in turn; with one entry a change of key rebuilds the table.
+ */
+#ifdef CONF_ECDSA_KEY_CACHE_SIZE
+#define ECDSA_KEY_CACHE_SIZE CONF_ECDSA_KEY_CACHE_SIZE
+#else
+#define ECDSA_KEY_CACHE_SIZE 1
+#endif
+
+/**
+ * A public key together with its precomputed verification table, so that
+ * repeated verifications with the same key skip ecdsa_init().
+ */
+typedef struct ecdsa_key {
+  point_t pub;
+  point_t table[ECDSA_KEY_POINTS];
+} ecdsa_key_t;
+
+/**
+ * One signature for ecdsa_verify_batch().
+ */
+typedef struct ecdsa_verify_item {
+  uint8_t *sha256sum;
+  NN_DIGIT *r;
+  NN_DIGIT *s;
+  point_t *pb_key;
+  /* set to the return value of ecdsa_verify() */
+  uint8_t result;
+} ecdsa_verify_item_t;
+
 /**
  * \brief             Initialize the ECDSA using the public key that is to be
  *                    used to verify the signature.
@@ -29,9 +103,12 @@
  *                    key whose key is used to verify the signature.
  */
 void ecdsa_init(point_t * pb_key);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
 /**
  * \brief             Sign a message using the private key.
+ *                    Uses a precomputed nonce tuple when one is available,
+ *                    see ecdsa_pool_fill().
  *
  * \param sha256sum   Hash of the message to sign.
  * \param r
@@ -40,6 +117,42 @@ void ecdsa_init(point_t * pb_key);
  */
 void ecdsa_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT * pr_key);
 
+/**
+ * \brief             Sign a message using the private key, with the nonce
+ *                    derived from the key and the hash as in RFC 6979
+ *                    (HMAC-SHA256). Needs no random numbers and always gives
+ *                    the same signature for the same key and hash.
+ *
+ * \param sha256sum   Hash of the message to sign.
+ * \param r
+ * \param s           Signature of the message.
+ * \param pr_key      The private key that is used to sign the message.
+ */
+void ecdsa_sign_deterministic(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT * pr_key);
+
+/**
+ * \brief             Precompute up to count nonce tuples (k^-1, r) for
+ *                    ecdsa_sign(), e.g. while idle or before deep sleep.
+ *                    Each tuple costs about as much as a signature and is
+ *                    used once; ecdsa_sign() then only needs two modular
+ *                    multiplications. ecc_init() must have been called.
+ *
+ * \param count       Maximum number of tuples to add.
+ * \return            Number of tuples in the pool, at most ECDSA_POOL_SIZE.
+ */
+uint8_t ecdsa_pool_fill(uint8_t count);
+
+/**
+ * \brief             Number of precomputed nonce tuples left.
+ */
+uint8_t ecdsa_pool_available(void);
+
+/**
+ * \brief             Wipe all precomputed nonce tuples.
+ */
+void ecdsa_pool_clear(void);
+
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief             Verify a message using public key.
  * \param sha256sum   Hash of the message to sign.
@@ -53,6 +166,54 @@ void ecdsa_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *
  */
 uint8_t ecdsa_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, point_t * pb_key);
 
+/**
+ * \brief             Build the verification table of a public key.
+ *                    ecc_init() must have been called.
+ *
+ * \param key         The key object to fill.
+ * \param pb_key      The public key.
+ */
+void ecdsa_key_init(ecdsa_key_t *key, point_t *pb_key);
+
+/**
+ * \brief             Verify a message with a key set up by ecdsa_key_init().
+ *                    Does not touch the table of ecdsa_init().
+ *
+ * \return            Same as ecdsa_verify().
+ */
+uint8_t ecdsa_key_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, ecdsa_key_t *key);
+
+/**
+ * \brief             Look up the key object of a public key in a least
+ *                    recently used cache of ECDSA_KEY_CACHE_SIZE entries,
+ *                    building its table on a miss.
+ *
+ * \return            The cached key, valid until ECDSA_KEY_CACHE_SIZE other
+ *                    keys have been looked up or ecdsa_key_cache_clear().
+ */
+ecdsa_key_t *ecdsa_key_cache_get(point_t *pb_key);
+
+/**
+ * \brief             Drop all cached verification keys.
+ */
+void ecdsa_key_cache_clear(void);
+
+/**
+ * \brief             Verify count signatures, possibly with different keys.
+ *                    Signatures by the same key are verified one after the
+ *                    other so its table is built at most once, whatever the
+ *                    order of items. This is not batch verification in the
+ *                    cryptographic sense: every signature still costs a full
+ *                    verification, and only the table builds, a few percent
+ *                    of a verification each, are saved.
+ *
+ * \param items       The signatures; each result field is set.
+ * \param count       Number of items.
+ * \return            Number of items whose signature is valid.
+ */
+uint16_t ecdsa_verify_batch(ecdsa_verify_item_t *items, uint16_t count);
+#endif /* CONF_ECDSA_SIGN_ONLY */
+
 
 #endif /* __EDSA_H__ */
 
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "hmac_sha256.h"
+
+#define IPAD 0x36
+#define OPAD 0x5c
+
+HmacSha256::HmacSha256(const BYTE key[], size_t len) {
+  BYTE pad[HMAC_SHA256_BLOCK_LENGTH];
+  size_t i;
+
+  // Keys longer than a block are hashed first, shorter ones are zero padded.
+  memset(this->key_block, 0, HMAC_SHA256_BLOCK_LENGTH);
+  if (len > HMAC_SHA256_BLOCK_LENGTH) {
+    Sha256 key_hash;
+    key_hash.update(key, len);
+    key_hash.final(this->key_block);
+  } else {
+    memcpy(this->key_block, key, len);
+  }
+
+  for (i = 0; i < HMAC_SHA256_BLOCK_LENGTH; i++) {
+    pad[i] = this->key_block[i] ^ IPAD;
+  }
+  this->inner.update(pad, HMAC_SHA256_BLOCK_LENGTH);
+}
+
+void HmacSha256::update(const BYTE data[], size_t len) {
+  this->inner.update(data, len);
+}
+
+void HmacSha256::final(BYTE mac[]) {
+  BYTE inner_hash[HMAC_SHA256_DIGEST_LENGTH];
+  Sha256 outer;
+  size_t i;
+
+  this->inner.final(inner_hash);
+
+  // Reuse the key block as the outer pad, the instance is done after this.
+  for (i = 0; i < HMAC_SHA256_BLOCK_LENGTH; i++) {
+    this->key_block[i] ^= OPAD;
+  }
+  outer.update(this->key_block, HMAC_SHA256_BLOCK_LENGTH);
+  outer.update(inner_hash, HMAC_SHA256_DIGEST_LENGTH);
+  outer.final(mac);
+}
+
+void hkdf_sha256(const BYTE salt[], size_t salt_len, const BYTE ikm[],
+                 size_t ikm_len, const BYTE info[], size_t info_len,
+                 BYTE okm[], size_t okm_len) {
+  BYTE prk[HMAC_SHA256_DIGEST_LENGTH];
+  BYTE t[HMAC_SHA256_DIGEST_LENGTH];
+  BYTE counter = 1;
+
+  HmacSha256 extract(salt, salt_len);
+  extract.update(ikm, ikm_len);
+  extract.final(prk);
+
+  // T(n) = HMAC(PRK, T(n-1) || info || n), T(0) empty
+  while (okm_len > 0) {
+    HmacSha256 expand(prk, HMAC_SHA256_DIGEST_LENGTH);
+    if (counter > 1) {
+      expand.update(t, HMAC_SHA256_DIGEST_LENGTH);
+    }
+    expand.update(info, info_len);
+    expand.update(&counter, 1);
+    expand.final(t);
+
+    size_t n = okm_len < HMAC_SHA256_DIGEST_LENGTH ? okm_len
+                                                   : HMAC_SHA256_DIGEST_LENGTH;
+    memcpy(okm, t, n);
+    okm += n;
+    okm_len -= n;
+    counter++;
+  }
+  memset(prk, 0, sizeof(prk));
+  memset(t, 0, sizeof(t));
+}
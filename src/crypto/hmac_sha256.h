@@ -0,0 +1,43 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _HMAC_SHA256_H_
+#define _HMAC_SHA256_H_
+
+#include "sha256.h"
+
+#define HMAC_SHA256_BLOCK_LENGTH 64
+#define HMAC_SHA256_DIGEST_LENGTH 32
+
+// HMAC-SHA256 (RFC 2104) on top of Sha256. Like Sha256, an instance is
+// good for a single message: construct, update() any number of times, then
+// final().
+class HmacSha256 {
+  public:
+    HmacSha256(const BYTE key[], size_t len);
+    void update(const BYTE data[], size_t len);
+    void final(BYTE mac[]);
+  private:
+    Sha256 inner;
+    BYTE key_block[HMAC_SHA256_BLOCK_LENGTH];
+};
+
+// HKDF-SHA256 (RFC 5869): extracts a pseudorandom key from salt and ikm,
+// then expands it with info into okm_len (at most 255 * 32) bytes of okm.
+void hkdf_sha256(const BYTE salt[], size_t salt_len, const BYTE ikm[],
+                 size_t ikm_len, const BYTE info[], size_t info_len,
+                 BYTE okm[], size_t okm_len);
+
+#endif /* _HMAC_SHA256_H_ */
@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 /**
  * \defgroup x86 X86 specific implementation (might work on other systems as well)
  * \ingroup nn
@@ -6,6 +7,7 @@
  */
 
 #include "nn.h"
+#include <stdlib.h>
 #if !defined(WITH_CONTIKI) && defined(HAVE_ASSERT_H)
 #include <assert.h>
 #else
@@ -96,6 +98,7 @@ NN_AssignZero(NN_DIGIT *a, NN_UINT digits)
   }
 }
 /*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 void
 NN_Assign2Exp(NN_DIGIT *a, NN_UINT2 b, NN_UINT digits)
 {
@@ -107,6 +110,7 @@ NN_Assign2Exp(NN_DIGIT *a, NN_UINT2 b, NN_UINT digits)
 
   a[b / NN_DIGIT_BITS] = (NN_DIGIT)1 << (b % NN_DIGIT_BITS);
 }
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /*---------------------------------------------------------------------------*/
 void
 NN_AssignDigit(NN_DIGIT * a, NN_DIGIT b, NN_UINT digits)
@@ -163,7 +167,8 @@ NN_Sub(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 void
 NN_Mult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 {
-  NN_DIGIT t[2 * MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t, 2 * MAX_NN_DIGITS);
   unsigned int b_digits, c_digits, i;
 
   NN_AssignZero (t, 2 * digits);
@@ -228,7 +233,10 @@ NN_RShift(NN_DIGIT *a, NN_DIGIT *b, NN_UINT c, NN_UINT digits)
 void
 NN_Div(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT c_digits, NN_DIGIT *d, NN_UINT d_digits)
 {
-  NN_DIGIT ai, cc[2 * MAX_NN_DIGITS+1], dd[MAX_NN_DIGITS], t;
+  NN_DIGIT ai, t;
+  NN_SCRATCH_FRAME();
+  NN_TEMP(cc, 2 * MAX_NN_DIGITS+1);
+  NN_TEMP(dd, MAX_NN_DIGITS);
 
   int i;
   int dd_digits, shift;
@@ -283,7 +291,8 @@ NN_DigitDiv(NN_DIGIT *a, NN_DIGIT b[2], NN_DIGIT c)
 void
 NN_Sqr(NN_DIGIT *a, NN_DIGIT *b, NN_UINT digits)
 {
-  NN_DIGIT t[2 * MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t, 2 * MAX_NN_DIGITS);
   NN_UINT b_digits, i;
 
   NN_AssignZero (t, 2 * digits);
@@ -307,7 +316,8 @@ NN_Mod(NN_DIGIT *a, NN_DIGIT *b, NN_UINT b_digits, NN_DIGIT *c, NN_UINT c_digits
 void
 NN_ModAdd(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_UINT digits)
 {
-  NN_DIGIT tmp[MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(tmp, MAX_NN_DIGITS);
   NN_DIGIT carry;
 
   carry = NN_Add(tmp, b, c, digits);
@@ -324,7 +334,8 @@ NN_ModAdd(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_UINT digits
 void
 NN_ModSub(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_UINT digits)
 {
-  NN_DIGIT tmp[MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(tmp, MAX_NN_DIGITS);
   NN_DIGIT borrow;
 
   borrow = NN_Sub(tmp, b, c, digits);
@@ -339,7 +350,8 @@ NN_ModSub(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_UINT digits
 void
 NN_ModMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits)
 {
-  NN_DIGIT t[2 * MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t, 2 * MAX_NN_DIGITS);
 
   //memset(t, 0, 2*MAX_NN_DIGITS*NN_DIGIT_LEN);
   t[2 * MAX_NN_DIGITS-1] = 0;
@@ -348,6 +360,7 @@ NN_ModMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits)
   NN_Mod(a, t, 2 * digits, d, digits);
 }
 /*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 void
 NN_ModExp(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT c_digits, NN_DIGIT *d, NN_UINT d_digits)
 {
@@ -389,13 +402,20 @@ NN_ModExp(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT c_digits, NN_DIGIT *d,
 
   NN_Assign(a, t, d_digits);
 }
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /*---------------------------------------------------------------------------*/
 void
 NN_ModInv(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 {
-  NN_DIGIT q[MAX_NN_DIGITS], t1[MAX_NN_DIGITS], t3[MAX_NN_DIGITS],
-          u1[MAX_NN_DIGITS], u3[MAX_NN_DIGITS], v1[MAX_NN_DIGITS],
-          v3[MAX_NN_DIGITS], w[2 * MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(q, MAX_NN_DIGITS);
+  NN_TEMP(t1, MAX_NN_DIGITS);
+  NN_TEMP(t3, MAX_NN_DIGITS);
+  NN_TEMP(u1, MAX_NN_DIGITS);
+  NN_TEMP(u3, MAX_NN_DIGITS);
+  NN_TEMP(v1, MAX_NN_DIGITS);
+  NN_TEMP(v3, MAX_NN_DIGITS);
+  NN_TEMP(w, 2 * MAX_NN_DIGITS);
   int u1Sign;
 
   /* Apply extended Euclidean algorithm, modified to avoid negative numbers. */
@@ -428,8 +448,9 @@ NN_ModInv(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 void
 NN_ModMultOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT digits)
 {
-  NN_DIGIT t1[2*MAX_NN_DIGITS];
-  NN_DIGIT t2[2*MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t1, 2*MAX_NN_DIGITS);
+  NN_TEMP(t2, 2*MAX_NN_DIGITS);
   NN_DIGIT *pt1;
   NN_UINT len_t2, len_t1;
 
@@ -470,6 +491,7 @@ NN_ModMultOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_DIGIT *
 
 }
 /*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 void
 NN_ModDivOpt(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits)
 {
@@ -529,12 +551,14 @@ NN_ModDivOpt(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits)
 
   NN_Assign(a, U, digits);
 }
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /*---------------------------------------------------------------------------*/
 void
 NN_ModSqrOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT digits)
 {
-  NN_DIGIT t1[2*MAX_NN_DIGITS];
-  NN_DIGIT t2[2*MAX_NN_DIGITS];
+  NN_SCRATCH_FRAME();
+  NN_TEMP(t1, 2*MAX_NN_DIGITS);
+  NN_TEMP(t2, 2*MAX_NN_DIGITS);
   NN_DIGIT *pt1;
   NN_UINT len_t1, len_t2;
 
@@ -572,6 +596,7 @@ NN_ModSqrOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT
 
 }
 /*--------------------------- OTHER OPERATIONS -------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 void
 NN_Gcd(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 {
@@ -589,6 +614,7 @@ NN_Gcd(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
   NN_Assign(a, u, digits);
 
 }
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
 /*---------------------------------------------------------------------------*/
 int
@@ -626,6 +652,7 @@ NN_Zero(NN_DIGIT *a, NN_UINT digits)
   return 1;
 }
 /*---------------------------------------------------------------------------*/
+#ifndef CONF_ECDSA_SIGN_ONLY
 int
 NN_One(NN_DIGIT * a, NN_UINT digits)
 {
@@ -642,6 +669,7 @@ NN_One(NN_DIGIT * a, NN_UINT digits)
 
   return FALSE;
 }
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /*---------------------------------------------------------------------------*/
 unsigned int
 NN_Bits(NN_DIGIT *a, NN_UINT digits)
@@ -751,6 +779,83 @@ NN_ModSmall(NN_DIGIT * b, NN_DIGIT * c, NN_UINT digits)
   }
 }
 
+/*--------------------------- SCRATCH WORKSPACE ------------------------------*/
+#ifdef CONF_NN_SCRATCH
+#include "ecc.h"
+
+static NN_DIGIT scratch_default[NN_SCRATCH_DIGITS];
+static NN_DIGIT *scratch = scratch_default;
+static NN_UINT2 scratch_size = NN_SCRATCH_DIGITS;
+static NN_UINT2 scratch_used = 0;
+static NN_UINT2 scratch_peak = 0;
+
+void
+NN_ScratchAttach(NN_DIGIT *workspace, NN_UINT2 digits)
+{
+  if(workspace) {
+    scratch = workspace;
+    scratch_size = digits;
+  } else {
+    scratch = scratch_default;
+    scratch_size = NN_SCRATCH_DIGITS;
+  }
+  scratch_used = 0;
+}
+/*---------------------------------------------------------------------------*/
+NN_UINT2
+NN_ScratchHighWater(void)
+{
+  return scratch_peak;
+}
+/*---------------------------------------------------------------------------*/
+NN_DIGIT *
+NN_ScratchAlloc(NN_UINT2 digits)
+{
+  NN_DIGIT *p = scratch + scratch_used;
+
+  /* An undersized workspace was attached. Carrying on would overwrite what
+   * follows it, and callers can not recover from a missing temporary. */
+  if(digits > scratch_size - scratch_used) {
+    abort();
+  }
+  scratch_used += digits;
+  if(scratch_used > scratch_peak) {
+    scratch_peak = scratch_used;
+  }
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+NN_ScratchFrame::NN_ScratchFrame()
+{
+  mark = scratch_used;
+}
+/*---------------------------------------------------------------------------*/
+NN_ScratchFrame::~NN_ScratchFrame()
+{
+  scratch_used = mark;
+}
+#else
+void
+NN_ScratchAttach(NN_DIGIT *workspace, NN_UINT2 digits)
+{
+  (void)workspace;
+  (void)digits;
+}
+/*---------------------------------------------------------------------------*/
+NN_UINT2
+NN_ScratchHighWater(void)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+NN_DIGIT *
+NN_ScratchAlloc(NN_UINT2 digits)
+{
+  (void)digits;
+  return 0;
+}
+#endif /* CONF_NN_SCRATCH */
+
 /**
  * @}
  */
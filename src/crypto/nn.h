@@ -1,4 +1,5 @@
-// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.
+// AUTOGENERATED by pull_crypto.sh with the local changes in crypto.patch.
+// Edit the patch, not this file. See CONTRIBUTING.md for instructions.
 #define SECP256R1
 #define THIRTYTWO_BIT_PROCESSOR
 /**
@@ -196,12 +197,14 @@ void NN_Assign(NN_DIGIT *a, NN_DIGIT *b, NN_UINT digits);
  *              Lengths: a[digits].
  */
 void NN_AssignZero(NN_DIGIT *a, NN_UINT digits);
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief       Assigns a = 2^b.
  *              Lengths: a[digits].
  *              Requires b < digits * NN_DIGIT_BITS.
  */
 void NN_Assign2Exp(NN_DIGIT *a, NN_UINT2 b, NN_UINT digits);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /**
  * \brief       Assigns a = b, where b is a digit.
  */
@@ -292,12 +295,14 @@ void NN_ModSub(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_UINT d
  *              Assumes d > 0, digits < MAX_NN_DIGITS.
  */
 void NN_ModMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits);
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief       Computes a = b^c mod d.
  *              Lengths: a[d_digits], b[d_digits], c[c_digits], d[d_digits].
  *              Assumes d > 0, cDigits > 0, dDigits < MAX_NN_DIGITS.
  */
 void NN_ModExp(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT c_digits, NN_DIGIT *d, NN_UINT d_digits);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /**
  * \brief       Compute a = 1/b mod c, assuming inverse exists.
  *              a, b, c can be same
@@ -311,12 +316,14 @@ void NN_ModInv(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits);
  *              (Integer multipication with curve-specific optimizations)
  */
 void NN_ModMultOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT digits);
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief       Computes a= b/c mod d
  *              Algorithm in "From Euclid's GCD to Montgomery Multiplication
  *              to the Great Divide"
  */
 void NN_ModDivOpt(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /**
  * \brief       Computes a = b^2 mod d
  *              d is generalized mersenne prime, d = 2^KEYBITS - omega
@@ -347,10 +354,12 @@ int NN_Zero(NN_DIGIT *a, NN_UINT digits);
  *              Lengths: a[digits].
  */
 unsigned int NN_Bits(NN_DIGIT *a, NN_UINT digits);
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief       returns 1 iff a = 1
  */
 int NN_One(NN_DIGIT * a, NN_UINT digits);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 /**
  * \brief       Returns the significant length of a in digits.
  *              Lengths: a[digits].
@@ -378,6 +387,7 @@ NN_DIGIT NN_SubDigitMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT c, NN_DIGIT *d, NN_U
  *              Lengths: b[digits], c[digits].
  */
 void NN_ModSmall(NN_DIGIT * b, NN_DIGIT * c, NN_UINT digits);
+#ifndef CONF_ECDSA_SIGN_ONLY
 /**
  * \brief       Computes a = gcd(b, c).
  *              a, b, c can be same
@@ -385,9 +395,57 @@ void NN_ModSmall(NN_DIGIT * b, NN_DIGIT * c, NN_UINT digits);
  *              Assumes b > c, digits < MAX_NN_DIGITS.
  */
 void NN_Gcd(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits);
+#endif /* CONF_ECDSA_SIGN_ONLY */
 
 NN_UINT omega_mul(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *omega, NN_UINT digits);
 
+/*************************** SCRATCH WORKSPACE *******************************/
+
+/**
+ * By default the big-number temporaries of the NN, ECC and ECDSA routines
+ * live on the stack. Define CONF_NN_SCRATCH to take them from a scratch
+ * workspace instead, so the signing call tree only keeps a few bytes of
+ * bookkeeping per frame on the stack. The workspace is a static buffer of
+ * NN_SCRATCH_DIGITS digits (see ecc.h) unless another one is attached with
+ * NN_ScratchAttach(). The workspace is not reentrant: do not sign from two
+ * tasks at once.
+ */
+
+/**
+ * \brief       Attach a scratch workspace of at least NN_SCRATCH_DIGITS
+ *              digits, or pass NULL to go back to the built-in one.
+ *              Running out of workspace calls abort(). Does nothing
+ *              without CONF_NN_SCRATCH.
+ */
+void NN_ScratchAttach(NN_DIGIT *workspace, NN_UINT2 digits);
+/**
+ * \brief       Returns the peak number of workspace digits used so far.
+ */
+NN_UINT2 NN_ScratchHighWater(void);
+/**
+ * \brief       Takes digits from the scratch workspace. Use NN_TEMP instead.
+ */
+NN_DIGIT *NN_ScratchAlloc(NN_UINT2 digits);
+
+#ifdef CONF_NN_SCRATCH
+/* Gives back everything allocated in the enclosing scope when it ends. */
+class NN_ScratchFrame {
+ public:
+  NN_ScratchFrame();
+  ~NN_ScratchFrame();
+ private:
+  NN_UINT2 mark;
+};
+#define NN_SCRATCH_FRAME() NN_ScratchFrame nn_scratch_frame
+#define NN_TEMP(name, digits) NN_DIGIT *name = NN_ScratchAlloc(digits)
+#define NN_TEMP_POINT(name) \
+  point_t *name = (point_t *)NN_ScratchAlloc(sizeof(point_t) / NN_DIGIT_LEN)
+#else
+#define NN_SCRATCH_FRAME() do {} while(0)
+#define NN_TEMP(name, digits) NN_DIGIT name[digits]
+#define NN_TEMP_POINT(name) point_t name##_storage; point_t *name = &name##_storage
+#endif /* CONF_NN_SCRATCH */
+
 
 #endif /* __NN_H__ */
 
@@ -14,18 +14,113 @@
  *****************************************************************************/
 
 #include "prng.h"
+#include "chacha20_poly1305.h"
 
 #if defined(ESP8266)
 #include "esp8266_peri.h"  // Can use RANDOM_REG32
+#elif defined(ESP32)
+#include <esp_system.h>  // esp_random()
+#elif defined(__linux__) || defined(__APPLE__)
+#include <stdio.h>
 #endif
 
+// ChaCha20 DRBG: the output is the ChaCha20 keystream, produced 64 bytes at
+// a time, under a key seeded from platform entropy. The key is replaced by
+// fresh keystream after every call, so earlier output can not be recovered
+// from the state, and fresh entropy is mixed in every PRNG_RESEED_BLOCKS
+// blocks.
+#define PRNG_BLOCK_SIZE CHACHA20_BLOCK_LENGTH
+#ifndef PRNG_RESEED_BLOCKS
+#define PRNG_RESEED_BLOCKS 1024
+#endif
+
+// constants, key[8], counter, nonce[3]
+static uint32_t state[16] = {
+  0x61707865, 0x3320646e, 0x79622d32, 0x6b206574
+};
+static unsigned char block[PRNG_BLOCK_SIZE];
+static size_t available = 0;
+static uint32_t blocks_until_reseed = 0;
+
+// Fills words with platform entropy.
+static void entropy(uint32_t *words, size_t count) {
+#if defined(__linux__) || defined(__APPLE__)
+  FILE *f = fopen("/dev/urandom", "rb");
+  if (f != NULL) {
+    size_t got = fread(words, sizeof(uint32_t), count, f);
+    fclose(f);
+    if (got == count) {
+      return;
+    }
+  }
+#endif
+  for (size_t i = 0; i < count; i++) {
+#if defined(ESP8266)
+    words[i] = RANDOM_REG32;
+#elif defined(ESP32)
+    words[i] = esp_random();
+#else
+    // No hardware RNG, take what timing jitter there is.
+    words[i] = ((uint32_t)random(0x10000) << 16) ^ random(0x10000) ^ micros();
+#endif
+  }
+}
+
+// Writes the next keystream block to out.
+static void next_block(unsigned char out[PRNG_BLOCK_SIZE]) {
+  chacha20_block(state, out);
+  state[12]++;
+  if (blocks_until_reseed > 0) {
+    blocks_until_reseed--;
+  }
+}
+
+// Replaces the key with fresh keystream.
+static void rekey() {
+  unsigned char next[PRNG_BLOCK_SIZE];
+
+  next_block(next);
+  for (int i = 0; i < 8; i++) {
+    state[4 + i] = next[4 * i] | (next[4 * i + 1] << 8) |
+        (next[4 * i + 2] << 16) | ((uint32_t)next[4 * i + 3] << 24);
+  }
+  state[12] = 0;
+  memset(next, 0, sizeof(next));
+}
+
+// Mixes platform entropy into key and nonce.
+static void reseed() {
+  uint32_t seed[11];
+
+  entropy(seed, 11);
+  for (int i = 0; i < 8; i++) {
+    state[4 + i] ^= seed[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    state[13 + i] ^= seed[8 + i];
+  }
+  memset(seed, 0, sizeof(seed));
+  blocks_until_reseed = PRNG_RESEED_BLOCKS;
+  rekey();
+}
+
 int prng(unsigned char *buf, size_t len) {
-  while (len--) {
-    #if defined(ESP8266)
-    *buf++ = RANDOM_REG32 % 255;
-    break;
-    #endif
-    *buf++ = random(0, 255);
+  while (len > 0) {
+    if (available == 0) {
+      if (blocks_until_reseed == 0) {
+        reseed();
+      }
+      next_block(block);
+      available = PRNG_BLOCK_SIZE;
+    }
+    size_t n = len < available ? len : available;
+    unsigned char *src = block + PRNG_BLOCK_SIZE - available;
+    memcpy(buf, src, n);
+    memset(src, 0, n);
+    buf += n;
+    len -= n;
+    available -= n;
   }
+  rekey();
   return 1;
 }
@@ -18,7 +18,9 @@
 
 #include <Arduino.h>
 
-// Fills buf with random chars.
+// Fills buf with random chars from a ChaCha20 DRBG seeded from platform
+// entropy (RANDOM_REG32 on ESP8266, esp_random() on ESP32, /dev/urandom on
+// hosts, random() and micros() elsewhere). Always returns 1.
 int prng(unsigned char *buf, size_t len);
 
 #endif /* _PRNG_H_ */
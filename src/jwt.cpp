@@ -18,8 +18,12 @@
 #include "crypto/ecdsa.h"
 #include "crypto/nn.h"
 #include "crypto/sha256.h"
+#include "CloudIoTCoreJson.h"
 #include "jwt.h"
 
+// Room for the claims, with a project id of up to 64 characters.
+#define JWT_PAYLOAD_SIZE 128
+
 // base64_encode copied from https://github.com/ReneNyffenegger/cpp-base64
 static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -75,48 +79,70 @@ String base64_encode(String str) {
   return base64_encode((const unsigned char *)str.c_str(), str.length());
 }
 
-// Get base64 signature string from the signature_r and signature_s ecdsa
-// signature.
-String MakeBase64Signature(NN_DIGIT *signature_r, NN_DIGIT *signature_s) {
-  unsigned char signature[64];
+EccLightSigner::EccLightSigner(NN_DIGIT *priv_key) {
+  this->priv_key = priv_key;
+}
+
+bool EccLightSigner::sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+                          unsigned char signature[JWT_SIGNATURE_LENGTH]) {
+  ecc_init();
+
+  // Signing sha with ec key. Signing does not need the public key, so there
+  // is no ecdsa_init() here.
+  // Use a nonce precomputed with ecdsa_pool_fill() if there is one, otherwise
+  // an RFC 6979 nonce so signing does not depend on the quality of prng().
+  NN_DIGIT signature_r[NUMWORDS], signature_s[NUMWORDS];
+  if (ecdsa_pool_available() > 0) {
+    ecdsa_sign((uint8_t *)digest, signature_r, signature_s, priv_key);
+  } else {
+    ecdsa_sign_deterministic((uint8_t *)digest, signature_r, signature_s, priv_key);
+  }
+
   NN_Encode(signature, (NUMWORDS - 1) * NN_DIGIT_LEN, signature_r,
             (NN_UINT)(NUMWORDS - 1));
   NN_Encode(signature + (NUMWORDS - 1) * NN_DIGIT_LEN,
             (NUMWORDS - 1) * NN_DIGIT_LEN, signature_s,
             (NN_UINT)(NUMWORDS - 1));
-
-  return base64_encode(signature, 64);
+  return true;
 }
 
 String CreateJwt(const char *project_id, long long int time, NN_DIGIT *priv_key, int jwt_exp_secs) {
-  ecc_init();
+  EccLightSigner signer(priv_key);
+  return CreateJwt(project_id, time, signer, jwt_exp_secs);
+}
+
+String CreateJwt(const char *project_id, long long int time, JwtSigner &signer, int jwt_exp_secs) {
   // Making jwt token json
 
   // payload
-  String payload = String("{\"iat\":") + (int) time
-    + ",\"exp\":" + (int) (time + jwt_exp_secs)
-    + ",\"aud\":\"" + project_id + "\"}";
+  char payload[JWT_PAYLOAD_SIZE];
+  JsonWriter json(payload, sizeof(payload));
+  json.beginObject()
+      .add("iat", time)
+      .add("exp", time + jwt_exp_secs)
+      .add("aud", project_id)
+      .endObject();
+  if (!json.ok()) {
+    return String();
+  }
 
   // header: base64_encode("{\"alg\":\"ES256\",\"typ\":\"JWT\"}") + "."
   String header_payload_base64 =
-      "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCJ9." + base64_encode(payload);
+      "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCJ9." +
+      base64_encode((const unsigned char *)json.c_str(), json.length());
 
   Sha256 sha256Instance;
   sha256Instance.update((const unsigned char *)header_payload_base64.c_str(), header_payload_base64.length());
   unsigned char sha256[SHA256_DIGEST_LENGTH];
   sha256Instance.final(sha256);
 
-  // Signing sha with ec key. Bellow is the ec private key.
-  point_t pub_key;
-  ecc_gen_pub_key(priv_key, &pub_key);
-
-  ecdsa_init(&pub_key);
-
-  NN_DIGIT signature_r[NUMWORDS], signature_s[NUMWORDS];
-  ecdsa_sign((uint8_t *)sha256, signature_r, signature_s, priv_key);
+  unsigned char signature[JWT_SIGNATURE_LENGTH];
+  if (!signer.sign(sha256, signature)) {
+    return String();
+  }
 
   return header_payload_base64 + "." +
-         MakeBase64Signature(signature_r, signature_s);
+         base64_encode(signature, JWT_SIGNATURE_LENGTH);
 }
 
 String CreateJwt(String &project_id, long long int time, NN_DIGIT *priv_key, int jwt_exp_secs) {
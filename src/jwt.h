@@ -19,8 +19,33 @@
 #include <Arduino.h>
 #include "crypto/nn.h"
 
+#define JWT_DIGEST_LENGTH 32
+#define JWT_SIGNATURE_LENGTH 64
+
+// Signing backend for CreateJwt: turns the SHA-256 digest of the JWT header
+// and claims into an ES256 signature.
+class JwtSigner {
+  public:
+    virtual ~JwtSigner() {}
+    // Writes the P-256 signature of digest as r || s, 32 big endian bytes
+    // each. Returns false if the digest could not be signed.
+    virtual bool sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+                      unsigned char signature[JWT_SIGNATURE_LENGTH]) = 0;
+};
+
+// The built-in signer using the crypto/ ECDSA code. Does not copy the key.
+class EccLightSigner : public JwtSigner {
+  public:
+    EccLightSigner(NN_DIGIT *priv_key);
+    bool sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+              unsigned char signature[JWT_SIGNATURE_LENGTH]);
+  private:
+    NN_DIGIT *priv_key;
+};
+
 String CreateJwt(String &project_id, long long int time, NN_DIGIT *priv_key);
 String CreateJwt(String &project_id, long long int time, NN_DIGIT *priv_key, int jwt_exp_secs);
 String CreateJwt(const char *project_id, long long int time, NN_DIGIT *priv_key, int jwt_exp_secs);
+String CreateJwt(const char *project_id, long long int time, JwtSigner &signer, int jwt_exp_secs);
 
 #endif  // JWT_H_
@@ -0,0 +1,70 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifdef CONF_OPENSSL_SIGNER
+
+// EC_KEY and ECDSA_do_sign are deprecated in OpenSSL 3.0 but still present;
+// they keep this file building against 1.1.1 as well.
+#ifndef OPENSSL_API_COMPAT
+#define OPENSSL_API_COMPAT 0x10101000L
+#endif
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+
+#include "jwt_openssl.h"
+
+OpenSslSigner::OpenSslSigner(const unsigned char *private_key) {
+  key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  BIGNUM *d = BN_bin2bn(private_key, JWT_DIGEST_LENGTH, NULL);
+  const EC_GROUP *group = key != NULL ? EC_KEY_get0_group(key) : NULL;
+  EC_POINT *pub = group != NULL ? EC_POINT_new(group) : NULL;
+
+  // libcrypto wants the public key alongside the private one.
+  if (d == NULL || pub == NULL ||
+      !EC_POINT_mul(group, pub, d, NULL, NULL, NULL) ||
+      !EC_KEY_set_private_key(key, d) || !EC_KEY_set_public_key(key, pub)) {
+    EC_KEY_free(key);
+    key = NULL;
+  }
+  EC_POINT_free(pub);
+  BN_clear_free(d);
+}
+
+OpenSslSigner::~OpenSslSigner() {
+  EC_KEY_free(key);
+}
+
+bool OpenSslSigner::sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+                         unsigned char signature[JWT_SIGNATURE_LENGTH]) {
+  if (key == NULL) {
+    return false;
+  }
+  ECDSA_SIG *sig = ECDSA_do_sign(digest, JWT_DIGEST_LENGTH, key);
+  if (sig == NULL) {
+    return false;
+  }
+  const BIGNUM *r, *s;
+  ECDSA_SIG_get0(sig, &r, &s);
+  bool ok = BN_bn2binpad(r, signature, JWT_SIGNATURE_LENGTH / 2) > 0 &&
+            BN_bn2binpad(s, signature + JWT_SIGNATURE_LENGTH / 2,
+                         JWT_SIGNATURE_LENGTH / 2) > 0;
+  ECDSA_SIG_free(sig);
+  return ok;
+}
+
+#endif /* CONF_OPENSSL_SIGNER */
@@ -0,0 +1,44 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef JWT_OPENSSL_H_
+#define JWT_OPENSSL_H_
+
+// JWT signer backed by OpenSSL's libcrypto, for host and Linux gateway builds
+// that link against it. Build with -DCONF_OPENSSL_SIGNER and -lcrypto, then
+// hand an OpenSslSigner to CloudIoTCoreDevice::setSigner().
+#ifdef CONF_OPENSSL_SIGNER
+
+#include "jwt.h"
+
+typedef struct ec_key_st EC_KEY;
+
+class OpenSslSigner : public JwtSigner {
+  public:
+    // private_key is the 32 byte big endian P-256 private key, in the same
+    // layout accepted by CloudIoTCoreDevice::setPrivateKey().
+    OpenSslSigner(const unsigned char *private_key);
+    ~OpenSslSigner();
+    bool sign(const unsigned char digest[JWT_DIGEST_LENGTH],
+              unsigned char signature[JWT_SIGNATURE_LENGTH]);
+  private:
+    EC_KEY *key;
+    OpenSslSigner(const OpenSslSigner &);
+    OpenSslSigner &operator=(const OpenSslSigner &);
+};
+
+#endif /* CONF_OPENSSL_SIGNER */
+
+#endif  // JWT_OPENSSL_H_
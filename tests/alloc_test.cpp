@@ -0,0 +1,79 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Heap use of the publish paths. malloc is wrapped to count calls, which
+// also counts operator new, and to fail on request: publishing must not
+// allocate, and must fail rather than go to a bogus topic when the device
+// could not allocate its topics.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+static long allocations = 0;
+static bool failAllocations = false;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *malloc(size_t size) {
+  allocations++;
+  return failAllocations ? NULL : __libc_malloc(size);
+}
+
+int main() {
+  CloudIoTCoreDevice device("my-project", "us-central1", "my-registry",
+                            "my-device-0001");
+  MQTTClient mqttClient;
+  mqttClient.record = false;
+  Client client;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+  String payload("{\"temp\":21.5}");
+  String subtopic("/sensors");
+  const char *raw = "{\"temp\":21.5}";
+
+  long before = allocations;
+  for (int i = 0; i < 1000; i++) {
+    CHECK(mqtt.publishTelemetry(payload));
+    CHECK(mqtt.publishTelemetry(payload, 1));
+    CHECK(mqtt.publishTelemetry(raw, 13));
+    CHECK(mqtt.publishTelemetry(subtopic, payload));
+    CHECK(mqtt.publishTelemetry(subtopic, raw, 13));
+    CHECK(mqtt.publishState(payload));
+    CHECK(mqtt.publishState(raw));
+    CHECK(mqtt.publishState(raw, 13));
+  }
+  long used = allocations - before;
+  printf("  8000 publishes, %ld allocations\n", used);
+  CHECK(used == 0);
+  CHECK(mqttClient.published == 8000);
+  CHECK(strcmp(device.getEventsTopicView(),
+               "/devices/my-device-0001/events") == 0);
+
+  // The topics are rendered again, into a failed allocation.
+  failAllocations = true;
+  device.setDeviceId("my-device-0002");
+  failAllocations = false;
+  CHECK(device.getEventsTopicView()[0] == '\0');
+  CHECK(!mqtt.publishTelemetry(payload));
+  CHECK(!mqtt.publishTelemetry(subtopic, raw, 13));
+  CHECK(!mqtt.publishState(payload));
+  CHECK(!mqtt.publishState(raw, 13));
+  CHECK(mqtt.openTelemetryChannel(subtopic) == NULL);
+  CHECK(mqtt.openStateChannel() == NULL);
+  CHECK(mqttClient.published == 8000);
+
+  // The next id change renders them.
+  device.setDeviceId("my-device-0003");
+  CHECK(mqtt.publishTelemetry(payload));
+  CHECK(mqttClient.published == 8001);
+  return TEST_RESULT();
+}
@@ -0,0 +1,244 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// TelemetryBatch frames decoded as the header documents them: ages and
+// deltas, samples in order per subfolder across many trips round the ring,
+// the oldest samples dropped when full, each flush threshold, and the depth,
+// byte and drop counters.
+
+#include <deque>
+#include <stdlib.h>
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreBatch.h"
+
+struct Sample {
+  uint32_t delta;
+  std::string data;
+};
+
+struct Frame {
+  uint32_t age;
+  std::vector<Sample> samples;
+};
+
+static bool getVarint(const std::string &in, size_t *pos, uint32_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*pos >= in.size()) {
+      return false;
+    }
+    unsigned char b = in[(*pos)++];
+    *value |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Decodes a whole frame; false if anything is off or left over.
+static bool decode(const std::string &in, Frame *frame) {
+  size_t pos = 0;
+  uint32_t count, length;
+  if (in.empty() || in[pos++] != BATCH_VERSION ||
+      !getVarint(in, &pos, &count) || !getVarint(in, &pos, &frame->age)) {
+    return false;
+  }
+  frame->samples.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    Sample sample;
+    if (!getVarint(in, &pos, &sample.delta) ||
+        !getVarint(in, &pos, &length) || pos + length > in.size()) {
+      return false;
+    }
+    sample.data = in.substr(pos, length);
+    pos += length;
+    frame->samples.push_back(sample);
+  }
+  return pos == in.size();
+}
+
+// Frames the next subfolder at now.
+static bool next(TelemetryBatch *batch, unsigned long now, std::string *subtopic,
+                 Frame *frame, int *qos) {
+  const char *topic;
+  size_t length;
+  const char *payload = batch->next(now, &topic, &length, qos);
+  if (payload == NULL) {
+    return false;
+  }
+  *subtopic = topic;
+  return decode(std::string(payload, length), frame);
+}
+
+static bool add(TelemetryBatch *batch, const char *subtopic,
+                const std::string &data, int qos, unsigned long now) {
+  return batch->add(subtopic, data.data(), data.size(), qos, now);
+}
+
+struct Queued {
+  std::string subtopic, data;
+  unsigned long at;
+};
+
+int main() {
+  std::string subtopic;
+  Frame frame;
+  int qos;
+
+  // The example from the header: the age once, then a delta per sample.
+  {
+    TelemetryBatch batch;
+    CHECK(!next(&batch, 0, &subtopic, &frame, &qos));
+    CHECK(add(&batch, "/a", "A", 0, 100));
+    CHECK(add(&batch, "/b", "BB", 1, 120));
+    CHECK(add(&batch, "/a", "AA", 1, 150));
+    CHECK(add(&batch, "/a", "AAA", 0, 160));
+    CHECK(batch.depth() == 4);
+    CHECK(batch.queuedBytes() == 4 * BATCH_RECORD_HEADER_LENGTH + 4 * 2 + 8);
+
+    const char *topic;
+    size_t length;
+    const char *payload = batch.next(200, &topic, &length, &qos);
+    const unsigned char expected[] = {1, 3, 100, 0, 1, 'A', 50, 2, 'A', 'A',
+                                      10, 3, 'A', 'A', 'A'};
+    CHECK(length == sizeof(expected) &&
+          memcmp(payload, expected, length) == 0);
+    CHECK(strcmp(topic, "/a") == 0 && qos == 1);
+    batch.remove();
+    CHECK(batch.depth() == 1);
+    CHECK(batch.queuedBytes() == BATCH_RECORD_HEADER_LENGTH + 2 + 2);
+
+    CHECK(next(&batch, 300, &subtopic, &frame, &qos));
+    CHECK(subtopic == "/b" && qos == 1 && frame.age == 180);
+    CHECK(frame.samples.size() == 1 && frame.samples[0].delta == 0 &&
+          frame.samples[0].data == "BB");
+    // A sample queued between next() and remove() keeps the frame queued.
+    CHECK(add(&batch, "/b", "late", 0, 310));
+    batch.remove();
+    CHECK(batch.depth() == 2);
+    CHECK(next(&batch, 320, &subtopic, &frame, &qos));
+    CHECK(frame.samples.size() == 2 && frame.samples[1].delta == 190);
+    batch.remove();
+    CHECK(batch.depth() == 0 && batch.queuedBytes() == 0);
+    CHECK(batch.droppedCount() == 0);
+  }
+
+  // Many trips round the ring with two subfolders, checked against a model.
+  {
+    TelemetryBatch batch(BATCH_BUFFER_SIZE, 1000, 1000000);
+    std::deque<Queued> model;
+    const char *topics[] = {"/temp", "/humidity/inside"};
+    unsigned long now = 0xffff0000UL;  // millis() wraps on the way
+    size_t total = 0;
+    srand(7);
+    for (int i = 0; i < 5000; i++) {
+      now += rand() % 300;
+      Queued q = {topics[rand() % 2 ? 1 : 0],
+                  std::string(1 + rand() % 60, 'a' + i % 26), now};
+      CHECK(add(&batch, q.subtopic.c_str(), q.data, 0, now));
+      model.push_back(q);
+      total += q.data.size();
+      if (batch.queuedBytes() < 400) {
+        continue;
+      }
+      now += 5;
+      while (next(&batch, now, &subtopic, &frame, &qos)) {
+        std::vector<Queued> expected;
+        for (const Queued &m : model) {
+          if (m.subtopic == subtopic) {
+            expected.push_back(m);
+          }
+        }
+        CHECK(!expected.empty() && expected[0].subtopic == model[0].subtopic);
+        CHECK(frame.samples.size() == expected.size());
+        CHECK(frame.age == now - expected[0].at);
+        for (size_t j = 0; j < frame.samples.size() && j < expected.size();
+             j++) {
+          CHECK(frame.samples[j].data == expected[j].data);
+          CHECK(frame.samples[j].delta ==
+                (j ? expected[j].at - expected[j - 1].at : 0));
+        }
+        batch.remove();
+        for (size_t j = 0; j < model.size();) {
+          if (model[j].subtopic == subtopic) {
+            model.erase(model.begin() + j);
+          } else {
+            j++;
+          }
+        }
+        CHECK(batch.depth() == model.size());
+      }
+      CHECK(model.empty());
+    }
+    CHECK(total > 20 * BATCH_BUFFER_SIZE);
+    CHECK(batch.droppedCount() == 0);
+  }
+
+  // Full: the oldest samples make room for new ones.
+  {
+    TelemetryBatch batch(BATCH_BUFFER_SIZE, 1000, 1000000);
+    const size_t record = BATCH_RECORD_HEADER_LENGTH + 2 + 40;
+    const size_t fit = BATCH_BUFFER_SIZE / record;
+    for (size_t i = 0; i < fit + 5; i++) {
+      CHECK(add(&batch, "/d", std::string(40, 'a' + i % 26), 0, i));
+    }
+    CHECK(batch.depth() == fit);
+    CHECK(batch.queuedBytes() == fit * record);
+    CHECK(batch.droppedCount() == 5);
+    CHECK(next(&batch, fit + 5, &subtopic, &frame, &qos));
+    CHECK(frame.samples.size() == fit && frame.age == fit);
+    CHECK(frame.samples[0].data == std::string(40, 'a' + 5));
+    CHECK(frame.samples[fit - 1].data == std::string(40, 'a' + (fit + 4) % 26));
+
+    // A sample that can never fit is refused and counted.
+    CHECK(!add(&batch, "/d", std::string(BATCH_BUFFER_SIZE, 'x'), 0, 0));
+    CHECK(!batch.add(std::string(256, 's').c_str(), "x", 1, 0, 0));
+    CHECK(batch.droppedCount() == 7);
+    CHECK(batch.depth() == fit);
+  }
+
+  // Each flush threshold on its own.
+  {
+    TelemetryBatch samples(BATCH_BUFFER_SIZE, 3, 1000000);
+    CHECK(!samples.isDue(0));
+    add(&samples, "/s", "1", 0, 0);
+    add(&samples, "/s", "2", 0, 0);
+    CHECK(!samples.isDue(0));
+    add(&samples, "/s", "3", 0, 0);
+    CHECK(samples.isDue(0));
+
+    const size_t record = BATCH_RECORD_HEADER_LENGTH + 2 + 10;
+    TelemetryBatch bytes(3 * record, 1000, 1000000);
+    add(&bytes, "/b", "0123456789", 0, 0);
+    add(&bytes, "/b", "0123456789", 0, 0);
+    CHECK(!bytes.isDue(0));
+    add(&bytes, "/b", "012345678", 0, 0);
+    CHECK(!bytes.isDue(0) && bytes.queuedBytes() == 3 * record - 1);
+    add(&bytes, "/b", "", 0, 0);
+    CHECK(bytes.isDue(0));
+
+    TelemetryBatch latency(BATCH_BUFFER_SIZE, 1000, 500);
+    add(&latency, "/l", "x", 0, 0xfffffff0UL);
+    add(&latency, "/l", "y", 0, 0x100);
+    CHECK(!latency.isDue(0xfffffff0UL + 499));
+    CHECK(latency.isDue(0xfffffff0UL + 500));  // across the millis() wrap
+    CHECK(next(&latency, 0x200, &subtopic, &frame, &qos));
+    CHECK(frame.age == 0x210 && frame.samples[1].delta == 0x110);
+    latency.remove();
+    CHECK(!latency.isDue(0x1000));
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,99 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// A broker behind a link with a fixed round trip, on the fake clock, for the
+// publish window tests and benchmarks. QoS 1 PUBLISH packets are parsed and
+// acknowledged rtt later. Each PUBACK comes behind a PINGRESP and is read at
+// most 3 bytes at a time, to exercise the window's packet framing.
+
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <utility>
+#include "Arduino.h"
+#include "Client.h"
+
+class BrokerLink : public Client {
+  public:
+    unsigned long rtt = 300;
+    int dropAcks = 0;                        // PUBACKs to lose
+    std::vector<std::pair<int, bool>> pubs;  // id and DUP of each PUBLISH
+    std::multiset<std::string> payloads;
+
+    size_t write(const uint8_t *b, size_t n) {
+      written += n;
+      writes++;
+      if ((b[0] & 0xf0) != 0x30 || ((b[0] >> 1) & 3) != 1) {
+        return n;
+      }
+      size_t p = 1, rem = 0, shift = 0;
+      do {
+        rem |= (size_t)(b[p] & 0x7f) << shift;
+        shift += 7;
+      } while (b[p++] & 0x80);
+      size_t end = p + rem;
+      p += 2 + ((b[p] << 8) | b[p + 1]);
+      int id = (b[p] << 8) | b[p + 1];
+      p += 2;
+      pubs.push_back(std::make_pair(id, (b[0] & 0x08) != 0));
+      payloads.insert(std::string((const char *)b + p, end - p));
+      if (dropAcks > 0) {
+        dropAcks--;
+        return n;
+      }
+      std::string ack("\xd0\x00\x40\x02", 4);
+      ack += (char)(id >> 8);
+      ack += (char)id;
+      in.push_back(Incoming{fakeMillis + rtt, ack});
+      return n;
+    }
+
+    int available() {
+      int n = 0;
+      for (auto &i : in) {
+        if (i.at <= fakeMillis) {
+          n += i.bytes.size();
+        }
+      }
+      return n;
+    }
+
+    int read(uint8_t *buf, size_t size) {
+      if (in.empty() || in.front().at > fakeMillis) {
+        return 0;
+      }
+      size_t n = std::min(std::min(size, (size_t)3), in.front().bytes.size());
+      memcpy(buf, in.front().bytes.data(), n);
+      in.front().bytes.erase(0, n);
+      if (in.front().bytes.empty()) {
+        in.pop_front();
+      }
+      return n;
+    }
+
+    // Moves the clock to when the last PUBACK sent arrives.
+    void waitForAcks() {
+      if (!in.empty()) {
+        fakeMillis = std::max(fakeMillis, in.back().at);
+      }
+    }
+
+  private:
+    struct Incoming {
+      unsigned long at;
+      std::string bytes;
+    };
+    std::deque<Incoming> in;
+};
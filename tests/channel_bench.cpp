@@ -0,0 +1,51 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Publishes per second through a channel against
+// publishTelemetry(subtopic, data), to a client that only counts bytes.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+int main() {
+  CloudIoTCoreDevice device("my-project", "us-central1", "my-registry",
+                            "my-device-0001");
+  MQTTClient mqttClient;
+  Client client;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+  mqttClient.begin("host", 8883, client);
+  mqttClient.record = false;
+
+  const int n = 2000000;
+  int lengths[] = {8, 32, 128};
+  for (int len : lengths) {
+    String subtopic("/sensors");
+    String data(std::string(len, 'x').c_str());
+    double t0 = now();
+    for (int i = 0; i < n; i++) {
+      mqtt.publishTelemetry(subtopic, data);
+    }
+    double direct = now() - t0;
+    PublishChannel *channel = mqtt.openTelemetryChannel(subtopic);
+    t0 = now();
+    for (int i = 0; i < n; i++) {
+      channel->publish(data);
+    }
+    double fast = now() - t0;
+    delete channel;
+    printf("payload %3d bytes: publishTelemetry %6.2f M/s, channel %6.2f M/s "
+           "(%.2fx)\n", len, n / direct / 1e6, n / fast / 1e6, direct / fast);
+  }
+  return 0;
+}
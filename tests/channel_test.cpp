@@ -0,0 +1,96 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Publish channels send the same bytes as MQTTClient::publish, and hand off
+// to it, or to publishEvent, whenever the fast path does not apply.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+// Keeps the last write.
+class CaptureClient : public Client {
+  public:
+    std::string last;
+    size_t write(const uint8_t *data, size_t size) {
+      last.assign((const char *)data, size);
+      written += size;
+      writes++;
+      return size;
+    }
+};
+
+int main() {
+  CloudIoTCoreDevice device("my-project", "us-central1", "my-registry",
+                            "my-device-0001");
+  unsigned char key[32] = {1};
+  device.setPrivateKey(key);
+  MQTTClient mqttClient;
+  CaptureClient client;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+  mqttClient.begin("host", 8883, client);
+  mqttClient.record = false;
+
+  // Every fixed header length, with and without retain.
+  int lengths[] = {0, 1, 7, 100, 120, 127, 200, 5000};
+  for (int retained = 0; retained < 2; retained++) {
+    for (int len : lengths) {
+      PublishChannel *channel =
+          mqtt.openTelemetryChannel("/sensors", 0, retained, 6000);
+      std::string payload(len, 'a' + len % 26);
+      CHECK(channel->publish(payload.data(), len));
+      std::string sent = client.last;
+      mqttClient.publish((device.getEventsTopic() + "/sensors").c_str(),
+                         payload.data(), len, retained, 0);
+      CHECK(sent == client.last);
+      delete channel;
+    }
+  }
+
+  PublishChannel *state = mqtt.openStateChannel(64);
+  CHECK(state->publish(String("on")));
+  std::string sent = client.last;
+  CHECK(mqtt.publishState(String("on")));
+  CHECK(sent == client.last);
+  delete state;
+
+  // QoS 1 and oversized payloads go through MQTTClient.
+  PublishChannel *qos1 = mqtt.openTelemetryChannel("/q", 1);
+  int published = mqttClient.published;
+  CHECK(qos1->publish(String("x")));
+  CHECK(mqttClient.published == published + 1);
+  delete qos1;
+  PublishChannel *small = mqtt.openTelemetryChannel("/s", 0, false, 4);
+  published = mqttClient.published;
+  CHECK(small->publish(String("12345")));
+  CHECK(mqttClient.published == published + 1);
+
+  // Nothing is written while disconnected.
+  mqttClient.isConnected = false;
+  int writes = client.writes;
+  published = mqttClient.published;
+  CHECK(!small->publish(String("1")));
+  CHECK(client.writes == writes && mqttClient.published == published);
+  mqttClient.isConnected = true;
+
+  // With envelopes the message is queued instead.
+  static TelemetryEnvelope envelope(&device);
+  mqtt.setEnvelope(&envelope);
+  writes = client.writes;
+  CHECK(small->publish(String("1")));
+  CHECK(client.writes == writes && envelope.count() == 1);
+  envelope.clear();
+  mqtt.setEnvelope(NULL);
+  delete small;
+  return TEST_RESULT();
+}
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// The connection state machine on a fake clock: one step per loop(),
+// backoff deadlines that grow and survive millis() wrapping, reconnecting
+// on JWT expiry, and mqttDisconnect() stopping it, also from a callback.
+
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+static CloudIoTCoreDevice *device;
+static int jwts = 0;
+String getJwt() {
+  jwts++;
+  return device->createJWT(1600000000LL, 3600);
+}
+
+static std::vector<int> seen;
+static ConnectionState disconnectOn = CONNECTION_IDLE;
+static void onState(CloudIoTCoreMqtt *mqtt, ConnectionState state) {
+  seen.push_back(state);
+  if (state == disconnectOn) {
+    mqtt->mqttDisconnect();
+  }
+}
+
+static std::vector<int> states(std::initializer_list<int> list) {
+  return list;
+}
+
+// Calls loop() every 10 ms until the state is no longer from.
+static void loopWhile(CloudIoTCoreMqtt *mqtt, ConnectionState from) {
+  for (int i = 0; i < 100000 && mqtt->getConnectionState() == from; i++) {
+    fakeMillis += 10;
+    mqtt->loop();
+  }
+}
+
+static void loopUntil(CloudIoTCoreMqtt *mqtt, ConnectionState to) {
+  for (int i = 0; i < 100000 && mqtt->getConnectionState() != to; i++) {
+    fakeMillis += 10;
+    mqtt->loop();
+  }
+}
+
+int main() {
+  CloudIoTCoreDevice theDevice("p", "l", "r", "d");
+  unsigned char key[32] = {1};
+  theDevice.setPrivateKey(key);
+  device = &theDevice;
+  MQTTClient mqttClient;
+  Client client;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &client, &theDevice);
+  mqttClient.isConnected = false;
+  mqttClient.record = false;
+  mqtt.setConnectionCallback(onState);
+  mqtt.setLogConnect(false);
+
+  // Idle: loop() does nothing.
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_IDLE);
+  CHECK(mqttClient.connects == 0);
+
+  // One step per loop().
+  mqtt.mqttConnectAsync();
+  CHECK(mqtt.getConnectionState() == CONNECTION_SIGNING && jwts == 0);
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_CONNECTING && jwts == 1);
+  CHECK(mqttClient.connects == 0);
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_SUBSCRIBING);
+  CHECK(mqttClient.connects == 1 && mqttClient.lastPassword.size() > 100);
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_ONLINE && mqttClient.subs == 2);
+  CHECK(seen == states({CONNECTION_SIGNING, CONNECTION_CONNECTING,
+                        CONNECTION_SUBSCRIBING, CONNECTION_ONLINE}));
+
+  // An outage: the backoff grows up to a minute and loop() never blocks.
+  mqttClient.connectOk = false;
+  mqttClient.isConnected = false;
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_CONNECTING);
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_BACKOFF);
+  CHECK(mqttClient.connects == 2);
+  unsigned long previous = 0;
+  for (int round = 0; round < 8; round++) {
+    unsigned long start = fakeMillis;
+    int connects = mqttClient.connects;
+    // Asking to connect again does not cut the backoff short.
+    mqtt.mqttConnectAsync();
+    CHECK(mqtt.getConnectionState() == CONNECTION_BACKOFF);
+    loopWhile(&mqtt, CONNECTION_BACKOFF);
+    unsigned long waited = fakeMillis - start;
+    mqtt.loop();  // signing
+    mqtt.loop();  // connecting
+    CHECK(mqttClient.connects == connects + 1);
+    CHECK(mqtt.getConnectionState() == CONNECTION_BACKOFF);
+    CHECK(waited >= previous || waited >= 60000 - 10);
+    CHECK(waited <= 60000 + 10);
+    previous = waited;
+  }
+
+  // Getting online resets the backoff.
+  mqttClient.connectOk = true;
+  loopUntil(&mqtt, CONNECTION_ONLINE);
+  mqttClient.connectOk = false;
+  mqttClient.isConnected = false;
+  mqtt.loop();
+  mqtt.loop();
+  unsigned long start = fakeMillis;
+  loopWhile(&mqtt, CONNECTION_BACKOFF);
+  CHECK(fakeMillis - start <= 3000);
+
+  // A failed subscribe backs off too.
+  mqttClient.connectOk = true;
+  mqttClient.subOk = false;
+  seen.clear();
+  for (int i = 0; i < 1000 && seen.size() < 3; i++) {
+    fakeMillis += 10;
+    mqtt.loop();
+  }
+  CHECK(seen == states({CONNECTION_CONNECTING, CONNECTION_SUBSCRIBING,
+                        CONNECTION_BACKOFF}));
+  mqttClient.subOk = true;
+
+  // A deadline past 2^32 ms neither fires early nor never.
+  loopUntil(&mqtt, CONNECTION_ONLINE);
+  fakeMillis = 0xffffffffUL - 500;
+  device->createJWT(1600000000LL, 3600);
+  mqttClient.connectOk = false;
+  mqttClient.isConnected = false;
+  mqtt.loop();
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_BACKOFF);
+  fakeMillis += 10;
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_BACKOFF);
+  mqttClient.connectOk = true;
+  loopUntil(&mqtt, CONNECTION_ONLINE);
+  CHECK(mqtt.getConnectionState() == CONNECTION_ONLINE);
+
+  // An expiring JWT reconnects without a backoff.
+  fakeMillis = device->getExpMillis() + 1;
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_CONNECTING);
+  mqtt.loop();
+  mqtt.loop();
+  CHECK(mqtt.getConnectionState() == CONNECTION_ONLINE);
+
+  // mqttDisconnect() stops reconnecting.
+  mqtt.mqttDisconnect();
+  CHECK(mqtt.getConnectionState() == CONNECTION_IDLE);
+  int connects = mqttClient.connects;
+  for (int i = 0; i < 100; i++) {
+    fakeMillis += 1000;
+    mqtt.loop();
+  }
+  CHECK(mqttClient.connects == connects);
+
+  // The blocking connect runs the same steps.
+  mqtt.mqttConnect();
+  CHECK(mqtt.getConnectionState() == CONNECTION_ONLINE);
+
+  // And returns when a callback gives up on the connection.
+  mqtt.mqttDisconnect();
+  mqttClient.connectOk = false;
+  disconnectOn = CONNECTION_BACKOFF;
+  mqtt.mqttConnect();
+  CHECK(mqtt.getConnectionState() == CONNECTION_IDLE);
+  return TEST_RESULT();
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Peak stack of each P-256 operation. Every operation runs on a thread whose
+// stack was filled with a pattern; the depth reached is how much of the
+// pattern got overwritten. With CONF_NN_SCRATCH the temporaries move to the
+// workspace, so the stack limits are tighter and the workspace high-water
+// mark must stay within NN_SCRATCH_DIGITS.
+
+#include <pthread.h>
+#include "test.h"
+#include "ecdsa.h"
+
+#ifdef CONF_NN_SCRATCH
+static const long stackLimit = 1280;
+#else
+static const long stackLimit = 2560;
+#endif
+
+static char stack[1 << 16];
+static char *stackTop;
+static int op;
+
+static NN_DIGIT priv[NUMWORDS], r[NUMWORDS], s[NUMWORDS];
+static point_t pub;
+static uint8_t hash[32] = {1};
+static int verified;
+
+static void *runOp(void *) {
+  stackTop = (char *)__builtin_frame_address(0);
+  switch (op) {
+    case 0: ecc_init(); break;
+    case 1: ecc_gen_pub_key(priv, &pub); break;
+    case 2: ecdsa_init(&pub); break;
+    case 3: ecdsa_sign(hash, r, s, priv); break;
+    case 4: verified = ecdsa_verify(hash, r, s, &pub); break;
+  }
+  return nullptr;
+}
+
+static long peakStack(int which) {
+  op = which;
+  memset(stack, 0xA5, sizeof stack);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, sizeof stack);
+  pthread_t thread;
+  pthread_create(&thread, &attr, runOp, nullptr);
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+  size_t untouched = 0;
+  while (untouched < sizeof stack && (unsigned char)stack[untouched] == 0xA5) {
+    untouched++;
+  }
+  return stackTop - (stack + untouched);
+}
+
+int main() {
+  static const char *names[] = {"ecc_init", "ecc_gen_pub_key", "ecdsa_init",
+                                "ecdsa_sign", "ecdsa_verify"};
+  ecc_init();
+  ecc_gen_private_key(priv);
+  for (int i = 0; i < 5; i++) {
+    long used = peakStack(i);
+    printf("  %-16s %5ld bytes of stack\n", names[i], used);
+    CHECK(used > 0 && used < stackLimit);
+  }
+  CHECK(verified == 1);
+  hash[0] ^= 1;
+  CHECK(ecdsa_verify(hash, r, s, &pub) != 1);
+#ifdef CONF_NN_SCRATCH
+  printf("  scratch high-water %u of %u digits\n",
+         (unsigned)NN_ScratchHighWater(), (unsigned)NN_SCRATCH_DIGITS);
+  CHECK(NN_ScratchHighWater() > 0);
+  CHECK(NN_ScratchHighWater() <= NN_SCRATCH_DIGITS);
+#endif
+  return TEST_RESULT();
+}
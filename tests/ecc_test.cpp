@@ -0,0 +1,82 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// ecc_batch_to_affine() against converting one point at a time, infinity
+// included, and the window table it builds against plain ecc_mul().
+
+#include <stdlib.h>
+#include "test.h"
+#include "ecc.h"
+
+static bool same(point_t *a, point_t *b) {
+  return NN_Cmp(a->x, b->x, NUMWORDS) == 0 &&
+         NN_Cmp(a->y, b->y, NUMWORDS) == 0;
+}
+
+static void scalar(NN_DIGIT *n, NN_DIGIT v) {
+  NN_AssignZero(n, NUMWORDS);
+  n[0] = v;
+}
+
+int main() {
+  ecc_init();
+  point_t *G = ecc_get_base_p();
+
+  // [2]G, [4]G .. [128]G in Jacobian coordinates, with infinity in the
+  // middle.
+  const int num = 7;
+  point_t points[num];
+  NN_DIGIT Z[num * NUMWORDS];
+  point_t P = *G;
+  NN_DIGIT ZP[NUMWORDS];
+  scalar(ZP, 1);
+  for (int i = 0; i < num; i++) {
+    ecc_dbl_proj(&points[i], Z + i * NUMWORDS, &P, ZP);
+    P = points[i];
+    NN_Assign(ZP, Z + i * NUMWORDS, NUMWORDS);
+  }
+  NN_AssignZero(Z + 3 * NUMWORDS, NUMWORDS);
+  NN_DIGIT before[num * NUMWORDS];
+  memcpy(before, Z, sizeof(Z));
+
+  ecc_batch_to_affine(points, Z, num);
+  CHECK(memcmp(before, Z, sizeof(Z)) == 0);
+  for (int i = 0; i < num; i++) {
+    point_t expected;
+    NN_DIGIT k[NUMWORDS];
+    scalar(k, 2 << i);
+    ecc_mul(&expected, G, k);
+    if (i == 3) {
+      CHECK(NN_Zero(points[i].x, NUMWORDS) && NN_Zero(points[i].y, NUMWORDS));
+    } else {
+      CHECK(same(&points[i], &expected));
+    }
+  }
+  ecc_batch_to_affine(points, Z, 0);
+
+  // The window table behind ecc_win_mul_base().
+  srand(1);
+  for (int i = 0; i < 20; i++) {
+    NN_DIGIT k[NUMWORDS];
+    for (int j = 0; j < NUMWORDS; j++) {
+      k[j] = ((NN_DIGIT)rand() << 16) ^ rand();
+    }
+    k[NUMWORDS - 1] &= 0x7fffffff;
+    point_t fast, slow;
+    ecc_win_mul_base(&fast, k);
+    ecc_mul(&slow, G, k);
+    CHECK(same(&fast, &slow));
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Verification rate for signatures from a few keys, interleaved: setting up
+// each key before every verify, looking keys up in the cache, and handing
+// the whole list to ecdsa_verify_batch(), which only saves the table builds.
+// With the default cache of one key the cache misses on every change of key.
+
+#include <stdlib.h>
+#include "test.h"
+#include "ecdsa.h"
+
+#define KEYS 3
+#define PER_KEY 8
+#define SIGS (KEYS * PER_KEY)
+#define ROUNDS 4
+
+static NN_DIGIT priv[KEYS][NUMWORDS];
+static point_t pub[KEYS];
+static uint8_t hash[SIGS][32];
+static NN_DIGIT r[SIGS][NUMWORDS], s[SIGS][NUMWORDS];
+static ecdsa_verify_item_t items[SIGS];
+
+int main() {
+  ecc_init();
+  for (int k = 0; k < KEYS; k++) {
+    ecc_gen_private_key(priv[k]);
+    ecc_gen_pub_key(priv[k], &pub[k]);
+  }
+  for (int i = 0; i < SIGS; i++) {
+    int k = i % KEYS;
+    for (int j = 0; j < 32; j++) {
+      hash[i][j] = rand();
+    }
+    ecdsa_sign(hash[i], r[i], s[i], priv[k]);
+    items[i].sha256sum = hash[i];
+    items[i].r = r[i];
+    items[i].s = s[i];
+    items[i].pb_key = &pub[k];
+  }
+
+  double t0 = now();
+  int valid = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < SIGS; i++) {
+      ecdsa_init(items[i].pb_key);
+      valid += ecdsa_verify(hash[i], r[i], s[i], items[i].pb_key) == 1;
+    }
+  }
+  double t = now() - t0;
+  printf("init + verify:  %6.0f verifications/s (%d valid)\n",
+         ROUNDS * SIGS / t, valid);
+
+  ecdsa_key_cache_clear();
+  t0 = now();
+  int cached = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < SIGS; i++) {
+      ecdsa_key_t *key = ecdsa_key_cache_get(items[i].pb_key);
+      cached += ecdsa_key_verify(hash[i], r[i], s[i], key) == 1;
+    }
+  }
+  t = now() - t0;
+  printf("key cache of %d: %6.0f verifications/s (%d valid)\n",
+         ECDSA_KEY_CACHE_SIZE, ROUNDS * SIGS / t, cached);
+
+  ecdsa_key_cache_clear();
+  t0 = now();
+  int batched = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    batched += ecdsa_verify_batch(items, SIGS);
+  }
+  t = now() - t0;
+  printf("grouped by key: %6.0f verifications/s (%d valid)\n",
+         ROUNDS * SIGS / t, batched);
+
+  return valid == ROUNDS * SIGS && cached == valid && batched == valid ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Signing every telemetry message against signing envelopes of
+// ENVELOPE_MAX_MESSAGES, in messages per second and bytes added per
+// message.
+
+#include "test.h"
+#include "CloudIoTCoreEnvelope.h"
+#include "ecdsa.h"
+#include "sha256.h"
+
+int main() {
+  CloudIoTCoreDevice device("project", "location", "registry", "device");
+  unsigned char key[32];
+  for (int i = 0; i < 32; i++) {
+    key[i] = i + 1;
+  }
+  device.setPrivateKey(key);
+  const char msg[] = "{\"temp\":21.5,\"hum\":40}";
+  size_t msgLength = strlen(msg);
+  const int batches = 25, n = batches * ENVELOPE_MAX_MESSAGES;
+
+  double t0 = now();
+  for (int i = 0; i < n; i++) {
+    unsigned char digest[32], sig[JWT_SIGNATURE_LENGTH];
+    Sha256 sha;
+    sha.update((const unsigned char *)msg, msgLength);
+    sha.final(digest);
+    device.sign(digest, sig);
+  }
+  double single = now() - t0;
+
+  static TelemetryEnvelope envelope(&device);
+  size_t added = 0;
+  t0 = now();
+  for (int b = 0; b < batches; b++) {
+    envelope.clear();
+    for (int i = 0; i < ENVELOPE_MAX_MESSAGES; i++) {
+      envelope.add("", msg, msgLength, 0);
+    }
+    envelope.seal();
+    size_t len;
+    for (int i = 0; i < ENVELOPE_MAX_MESSAGES; i++) {
+      envelope.getEnvelope(i, &len);
+      added += len - msgLength;
+    }
+    envelope.getSignatureMessage(&len);
+    added += len;
+  }
+  double batched = now() - t0;
+
+  printf("sign each message:   %6.0f msg/s, %5.1f bytes added per message\n",
+         n / single, (double)JWT_SIGNATURE_LENGTH);
+  printf("envelopes of %d:      %6.0f msg/s, %5.1f bytes added per message\n",
+         ENVELOPE_MAX_MESSAGES, n / batched, (double)added / n);
+  return 0;
+}
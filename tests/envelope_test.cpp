@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Telemetry envelopes checked by an independent verifier for every batch
+// size: the batch signature against the device's public key and each
+// message's inclusion proof against the signed root.
+
+#include "test.h"
+#include "CloudIoTCoreEnvelope.h"
+#include "ecdsa.h"
+#include "sha256.h"
+
+static void hashNode(unsigned char out[32], const unsigned char left[32],
+                     const unsigned char right[32]) {
+  unsigned char prefix = 1;
+  Sha256 sha;
+  sha.update(&prefix, 1);
+  sha.update(left, 32);
+  sha.update(right, 32);
+  sha.final(out);
+}
+
+// Walks the proof of envelope e, of length len, up to root.
+static bool proofValid(const char *subtopic, const unsigned char *e,
+                       size_t len, const unsigned char *root) {
+  int index = e[5], count = e[6], proofLength = e[7];
+  const unsigned char *proof = e + ENVELOPE_HEADER_LENGTH;
+  const unsigned char *message = proof + 32 * proofLength;
+  size_t messageLength = len - (message - e);
+
+  unsigned char h[32], zero = 0;
+  Sha256 sha;
+  sha.update(&zero, 1);
+  sha.update((const unsigned char *)subtopic, strlen(subtopic) + 1);
+  sha.update(message, messageLength);
+  sha.final(h);
+
+  int used = 0;
+  for (; count > 1; index >>= 1, count = (count + 1) / 2) {
+    if ((index ^ 1) >= count) {
+      continue;  // no right sibling, moves up unchanged
+    }
+    if (index & 1) {
+      hashNode(h, proof + 32 * used, h);
+    } else {
+      hashNode(h, h, proof + 32 * used);
+    }
+    used++;
+  }
+  return used == proofLength && memcmp(h, root, 32) == 0;
+}
+
+int main() {
+  CloudIoTCoreDevice device("project", "location", "registry", "device");
+  unsigned char key[32];
+  for (int i = 0; i < 32; i++) {
+    key[i] = i + 1;
+  }
+  device.setPrivateKey(key);
+  NN_DIGIT priv[NUMWORDS];
+  point_t pub;
+  NN_Decode(priv, NUMWORDS, key, 32);
+  ecc_init();
+  ecc_gen_pub_key(priv, &pub);
+  ecdsa_init(&pub);
+
+  static TelemetryEnvelope envelope(&device);
+  for (int n = 1; n <= ENVELOPE_MAX_MESSAGES; n++) {
+    envelope.clear();
+    for (int i = 0; i < n; i++) {
+      char msg[64];
+      int len = snprintf(msg, sizeof msg, "{\"temp\":%d.%d}", 20 + i, i);
+      CHECK(envelope.add(i % 2 ? "/a" : "", msg, len, 0));
+    }
+    CHECK(envelope.count() == n);
+    CHECK(envelope.seal());
+
+    size_t sigLength;
+    const unsigned char *sig =
+        (const unsigned char *)envelope.getSignatureMessage(&sigLength);
+    CHECK(sigLength == ENVELOPE_SIGNATURE_MESSAGE_LENGTH);
+    CHECK(sig[0] == ENVELOPE_VERSION && sig[5] == n);
+    unsigned char digest[32];
+    Sha256 sha;
+    sha.update(sig, 6 + ENVELOPE_HASH_LENGTH);
+    sha.final(digest);
+    NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+    NN_Decode(r, NUMWORDS, (unsigned char *)sig + 38, 32);
+    NN_Decode(s, NUMWORDS, (unsigned char *)sig + 70, 32);
+    CHECK(ecdsa_verify(digest, r, s, &pub) == 1);
+
+    for (int i = 0; i < n; i++) {
+      size_t len;
+      const unsigned char *e =
+          (const unsigned char *)envelope.getEnvelope(i, &len);
+      CHECK(memcmp(e + 1, sig + 1, 4) == 0);
+      CHECK(proofValid(envelope.getSubtopic(i), e, len, sig + 6));
+      // Any flipped message bit breaks the proof.
+      std::string bad((const char *)e, len);
+      bad[len - 1] ^= 1;
+      CHECK(!proofValid(envelope.getSubtopic(i),
+                        (const unsigned char *)bad.data(), len, sig + 6));
+    }
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,258 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// ForwardLog over FileForwardStorage in a scratch directory: replay order
+// across segments, resuming from the saved cursor after a restart with no
+// more duplicates than documented, a torn last record, a record failing its
+// CRC, and the oldest segment dropped when the log is full.
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreForward.h"
+
+struct Message {
+  std::string subtopic, data;
+  int qos;
+};
+
+static char dir[] = "/tmp/forward_test.XXXXXX";
+
+static std::string segmentPath(uint32_t segment) {
+  return std::string(dir) + "/" + std::to_string(segment) + ".log";
+}
+
+// Number of segment files.
+static int segments() {
+  int n = 0;
+  DIR *d = opendir(dir);
+  while (struct dirent *e = readdir(d)) {
+    n += strstr(e->d_name, ".log") != NULL;
+  }
+  closedir(d);
+  return n;
+}
+
+static void clear() {
+  DIR *d = opendir(dir);
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] != '.') {
+      unlink((std::string(dir) + "/" + e->d_name).c_str());
+    }
+  }
+  closedir(d);
+}
+
+static Message message(int i) {
+  char data[64];
+  snprintf(data, sizeof(data), "{\"seq\":%06d,\"pad\":\"%020d\"}", i, i);
+  return {i % 3 ? "/events" : "/alerts", data, i % 2};
+}
+
+// Record size of message(i) in a segment.
+static long recordSize(int i) {
+  Message m = message(i);
+  return FORWARD_RECORD_HEADER_LENGTH + 2 + m.subtopic.size() + 1 +
+         m.data.size() + FORWARD_RECORD_TRAILER_LENGTH;
+}
+
+// Replays up to max records, removing each. The clock runs on across calls
+// since the log paces replay from the last record it returned.
+static unsigned long ticks = 0;
+
+static std::vector<Message> replay(ForwardLog *log, int max = 1 << 30) {
+  std::vector<Message> out;
+  const char *subtopic;
+  size_t length;
+  int qos;
+  while ((int)out.size() < max) {
+    const char *data = log->next(ticks++, &subtopic, &length, &qos);
+    if (data == NULL) {
+      break;
+    }
+    // The same record until remove().
+    const char *again = log->next(ticks++, &subtopic, &length, &qos);
+    CHECK(again != NULL && std::string(again, length) == std::string(data, length));
+    out.push_back({subtopic, std::string(data, length), qos});
+    log->remove();
+  }
+  return out;
+}
+
+// True if got is message(first), message(first + 1), ...
+static bool inOrder(const std::vector<Message> &got, int first) {
+  for (size_t i = 0; i < got.size(); i++) {
+    Message m = message(first + i);
+    if (got[i].subtopic != m.subtopic || got[i].data != m.data ||
+        got[i].qos != m.qos) {
+      printf("record %zu: %s %s\n", i, got[i].subtopic.c_str(),
+             got[i].data.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static void append(ForwardLog *log, int from, int to) {
+  for (int i = from; i < to; i++) {
+    Message m = message(i);
+    CHECK(log->append(m.subtopic.c_str(), m.data.data(), m.data.size(), m.qos));
+  }
+}
+
+// Flips a byte of the file at offset.
+static void damage(uint32_t segment, long offset) {
+  FILE *f = fopen(segmentPath(segment).c_str(), "r+b");
+  fseek(f, offset, SEEK_SET);
+  int c = fgetc(f);
+  fseek(f, offset, SEEK_SET);
+  fputc(c ^ 0x40, f);
+  fclose(f);
+}
+
+int main() {
+  CHECK(mkdtemp(dir) != NULL);
+  FileForwardStorage storage(dir);
+  const int perSegment = FORWARD_SEGMENT_SIZE / recordSize(0);
+
+  // Append and replay in order across segments; replayed segments are
+  // deleted.
+  {
+    ForwardLog log(&storage, 0);
+    CHECK(log.begin());
+    CHECK(!log.pending());
+    append(&log, 0, 3 * perSegment + 7);
+    CHECK(segments() == 4);
+    std::vector<Message> got = replay(&log);
+    CHECK(got.size() == (size_t)(3 * perSegment + 7) && inOrder(got, 0));
+    CHECK(!log.pending());
+    CHECK(segments() == 0);
+    CHECK(log.droppedCount() == 0);
+
+    // Too long for a record.
+    std::string big(FORWARD_RECORD_SIZE, 'x');
+    CHECK(!log.append("/events", big.data(), big.size(), 0));
+    CHECK(log.droppedCount() == 1);
+  }
+
+  // Restart partway through: the cursor resumes at most
+  // FORWARD_CURSOR_INTERVAL records back, and the rest follow in order.
+  clear();
+  {
+    const int total = 2 * perSegment, before = perSegment + 20;
+    ForwardLog log(&storage, 0);
+    CHECK(log.begin());
+    append(&log, 0, total);
+    CHECK(replay(&log, before).size() == (size_t)before);
+
+    ForwardLog restarted(&storage, 0);
+    CHECK(restarted.begin());
+    CHECK(restarted.pending());
+    std::vector<Message> got = replay(&restarted);
+    int resumed = total - (int)got.size();
+    CHECK(resumed <= before && before - resumed <= FORWARD_CURSOR_INTERVAL);
+    CHECK(inOrder(got, resumed));
+    CHECK(restarted.droppedCount() == 0);
+  }
+
+  // A torn last record: the damaged segment is closed at startup, its good
+  // records replay and new records go to the next segment.
+  clear();
+  {
+    ForwardLog log(&storage, 0);
+    CHECK(log.begin());
+    append(&log, 0, 10);
+    long size = 10 * recordSize(0);
+    CHECK(truncate(segmentPath(0).c_str(), size - 5) == 0);
+
+    ForwardLog restarted(&storage, 0);
+    CHECK(restarted.begin());
+    append(&restarted, 100, 105);
+    std::vector<Message> got = replay(&restarted);
+    CHECK(got.size() == 14);
+    got.resize(14);
+    CHECK(inOrder(std::vector<Message>(got.begin(), got.begin() + 9), 0));
+    CHECK(inOrder(std::vector<Message>(got.begin() + 9, got.end()), 100));
+    CHECK(restarted.droppedCount() == 1);
+  }
+
+  // A record failing its CRC ends its segment; later segments still replay.
+  clear();
+  {
+    ForwardLog log(&storage, 0);
+    CHECK(log.begin());
+    append(&log, 0, perSegment + 3);
+    long offset = 0;
+    for (int i = 0; i < 5; i++) {
+      offset += recordSize(i);
+    }
+    damage(0, offset + recordSize(5) - 10);
+    std::vector<Message> got = replay(&log);
+    CHECK(got.size() == 5 + 3);
+    CHECK(inOrder(std::vector<Message>(got.begin(), got.begin() + 5), 0));
+    CHECK(inOrder(std::vector<Message>(got.begin() + 5, got.end()),
+                  perSegment));
+    CHECK(log.droppedCount() == 1);
+    CHECK(segments() == 0);
+  }
+
+  // Full: rotating past FORWARD_MAX_SEGMENTS drops the oldest segment and
+  // counts its records.
+  clear();
+  {
+    ForwardLog log(&storage, 0);
+    CHECK(log.begin());
+    const int extra = 3;
+    append(&log, 0, (FORWARD_MAX_SEGMENTS + extra) * perSegment);
+    CHECK(segments() <= FORWARD_MAX_SEGMENTS);
+    uint32_t dropped = log.droppedCount();
+    CHECK(dropped == (uint32_t)(extra * perSegment));
+    std::vector<Message> got = replay(&log);
+    CHECK(got.size() + dropped == (size_t)(FORWARD_MAX_SEGMENTS + extra) *
+                                      perSegment);
+    CHECK(inOrder(got, dropped));
+
+    // The cursor survives a restart after segments were dropped.
+    append(&log, 0, 2 * perSegment);
+    CHECK(replay(&log, FORWARD_CURSOR_INTERVAL + 1).size() ==
+          FORWARD_CURSOR_INTERVAL + 1);
+    ForwardLog restarted(&storage, 0);
+    CHECK(restarted.begin());
+    got = replay(&restarted);
+    CHECK(got.size() >= (size_t)(2 * perSegment - FORWARD_CURSOR_INTERVAL) &&
+          got.size() <= (size_t)(2 * perSegment));
+    CHECK(inOrder(got, 2 * perSegment - (int)got.size()));
+  }
+
+  // Replay is paced by replayPerSecond.
+  clear();
+  {
+    ForwardLog log(&storage, 10);
+    CHECK(log.begin());
+    append(&log, 0, 3);
+    const char *subtopic;
+    size_t length;
+    int qos;
+    CHECK(log.next(1000, &subtopic, &length, &qos) != NULL);
+    log.remove();
+    CHECK(log.next(1099, &subtopic, &length, &qos) == NULL);
+    CHECK(log.next(1100, &subtopic, &length, &qos) != NULL);
+  }
+
+  clear();
+  rmdir(dir);
+  return TEST_RESULT();
+}
@@ -0,0 +1,210 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Many clients in one program: each instance signs with its own
+// JwtProvider and gets only its own messages in its MessageHandler, also
+// with more instances than dispatch buckets and after others are destroyed,
+// while instances without them still use the global getJwt(),
+// messageReceived() and messageReceivedAdvanced().
+
+#include <memory>
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+static int globalJwts = 0;
+String getJwt() {
+  globalJwts++;
+  return "global-jwt";
+}
+
+static std::vector<std::string> globalMessages;
+void messageReceived(String &topic, String &payload) {
+  globalMessages.push_back(std::string("simple ") + topic.c_str() + " " +
+                           payload.c_str());
+}
+
+static MQTTClient *advancedClient = NULL;
+void messageReceivedAdvanced(MQTTClient *client, char topic[], char bytes[],
+                             int length) {
+  advancedClient = client;
+  globalMessages.push_back(std::string("advanced ") + topic + " " +
+                           std::string(bytes, length));
+}
+
+class NamedJwt : public JwtProvider {
+  public:
+    std::string name;
+    int calls = 0;
+    NamedJwt(const std::string &name) : name(name) {}
+    String getJwt() {
+      calls++;
+      return name.c_str();
+    }
+};
+
+// Remembers which instance each message arrived on.
+class Recorder : public MessageHandler {
+  public:
+    std::vector<std::pair<CloudIoTCoreMqtt *, std::string>> got;
+    void messageReceived(CloudIoTCoreMqtt *mqtt, char topic[], char bytes[],
+                         int length) {
+      got.push_back({mqtt, std::string(topic) + " " +
+                               std::string(bytes, length)});
+    }
+};
+
+struct Instance {
+  CloudIoTCoreDevice device;
+  MQTTClient mqttClient;
+  Client client;
+  Recorder recorder;
+  CloudIoTCoreMqtt mqtt;
+  Instance(const char *id)
+      : device("p", "l", "r", id), mqtt(&mqttClient, &client, &device) {}
+};
+
+static void connect(CloudIoTCoreMqtt *mqtt, MQTTClient *mqttClient) {
+  mqttClient->isConnected = false;
+  mqttClient->record = false;
+  mqtt->setLogConnect(false);
+  mqtt->mqttConnectAsync();
+  for (int i = 0; i < 10 && mqtt->getConnectionState() != CONNECTION_ONLINE;
+       i++) {
+    mqtt->loop();
+  }
+  CHECK(mqtt->getConnectionState() == CONNECTION_ONLINE);
+}
+
+static void deliver(MQTTClient *mqttClient, const char *topic,
+                    const char *payload) {
+  mqttClient->deliver(topic, payload, strlen(payload));
+}
+
+int main() {
+  // Two instances, each with its own JWT and messages.
+  {
+    Instance one("one"), two("two");
+    NamedJwt jwtOne("jwt-one"), jwtTwo("jwt-two");
+    one.mqtt.setJwtProvider(&jwtOne);
+    two.mqtt.setJwtProvider(&jwtTwo);
+    one.mqtt.setMessageHandler(&one.recorder);
+    two.mqtt.setMessageHandler(&two.recorder);
+    one.mqtt.startMQTT();
+    two.mqtt.startMQTTAdvanced();
+    connect(&one.mqtt, &one.mqttClient);
+    connect(&two.mqtt, &two.mqttClient);
+    CHECK(one.mqttClient.lastPassword == "jwt-one" && jwtOne.calls == 1);
+    CHECK(two.mqttClient.lastPassword == "jwt-two" && jwtTwo.calls == 1);
+    CHECK(globalJwts == 0);
+
+    deliver(&one.mqttClient, "/devices/one/config", "1");
+    deliver(&two.mqttClient, "/devices/two/commands", "2");
+    deliver(&one.mqttClient, "/devices/one/commands/x", "3");
+    CHECK(one.recorder.got.size() == 2 && two.recorder.got.size() == 1);
+    CHECK(one.recorder.got.size() == 2 &&
+          one.recorder.got[0].first == &one.mqtt &&
+          one.recorder.got[0].second == "/devices/one/config 1" &&
+          one.recorder.got[1].first == &one.mqtt &&
+          one.recorder.got[1].second == "/devices/one/commands/x 3");
+    CHECK(two.recorder.got.size() == 1 &&
+          two.recorder.got[0].first == &two.mqtt &&
+          two.recorder.got[0].second == "/devices/two/commands 2");
+    CHECK(globalMessages.empty());
+  }
+
+  // More instances than dispatch buckets, some destroyed along the way.
+  {
+    const int count = 1000;
+    std::vector<std::unique_ptr<Instance>> clients;
+    std::vector<std::unique_ptr<NamedJwt>> jwts;
+    for (int i = 0; i < count; i++) {
+      std::string id = "d" + std::to_string(i);
+      clients.emplace_back(new Instance(id.c_str()));
+      jwts.emplace_back(new NamedJwt("jwt-" + id));
+      clients[i]->mqtt.setJwtProvider(jwts[i].get());
+      clients[i]->mqtt.setMessageHandler(&clients[i]->recorder);
+      clients[i]->mqtt.startMQTT();
+    }
+    for (int i = 0; i < count; i += 3) {
+      clients[i].reset();
+    }
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+      if (clients[i] == NULL) {
+        continue;
+      }
+      connect(&clients[i]->mqtt, &clients[i]->mqttClient);
+      std::string id = "d" + std::to_string(i);
+      wrong += clients[i]->mqttClient.lastPassword != "jwt-" + id;
+      deliver(&clients[i]->mqttClient, ("/devices/" + id + "/config").c_str(),
+              id.c_str());
+    }
+    for (int i = 0; i < count; i++) {
+      if (clients[i] == NULL) {
+        continue;
+      }
+      std::string id = "d" + std::to_string(i);
+      const Recorder &r = clients[i]->recorder;
+      wrong += r.got.size() != 1 || r.got[0].first != &clients[i]->mqtt ||
+               r.got[0].second != "/devices/" + id + "/config " + id;
+    }
+    CHECK(wrong == 0);
+    CHECK(globalJwts == 0 && globalMessages.empty());
+  }
+
+  // Without a provider or handler the global functions are used, next to
+  // an instance that has its own.
+  {
+    Instance legacy("legacy"), advanced("advanced"), own("own");
+    NamedJwt jwtOwn("jwt-own");
+    own.mqtt.setJwtProvider(&jwtOwn);
+    own.mqtt.setMessageHandler(&own.recorder);
+    own.mqtt.startMQTT();
+    legacy.mqtt.startMQTT();
+    advanced.mqtt.startMQTTAdvanced();
+    connect(&legacy.mqtt, &legacy.mqttClient);
+    connect(&own.mqtt, &own.mqttClient);
+    CHECK(legacy.mqttClient.lastPassword == "global-jwt" && globalJwts == 1);
+    CHECK(own.mqttClient.lastPassword == "jwt-own");
+
+    deliver(&legacy.mqttClient, "/devices/legacy/config", "a");
+    deliver(&advanced.mqttClient, "/devices/advanced/config", "b");
+    deliver(&own.mqttClient, "/devices/own/config", "c");
+    CHECK(globalMessages.size() == 2);
+    CHECK(globalMessages.size() == 2 &&
+          globalMessages[0] == "simple /devices/legacy/config a" &&
+          globalMessages[1] == "advanced /devices/advanced/config b");
+    CHECK(advancedClient == &advanced.mqttClient);
+    CHECK(own.recorder.got.size() == 1);
+  }
+
+  // Routes without a handler fall back to the globals for the rest.
+  {
+    Instance routed("routed");
+    routed.mqtt.onCommand("only", [](CloudIoTCoreMqtt *, const char *,
+                                     const char *, size_t) {
+      globalMessages.push_back("routed");
+    });
+    routed.mqtt.startMQTTAdvanced();
+    globalMessages.clear();
+    advancedClient = NULL;
+    deliver(&routed.mqttClient, "/devices/routed/commands/only", "x");
+    deliver(&routed.mqttClient, "/devices/routed/commands/other", "y");
+    CHECK(globalMessages.size() == 2 && globalMessages[0] == "routed" &&
+          globalMessages[1] == "advanced /devices/routed/commands/other y");
+    CHECK(advancedClient == &routed.mqttClient);
+  }
+  return TEST_RESULT();
+}
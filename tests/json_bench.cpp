@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// JsonParser throughput and memory on a 3 KB config fed in 256 byte pieces,
+// as ReceiveStream chunks arrive, against joining the pieces into one
+// string and picking the values out with find(). malloc is wrapped to count
+// heap allocations.
+
+#include <stdlib.h>
+#include "test.h"
+#include "CloudIoTCoreJson.h"
+
+static long allocations = 0;
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+static long sum;
+static void onInt(long v) { sum += v; }
+static void onNumber(double v) { sum += (long)v; }
+static void onBool(bool v) { sum += v; }
+static void onString(const char *, size_t n) { sum += n; }
+
+static double parse(JsonParser *p, const std::string &doc, int iterations) {
+  double t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    p->begin();
+    for (size_t o = 0; o < doc.size(); o += 256) {
+      p->feed(doc.data() + o, std::min<size_t>(256, doc.size() - o));
+    }
+    if (!p->end()) {
+      return -1;
+    }
+  }
+  return now() - t0;
+}
+
+int main() {
+  std::string doc = "{\"sampling\":{\"period_ms\":1500,\"gain\":0.5},"
+                    "\"enabled\":true,\"name\":\"sensor\",\"leds\":[";
+  for (int i = 0; i < 60; i++) {
+    doc += i ? "," : "";
+    doc += "{\"on\":true,\"color\":\"#ff00ff\",\"level\":" +
+           std::to_string(i * 3.25) + "}";
+  }
+  doc += "],\"tags\":[\"a\",\"b\",\"c\"]}";
+  const int iterations = 20000;
+  double mb = doc.size() * (double)iterations / 1e6;
+
+  JsonParser unbound;
+  double t = parse(&unbound, doc, iterations);
+  printf("document: %zu bytes, sizeof(JsonParser) %zu bytes\n", doc.size(),
+         sizeof(JsonParser));
+  printf("no bindings:      %6.0f MB/s\n", mb / t);
+
+  JsonParser bound;
+  bound.bind("$.sampling.period_ms", onInt);
+  bound.bind("$.sampling.gain", onNumber);
+  bound.bind("$.enabled", onBool);
+  bound.bind("$.name", onString);
+  bound.bind("$.leds[*].on", onBool);
+  bound.bind("$.leds[2].level", onNumber);
+  long before = allocations;
+  t = parse(&bound, doc, iterations);
+  long used = allocations - before;
+  printf("6 bindings:       %6.0f MB/s, %5.1f us/doc, %ld allocations\n",
+         mb / t, t / iterations * 1e6, used);
+
+  before = allocations;
+  double t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    std::string joined;
+    for (size_t o = 0; o < doc.size(); o += 256) {
+      joined += doc.substr(o, 256);
+    }
+    size_t k = joined.find("\"period_ms\":");
+    sum += atol(joined.c_str() + k + 12);
+    k = joined.find("\"enabled\":");
+    sum += joined[k + 10] == 't';
+    k = joined.find("\"gain\":");
+    sum += (long)atof(joined.c_str() + k + 7);
+    k = joined.find("\"name\":\"");
+    sum += joined.find('"', k + 8) - k;
+  }
+  t = now() - t0;
+  printf("join and find():  %6.0f MB/s, %5.1f allocations/doc, "
+         "holds the whole %zu byte document\n",
+         mb / t, (double)(allocations - before) / iterations, doc.size());
+  return used == 0 && sum != 0 ? 0 : 1;
+}
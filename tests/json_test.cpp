@@ -0,0 +1,154 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// JsonParser: bound values arrive the same however the document is split,
+// the first matching binding wins, values that do not fit are skipped, and
+// malformed documents are rejected with an offset.
+
+#include <math.h>
+#include "test.h"
+#include "CloudIoTCoreJson.h"
+
+static long period, ledsOn, led2;
+static double gain;
+static bool enabled;
+static std::string name;
+static int names;
+
+static void setPeriod(long v) { period = v; }
+static void setGain(double v) { gain = v; }
+static void setEnabled(bool v) { enabled = v; }
+static void setName(const char *v, size_t n) {
+  name.assign(v, n);
+  names++;
+}
+static void setLed(bool v) { ledsOn += v; }
+static void setLed2(bool v) { led2 = v; }
+
+static void reset() {
+  period = -1;
+  gain = 0;
+  enabled = false;
+  name = "";
+  names = 0;
+  ledsOn = 0;
+  led2 = -1;
+}
+
+// Feeds s in pieces of step bytes.
+static bool parse(JsonParser *p, const std::string &s, size_t step) {
+  p->begin();
+  for (size_t i = 0; i < s.size(); i += step) {
+    if (!p->feed(s.data() + i, std::min(step, s.size() - i))) {
+      break;
+    }
+  }
+  return p->end();
+}
+
+int main() {
+  JsonParser p;
+  CHECK(p.bind("$.sampling.period_ms", setPeriod));
+  CHECK(p.bind("$.sampling.gain", setGain));
+  CHECK(p.bind("$.enabled", setEnabled));
+  CHECK(p.bind("$.name", setName));
+  CHECK(p.bind("$.leds[*].on", setLed));
+  CHECK(p.bind("$.leds[2].on", setLed2));  // shadowed by [*]
+
+  std::string doc =
+      "{ \"name\" : \"dev\\u00e9\\ud83d\\ude00\\n\\\"x\", "
+      "\"x\":[1,{\"a\":[]},-0.5e+3,null,true],"
+      "\"sampling\":{\"period_ms\":1500,\"gain\":-2.5e-1},\"enabled\":true,"
+      "\"leds\":[{\"on\":true},{\"on\":false},{\"on\":true,\"c\":\"r\"}] }";
+  size_t steps[] = {1, 2, 3, 7, 1000};
+  for (size_t step : steps) {
+    reset();
+    CHECK(parse(&p, doc, step));
+    CHECK(period == 1500);
+    CHECK(fabs(gain + 0.25) < 1e-12);
+    CHECK(enabled);
+    CHECK(name == "dev\xc3\xa9\xf0\x9f\x98\x80\n\"x");
+    CHECK(ledsOn == 2 && led2 == -1);
+  }
+
+  // Index paths, and the root itself.
+  JsonParser q;
+  q.bind("$.leds[2].on", setLed2);
+  q.bind("$[1]", setPeriod);
+  q.bind("$", setGain);
+  reset();
+  CHECK(parse(&q, "{\"leds\":[0,0,{\"on\":true}]}", 1));
+  CHECK(led2 == 1);
+  reset();
+  CHECK(parse(&q, "[0, 42 ,3]", 1));
+  CHECK(period == 42);
+  reset();
+  CHECK(parse(&q, " 12.5 ", 1));
+  CHECK(gain == 12.5);
+  reset();
+  CHECK(parse(&q, "12.5", 4));
+  CHECK(gain == 12.5);
+
+  // A fraction for an int, a number for a bool and an overlong string are
+  // skipped.
+  uint32_t skipped = p.skippedCount();
+  reset();
+  CHECK(parse(&p, "{\"sampling\":{\"period_ms\":1.5},\"enabled\":1,\"name\":\"" +
+                      std::string(100, 'a') + "\"}", 5));
+  CHECK(period == -1 && names == 0);
+  CHECK(p.skippedCount() == skipped + 3);
+
+  const char *malformed[] = {
+      "{", "{\"a\"}", "{\"a\":1,}", "[1,]", "[01]", "[-]", "[1.]", "[1e]",
+      "tru", "[truex]", "{\"a\":1}}", "{} {}", "\"a\nb\"", "\"\\x\"",
+      "\"\\u12g4\"", "{a:1}", "[1 2]", "{\"a\":1]", ""};
+  for (const char *bad : malformed) {
+    CHECK(!parse(&p, bad, 1));
+  }
+  p.begin();
+  p.feed("[1,]", 4);
+  CHECK(p.error() == JSON_SYNTAX && p.errorOffset() == 3);
+  p.begin();
+  p.feed("{", 1);
+  CHECK(!p.end() && p.error() == JSON_INCOMPLETE);
+
+  std::string deep(JSON_MAX_DEPTH, '[');
+  deep += std::string(JSON_MAX_DEPTH, ']');
+  CHECK(parse(&p, deep, 1));
+  std::string deeper(JSON_MAX_DEPTH + 1, '[');
+  p.begin();
+  p.feed(deeper.data(), deeper.size());
+  CHECK(p.error() == JSON_TOO_DEEP);
+
+  // A key too long for the path matches nothing, and later keys still do.
+  reset();
+  CHECK(parse(&p, "{\"" + std::string(200, 'k') +
+                      "\":{\"x\":[1,2]},\"enabled\":true}", 1));
+  CHECK(enabled);
+
+  // Lone surrogates become U+FFFD.
+  reset();
+  CHECK(parse(&p, "{\"name\":\"\\ud800x\\udc00\"}", 1));
+  CHECK(name == "\xef\xbf\xbdx\xef\xbf\xbd");
+
+  JsonParser full;
+  int bound = 0;
+  for (int i = 0; i < JSON_BINDINGS + 2; i++) {
+    bound += full.bind("$", setEnabled);
+  }
+  CHECK(bound == JSON_BINDINGS);
+  CHECK(!full.bind("", setEnabled));
+  CHECK(!q.bind("leds", setEnabled));
+  return TEST_RESULT();
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// JsonWriter building a telemetry line against String concatenation with
+// the floats through snprintf, and a lone double against snprintf("%.17g").
+// malloc is wrapped to count heap allocations; the host String keeps short
+// strings inline, so an Arduino String allocates more than counted here.
+
+#include <stdlib.h>
+#include "test.h"
+#include "CloudIoTCoreJson.h"
+
+static long allocations = 0;
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+static const int iterations = 1000000;
+static const float temp = 21.37f, humidity = 48.2f;
+static const long rssi = -67;
+static const unsigned long uptime = 123456;
+static size_t total;
+
+// String with the floats through snprintf(format).
+static double concatenate(const char *format) {
+  double t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    char t[24], h[24];
+    snprintf(t, sizeof(t), format, (double)(temp + (i & 15) * 0.01f));
+    snprintf(h, sizeof(h), format, (double)humidity);
+    String s = String("{\"rssi\":") + String(rssi - (i & 7)) + ",\"temp\":" +
+               String(t) + ",\"hum\":" + String(h) + ",\"uptime\":" +
+               String(uptime + i) + "}";
+    total += s.length();
+  }
+  return now() - t0;
+}
+
+int main() {
+  long before = allocations;
+  double t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    char buffer[128];
+    JsonWriter json(buffer, sizeof(buffer));
+    json.beginObject().add("rssi", rssi - (i & 7))
+        .add("temp", temp + (i & 15) * 0.01f).add("hum", humidity)
+        .add("uptime", uptime + i).endObject();
+    total += json.length();
+  }
+  double t = now() - t0;
+  long used = allocations - before;
+  printf("telemetry line:\n");
+  printf("  JsonWriter:            %4.0f ns, %ld allocations\n",
+         t / iterations * 1e9, used);
+
+  before = allocations;
+  t = concatenate("%.2f");
+  printf("  String, %%.2f floats:   %4.0f ns, %.1f allocations/line\n",
+         t / iterations * 1e9, (double)(allocations - before) / iterations);
+  before = allocations;
+  t = concatenate("%.9g");
+  printf("  String, %%.9g floats:   %4.0f ns, %.1f allocations/line\n",
+         t / iterations * 1e9, (double)(allocations - before) / iterations);
+
+  t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    char buffer[64];
+    JsonWriter json(buffer, sizeof(buffer));
+    json.value(1.2345678901234567e-5 * (i + 1));
+    total += json.length();
+  }
+  t = now() - t0;
+  printf("double:\n  JsonWriter:            %4.0f ns\n", t / iterations * 1e9);
+  t0 = now();
+  for (int i = 0; i < iterations; i++) {
+    char buffer[64];
+    total += snprintf(buffer, sizeof(buffer), "%.17g",
+                      1.2345678901234567e-5 * (i + 1));
+  }
+  t = now() - t0;
+  printf("  snprintf(\"%%.17g\"):     %4.0f ns\n", t / iterations * 1e9);
+  return used == 0 && total != 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// JsonWriter: number formats, floats in the fewest digits that read back as
+// the same value, escaping, nesting, and overflow.
+
+#include <limits.h>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "CloudIoTCoreJson.h"
+
+static std::string format(double v) {
+  char buffer[64];
+  JsonWriter json(buffer, sizeof(buffer));
+  json.value(v);
+  return buffer;
+}
+
+static std::string formatFloat(float v) {
+  char buffer[64];
+  JsonWriter json(buffer, sizeof(buffer));
+  json.value(v);
+  return buffer;
+}
+
+// Significant digits of a number in printf's %e format or ours, without
+// leading or trailing zeros.
+static std::string digits(const char *s) {
+  std::string d;
+  for (; *s != '\0' && *s != 'e'; s++) {
+    if (isdigit((unsigned char)*s)) {
+      d += *s;
+    }
+  }
+  size_t first = d.find_first_not_of('0');
+  if (first == std::string::npos) {
+    return "0";
+  }
+  return d.substr(first, d.find_last_not_of('0') - first + 1);
+}
+
+// The fewest significant digits that read back as v, closest to v: printf
+// rounds correctly to as many as it is asked for.
+static std::string shortest(double v) {
+  char b[40];
+  for (int p = 1; p < 17; p++) {
+    snprintf(b, sizeof(b), "%.*e", p - 1, v);
+    if (strtod(b, NULL) == v) {
+      return digits(b);
+    }
+  }
+  snprintf(b, sizeof(b), "%.16e", v);
+  return digits(b);
+}
+
+// True if v lies exactly halfway between two numbers of n significant
+// digits, so either is as close.
+static bool halfway(double v, int n) {
+  char b[80];
+  snprintf(b, sizeof(b), "%.*e", n + 40, v);
+  std::string d = digits(b);
+  return d.size() == (size_t)n + 1 && d[n] == '5';
+}
+
+// Digits of s, written for v, match the shortest or tie with it.
+static bool shortestOrTie(const std::string &s, double v,
+                          const std::string &shortest) {
+  std::string d = digits(s.c_str());
+  return d == shortest ||
+         (d.size() == shortest.size() && halfway(v, (int)d.size()));
+}
+
+static std::string shortestFloat(float v) {
+  char b[40];
+  for (int p = 1; p < 9; p++) {
+    snprintf(b, sizeof(b), "%.*e", p - 1, (double)v);
+    if (strtof(b, NULL) == v) {
+      return digits(b);
+    }
+  }
+  snprintf(b, sizeof(b), "%.8e", (double)v);
+  return digits(b);
+}
+
+int main() {
+  CHECK(format(0) == "0");
+  CHECK(format(-0.0) == "-0");
+  CHECK(format(1) == "1");
+  CHECK(format(0.1) == "0.1");
+  CHECK(format(0.3) == "0.3");
+  CHECK(format(0.1 + 0.2) == "0.30000000000000004");
+  CHECK(format(-2.5) == "-2.5");
+  CHECK(format(123.456) == "123.456");
+  CHECK(format(1e20) == "100000000000000000000");
+  CHECK(format(1e21) == "1e21");
+  CHECK(format(1e-6) == "0.000001");
+  CHECK(format(1e-7) == "1e-7");
+  CHECK(format(5e-324) == "5e-324");
+  CHECK(format(2.2250738585072014e-308) == "2.2250738585072014e-308");
+  CHECK(format(1.7976931348623157e308) == "1.7976931348623157e308");
+  CHECK(format(NAN) == "null");
+  CHECK(format(-INFINITY) == "null");
+  CHECK(formatFloat(0.1f) == "0.1");
+  CHECK(formatFloat(21.5f) == "21.5");
+  CHECK(formatFloat(16777216.f) == "16777216");
+  CHECK(formatFloat(1e-45f) == "1e-45");
+  CHECK(formatFloat(3.4028235e38f) == "3.4028235e38");
+
+  // Where the scaled arithmetic can not be sure of the fewest digits.
+  CHECK(format(53165205877497296.) == "53165205877497300");
+  CHECK(format(-1.2812157077389319e-278) == "-1.281215707738932e-278");
+  CHECK(format(6.2842961952713254e218) == "6.284296195271325e218");
+  CHECK(format(2.0533158386420102e-43) == "2.05331583864201e-43");
+  CHECK(formatFloat(33871888.f) == "33871890");
+
+  // Random doubles, a quarter of them with every exponent in turn, and every
+  // 977th float bit pattern must read back exactly; a sample of each must
+  // have the same digits as the shortest printf finds, or as close ones
+  // where the value is halfway between.
+  std::mt19937_64 rng(1);
+  long longer = 0, sampled = 0;
+  for (long i = 0; i < 400000; i++) {
+    uint64_t bits = rng();
+    if (i % 4 == 0) {
+      bits = (bits & 0x800fffffffffffffULL) | ((uint64_t)(i / 4 % 2047) << 52);
+    }
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    if (!isfinite(v)) {
+      continue;
+    }
+    std::string s = format(v);
+    if (strtod(s.c_str(), NULL) != v) {
+      printf("%.17g written as %s\n", v, s.c_str());
+      testFailures++;
+    }
+    if (i % 8 == 0) {
+      sampled++;
+      if (!shortestOrTie(s, v, shortest(v))) {
+        printf("%.17g written as %s\n", v, s.c_str());
+        longer++;
+      }
+    }
+  }
+  CHECK(longer == 0 && sampled > 40000);
+
+  longer = sampled = 0;
+  for (uint64_t i = 0; i < (1ULL << 32); i += 977) {
+    uint32_t bits = (uint32_t)i;
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    if (!isfinite(v)) {
+      continue;
+    }
+    std::string s = formatFloat(v);
+    if (strtof(s.c_str(), NULL) != v) {
+      printf("%.9g written as %s\n", v, s.c_str());
+      testFailures++;
+    }
+    if (i % (977 * 16) == 0) {
+      sampled++;
+      if (!shortestOrTie(s, v, shortestFloat(v))) {
+        printf("%.9g written as %s\n", v, s.c_str());
+        longer++;
+      }
+    }
+  }
+  CHECK(longer == 0 && sampled > 250000);
+
+  char buffer[128];
+  JsonWriter json(buffer, sizeof(buffer));
+  json.beginArray().value(0).value(-1).value(LLONG_MIN).value(ULLONG_MAX)
+      .value(4294967295UL).value(4294967296LL).value(true).nullValue()
+      .endArray();
+  CHECK(std::string(buffer) == "[0,-1,-9223372036854775808,"
+                               "18446744073709551615,4294967295,4294967296,"
+                               "true,null]");
+  for (int i = 0; i < 100000; i++) {
+    long long v = (long long)rng() >> (rng() % 64);
+    json.clear();
+    json.value(v);
+    if (strtoll(buffer, NULL, 10) != v) {
+      printf("%lld written as %s\n", v, buffer);
+      testFailures++;
+    }
+  }
+
+  json.clear();
+  json.beginObject().add("a", "x\"y\\\n\x01\xc3\xa9").key("b").beginArray()
+      .beginObject().endObject().beginArray().endArray().value(1.5f)
+      .endArray().add("c", String("s")).endObject();
+  CHECK(std::string(buffer) ==
+        "{\"a\":\"x\\\"y\\\\\\n\\u0001\xc3\xa9\",\"b\":[{},[],1.5],"
+        "\"c\":\"s\"}");
+  CHECK(json.ok());
+  CHECK(json.length() == strlen(buffer));
+
+  // What does not fit is cut off, still terminated.
+  char small[8];
+  JsonWriter cut(small, sizeof(small));
+  cut.beginObject().add("abc", 12345);
+  CHECK(!cut.ok());
+  CHECK(cut.length() == 7);
+  CHECK(strlen(small) == 7);
+  JsonWriter none(NULL, 0);
+  none.value(1);
+  CHECK(!none.ok());
+  CHECK(none.length() == 0);
+  CHECK(none.c_str()[0] == 0);
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// CreateJwt() with the built-in signer and with OpenSslSigner: both JWTs
+// carry the same header and claims, and both signatures verify against the
+// one public key, checked by libcrypto and by ecdsa_verify().
+
+#ifndef OPENSSL_API_COMPAT
+#define OPENSSL_API_COMPAT 0x10101000L
+#endif
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include "test.h"
+#include "ecdsa.h"
+#include "sha256.h"
+#include "jwt.h"
+#include "jwt_openssl.h"
+
+static const unsigned char privateKey[32] = {
+  0xc9, 0xaf, 0xa9, 0xd8, 0x45, 0xba, 0x75, 0x16, 0x6b, 0x5c, 0x21,
+  0x57, 0x67, 0xb1, 0xd6, 0x93, 0x4e, 0x50, 0xc3, 0xdb, 0x36, 0xe8,
+  0x9b, 0x12, 0x7b, 0x8a, 0x62, 0x2b, 0x12, 0x0f, 0x67, 0x21};
+
+static std::string base64UrlDecode(const std::string &in) {
+  static const std::string chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  std::string out;
+  unsigned bits = 0, count = 0;
+  for (char c : in) {
+    size_t v = chars.find(c);
+    if (v == std::string::npos) {
+      return "";
+    }
+    bits = (bits << 6) | v;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out.push_back((char)(bits >> count));
+    }
+  }
+  return out;
+}
+
+// Verifies jwt with libcrypto against key, and with ecdsa_verify() against
+// pub as set up by ecdsa_init().
+static bool verifies(const String &jwt, EC_KEY *key, point_t *pub) {
+  size_t dot = jwt.rfind('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string signature = base64UrlDecode(jwt.substr(dot + 1));
+  if (signature.size() != JWT_SIGNATURE_LENGTH) {
+    return false;
+  }
+  unsigned char digest[32];
+  Sha256 sha;
+  sha.update((const BYTE *)jwt.data(), dot);
+  sha.final(digest);
+
+  const unsigned char *sig = (const unsigned char *)signature.data();
+  ECDSA_SIG *s = ECDSA_SIG_new();
+  ECDSA_SIG_set0(s, BN_bin2bn(sig, 32, NULL), BN_bin2bn(sig + 32, 32, NULL));
+  bool openssl = ECDSA_do_verify(digest, sizeof(digest), s, key) == 1;
+  ECDSA_SIG_free(s);
+
+  NN_DIGIT r[NUMWORDS], sv[NUMWORDS];
+  NN_Decode(r, NUMWORDS, (unsigned char *)sig, 32);
+  NN_Decode(sv, NUMWORDS, (unsigned char *)sig + 32, 32);
+  bool builtIn = ecdsa_verify(digest, r, sv, pub) == 1;
+  CHECK(openssl == builtIn);
+  return openssl && builtIn;
+}
+
+int main() {
+  NN_DIGIT priv[NUMWORDS];
+  NN_Decode(priv, NUMWORDS, (unsigned char *)privateKey, 32);
+  ecc_init();
+  point_t pub;
+  ecc_gen_pub_key(priv, &pub);
+  ecdsa_init(&pub);
+
+  EC_KEY *key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  unsigned char encoded[65] = {4};
+  NN_Encode(encoded + 1, 32, pub.x, NUMWORDS);
+  NN_Encode(encoded + 33, 32, pub.y, NUMWORDS);
+  const unsigned char *p = encoded;
+  CHECK(o2i_ECPublicKey(&key, &p, sizeof(encoded)) != NULL);
+
+  OpenSslSigner openssl(privateKey);
+  String builtIn = CreateJwt("my-project", 1600000000, priv, 3600);
+  String other = CreateJwt("my-project", 1600000000, openssl, 3600);
+  CHECK(builtIn.length() > 0 && other.length() > 0);
+  CHECK(builtIn.substr(0, builtIn.rfind('.')) ==
+        other.substr(0, other.rfind('.')));
+  CHECK(verifies(builtIn, key, &pub));
+  CHECK(verifies(other, key, &pub));
+
+  // A changed claim or signature no longer verifies.
+  String changed = other;
+  changed[40] = changed[40] == 'A' ? 'B' : 'A';
+  CHECK(!verifies(changed, key, &pub));
+  changed = builtIn;
+  changed[changed.length() - 5] ^= 1;
+  CHECK(!verifies(changed, key, &pub));
+
+  EC_KEY_free(key);
+  return TEST_RESULT();
+}
@@ -0,0 +1,116 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// The verification key cache evicts the least recently used key, and
+// ecdsa_verify_batch() gives each item the result ecdsa_key_verify() would,
+// with valid and invalid signatures by several keys interleaved. A cached
+// table is marked by overwriting its first point, a copy of the key: a hit
+// returns it marked, a miss rebuilds it. Also run against a library built
+// with a cache of 3 keys.
+
+#include <stdlib.h>
+#include "test.h"
+#include "ecdsa.h"
+
+#define KEYS (ECDSA_KEY_CACHE_SIZE + 2)
+#define SIGS (4 * KEYS)
+
+static NN_DIGIT priv[KEYS][NUMWORDS];
+static point_t pub[KEYS];
+
+static ecdsa_key_t *mark(int k) {
+  ecdsa_key_t *key = ecdsa_key_cache_get(&pub[k]);
+  key->table[0].x[0] ^= 1;
+  return key;
+}
+
+static bool marked(ecdsa_key_t *key) {
+  return !NN_Equal(key->table[0].x, key->pub.x, NUMWORDS);
+}
+
+int main() {
+  ecc_init();
+  for (int k = 0; k < KEYS; k++) {
+    ecc_gen_private_key(priv[k]);
+    ecc_gen_pub_key(priv[k], &pub[k]);
+  }
+
+  ecdsa_key_cache_clear();
+  ecdsa_key_t *cached[KEYS];
+  for (int k = 0; k < ECDSA_KEY_CACHE_SIZE; k++) {
+    cached[k] = mark(k);
+    CHECK(NN_Equal(cached[k]->pub.x, pub[k].x, NUMWORDS));
+  }
+  for (int k = 0; k < ECDSA_KEY_CACHE_SIZE; k++) {
+    ecdsa_key_t *key = ecdsa_key_cache_get(&pub[k]);
+    CHECK(key == cached[k]);
+    CHECK(marked(key));
+  }
+  // Key 0 is now the most recently used, unless it is the only one.
+  ecdsa_key_cache_get(&pub[0]);
+  ecdsa_key_t *added = ecdsa_key_cache_get(&pub[ECDSA_KEY_CACHE_SIZE]);
+  CHECK(!marked(added));
+  if (ECDSA_KEY_CACHE_SIZE > 1) {
+    CHECK(marked(ecdsa_key_cache_get(&pub[0])));
+    CHECK(!marked(ecdsa_key_cache_get(&pub[1])));
+  } else {
+    CHECK(!marked(ecdsa_key_cache_get(&pub[0])));
+  }
+  mark(0);
+  ecdsa_key_cache_clear();
+  CHECK(!marked(ecdsa_key_cache_get(&pub[0])));
+
+  // Signatures by all keys in turn, every other one spoilt in its own way.
+  static uint8_t hash[SIGS][32];
+  static NN_DIGIT r[SIGS][NUMWORDS], s[SIGS][NUMWORDS];
+  static ecdsa_verify_item_t items[SIGS];
+  NN_DIGIT n[NUMWORDS];
+  ecc_get_order(n);
+  int valid = 0;
+  for (int i = 0; i < SIGS; i++) {
+    int k = i % KEYS;
+    for (int j = 0; j < 32; j++) {
+      hash[i][j] = rand();
+    }
+    ecdsa_sign(hash[i], r[i], s[i], priv[k]);
+    items[i].sha256sum = hash[i];
+    items[i].r = r[i];
+    items[i].s = s[i];
+    items[i].pb_key = &pub[k];
+    items[i].result = 0xff;
+    switch (i % 10) {
+      case 1: hash[i][5] ^= 1; break;
+      case 3: s[i][0] ^= 1; break;
+      case 5: items[i].pb_key = &pub[(k + 1) % KEYS]; break;
+      case 7: NN_AssignZero(r[i], NUMWORDS); break;
+      case 9: NN_Assign(s[i], n, NUMWORDS); break;
+      default: valid++;
+    }
+  }
+
+  for (int round = 0; round < 2; round++) {
+    CHECK(ecdsa_verify_batch(items, SIGS) == valid);
+    for (int i = 0; i < SIGS; i++) {
+      ecdsa_key_t key;
+      ecdsa_key_init(&key, items[i].pb_key);
+      uint8_t expected = ecdsa_key_verify(hash[i], r[i], s[i], &key);
+      CHECK(items[i].result == expected);
+      CHECK((items[i].result == 1) == (i % 2 == 0));
+    }
+  }
+  CHECK(items[7].result == 4);
+  CHECK(items[9].result == 5);
+  CHECK(ecdsa_verify_batch(items, 0) == 0);
+  return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Delta OTA patch sizes and apply times. Patches come from ota_image.py
+// (python3 is needed); the firmware pairs are the host builds of the crypto
+// code, standing in for device images. Times include the signature check
+// and are for 1 KB chunks, as from MQTT.
+
+#include <stdlib.h>
+#include "test.h"
+#include "ota_image.h"
+
+class StringSource : public OtaSource {
+  public:
+    std::string old;
+    bool read(unsigned long offset, unsigned char *data, size_t len) {
+      for (size_t i = 0; i < len; i++) {
+        data[i] = offset + i < old.size() ? old[offset + i] : 0;
+      }
+      return true;
+    }
+};
+
+class NullWriter : public OtaWriter {
+  public:
+    bool begin(size_t) { return true; }
+    bool write(const unsigned char *, size_t) { return true; }
+    bool end() { return true; }
+    void abort() {}
+};
+
+static std::string readFile(const char *path) {
+  std::string out;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return out;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof buf, f)) > 0) {
+    out.append(buf, n);
+  }
+  fclose(f);
+  return out;
+}
+
+static void writeFile(const char *path, const std::string &data) {
+  FILE *f = fopen(path, "wb");
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+}
+
+static std::string objects(const char *dir) {
+  std::string out;
+  const char *names[] = {"ecc.o", "ecdsa.o", "nn.o"};
+  for (const char *name : names) {
+    out += readFile((std::string(dir) + name).c_str());
+  }
+  return out;
+}
+
+// Patch from ota_image.py for old -> new.
+static std::string makePatch(const std::string &old, const std::string &new_) {
+  writeFile("build/ota_old.bin", old);
+  writeFile("build/ota_new.bin", new_);
+  int ret = system(
+      "python3 -c 'import sys; sys.path.insert(0, \"..\"); import ota_image; "
+      "old = open(\"build/ota_old.bin\", \"rb\").read(); "
+      "new = open(\"build/ota_new.bin\", \"rb\").read(); "
+      "open(\"build/ota.patch\", \"wb\").write(ota_image.make_patch(old, new))'");
+  std::string patch = ret == 0 ? readFile("build/ota.patch") : "";
+  remove("build/ota_old.bin");
+  remove("build/ota_new.bin");
+  remove("build/ota.patch");
+  return patch;
+}
+
+// Milliseconds per image, or -1 if it did not verify.
+static double apply(OtaKey *key, const std::string &image, OtaSource *source) {
+  const int rounds = 10;
+  NullWriter writer;
+  double t0 = now();
+  for (int i = 0; i < rounds; i++) {
+    CloudIoTCoreOta ota(&writer, key->publicKey, source);
+    if (otaFeed(&ota, image, 1024) != OTA_VERIFIED) {
+      return -1;
+    }
+  }
+  return (now() - t0) * 1000 / rounds;
+}
+
+int main() {
+  OtaKey key;
+  std::string plain = objects("build/lib/");
+  std::string scratch = objects("build/scratch/");
+  std::string edited = plain;
+  size_t at = edited.find("ecdsa");
+  edited.replace(at, 5, "ECDSA");
+
+  struct {
+    const char *name;
+    const std::string &old, &new_;
+  } pairs[] = {
+    {"one string changed", plain, edited},
+    {"CONF_NN_SCRATCH build", plain, scratch},
+  };
+  printf("%-24s %9s %8s %10s %10s\n", "pair", "firmware", "patch", "delta ms",
+         "full ms");
+  for (auto &pair : pairs) {
+    std::string patch = makePatch(pair.old, pair.new_);
+    if (patch.empty()) {
+      printf("%-24s could not run ota_image.py\n", pair.name);
+      return 1;
+    }
+    StringSource source;
+    source.old = pair.old;
+    double delta = apply(&key, key.image(pair.new_, patch, true), &source);
+    double full = apply(&key, key.image(pair.new_, pair.new_), NULL);
+    printf("%-24s %9zu %8zu %10.1f %10.1f\n", pair.name, pair.new_.size(),
+           patch.size(), delta, full);
+    if (delta < 0 || full < 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Builds signed OTA images for the OTA tests and benchmarks, in the format
+// described in CloudIoTCoreOta.h.
+
+#pragma once
+#include <string>
+#include "CloudIoTCoreOta.h"
+
+// Key pair that signs test images. publicKey is in the form
+// CloudIoTCoreOta expects.
+struct OtaKey {
+  NN_DIGIT priv[NUMWORDS];
+  unsigned char publicKey[OTA_SIGNATURE_LENGTH];
+
+  OtaKey() {
+    point_t pub;
+    ecc_init();
+    ecc_gen_private_key(priv);
+    ecc_gen_pub_key(priv, &pub);
+    NN_Encode(publicKey, 32, pub.x, NUMWORDS);
+    NN_Encode(publicKey + 32, 32, pub.y, NUMWORDS);
+  }
+
+  // Header, body and the signature over firmware. body is the firmware
+  // itself for full images and a patch for delta ones.
+  std::string image(const std::string &firmware, const std::string &body,
+                    bool delta = false) {
+    NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+    unsigned char digest[SHA256_DIGEST_LENGTH], sig[OTA_SIGNATURE_LENGTH];
+    Sha256 sha;
+    sha.update((const unsigned char *)firmware.data(), firmware.size());
+    sha.final(digest);
+    ecdsa_sign(digest, r, s, priv);
+    NN_Encode(sig, 32, r, NUMWORDS);
+    NN_Encode(sig + 32, 32, s, NUMWORDS);
+
+    size_t n = firmware.size();
+    std::string out(delta ? OTA_DELTA_MAGIC : OTA_MAGIC);
+    out += (char)(n >> 24);
+    out += (char)(n >> 16);
+    out += (char)(n >> 8);
+    out += (char)n;
+    out += body;
+    out.append((const char *)sig, sizeof sig);
+    return out;
+  }
+};
+
+// Appends a patch record, see CloudIoTCoreOta.h.
+static inline void otaRecord(std::string *patch, unsigned long copy,
+                             const std::string &extra, long seek) {
+  unsigned long fields[3] = {
+      copy, extra.size(),
+      seek < 0 ? ((unsigned long)-seek << 1) - 1 : (unsigned long)seek << 1};
+  for (unsigned long v : fields) {
+    do {
+      unsigned char b = v & 0x7f;
+      v >>= 7;
+      *patch += (char)(v ? b | 0x80 : b);
+    } while (v);
+  }
+  *patch += extra;
+}
+
+// Feeds image to ota in chunks of the given size.
+static inline OtaStatus otaFeed(CloudIoTCoreOta *ota, const std::string &image,
+                                size_t chunk) {
+  OtaStatus status = ota->getStatus();
+  for (size_t i = 0; i < image.size(); i += chunk) {
+    size_t n = image.size() - i < chunk ? image.size() - i : chunk;
+    status = ota->write((const unsigned char *)image.data() + i, n);
+  }
+  return status;
+}
@@ -0,0 +1,211 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Signed OTA images, full and delta: accepted in any chunking, rejected when
+// corrupted or malformed, and the writer is aborted whenever an image it has
+// begun is abandoned.
+
+#include <sys/stat.h>
+#include "test.h"
+#include "ota_image.h"
+
+// Records the calls it gets; write() fails once failWrites is reached.
+class RecordingWriter : public OtaWriter {
+  public:
+    int begins = 0, ends = 0, aborts = 0;
+    size_t writes = 0, failWrites = (size_t)-1;
+    std::string data;
+
+    bool begin(size_t) {
+      begins++;
+      data.clear();
+      return true;
+    }
+    bool write(const unsigned char *p, size_t len) {
+      if (writes++ == failWrites) {
+        return false;
+      }
+      data.append((const char *)p, len);
+      return true;
+    }
+    bool end() {
+      ends++;
+      return true;
+    }
+    void abort() { aborts++; }
+};
+
+// Old firmware held in memory.
+class StringSource : public OtaSource {
+  public:
+    std::string old;
+    bool read(unsigned long offset, unsigned char *data, size_t len) {
+      for (size_t i = 0; i < len; i++) {
+        data[i] = offset + i < old.size() ? old[offset + i] : 0;
+      }
+      return true;
+    }
+};
+
+static std::string firmware(size_t n) {
+  std::string out;
+  for (size_t i = 0; i < n; i++) {
+    out += (char)(i * 7 + (i >> 9));
+  }
+  return out;
+}
+
+static bool fileIs(const char *path, const std::string &want) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  std::string got;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof buf, f)) > 0) {
+    got.append(buf, n);
+  }
+  fclose(f);
+  return got == want;
+}
+
+int main() {
+  OtaKey key;
+  std::string fw = firmware(100000);
+  std::string image = key.image(fw, fw);
+  const char *path = "build/ota_test.bin";
+  struct stat st;
+
+  // Any chunking works and the file holds the firmware.
+  size_t chunks[] = {1, 7, 977, 4096, image.size()};
+  for (size_t chunk : chunks) {
+    FileOtaWriter writer(path);
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, image, chunk) == OTA_VERIFIED);
+    CHECK(ota.getWritten() == fw.size());
+    CHECK(fileIs(path, fw));
+  }
+
+  // A flipped firmware bit fails the signature and removes the file.
+  {
+    std::string bad = image;
+    bad[OTA_HEADER_LENGTH + 1000] ^= 1;
+    FileOtaWriter writer(path);
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, bad, 4096) == OTA_FAILED);
+    CHECK(stat(path, &st) != 0);
+  }
+
+  // Bad magic or a zero length fails before the writer is begun.
+  {
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, "OTAX" + image.substr(4), 64) == OTA_FAILED);
+    CHECK(writer.begins == 0 && writer.aborts == 0);
+    std::string empty = key.image("", "");
+    ota.reset();
+    CHECK(otaFeed(&ota, empty, 64) == OTA_FAILED);
+    CHECK(writer.begins == 0 && writer.aborts == 0);
+  }
+
+  // reset() straight after the header aborts the begun writer.
+  {
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, image.substr(0, OTA_HEADER_LENGTH), 64) ==
+          OTA_RECEIVING);
+    CHECK(writer.begins == 1);
+    ota.reset();
+    CHECK(writer.aborts == 1);
+    ota.reset();
+    CHECK(writer.aborts == 1);
+  }
+
+  // So does a failing first write, and nothing after it.
+  {
+    RecordingWriter writer;
+    writer.failWrites = 0;
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, image, 4096) == OTA_FAILED);
+    CHECK(writer.aborts == 1);
+    ota.reset();
+    CHECK(writer.aborts == 1);
+  }
+
+  // A verified image is ended, not aborted, by a later reset().
+  {
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, image, 4096) == OTA_VERIFIED);
+    CHECK(writer.ends == 1 && writer.data == fw);
+    ota.reset();
+    CHECK(writer.aborts == 0);
+  }
+
+  // The file writer can be begun again without ending the first image.
+  {
+    FileOtaWriter writer(path);
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, image.substr(0, 5000), 4096) == OTA_RECEIVING);
+    CHECK(writer.begin(fw.size()));
+    CloudIoTCoreOta again(&writer, key.publicKey);
+    CHECK(otaFeed(&again, image, 977) == OTA_VERIFIED);
+    CHECK(fileIs(path, fw));
+  }
+  remove(path);
+
+  // A delta keeping the start and end of the old firmware around new bytes.
+  StringSource source;
+  source.old = fw;
+  std::string fw2 = fw.substr(0, 40000) + "new bytes" + fw.substr(50000);
+  std::string patch;
+  otaRecord(&patch, 40000, "new bytes", 10000);
+  otaRecord(&patch, fw.size() - 50000, "", 0);
+  std::string delta = key.image(fw2, patch, true);
+  for (size_t chunk : chunks) {
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey, &source);
+    CHECK(otaFeed(&ota, delta, chunk) == OTA_VERIFIED);
+    CHECK(writer.data == fw2 && writer.aborts == 0);
+  }
+
+  // Without a source the delta fails before the writer is begun.
+  {
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey);
+    CHECK(otaFeed(&ota, delta, 4096) == OTA_FAILED);
+    CHECK(writer.begins == 0);
+  }
+
+  // A first record that copies or adds more than the whole firmware, or
+  // seeks before the start of the old one, fails and aborts the writer.
+  const char *malformed[] = {"copy", "extra", "seek"};
+  for (const char *what : malformed) {
+    std::string bad;
+    if (what[0] == 'c') {
+      otaRecord(&bad, fw2.size() + 1, "", 0);
+    } else if (what[0] == 'e') {
+      otaRecord(&bad, 0, std::string(fw2.size() + 1, 'x'), 0);
+    } else {
+      otaRecord(&bad, 10, "", -11);
+    }
+    bad += patch;
+    RecordingWriter writer;
+    CloudIoTCoreOta ota(&writer, key.publicKey, &source);
+    CHECK(otaFeed(&ota, key.image(fw2, bad, true), 977) == OTA_FAILED);
+    CHECK(writer.begins == 1 && writer.aborts == 1 && writer.ends == 0);
+  }
+  return TEST_RESULT();
+}
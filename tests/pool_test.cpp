@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// The nonce pool: ecdsa_sign() takes one precomputed tuple per signature
+// until the pool is empty, then falls back to fresh nonces, and a tuple is
+// never used twice.
+
+#include "test.h"
+#include "ecdsa.h"
+
+static NN_DIGIT priv[NUMWORDS];
+static point_t pub;
+static NN_DIGIT used[3 * ECDSA_POOL_SIZE + 4][NUMWORDS];
+static int signatures;
+
+// Signs a message of its own and checks the signature and its r is new.
+static void signAndVerify() {
+  uint8_t hash[32] = {0};
+  hash[0] = signatures + 1;
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+  ecdsa_sign(hash, r, s, priv);
+  CHECK(ecdsa_verify(hash, r, s, &pub));
+  for (int i = 0; i < signatures; i++) {
+    CHECK(!NN_Equal(used[i], r, NUMWORDS));
+  }
+  NN_Assign(used[signatures++], r, NUMWORDS);
+}
+
+int main() {
+  ecc_init();
+  ecc_gen_private_key(priv);
+  ecc_gen_pub_key(priv, &pub);
+  ecdsa_init(&pub);
+
+  CHECK(ecdsa_pool_available() == 0);
+  CHECK(ecdsa_pool_fill(1) == 1);
+  CHECK(ecdsa_pool_fill(255) == ECDSA_POOL_SIZE);
+  CHECK(ecdsa_pool_fill(1) == ECDSA_POOL_SIZE);
+  for (int left = ECDSA_POOL_SIZE; left > 0; left--) {
+    CHECK(ecdsa_pool_available() == left);
+    signAndVerify();
+    CHECK(ecdsa_pool_available() == left - 1);
+  }
+
+  // Empty: fresh nonces.
+  signAndVerify();
+  signAndVerify();
+  CHECK(ecdsa_pool_available() == 0);
+
+  // Refilled, then wiped.
+  CHECK(ecdsa_pool_fill(ECDSA_POOL_SIZE) == ECDSA_POOL_SIZE);
+  signAndVerify();
+  ecdsa_pool_clear();
+  CHECK(ecdsa_pool_available() == 0);
+  signAndVerify();
+  CHECK(ecdsa_pool_available() == 0);
+
+  // Deterministic signatures leave the pool alone.
+  CHECK(ecdsa_pool_fill(ECDSA_POOL_SIZE) == ECDSA_POOL_SIZE);
+  uint8_t hash[32] = {0xff};
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+  ecdsa_sign_deterministic(hash, r, s, priv);
+  CHECK(ecdsa_verify(hash, r, s, &pub));
+  CHECK(ecdsa_pool_available() == ECDSA_POOL_SIZE);
+  while (ecdsa_pool_available() > 0) {
+    signAndVerify();
+  }
+  signAndVerify();
+  return TEST_RESULT();
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// prng() throughput in bulk and for 32-byte requests, the size of one
+// private key or signing nonce.
+
+#include "test.h"
+#include "prng.h"
+
+static unsigned char buf[1 << 20];
+
+int main() {
+  const int bulkRounds = 64;
+  double t0 = now();
+  for (int i = 0; i < bulkRounds; i++) {
+    prng(buf, sizeof buf);
+  }
+  double t = now() - t0;
+  printf("prng bulk:      %8.1f MB/s\n", bulkRounds / t);
+
+  const int calls = 200000;
+  t0 = now();
+  for (int i = 0; i < calls; i++) {
+    prng(buf, 32);
+  }
+  t = now() - t0;
+  printf("prng 32 bytes:  %8.0f calls/s\n", calls / t);
+  return 0;
+}
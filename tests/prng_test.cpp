@@ -0,0 +1,69 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Statistical sanity checks on prng() output: byte frequencies, bit balance,
+// distinct results for back-to-back calls and lengths that are not a
+// multiple of the block size. These catch a broken generator (a stuck byte,
+// a short fill), not a weak one.
+
+#include <math.h>
+#include "test.h"
+#include "prng.h"
+
+static unsigned char buf[1 << 20];
+
+int main() {
+  // Bytes are uniform: chi-square with 255 degrees of freedom stays well
+  // under the 1e-6 tail at about 360.
+  long count[256] = {0};
+  prng(buf, sizeof buf);
+  for (size_t i = 0; i < sizeof buf; i++) {
+    count[buf[i]]++;
+  }
+  double expected = (double)sizeof buf / 256, chi = 0;
+  for (int i = 0; i < 256; i++) {
+    chi += (count[i] - expected) * (count[i] - expected) / expected;
+  }
+  printf("  chi-square %.1f (255 degrees of freedom)\n", chi);
+  CHECK(chi < 360);
+  CHECK(count[255] > 0);
+
+  long ones = 0;
+  for (size_t i = 0; i < sizeof buf; i++) {
+    ones += __builtin_popcount(buf[i]);
+  }
+  double ratio = ones / (8.0 * sizeof buf);
+  printf("  ones ratio %.5f\n", ratio);
+  CHECK(fabs(ratio - 0.5) < 0.001);
+
+  // Two keys in a row differ.
+  unsigned char a[32], b[32];
+  prng(a, sizeof a);
+  prng(b, sizeof b);
+  CHECK(memcmp(a, b, sizeof a) != 0);
+
+  // Odd lengths are filled to the last byte: the chance of a given byte
+  // staying at its marker value through 16 fills is 2^-128.
+  for (size_t len = 1; len < 200; len += 13) {
+    bool filled = false;
+    for (int tries = 0; tries < 16 && !filled; tries++) {
+      memset(buf, 0, len + 1);
+      prng(buf, len);
+      filled = buf[len - 1] != 0;
+      CHECK(buf[len] == 0);
+    }
+    CHECK(filled);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,241 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Incoming messages larger than the MQTTClient buffer: a 64 KB config goes
+// through a client with a 1 KB buffer in bounded chunks. Other packets still
+// reach MQTTClient and the publish window, malformed ones are skipped, and
+// a message cut off by a lost connection is aborted.
+
+#include <deque>
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+static std::vector<std::string> smallMessages;
+void messageReceived(String &topic, String &payload) {
+  smallMessages.push_back(std::string(topic.c_str()) + "=" + payload.c_str());
+}
+
+// The broker side: bytes arrive in segments between loop() calls.
+class Pipe : public Client {
+  public:
+    std::deque<uint8_t> in;
+    std::string out;
+    int stops = 0;
+    size_t maxRead = 0;
+
+    int available() { return in.size(); }
+    int read(uint8_t *buf, size_t size) {
+      if (in.empty()) {
+        return -1;
+      }
+      maxRead = std::max(maxRead, size);
+      size_t n = std::min(size, in.size());
+      for (size_t i = 0; i < n; i++) {
+        buf[i] = in.front();
+        in.pop_front();
+      }
+      return n;
+    }
+    int read() {
+      uint8_t b;
+      return read(&b, 1) == 1 ? b : -1;
+    }
+    size_t write(const uint8_t *data, size_t size) {
+      out.append((const char *)data, size);
+      written += size;
+      writes++;
+      return size;
+    }
+    void stop() { stops++; }
+};
+
+class Collector : public ReceiveHandler {
+  public:
+    std::string topic, data;
+    size_t length = 0, maxChunk = 0;
+    int begins = 0, ends = 0, aborted = 0, chunks = 0;
+
+    void begin(const char *t, size_t len) {
+      begins++;
+      topic = t;
+      length = len;
+      data.clear();
+    }
+    void chunk(const char *d, size_t len) {
+      chunks++;
+      data.append(d, len);
+      maxChunk = std::max(maxChunk, len);
+    }
+    void end(bool complete) {
+      if (complete) {
+        ends++;
+      } else {
+        aborted++;
+      }
+    }
+};
+
+static std::string publish(const std::string &topic, const std::string &payload,
+                           int qos, uint16_t id) {
+  std::string p(1, (char)(0x30 | qos << 1));
+  size_t rem = 2 + topic.size() + (qos ? 2 : 0) + payload.size();
+  do {
+    unsigned char b = rem & 0x7f;
+    rem >>= 7;
+    p += (char)(rem ? b | 0x80 : b);
+  } while (rem);
+  p += (char)(topic.size() >> 8);
+  p += (char)topic.size();
+  p += topic;
+  if (qos) {
+    p += (char)(id >> 8);
+    p += (char)id;
+  }
+  return p + payload;
+}
+
+// Delivers bytes in TCP-sized segments of random length, running loop()
+// after each.
+static void feed(CloudIoTCoreMqtt *mqtt, Pipe *net, const std::string &bytes) {
+  size_t pos = 0;
+  while (pos < bytes.size()) {
+    size_t n = std::min(bytes.size() - pos, (size_t)(1 + rand() % 1460));
+    net->in.insert(net->in.end(), bytes.begin() + pos, bytes.begin() + pos + n);
+    pos += n;
+    mqtt->loop();
+  }
+  for (int i = 0; i < 3; i++) {
+    mqtt->loop();
+  }
+}
+
+int main() {
+  fakeMillis = 1000;
+  CloudIoTCoreDevice device("p", "l", "r", "dev");
+  unsigned char key[32] = {1};
+  device.setPrivateKey(key);
+  device.createJWT(1600000000LL, 3600);
+  std::string config(64 * 1024, 0);
+  for (auto &c : config) {
+    c = 'a' + rand() % 26;
+  }
+  std::string configTopic = "/devices/dev/config";
+
+  // Without a stream the 1 KB MQTTClient drops the connection.
+  {
+    MQTTClient mqttClient;
+    mqttClient.rxSize = 1024;
+    Pipe net;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &net, &device);
+    mqtt.setLogConnect(false);
+    mqtt.startMQTT();
+    mqtt.mqttConnect();
+    feed(&mqtt, &net, publish(configTopic, config, 1, 7));
+    CHECK(mqttClient.tooShort >= 1 && net.stops >= 1);
+  }
+
+  // With one the whole config arrives, in chunks.
+  {
+    MQTTClient mqttClient;
+    mqttClient.rxSize = 1024;
+    Pipe net;
+    Collector collector;
+    ReceiveStream stream(&collector);
+    CloudIoTCoreMqtt mqtt(&mqttClient, &net, &device);
+    mqtt.setLogConnect(false);
+    mqtt.setReceiveStream(&stream);
+    mqtt.startMQTT();
+    mqtt.mqttConnect();
+    net.out.clear();
+    feed(&mqtt, &net, publish(configTopic, config, 1, 0x1234));
+    CHECK(collector.begins == 1 && collector.ends == 1);
+    CHECK(collector.topic == configTopic);
+    CHECK(collector.length == config.size() && collector.data == config);
+    CHECK(collector.maxChunk <= RECEIVE_CHUNK_SIZE);
+    CHECK(net.maxRead <= RECEIVE_CHUNK_SIZE);
+    CHECK(net.out == std::string("\x40\x02\x12\x34", 4));  // its PUBACK
+    CHECK(mqttClient.connected() && mqttClient.err == LWMQTT_SUCCESS);
+  }
+
+  // Streamed messages mixed with packets for MQTTClient and the window.
+  {
+    MQTTClient mqttClient;
+    mqttClient.rxSize = 1024;
+    Pipe net;
+    Collector collector;
+    ReceiveStream stream(&collector, 512);
+    PublishWindow window(4);
+    CloudIoTCoreMqtt mqtt(&mqttClient, &net, &device);
+    mqtt.setLogConnect(false);
+    mqtt.setReceiveStream(&stream);
+    mqtt.setPublishWindow(&window);
+    mqtt.startMQTT();
+    mqtt.mqttConnect();
+    CHECK(mqtt.publishTelemetry(String("x"), 1));
+    uint16_t id = window.lastId();
+    CHECK(window.inFlight() == 1);
+
+    std::string in = publish(configTopic, config, 1, 0x1234);
+    in += std::string("\xd0\x00", 2);  // PINGRESP for MQTTClient
+    in += std::string("\x40\x02", 2) + (char)(id >> 8) + (char)id;
+    in += publish("/devices/dev/commands/led", "on", 0, 0);
+    in += publish("/devices/dev/commands/big", std::string(3000, 'B'), 0, 0);
+    in += publish("/devices/dev/commands/mid", std::string(600, 'E'), 1, 9);
+    net.out.clear();
+    feed(&mqtt, &net, in);
+    CHECK(collector.begins == 3 && collector.ends == 3);
+    CHECK(collector.aborted == 0);
+    CHECK(mqttClient.connected() && mqttClient.err == LWMQTT_SUCCESS);
+    CHECK(smallMessages.size() == 1 &&
+          smallMessages[0] == "/devices/dev/commands/led=on");
+    CHECK(mqttClient.rxOther.size() == 2 && mqttClient.rxOther[0] == 0xd0 &&
+          mqttClient.rxOther[1] == 0x40);
+    CHECK(window.inFlight() == 0);
+    CHECK(net.out.find(std::string("\x40\x02\x12\x34", 4)) != std::string::npos);
+    CHECK(net.out.find(std::string("\x40\x02\x00\x09", 4)) != std::string::npos);
+  }
+
+  // An empty payload, a topic too long to keep, then a good message; and
+  // a message cut off by a lost connection.
+  {
+    MQTTClient mqttClient;
+    mqttClient.rxSize = 1024;
+    Pipe net;
+    Collector collector;
+    ReceiveStream stream(&collector);
+    CloudIoTCoreMqtt mqtt(&mqttClient, &net, &device);
+    mqtt.setLogConnect(false);
+    mqtt.setReceiveStream(&stream);
+    mqtt.startMQTT();
+    mqtt.mqttConnect();
+    feed(&mqtt, &net,
+         publish("/devices/dev/commands/z", "", 0, 0) +
+             publish(std::string(300, 't'), "xx", 1, 3) +
+             publish("/devices/dev/commands/ok", "fine", 0, 0));
+    CHECK(collector.begins == 2 && collector.ends == 2);
+    CHECK(stream.droppedCount() == 1);
+    CHECK(collector.topic == "/devices/dev/commands/ok");
+    CHECK(collector.data == "fine");
+
+    std::string part = publish(configTopic, config, 1, 5).substr(0, 10000);
+    net.in.insert(net.in.end(), part.begin(), part.end());
+    mqtt.loop();
+    CHECK(collector.begins == 3 && collector.aborted == 0);
+    net.in.clear();
+    stream.wrap(&net)->stop();
+    CHECK(collector.aborted == 1);
+  }
+  return TEST_RESULT();
+}
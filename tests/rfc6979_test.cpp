@@ -0,0 +1,161 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// HMAC-SHA256 against RFC 4231 and deterministic ECDSA against RFC 6979
+// A.2.5 (P-256, SHA-256). The nonce is not exposed, so k is recovered from
+// the signature as s^-1 * (h + r * d) mod n. Also run against the
+// CONF_ECDSA_SIGN_ONLY profile.
+
+#include <algorithm>
+#include <string>
+#include "test.h"
+#include "ecdsa.h"
+#include "hmac_sha256.h"
+
+static bool hexIs(const unsigned char *data, size_t len, const char *hex) {
+  char buf[3];
+  for (size_t i = 0; i < len; i++) {
+    snprintf(buf, sizeof buf, "%02x", data[i]);
+    if (memcmp(buf, hex + 2 * i, 2) != 0) {
+      return false;
+    }
+  }
+  return hex[2 * len] == 0;
+}
+
+static void fromHex(unsigned char *out, const char *hex) {
+  for (size_t i = 0; hex[2 * i]; i++) {
+    unsigned v;
+    sscanf(hex + 2 * i, "%2x", &v);
+    out[i] = v;
+  }
+}
+
+static void number(NN_DIGIT *n, const char *hex) {
+  unsigned char b[32];
+  fromHex(b, hex);
+  NN_Decode(n, NUMWORDS, b, 32);
+}
+
+// HMAC of data under key, fed in pieces of step bytes.
+static void mac(const std::string &key, const std::string &data, size_t step,
+                unsigned char out[32]) {
+  HmacSha256 hmac((const BYTE *)key.data(), key.size());
+  for (size_t i = 0; i < data.size(); i += step) {
+    hmac.update((const BYTE *)data.data() + i,
+                std::min(step, data.size() - i));
+  }
+  hmac.final(out);
+}
+
+struct HmacCase {
+  std::string key, data;
+  const char *mac;
+};
+
+struct SignCase {
+  const char *message, *k, *r, *s;
+};
+
+int main() {
+  std::string keyed(25, 0);
+  for (int i = 0; i < 25; i++) {
+    keyed[i] = i + 1;
+  }
+  const HmacCase hmacCases[] = {
+    // RFC 4231 4.2 to 4.8
+    {std::string(20, 0x0b), "Hi There",
+     "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+    {"Jefe", "what do ya want for nothing?",
+     "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+    {std::string(20, (char)0xaa), std::string(50, (char)0xdd),
+     "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe"},
+    {keyed, std::string(50, (char)0xcd),
+     "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b"},
+    {std::string(20, 0x0c), "Test With Truncation",
+     "a3b6167473100ee06e0c796c2955552b"},
+    {std::string(131, (char)0xaa),
+     "Test Using Larger Than Block-Size Key - Hash Key First",
+     "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+    {std::string(131, (char)0xaa),
+     "This is a test using a larger than block-size key and a larger than "
+     "block-size data. The key needs to be hashed before being used by the "
+     "HMAC algorithm.",
+     "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2"},
+  };
+  for (const HmacCase &c : hmacCases) {
+    for (size_t step : {(size_t)1000, (size_t)1, (size_t)7, (size_t)64}) {
+      unsigned char out[32];
+      mac(c.key, c.data, step, out);
+      CHECK(hexIs(out, strlen(c.mac) / 2, c.mac));
+    }
+  }
+
+  // RFC 6979 A.2.5
+  ecc_init();
+  NN_DIGIT d[NUMWORDS], n[NUMWORDS];
+  point_t pub, expectedPub;
+  number(d, "c9afa9d845ba75166b5c215767b1d6934e50c3db36e89b127b8a622b120f6721");
+  number(expectedPub.x,
+         "60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6");
+  number(expectedPub.y,
+         "7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462299");
+  ecc_gen_pub_key(d, &pub);
+  CHECK(NN_Equal(pub.x, expectedPub.x, NUMWORDS));
+  CHECK(NN_Equal(pub.y, expectedPub.y, NUMWORDS));
+  ecc_get_order(n);
+
+  const SignCase signCases[] = {
+    {"sample",
+     "a6e3c57dd01abe90086538398355dd4c3b17aa873382b0f24d6129493d8aad60",
+     "efd48b2aacb6a8fd1140dd9cd45e81d69d2c877b56aaf991c34d0ea84eaf3716",
+     "f7cb1c942d657c41d436c7a1b6e29f65f3e900dbb9aff4064dc4ab2f843acda8"},
+    {"test",
+     "d16b6ae827f17175e040871a1c7ec3500192c4c92677336ec2537acaee0008e0",
+     "f1abb023518351cd71d881567b1ea663ed3efcf6c5132b354f28d3b0b7d38367",
+     "019f4113742a2b14bd25926b49c649155f267e60d3814b4c0cc84250e46f0083"},
+  };
+  for (const SignCase &c : signCases) {
+    uint8_t hash[32];
+    Sha256 sha;
+    sha.update((const BYTE *)c.message, strlen(c.message));
+    sha.final(hash);
+
+    NN_DIGIT r[NUMWORDS], s[NUMWORDS], k[NUMWORDS], expected[NUMWORDS];
+    ecdsa_sign_deterministic(hash, r, s, d);
+    number(expected, c.r);
+    CHECK(NN_Equal(r, expected, NUMWORDS));
+    number(expected, c.s);
+    CHECK(NN_Equal(s, expected, NUMWORDS));
+
+    NN_DIGIT h[NUMWORDS], t[NUMWORDS];
+    NN_Decode(h, NUMWORDS, hash, 32);
+    NN_ModSmall(h, n, NUMWORDS);
+    NN_ModMult(t, r, d, n, NUMWORDS);
+    NN_ModAdd(t, t, h, n, NUMWORDS);
+    NN_ModInv(k, s, n, NUMWORDS);
+    NN_ModMult(k, k, t, n, NUMWORDS);
+    number(expected, c.k);
+    CHECK(NN_Equal(k, expected, NUMWORDS));
+
+    NN_DIGIT r2[NUMWORDS], s2[NUMWORDS];
+    ecdsa_sign_deterministic(hash, r2, s2, d);
+    CHECK(NN_Equal(r, r2, NUMWORDS) && NN_Equal(s, s2, NUMWORDS));
+#ifndef CONF_ECDSA_SIGN_ONLY
+    ecdsa_init(&pub);
+    CHECK(ecdsa_verify(hash, r, s, &pub));
+#endif
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,172 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Config and commands messages reach the handler routed to their topic:
+// config, commands with no subfolder, commands/<subfolder>, two subfolders
+// whose FNV-1a hashes collide, the catch-all route, and the MessageHandler
+// for what no route takes.
+
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+struct Call {
+  std::string handler, subfolder, data;
+};
+static std::vector<Call> calls;
+
+#define HANDLER(name)                                                   \
+  static void name(CloudIoTCoreMqtt *, const char *subfolder,          \
+                   const char *data, size_t length) {                   \
+    calls.push_back({#name, subfolder, std::string(data, length)});     \
+  }
+HANDLER(config)
+HANDLER(plain)
+HANDLER(reboot)
+HANDLER(nested)
+HANDLER(first)
+HANDLER(second)
+HANDLER(any)
+
+class Unrouted : public MessageHandler {
+  public:
+    void messageReceived(CloudIoTCoreMqtt *, char topic[], char bytes[],
+                         int length) {
+      calls.push_back({"unrouted", topic, std::string(bytes, length)});
+    }
+};
+
+static uint32_t fnv1a(const char *s) {
+  uint32_t hash = 2166136261u;
+  for (; *s; s++) {
+    hash = (hash ^ (unsigned char)*s) * 16777619u;
+  }
+  return hash;
+}
+
+// Delivers a message and returns the one call it made.
+static Call deliver(MQTTClient *mqttClient, const char *topic,
+                    const char *data = "x") {
+  calls.clear();
+  mqttClient->deliver(topic, data, strlen(data));
+  CHECK(calls.size() == 1);
+  return calls.empty() ? Call() : calls[0];
+}
+
+static bool is(const Call &call, const char *handler, const char *subfolder,
+               const char *data = "x") {
+  if (call.handler != handler || call.subfolder != subfolder ||
+      call.data != data) {
+    printf("%s(\"%s\", \"%s\")\n", call.handler.c_str(),
+           call.subfolder.c_str(), call.data.c_str());
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  CloudIoTCoreDevice device("p", "l", "r", "dev");
+  // Same length, same hash: only the byte compare tells them apart.
+  const char *a = "cmd0872068", *b = "cmd1174626";
+  CHECK(fnv1a(a) == fnv1a(b) && strlen(a) == strlen(b));
+
+  // Routes for each kind of topic.
+  {
+    MQTTClient mqttClient;
+    Client client;
+    Unrouted unrouted;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.setMessageHandler(&unrouted);
+    mqtt.onConfig(config);
+    CHECK(mqtt.onCommand("", plain));
+    CHECK(mqtt.onCommand("reboot", reboot));
+    CHECK(mqtt.onCommand("a/b", nested));
+    CHECK(mqtt.onCommand(a, first));
+    CHECK(mqtt.onCommand(b, second));
+    mqtt.startMQTT();
+
+    CHECK(is(deliver(&mqttClient, "/devices/dev/config", "{\"v\":1}"),
+             "config", "", "{\"v\":1}"));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands"), "plain", ""));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/"), "plain", ""));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/reboot", "now"),
+             "reboot", "reboot", "now"));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/a/b"), "nested",
+             "a/b"));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/cmd0872068"),
+             "first", a));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/cmd1174626"),
+             "second", b));
+
+    // Nothing routed: a prefix or extension of a route, another device,
+    // other topics under the device.
+    const char *others[] = {
+        "/devices/dev/commands/rebootx", "/devices/dev/commands/reboo",
+        "/devices/dev/commands/a",       "/devices/dev/commandsx",
+        "/devices/dev/commandsx/reboot", "/devices/other/commands/reboot",
+        "/devices/dev/configx",          "/devices/dev/state",
+        "/devices/de/commands/reboot",   "/devices/dev/commands/cmd0872069",
+    };
+    for (const char *topic : others) {
+      CHECK(is(deliver(&mqttClient, topic), "unrouted", topic));
+    }
+
+    // Setting a subfolder again replaces its handler; the table is bounded.
+    CHECK(mqtt.onCommand("reboot", any));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/reboot"), "any",
+             "reboot"));
+    static char names[TOPIC_ROUTES][8];
+    int added = 0;
+    for (int i = 0; i < TOPIC_ROUTES; i++) {
+      snprintf(names[i], sizeof(names[i]), "r%d", i);
+      added += mqtt.onCommand(names[i], any);
+    }
+    CHECK(added == TOPIC_ROUTES - 5);
+  }
+
+  // The catch-all takes commands no other route does, whichever order the
+  // routes were set in, but not config.
+  {
+    MQTTClient mqttClient;
+    Client client;
+    Unrouted unrouted;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.setMessageHandler(&unrouted);
+    CHECK(mqtt.onCommand(NULL, any));
+    CHECK(mqtt.onCommand(a, first));
+    mqtt.startMQTT();
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/cmd0872068"),
+             "first", a));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/cmd1174626"),
+             "any", b));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands"), "any", ""));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/config"), "unrouted",
+             "/devices/dev/config"));
+  }
+
+  // Config alone routes config and leaves commands to the handler.
+  {
+    MQTTClient mqttClient;
+    Client client;
+    Unrouted unrouted;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.setMessageHandler(&unrouted);
+    mqtt.onConfig(config);
+    mqtt.startMQTT();
+    CHECK(is(deliver(&mqttClient, "/devices/dev/config"), "config", ""));
+    CHECK(is(deliver(&mqttClient, "/devices/dev/commands/reboot"),
+             "unrouted", "/devices/dev/commands/reboot"));
+  }
+  return TEST_RESULT();
+}
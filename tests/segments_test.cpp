@@ -0,0 +1,162 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Scatter-gather telemetry sends the same packets as publishing the joined
+// payload, on every path: direct at QoS 0, through MQTTClient or the publish
+// window at QoS 1, and into a batch.
+
+#include <vector>
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+// Keeps everything written.
+class CaptureClient : public Client {
+  public:
+    std::string out;
+    size_t write(const uint8_t *data, size_t size) {
+      out.append((const char *)data, size);
+      written += size;
+      writes++;
+      return size;
+    }
+};
+
+int main() {
+  CloudIoTCoreDevice device("p", "l", "r", "dev");
+  std::string head = "{\"ts\":1600000000,\"v\":1,", body(2048, 'b'),
+              tail = "\"end\":true}";
+  PublishSegment segments[3] = {{head.data(), head.size()},
+                                {body.data(), body.size()},
+                                {tail.data(), tail.size()}};
+  std::string joined = head + body + tail;
+
+  // QoS 0 matches MQTTClient with the joined payload.
+  {
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.startMQTT();
+    CHECK(mqtt.publishTelemetry(segments, 3));
+    std::string sent = client.out;
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry(String(joined.c_str())));
+    CHECK(sent == client.out);
+
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry("/sub", segments, 3));
+    sent = client.out;
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry("/sub", String(joined.c_str())));
+    CHECK(sent == client.out);
+
+    // Many small segments are coalesced into few writes.
+    std::vector<std::string> parts;
+    std::vector<PublishSegment> small;
+    std::string all;
+    for (int i = 0; i < 100; i++) {
+      parts.push_back("{\"k" + std::to_string(i) + "\":" +
+                      std::to_string(i * i) + "},");
+    }
+    for (auto &part : parts) {
+      small.push_back(PublishSegment{part.data(), part.size()});
+      all += part;
+    }
+    client.out.clear();
+    client.writes = 0;
+    CHECK(mqtt.publishTelemetry(small.data(), small.size()));
+    CHECK(client.writes <= 8);
+    sent = client.out;
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry(String(all.c_str())));
+    CHECK(sent == client.out);
+
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry(small.data(), 0));
+    sent = client.out;
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry(String("")));
+    CHECK(sent == client.out);
+
+    // QoS 2 is refused rather than sent at another QoS.
+    client.out.clear();
+    int published = mqttClient.published;
+    CHECK(!mqtt.publishTelemetry(segments, 3, 2));
+    CHECK(!mqtt.publishTelemetry(segments, 3, -1));
+    CHECK(client.out.empty() && mqttClient.published == published);
+
+    mqttClient.isConnected = false;
+    CHECK(!mqtt.publishTelemetry(segments, 3));
+  }
+
+  // QoS 1 without a window goes through MQTTClient, joined.
+  {
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.startMQTT();
+    mqttClient.capture = true;
+    CHECK(mqtt.publishTelemetry(segments, 3, 1));
+    CHECK(mqttClient.packets.size() == 1);
+    const std::string &packet = mqttClient.packets[0];
+    CHECK(packet.size() > joined.size() &&
+          packet.compare(packet.size() - joined.size(), joined.size(),
+                         joined) == 0);
+  }
+
+  // QoS 1 through a window matches its single buffer publish, but for the
+  // packet id.
+  {
+    PublishWindow window(8);
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.setPublishWindow(&window);
+    mqtt.startMQTT();
+    std::string small = head + tail;
+    PublishSegment two[2] = {{head.data(), head.size()},
+                             {tail.data(), tail.size()}};
+    CHECK(mqtt.publishTelemetry(two, 2, 1));
+    std::string sent = client.out;
+    uint16_t first = window.lastId();
+    client.out.clear();
+    CHECK(mqtt.publishTelemetry(String(small.c_str()), 1));
+    CHECK(window.lastId() == (uint16_t)(first + 1));
+    CHECK(sent.size() == client.out.size());
+    size_t idLow = sent.size() - small.size() - 1;
+    sent[idLow] = client.out[idLow];
+    CHECK(sent == client.out);
+    CHECK(!mqtt.publishTelemetry(segments, 3, 1));  // larger than a slot
+  }
+
+  // Batches get the joined payload.
+  {
+    TelemetryBatch batch;
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.setBatch(&batch);
+    mqtt.startMQTT();
+    PublishSegment two[2] = {{head.data(), head.size()},
+                             {tail.data(), tail.size()}};
+    CHECK(mqtt.publishTelemetry("/b", two, 2));
+    const char *subtopic;
+    size_t length;
+    int qos;
+    const char *frame = batch.next(1000, &subtopic, &length, &qos);
+    CHECK(frame != NULL && strcmp(subtopic, "/b") == 0);
+    CHECK(frame != NULL &&
+          std::string(frame, length).find(head + tail) != std::string::npos);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,68 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Cost of end to end encryption: session setup (ECDH and HKDF), encrypting
+// small and large telemetry messages, and bulk ChaCha20-Poly1305.
+
+#include "test.h"
+#include "CloudIoTCoreSession.h"
+
+int main() {
+  ecc_init();
+  NN_DIGIT backendPriv[NUMWORDS];
+  point_t backendPub;
+  unsigned char backendKey[64];
+  ecc_gen_private_key(backendPriv);
+  ecc_gen_pub_key(backendPriv, &backendPub);
+  NN_Encode(backendKey, 32, backendPub.x, NUMWORDS);
+  NN_Encode(backendKey + 32, 32, backendPub.y, NUMWORDS);
+  static CloudIoTCoreSession session(backendKey, 3600000UL);
+
+  const int rotations = 20;
+  double t0 = now();
+  for (int i = 0; i < rotations; i++) {
+    session.rotate();
+  }
+  printf("session setup:          %8.2f ms\n", (now() - t0) * 1e3 / rotations);
+
+  const char msg[] = "{\"temp\":21.5,\"hum\":40}";
+  size_t length;
+  const int small = 100000;
+  t0 = now();
+  for (int i = 0; i < small; i++) {
+    session.encrypt(msg, strlen(msg), &length);
+  }
+  printf("encrypt %3zu bytes:      %8.2f us\n", strlen(msg),
+         (now() - t0) * 1e6 / small);
+
+  static char big[900];
+  const int large = 20000;
+  t0 = now();
+  for (int i = 0; i < large; i++) {
+    session.encrypt(big, sizeof big, &length);
+  }
+  printf("encrypt %3zu bytes:      %8.2f us\n", sizeof big,
+         (now() - t0) * 1e6 / large);
+
+  static unsigned char bulk[1 << 20];
+  unsigned char key[32] = {1}, nonce[12] = {0}, tag[16];
+  const int rounds = 32;
+  t0 = now();
+  for (int i = 0; i < rounds; i++) {
+    chacha20_poly1305_encrypt(key, nonce, NULL, 0, bulk, sizeof bulk, bulk,
+                              tag);
+  }
+  printf("chacha20-poly1305 bulk: %8.1f MB/s\n", rounds / (now() - t0));
+  return 0;
+}
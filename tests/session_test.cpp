@@ -0,0 +1,121 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// End to end encryption: the AEAD and HKDF against their RFC vectors, and a
+// backend holding only its private key and the announcement decrypting what
+// CloudIoTCoreSession produced.
+
+#include "test.h"
+#include "CloudIoTCoreSession.h"
+#include "hmac_sha256.h"
+
+static bool hexIs(const unsigned char *data, size_t len, const char *hex) {
+  char buf[3];
+  for (size_t i = 0; i < len; i++) {
+    snprintf(buf, sizeof buf, "%02x", data[i]);
+    if (memcmp(buf, hex + 2 * i, 2) != 0) {
+      return false;
+    }
+  }
+  return hex[2 * len] == 0;
+}
+
+int main() {
+  // RFC 8439 2.8.2
+  unsigned char key[32], tag[16], out[200], back[200];
+  unsigned char nonce[12] = {7, 0, 0, 0, 0x40, 0x41, 0x42, 0x43,
+                             0x44, 0x45, 0x46, 0x47};
+  unsigned char aad[12] = {0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1,
+                           0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7};
+  for (int i = 0; i < 32; i++) {
+    key[i] = 0x80 + i;
+  }
+  const char *text = "Ladies and Gentlemen of the class of '99: If I could "
+                     "offer you only one tip for the future, sunscreen would "
+                     "be it.";
+  size_t n = strlen(text);
+  chacha20_poly1305_encrypt(key, nonce, aad, 12, (const unsigned char *)text,
+                            n, out, tag);
+  CHECK(hexIs(out, 8, "d31a8d34648e60db"));
+  CHECK(hexIs(out + n - 2, 2, "6116"));
+  CHECK(hexIs(tag, 16, "1ae10b594f09e26a7e902ecbd0600691"));
+  CHECK(chacha20_poly1305_decrypt(key, nonce, aad, 12, out, n, back, tag));
+  CHECK(memcmp(back, text, n) == 0);
+  out[10] ^= 1;
+  CHECK(!chacha20_poly1305_decrypt(key, nonce, aad, 12, out, n, back, tag));
+
+  // RFC 5869 A.1
+  unsigned char ikm[22], salt[13], info[10], okm[42];
+  memset(ikm, 0x0b, sizeof ikm);
+  for (int i = 0; i < 13; i++) {
+    salt[i] = i;
+  }
+  for (int i = 0; i < 10; i++) {
+    info[i] = 0xf0 + i;
+  }
+  hkdf_sha256(salt, sizeof salt, ikm, sizeof ikm, info, sizeof info, okm,
+              sizeof okm);
+  CHECK(hexIs(okm, sizeof okm,
+              "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5"
+              "bf34007208d5b887185865"));
+
+  // The backend's side of a session.
+  ecc_init();
+  NN_DIGIT backendPriv[NUMWORDS];
+  point_t backendPub;
+  unsigned char backendKey[64];
+  ecc_gen_private_key(backendPriv);
+  ecc_gen_pub_key(backendPriv, &backendPub);
+  NN_Encode(backendKey, 32, backendPub.x, NUMWORDS);
+  NN_Encode(backendKey + 32, 32, backendPub.y, NUMWORDS);
+
+  static CloudIoTCoreSession session(backendKey, 3600000UL);
+  CHECK(session.needsRotation());
+  session.rotate();
+  CHECK(!session.needsRotation());
+  size_t length;
+  const unsigned char *announcement =
+      (const unsigned char *)session.getAnnouncement(&length);
+  CHECK(length == SESSION_ANNOUNCEMENT_LENGTH);
+
+  point_t ephemeral, shared;
+  NN_Decode(ephemeral.x, NUMWORDS, (unsigned char *)announcement + 5, 32);
+  NN_Decode(ephemeral.y, NUMWORDS, (unsigned char *)announcement + 37, 32);
+  ecc_mul(&shared, &ephemeral, backendPriv);
+  unsigned char secret[32], sessionKey[32];
+  NN_Encode(secret, 32, shared.x, NUMWORDS);
+  hkdf_sha256(announcement + 5, 64, secret, 32,
+              (const unsigned char *)SESSION_HKDF_INFO,
+              strlen(SESSION_HKDF_INFO), sessionKey, 32);
+
+  for (int i = 0; i < 5; i++) {
+    char msg[40];
+    int len = snprintf(msg, sizeof msg, "{\"t\":%d}", i);
+    const unsigned char *c =
+        (const unsigned char *)session.encrypt(msg, len, &length);
+    CHECK(length == (size_t)len + SESSION_OVERHEAD);
+    CHECK(memcmp(c + 1, announcement + 1, 4) == 0);
+    CHECK(c[SESSION_HEADER_LENGTH - 1] == i);
+    CHECK(chacha20_poly1305_decrypt(sessionKey, c + 1, c,
+                                    SESSION_HEADER_LENGTH,
+                                    c + SESSION_HEADER_LENGTH, len, back,
+                                    c + length - POLY1305_TAG_LENGTH));
+    CHECK(memcmp(back, msg, len) == 0);
+  }
+  static char big[SESSION_BUFFER_SIZE];
+  CHECK(session.encrypt(big, sizeof big - SESSION_OVERHEAD, &length) != NULL);
+  CHECK(session.encrypt(big, sizeof big - SESSION_OVERHEAD + 1, &length) ==
+        NULL);
+  return TEST_RESULT();
+}
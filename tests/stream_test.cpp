@@ -0,0 +1,183 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Streamed telemetry goes out as one PUBLISH packet written a
+// STREAM_CHUNK_SIZE buffer at a time: the bytes on the wire, the remaining
+// length encoding at its size boundaries, and a reader failing partway,
+// which must close the connection rather than leave the packet unfinished.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+
+// Keeps everything written, and how the connection was closed.
+class CaptureClient : public Client {
+  public:
+    std::string out;
+    size_t largest = 0;
+    int stops = 0;
+    size_t write(const uint8_t *data, size_t size) {
+      out.append((const char *)data, size);
+      written += size;
+      writes++;
+      largest = size > largest ? size : largest;
+      return size;
+    }
+    void stop() { stops++; }
+};
+
+// A counting pattern handed out in uneven reads, failing after failAt bytes.
+class PatternReader : public PublishReader {
+  public:
+    size_t pos = 0;
+    size_t failAt;
+    int reads = 0;
+    PatternReader(size_t failAt = (size_t)-1) : failAt(failAt) {}
+    int read(char *data, size_t length) {
+      reads++;
+      if (pos >= failAt) {
+        return 0;
+      }
+      size_t n = length > 1000 ? 1000 - reads % 7 * 100 : length;
+      if (n > failAt - pos) {
+        n = failAt - pos;
+      }
+      for (size_t i = 0; i < n; i++) {
+        data[i] = byte(pos + i);
+      }
+      pos += n;
+      return (int)n;
+    }
+    static char byte(size_t i) { return (char)(i * 31 + i / 251); }
+};
+
+// Splits a PUBLISH packet, checking the header is well formed and the
+// remaining length is encoded in as few bytes as it can be.
+static bool parse(const std::string &packet, std::string *topic,
+                  std::string *payload) {
+  if (packet.size() < 2 || (unsigned char)packet[0] != 0x30) {
+    return false;
+  }
+  size_t remaining = 0, pos = 1;
+  int shift = 0;
+  unsigned char b;
+  do {
+    if (pos >= packet.size() || pos > 4) {
+      return false;
+    }
+    b = packet[pos++];
+    remaining |= (size_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  size_t lengthBytes = pos - 1;
+  size_t minimal = remaining < 128 ? 1 : remaining < 16384 ? 2
+                   : remaining < 2097152 ? 3 : 4;
+  if (lengthBytes != minimal || packet.size() - pos != remaining) {
+    return false;
+  }
+  size_t topicLength = (unsigned char)packet[pos] << 8 |
+                       (unsigned char)packet[pos + 1];
+  *topic = packet.substr(pos + 2, topicLength);
+  *payload = packet.substr(pos + 2 + topicLength);
+  return true;
+}
+
+static std::string pattern(size_t length) {
+  std::string s(length, 0);
+  for (size_t i = 0; i < length; i++) {
+    s[i] = PatternReader::byte(i);
+  }
+  return s;
+}
+
+int main() {
+  CloudIoTCoreDevice device("p", "l", "r", "dev");
+  std::string events = device.getEventsTopic().c_str();
+
+  // 200 KB, far past the MQTTClient buffer, in STREAM_CHUNK_SIZE writes.
+  {
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.startMQTT();
+    client.out.clear();
+    client.writes = 0;
+    const size_t length = 200 * 1024;
+    PatternReader reader;
+    CHECK(mqtt.publishTelemetryStream("/image", length, &reader));
+    std::string topic, payload;
+    CHECK(parse(client.out, &topic, &payload));
+    CHECK(topic == events + "/image");
+    CHECK(payload == pattern(length));
+    CHECK(client.largest <= STREAM_CHUNK_SIZE);
+    CHECK(client.writes == (int)((client.out.size() + STREAM_CHUNK_SIZE - 1) /
+                                 STREAM_CHUNK_SIZE));
+    // The header and the start of the payload share the first write.
+    CHECK((unsigned char)client.out[1] == (0x80 | ((2 + topic.size() + length) & 0x7f)));
+    CHECK(client.stops == 0 && mqttClient.published == 0);
+  }
+
+  // Remaining lengths either side of each encoding boundary.
+  {
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.startMQTT();
+    size_t overhead = 2 + events.size();
+    const size_t boundaries[] = {128, 16384, 2097152};
+    for (size_t boundary : boundaries) {
+      for (size_t remaining = boundary - 1; remaining <= boundary; remaining++) {
+        client.out.clear();
+        PatternReader reader;
+        size_t length = remaining - overhead;
+        CHECK(mqtt.publishTelemetryStream("", length, &reader));
+        std::string topic, payload;
+        CHECK(parse(client.out, &topic, &payload));
+        CHECK(topic == events && payload.size() == length);
+        CHECK(payload == pattern(length));
+      }
+    }
+    client.out.clear();
+    PatternReader reader;
+    CHECK(mqtt.publishTelemetryStream("", 0, &reader));
+    CHECK(client.out == std::string("\x30", 1) + (char)overhead +
+                        (char)(events.size() >> 8) + (char)events.size() +
+                        events);
+  }
+
+  // A reader failing partway closes the connection once the packet has
+  // started, and fails without a write before then.
+  {
+    MQTTClient mqttClient;
+    CaptureClient client;
+    CloudIoTCoreMqtt mqtt(&mqttClient, &client, &device);
+    mqtt.startMQTT();
+    client.out.clear();
+    PatternReader late(100 * 1024 + 17);
+    CHECK(!mqtt.publishTelemetryStream("/image", 200 * 1024, &late));
+    CHECK(client.stops == 1);
+    CHECK(client.out.size() > 0 && client.out.size() < 100 * 1024 + 17 + 64);
+
+    client.out.clear();
+    PatternReader early(STREAM_CHUNK_SIZE / 2);
+    CHECK(!mqtt.publishTelemetryStream("/image", 200 * 1024, &early));
+    CHECK(client.stops == 1 && client.out.empty());
+
+    // Disconnected with nowhere to keep it.
+    mqttClient.isConnected = false;
+    PatternReader reader;
+    CHECK(!mqtt.publishTelemetryStream("/image", 1024, &reader));
+    CHECK(reader.reads == 0 && client.out.empty());
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Just enough of the Arduino core to build the library on a host.
+
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+typedef bool boolean;
+
+inline long random(long a, long b) { return a + rand() % (b - a); }
+inline long random(long b) { return rand() % b; }
+
+// A fake clock: millis() returns fakeMillis, which tests move by hand.
+extern unsigned long fakeMillis;
+unsigned long millis();
+inline unsigned long micros() { return fakeMillis * 1000; }
+inline void delay(unsigned long ms) { fakeMillis += ms; }
+inline void yield() {}
+
+class String : public std::string {
+  public:
+    String() {}
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+    explicit String(int v) : std::string(std::to_string(v)) {}
+    explicit String(unsigned v) : std::string(std::to_string(v)) {}
+    explicit String(long v) : std::string(std::to_string(v)) {}
+    explicit String(unsigned long v) : std::string(std::to_string(v)) {}
+    explicit String(char c) : std::string(1, c) {}
+    String &operator+=(const char *s) { append(s); return *this; }
+    String &operator+=(char c) { push_back(c); return *this; }
+    String &operator+=(const std::string &s) { append(s); return *this; }
+    String &operator+=(int v) { append(std::to_string(v)); return *this; }
+    int indexOf(char c) const {
+      size_t p = find(c);
+      return p == npos ? -1 : (int)p;
+    }
+    int lastIndexOf(const char *s) const {
+      size_t p = rfind(s);
+      return p == npos ? -1 : (int)p;
+    }
+    String substring(size_t a) const { return String(std::string::substr(a)); }
+};
+
+inline String operator+(const String &a, const char *b) { String r(a); r.append(b); return r; }
+inline String operator+(const String &a, const String &b) { String r(a); r.append(b); return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r.append(b); return r; }
+inline String operator+(const String &a, int b) { String r(a); r.append(std::to_string(b)); return r; }
+inline String operator+(const String &a, long b) { String r(a); r.append(std::to_string(b)); return r; }
+inline String operator+(const String &a, char b) { String r(a); r.push_back(b); return r; }
+
+struct SerialStub {
+  template <class T> void print(const T &) {}
+  template <class T> void println(const T &) {}
+  void println() {}
+};
+extern SerialStub Serial;
@@ -0,0 +1,46 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// The Arduino Client interface. The base class swallows writes and counts
+// them; tests derive from it for anything else.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class IPAddress {};
+
+class Client {
+  public:
+    size_t written = 0;
+    int writes = 0;
+
+    virtual ~Client() {}
+    virtual int connect(IPAddress, uint16_t) { return 1; }
+    virtual int connect(const char *, uint16_t) { return 1; }
+    virtual size_t write(uint8_t b) { return write(&b, 1); }
+    virtual size_t write(const uint8_t *, size_t size) {
+      written += size;
+      writes++;
+      return size;
+    }
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int read(uint8_t *, size_t) { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+    virtual void stop() {}
+    virtual uint8_t connected() { return 1; }
+    virtual operator bool() { return true; }
+};
@@ -0,0 +1,269 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// A stand-in for the 256dpi MQTTClient. publish() encodes the PUBLISH packet
+// the way lwmqtt does and writes it to the network client in one go. With
+// rxSize set, loop() reads whole packets into a buffer of that size like
+// lwmqtt, dropping the connection when one does not fit.
+
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+
+typedef enum {
+  LWMQTT_SUCCESS = 0,
+  LWMQTT_BUFFER_TOO_SHORT = -1,
+  LWMQTT_VARNUM_OVERFLOW = -2,
+  LWMQTT_NETWORK_FAILED_CONNECT = -3,
+  LWMQTT_NETWORK_TIMEOUT = -4,
+  LWMQTT_NETWORK_FAILED_READ = -5,
+  LWMQTT_NETWORK_FAILED_WRITE = -6,
+  LWMQTT_REMAINING_LENGTH_OVERFLOW = -7,
+  LWMQTT_REMAINING_LENGTH_MISMATCH = -8,
+  LWMQTT_MISSING_OR_WRONG_PACKET = -9,
+  LWMQTT_CONNECTION_DENIED = -10,
+  LWMQTT_FAILED_SUBSCRIPTION = -11,
+  LWMQTT_SUBACK_ARRAY_OVERFLOW = -12,
+  LWMQTT_PONG_TIMEOUT = -13
+} lwmqtt_err_t;
+
+typedef enum {
+  LWMQTT_CONNECTION_ACCEPTED = 0,
+  LWMQTT_UNACCEPTABLE_PROTOCOL = 1,
+  LWMQTT_IDENTIFIER_REJECTED = 2,
+  LWMQTT_SERVER_UNAVAILABLE = 3,
+  LWMQTT_BAD_USERNAME_OR_PASSWORD = 4,
+  LWMQTT_NOT_AUTHORIZED = 5,
+  LWMQTT_UNKNOWN_RETURN_CODE = 6
+} lwmqtt_return_code_t;
+
+class MQTTClient;
+typedef void (*MQTTClientCallbackSimple)(String &topic, String &payload);
+typedef void (*MQTTClientCallbackAdvanced)(MQTTClient *client, char topic[],
+                                           char bytes[], int length);
+
+class MQTTClient {
+  public:
+    Client *net = nullptr;
+    bool isConnected = true;
+    lwmqtt_err_t err = LWMQTT_SUCCESS;
+
+    // connect() results and counters
+    bool connectOk = true;
+    bool subOk = true;
+    int connects = 0;
+    int subs = 0;
+    std::string lastPassword;
+
+    // what publish() sent
+    int published = 0;
+    size_t bytes = 0;
+    bool record = true;
+    std::vector<std::string> log;           // "topic length" per message
+    bool capture = false;
+    std::vector<std::string> packets;       // whole packets, with capture
+    void (*afterQos1)() = nullptr;          // stands in for the PUBACK wait
+
+    // incoming packets, with rxSize > 0
+    size_t rxSize = 0;
+    int tooShort = 0;
+    int pubacksSent = 0;
+    std::vector<unsigned char> rxOther;     // types of non-PUBLISH packets
+
+    MQTTClientCallbackSimple simple = nullptr;
+    MQTTClientCallbackAdvanced advanced = nullptr;
+
+    MQTTClient(int bufSize = 128) : buf(bufSize > 65536 ? bufSize : 65536) {}
+
+    void begin(const char *, int, Client &c) { net = &c; }
+    void onMessage(MQTTClientCallbackSimple cb) { simple = cb; advanced = nullptr; }
+    void onMessageAdvanced(MQTTClientCallbackAdvanced cb) { advanced = cb; simple = nullptr; }
+
+    // Hands a message to the callback as if it had arrived.
+    void deliver(const char *topic, const char *payload, int len) {
+      std::string t(topic);
+      if (advanced) {
+        advanced(this, &t[0], (char *)payload, len);
+      } else if (simple) {
+        String ts(topic), ps(std::string(payload, len));
+        simple(ts, ps);
+      }
+    }
+
+    bool connect(const char *, const char *, const char *pw, bool = false) {
+      connects++;
+      lastPassword = pw;
+      isConnected = connectOk;
+      err = connectOk ? LWMQTT_SUCCESS : LWMQTT_NETWORK_FAILED_CONNECT;
+      return connectOk;
+    }
+
+    bool publish(const String &topic, const String &payload) {
+      return publish(topic.c_str(), payload.c_str(), (int)payload.length());
+    }
+    bool publish(const String &topic, const String &payload, bool, int) {
+      return publish(topic.c_str(), payload.c_str(), (int)payload.length());
+    }
+    bool publish(const char topic[], const String &payload) {
+      return publish(topic, payload.c_str(), (int)payload.length());
+    }
+    bool publish(const char topic[], const char payload[]) {
+      return publish(topic, payload, (int)strlen(payload));
+    }
+    bool publish(const char topic[], const char payload[], int length) {
+      return publish(topic, payload, length, false, 0);
+    }
+    bool publish(const char topic[], const char payload[], int length,
+                 bool retained, int qos) {
+      if (!isConnected) {
+        return false;
+      }
+      if (net) {
+        size_t tl = strlen(topic);
+        size_t rem = 2 + tl + (qos ? 2 : 0) + length;
+        size_t p = 0;
+        buf[p++] = 0x30 | (qos << 1) | (retained ? 1 : 0);
+        do {
+          unsigned char b = rem & 0x7f;
+          rem >>= 7;
+          buf[p++] = rem ? b | 0x80 : b;
+        } while (rem);
+        buf[p++] = tl >> 8;
+        buf[p++] = tl & 0xff;
+        memcpy(&buf[p], topic, tl);
+        p += tl;
+        if (qos) {
+          buf[p++] = 0;
+          buf[p++] = 1;
+        }
+        memcpy(&buf[p], payload, length);
+        p += length;
+        if (capture) {
+          packets.push_back(std::string((char *)&buf[0], p));
+        }
+        if (net->write(&buf[0], p) != p) {
+          return false;
+        }
+        if (qos && afterQos1) {
+          afterQos1();
+        }
+      }
+      published++;
+      bytes += length;
+      if (record) {
+        log.push_back(std::string(topic) + " " + std::to_string(length));
+      }
+      return true;
+    }
+
+    bool subscribe(const String &, int) { return true; }
+    bool subscribe(const char[], int) { subs++; return subOk; }
+
+    bool loop() {
+      if (!net) {
+        return isConnected;
+      }
+      if (rxSize == 0) {
+        uint8_t b[256];
+        while (net->available() > 0) {
+          net->read(b, sizeof b);
+        }
+        return isConnected;
+      }
+      if (!isConnected) {
+        return false;
+      }
+      size_t avail = net->available(), total = 0;
+      while (total < avail) {
+        uint8_t h, b;
+        size_t rem = 0, shift = 0, hl = 1;
+        if (!readFull(&h, 1)) {
+          return timeout();
+        }
+        do {
+          if (!readFull(&b, 1)) {
+            return timeout();
+          }
+          hl++;
+          rem |= (size_t)(b & 0x7f) << shift;
+          shift += 7;
+        } while (b & 0x80);
+        if (hl + rem > rxSize) {
+          err = LWMQTT_BUFFER_TOO_SHORT;
+          tooShort++;
+          isConnected = false;
+          net->stop();
+          return false;
+        }
+        std::vector<uint8_t> body(rem + 1);
+        if (rem && !readFull(body.data(), rem)) {
+          return timeout();
+        }
+        total += hl + rem;
+        if ((h & 0xf0) != 0x30) {
+          rxOther.push_back(h);
+          continue;
+        }
+        size_t tl = body[0] << 8 | body[1];
+        std::string t((char *)body.data() + 2, tl);
+        size_t p = 2 + tl;
+        uint16_t id = 0;
+        if (h & 0x06) {
+          id = body[p] << 8 | body[p + 1];
+          p += 2;
+        }
+        body[rem] = 0;
+        if (advanced) {
+          advanced(this, &t[0], (char *)body.data() + p, rem - p);
+        } else if (simple) {
+          String ts(t.c_str()), ps(std::string((char *)body.data() + p, rem - p));
+          simple(ts, ps);
+        }
+        if ((h & 0x06) == 2) {
+          uint8_t ack[4] = {0x40, 2, (uint8_t)(id >> 8), (uint8_t)id};
+          net->write(ack, 4);
+          pubacksSent++;
+        }
+      }
+      return isConnected;
+    }
+
+    bool connected() { return isConnected; }
+    bool disconnect() { isConnected = false; return true; }
+    lwmqtt_err_t lastError() { return err; }
+    lwmqtt_return_code_t returnCode() { return LWMQTT_CONNECTION_ACCEPTED; }
+
+  private:
+    std::vector<unsigned char> buf;
+
+    bool readFull(uint8_t *p, size_t n) {
+      size_t got = 0;
+      int spins = 0;
+      while (got < n) {
+        int r = net->read(p + got, n - got);
+        if (r > 0) {
+          got += r;
+        } else if (++spins > 1000) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool timeout() {
+      err = LWMQTT_NETWORK_TIMEOUT;
+      isConnected = false;
+      return false;
+    }
+};
@@ -0,0 +1,40 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// Shared by the host tests: CHECK() records failures, TEST_RESULT() ends
+// main() with them, and now() times benchmarks.
+
+#pragma once
+#include <chrono>
+#include <stdio.h>
+
+static int testFailures __attribute__((unused)) = 0;
+
+#define CHECK(cond)                                            \
+  do {                                                         \
+    if (!(cond)) {                                             \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      testFailures++;                                          \
+    }                                                          \
+  } while (0)
+
+#define TEST_RESULT()                                          \
+  (printf("%s: %s\n", __FILE__, testFailures ? "FAILED" : "ok"), \
+   testFailures ? 1 : 0)
+
+// Seconds on a monotonic clock.
+static inline double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
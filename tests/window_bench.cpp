@@ -0,0 +1,79 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// QoS 1 throughput over a link with a 300 ms round trip, one message at a
+// time through MQTTClient against the publish window at several sizes. The
+// clock is simulated, so this measures protocol behavior, not CPU.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+#include "broker_link.h"
+
+static BrokerLink *theLink;
+static MQTTClient *theClient;
+
+// MQTTClient blocks until the PUBACK of each QoS 1 publish.
+static void waitForAck() {
+  theLink->waitForAcks();
+  theClient->loop();
+}
+
+// Messages per second for n messages with the given window size, 0 for
+// none.
+static double run(int windowSize, int n) {
+  CloudIoTCoreDevice device("my-project", "us-central1", "my-registry",
+                            "my-device-0001");
+  unsigned char key[32] = {1};
+  device.setPrivateKey(key);
+  device.createJWT(1600000000LL, 360000);
+  MQTTClient mqttClient;
+  BrokerLink brokerLink;
+  theLink = &brokerLink;
+  theClient = &mqttClient;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &brokerLink, &device);
+  PublishWindow *window = NULL;
+  if (windowSize > 0) {
+    window = new PublishWindow(windowSize, 5000);
+    mqtt.setPublishWindow(window);
+  } else {
+    mqttClient.afterQos1 = waitForAck;
+  }
+  mqtt.startMQTT();
+  mqttClient.record = false;
+
+  unsigned long start = fakeMillis;
+  int sent = 0;
+  while (sent < n || (window != NULL && window->inFlight() > 0)) {
+    String payload(("{\"n\":" + std::to_string(sent) + "}").c_str());
+    if (sent < n && mqtt.publishTelemetry(String("/sensors"), payload, 1)) {
+      sent++;
+    } else {
+      fakeMillis++;
+      mqtt.loop();
+    }
+  }
+  delete window;
+  return n / ((fakeMillis - start) / 1000.0);
+}
+
+int main() {
+  fakeMillis = 1000;
+  printf("RTT 300 ms, 200 QoS 1 messages:\n");
+  printf("  MQTTClient, one at a time: %6.1f msg/s\n", run(0, 200));
+  int sizes[] = {1, 4, PUBLISH_WINDOW_SLOTS};
+  for (int size : sizes) {
+    printf("  window of %2d:              %6.1f msg/s\n", size, run(size, 200));
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * Copyright 2020 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+// The publish window over a link with a 300 ms round trip: lost PUBACKs are
+// retransmitted with DUP, a reconnect resends what is in flight, a full
+// window pushes back, and packet ids wrap around.
+
+#include "test.h"
+#include "CloudIoTCoreMqtt.h"
+#include "broker_link.h"
+
+static std::vector<uint16_t> acks;
+static void onAck(PublishWindow *, uint16_t id) {
+  acks.push_back(id);
+}
+
+static void run(CloudIoTCoreMqtt *mqtt, int ms) {
+  for (int i = 0; i < ms; i++) {
+    fakeMillis++;
+    mqtt->loop();
+  }
+}
+
+int main() {
+  fakeMillis = 1000;
+  CloudIoTCoreDevice device("p", "l", "r", "d");
+  unsigned char key[32] = {1};
+  device.setPrivateKey(key);
+  device.createJWT(1600000000LL, 360000);
+  MQTTClient mqttClient;
+  BrokerLink link;
+  CloudIoTCoreMqtt mqtt(&mqttClient, &link, &device);
+  PublishWindow window(4, 1000);
+  mqtt.setPublishWindow(&window);
+  window.setAckCallback(onAck);
+  mqtt.startMQTT();
+  mqttClient.record = false;
+
+  // The first PUBACK is lost and the window fills up.
+  link.dropAcks = 1;
+  for (int i = 0; i < 4; i++) {
+    CHECK(mqtt.publishTelemetry(String("/t"), String(std::to_string(i).c_str()), 1));
+  }
+  uint16_t first = window.lastId() - 3;
+  CHECK(!mqtt.publishTelemetry(String("/t"), String("full"), 1));
+  CHECK(window.isFull());
+  run(&mqtt, 400);
+  CHECK(acks.size() == 3 && window.isPending(first) && window.inFlight() == 1);
+
+  // It is sent again with DUP after the retry time.
+  run(&mqtt, 1000);
+  CHECK(window.retransmitCount() == 1);
+  CHECK(link.pubs.back().first == first && link.pubs.back().second);
+  run(&mqtt, 400);
+  CHECK(!window.isPending(first) && window.inFlight() == 0);
+  CHECK(acks.size() == 4 && acks.back() == first);
+
+  // A reconnect resends everything in flight.
+  link.dropAcks = 2;
+  mqtt.publishTelemetry(String("/t"), String("a"), 1);
+  mqtt.publishTelemetry(String("/t"), String("b"), 1);
+  mqttClient.isConnected = false;
+  mqtt.mqttConnectAsync();
+  run(&mqtt, 5);
+  CHECK(mqtt.getConnectionState() == CONNECTION_ONLINE);
+  CHECK(window.retransmitCount() == 3);
+  run(&mqtt, 400);
+  CHECK(window.inFlight() == 0 && acks.size() == 6);
+
+  // QoS 0 still goes through MQTTClient, and oversized QoS 1 fails.
+  int published = mqttClient.published;
+  CHECK(mqtt.publishTelemetry(String("/t"), String("q0")));
+  CHECK(mqttClient.published == published + 1);
+  std::string big(PUBLISH_WINDOW_PACKET_SIZE, 'x');
+  CHECK(!mqtt.publishTelemetry(String("/t"), String(big.c_str()), 1));
+
+  // Ids wrap around without colliding with those in flight.
+  link.rtt = 1;
+  link.payloads.clear();
+  acks.clear();
+  const int n = 70000;
+  int sent = 0;
+  while (sent < n || window.inFlight() > 0) {
+    if (sent < n && mqtt.publishTelemetry(String("/w"),
+                                          String(std::to_string(sent).c_str()), 1)) {
+      sent++;
+    } else {
+      run(&mqtt, 1);
+    }
+  }
+  CHECK(acks.size() == (size_t)n && link.payloads.size() == (size_t)n);
+  bool ownIds = true;
+  for (uint16_t id : acks) {
+    ownIds = ownIds && id >= PUBLISH_WINDOW_FIRST_ID;
+  }
+  CHECK(ownIds);
+  return TEST_RESULT();
+}